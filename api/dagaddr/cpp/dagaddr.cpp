@@ -103,7 +103,8 @@ vector_push_back_unique(std::vector<T>& v, const T& e)
 
 
 
-Node::container Node::dummy_source_ = {0xff, "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0", 0};
+// 0 is reserved for the dummy source
+static uint64_t next_uid = 1;
 
 const std::string Node::XID_TYPE_UNKNOWN_STRING = "UNKNOWN";
 const std::string Node::XID_TYPE_DUMMY_SOURCE_STRING = "SOURCE";
@@ -121,30 +122,16 @@ const std::string Node::XID_TYPE_IP_STRING = "IP";
 * 			commonly used to create the "dummy" source node.
 */
 Node::Node()
-	: ptr_(&dummy_source_)
+	: type_(XID_TYPE_DUMMY_SOURCE), uid_(0)
 {
-}
-
-/**
-* @brief Create a copy of a node
-*
-* Create a new node that is a copy of the supplied node.
-*
-* @param r The node to be copied.
-*/
-Node::Node(const Node& r)
-	: ptr_(r.ptr_)
-{
-	acquire();
+	memset(id_, 0, ID_LEN);
 }
 
 Node::Node(uint32_t type, const void* id, int dummy)
 {
 	(void)dummy;
-	ptr_ = new container;
-	ptr_->type = type;
-	memcpy(ptr_->id, id, ID_LEN);
-	ptr_->ref_count = 1;
+	init(type);
+	memcpy(id_, id, ID_LEN);
 }
 
 /**
@@ -165,14 +152,12 @@ Node::Node(uint32_t type, const void* id, int dummy)
 */
 Node::Node(int type, const std::string id_str)
 {
-	ptr_ = new container;
-	ptr_->ref_count = 1;
-	ptr_->type = type;
+	init(type);
 
 	for (std::size_t i = 0; i < ID_LEN; i++)
 	{
 		int num = stoi(id_str.substr(2*i, 2), 0, 16);
-		memcpy(&(ptr_->id[i]), &num, 1);
+		memcpy(&(id_[i]), &num, 1);
 	}
 }
 
@@ -216,66 +201,41 @@ Node::Node(const std::string node_string)
 	construct_from_strings(xid_elems[0], xid_elems[1]);
 }
 
-Node::~Node()
-{
-	release();
-}
-
-Node&
-Node::operator=(const Node& r)
-{
-	release();
-	ptr_ = r.ptr_;
-	acquire();
-	return *this;
-}
-
 bool
 Node::equal_to(const Node& r) const
 {
-	return ptr_->type == r.ptr_->type && memcmp(ptr_->id, r.ptr_->id, ID_LEN) == 0;
-}
-
-void
-Node::acquire() const
-{
-	if (ptr_ == &dummy_source_)
-		return;
-	++ptr_->ref_count;
+	return type_ == r.type_ && memcmp(id_, r.id_, ID_LEN) == 0;
 }
 
+/*
+ * give a newly constructed node its own identity
+ */
 void
-Node::release() const
+Node::init(uint32_t type)
 {
-	if (ptr_ == &dummy_source_)
-		return;
-	if (--ptr_->ref_count == 0)
-	{
-		delete ptr_;
-		ptr_ = &dummy_source_;
-	}
+	type_ = type;
+	uid_ = __sync_fetch_and_add(&next_uid, 1);
 }
 
 
 void
 Node::construct_from_strings(const std::string type_str, const std::string id_str)
 {
-	ptr_ = new container;
-	ptr_->ref_count = 1;
-    memset(ptr_->id,0,Node::ID_LEN); // zero the ID
+	init(XID_TYPE_UNKNOWN);
+    memset(id_,0,Node::ID_LEN); // zero the ID
 
 	if (type_str == XID_TYPE_AD_STRING)
-		ptr_->type = XID_TYPE_AD;
+		type_ = XID_TYPE_AD;
 	else if (type_str == XID_TYPE_HID_STRING)
-		ptr_->type = XID_TYPE_HID;
+		type_ = XID_TYPE_HID;
 	else if (type_str == XID_TYPE_CID_STRING)
-		ptr_->type = XID_TYPE_CID;
+		type_ = XID_TYPE_CID;
 	else if (type_str == XID_TYPE_SID_STRING)
-		ptr_->type = XID_TYPE_SID;
+		type_ = XID_TYPE_SID;
 	else if (type_str == XID_TYPE_IP_STRING)
-		ptr_->type = XID_TYPE_IP;
+		type_ = XID_TYPE_IP;
 	else if (type_str == XID_TYPE_DUMMY_SOURCE_STRING)
-		ptr_->type = XID_TYPE_DUMMY_SOURCE;
+		type_ = XID_TYPE_DUMMY_SOURCE;
 	else
 	{
 		// see if it's a user defined XID
@@ -286,13 +246,13 @@ Node::construct_from_strings(const std::string type_str, const std::string id_st
 
 			if (type_str == (*itr).second) {
 				found = 1;
-				ptr_->type = (*itr).first;
+				type_ = (*itr).first;
 				break;
 			}
 		}
 
 		if (!found) {
-			ptr_->type = 0;
+			type_ = 0;
 			printf("WARNING: Unrecognized XID type: %s\n", type_str.c_str());
 		}
 	}
@@ -301,17 +261,17 @@ Node::construct_from_strings(const std::string type_str, const std::string id_st
 	// need to handle it separately. Otherwise, treat string as
 	// hex digits.
 	uint32_t ip = inet_addr(id_str.c_str());
-	if (ptr_->type == XID_TYPE_IP && ip != INADDR_NONE)
+	if (type_ == XID_TYPE_IP && ip != INADDR_NONE)
 	{
-        ptr_->id[0] = 0x45;  // set some special "4ID" values
-        ptr_->id[5] = 0x01;
-        ptr_->id[8] = 0xFA;
-        ptr_->id[9] = 0xFA;
-
-		ptr_->id[16] = *(((unsigned char*)&ip)+0);
-		ptr_->id[17] = *(((unsigned char*)&ip)+1);
-		ptr_->id[18] = *(((unsigned char*)&ip)+2);
-		ptr_->id[19] = *(((unsigned char*)&ip)+3);
+        id_[0] = 0x45;  // set some special "4ID" values
+        id_[5] = 0x01;
+        id_[8] = 0xFA;
+        id_[9] = 0xFA;
+
+		id_[16] = *(((unsigned char*)&ip)+0);
+		id_[17] = *(((unsigned char*)&ip)+1);
+		id_[18] = *(((unsigned char*)&ip)+2);
+		id_[19] = *(((unsigned char*)&ip)+3);
 	}
 	else
 	{
@@ -326,7 +286,7 @@ Node::construct_from_strings(const std::string type_str, const std::string id_st
 			if (num == -1)
 				printf("WARNING: Error parsing XID string (should be 20 hex digits): %s\n", id_str.c_str());
 			else
-				memcpy(&(ptr_->id[i]), &num, 1);
+				memcpy(&(id_[i]), &num, 1);
 		}
 	}
 }
@@ -434,8 +394,8 @@ Graph::Graph(const Node& n)
 Graph::Graph(const Graph& r)
 {
 	nodes_ = r.nodes_;
-	out_edges_ = r.out_edges_;
-	in_edges_ = r.in_edges_;
+	degree_ = r.degree_;
+	edges_ = r.edges_;
 }
 
 /**
@@ -492,8 +452,8 @@ Graph&
 Graph::operator=(const Graph& r)
 {
 	nodes_ = r.nodes_;
-	out_edges_ = r.out_edges_;
-	in_edges_ = r.in_edges_;
+	degree_ = r.degree_;
+	edges_ = r.edges_;
 	return *this;
 }
 
@@ -512,8 +472,9 @@ Graph::operator*=(const Graph& r)
 		{
 			if (r.nodes_[i].type() == Node::XID_TYPE_DUMMY_SOURCE)
 			{
-				for (std::vector<std::size_t>::const_iterator it = r.out_edges_[i].begin(); it != r.out_edges_[i].end(); ++it)
-					vector_push_back_unique(sources, *it);
+				for (std::size_t e = 0; e < r.edges_.size(); e++)
+					if (r.edges_[e].from == i)
+						vector_push_back_unique(sources, (std::size_t)r.edges_[e].to);
 			}
 			else
 			{
@@ -595,14 +556,16 @@ Graph::print_graph() const
 		for (std::size_t j = 0; j < Node::ID_LEN; j++)
 			printf("%02x", nodes_[i].id()[j]);
 		bool first = true;
-		for (std::size_t j = 0; j < out_edges_[i].size(); j++)
+		for (std::size_t j = 0; j < edges_.size(); j++)
 		{
+			if (edges_[j].from != i)
+				continue;
 			if (first)
 			{
 				first = false;
 				printf(" ->");
 			}
-			printf(" Node %lu", out_edges_[i][j]);
+			printf(" Node %u", edges_[j].to);
 		}
 		if (is_sink(i))
 			printf(" [SNK]");
@@ -613,20 +576,16 @@ Graph::print_graph() const
 std::size_t
 Graph::add_node(const Node& p, bool allow_duplicate_nodes)
 {
-	std::size_t idx;
-	if (allow_duplicate_nodes) {
-		nodes_.push_back(p);
-		idx = nodes_.size()-1;
-	} else {
-		idx = vector_push_back_unique(nodes_, p);
+	if (!allow_duplicate_nodes) {
+		for (std::size_t i = 0; i < nodes_.size(); i++)
+			if (nodes_[i] == p)
+				return i;
 	}
 
-	if (idx >= out_edges_.size())
-	{
-		out_edges_.push_back(std::vector<std::size_t>());
-		in_edges_.push_back(std::vector<std::size_t>());
-	}
-	return idx;
+	Degree d = {0, 0};
+	nodes_.push_back(p);
+	degree_.push_back(d);
+	return nodes_.size()-1;
 }
 
 void
@@ -634,20 +593,38 @@ Graph::add_edge(std::size_t from_id, std::size_t to_id)
 {
 	if (from_id == to_id)
 		return;
-	vector_push_back_unique(out_edges_[from_id], to_id);
-	vector_push_back_unique(in_edges_[to_id], from_id);
+	for (std::size_t i = 0; i < edges_.size(); i++)
+		if (edges_[i].from == from_id && edges_[i].to == to_id)
+			return;
+
+	Edge e = {(uint16_t)from_id, (uint16_t)to_id};
+	edges_.push_back(e);
+	degree_[from_id].out++;
+	degree_[to_id].in++;
 }
 
 bool
 Graph::is_source(std::size_t id) const
 {
-	return in_edges_[id].size() == 0;
+	return degree_[id].in == 0;
 }
 
 bool
 Graph::is_sink(std::size_t id) const
 {
-	return out_edges_[id].size() == 0;
+	return degree_[id].out == 0;
+}
+
+/*
+ * index of the node's highest priority out edge
+ */
+std::size_t
+Graph::first_out_edge(std::size_t id) const
+{
+	for (std::size_t i = 0; i < edges_.size(); i++)
+		if (edges_[i].from == id)
+			return edges_[i].to;
+	return -1;
 }
 
 /**
@@ -672,19 +649,20 @@ Graph::merge_graph(const Graph& r, std::vector<std::size_t>& node_mapping, bool
 {
 	node_mapping.clear();
 
-	for (std::vector<Node>::const_iterator it = r.nodes_.begin(); it != r.nodes_.end(); ++it)
-		if (allow_duplicate_nodes && (*it).type() == Node::XID_TYPE_DUMMY_SOURCE) // don't add r's source node to the middle of this graph
+	for (std::size_t i = 0; i < r.nodes_.size(); i++)
+		if (allow_duplicate_nodes && r.nodes_[i].type() == Node::XID_TYPE_DUMMY_SOURCE) // don't add r's source node to the middle of this graph
 			node_mapping.push_back(-1);
 		else
 		{
-			node_mapping.push_back(add_node(*it, allow_duplicate_nodes));
+			node_mapping.push_back(add_node(r.nodes_[i], allow_duplicate_nodes));
 		}
 
-	for (std::size_t from_id = 0; from_id < r.out_edges_.size(); from_id++)
+	for (std::size_t from_id = 0; from_id < r.nodes_.size(); from_id++)
 	{
 		if (allow_duplicate_nodes && r.nodes_[from_id].type() == Node::XID_TYPE_DUMMY_SOURCE) continue;
-		for (std::vector<std::size_t>::const_iterator it = r.out_edges_[from_id].begin(); it != r.out_edges_[from_id].end(); ++it)
-			add_edge(node_mapping[from_id], node_mapping[*it]);
+		for (std::size_t e = 0; e < r.edges_.size(); e++)
+			if (r.edges_[e].from == from_id)
+				add_edge(node_mapping[from_id], node_mapping[r.edges_[e].to]);
 	}
 }
 
@@ -692,15 +670,15 @@ std::string
 Graph::out_edges_for_index(std::size_t i, std::size_t source_index, std::size_t sink_index) const
 {
 	std::string out_edge_string;
-	for (std::size_t j = 0; j < out_edges_[i].size(); j++)
+	for (std::size_t j = 0; j < edges_.size(); j++)
 	{
-		size_t idx = index_in_dag_string(out_edges_[i][j], source_index, sink_index);
-		char *idx_str;
-		int size = snprintf(NULL, 0, " %zu", idx);
-		idx_str = (char*)malloc(sizeof(char) * size +1); // +1 for null char (sprintf automatically appends it)
-		sprintf(idx_str, " %zu", idx);
+		if (edges_[j].from != i)
+			continue;
+
+		size_t idx = index_in_dag_string(edges_[j].to, source_index, sink_index);
+		char idx_str[24];
+		snprintf(idx_str, sizeof(idx_str), " %zu", idx);
 		out_edge_string += idx_str;
-		free(idx_str);
 	}
 
 	return out_edge_string;
@@ -943,7 +921,7 @@ Graph::next_hop(const Node& n)
 				printf("Warning: next_hop: n not found or is not an intent node\n");
 				return Graph();
 			} else {
-				curIndex = out_edges_[curIndex][0];
+				curIndex = first_out_edge(curIndex);
 			}
 		}
 	}
@@ -964,7 +942,7 @@ Graph::next_hop(const Node& n)
 		if (is_sink(intentIndex)) {
 			break;
 		}
-		intentIndex = out_edges_[intentIndex][0];
+		intentIndex = first_out_edge(intentIndex);
 
 	}
 
@@ -992,9 +970,10 @@ Graph::next_hop(const Node& n)
 
 		// prepare to process its children
 		if (curIndex == intentIndex) continue; // but if we've gotten to the new intent node, stop
-		for (std::size_t i = 0; i < out_edges_[curIndex].size(); i++)
+		for (std::size_t i = 0; i < edges_.size(); i++)
 		{
-			vector_push_back_unique(to_process, out_edges_[curIndex][i]);
+			if (edges_[i].from == curIndex)
+				vector_push_back_unique(to_process, (std::size_t)edges_[i].to);
 		}
 	}
 
@@ -1006,9 +985,10 @@ Graph::next_hop(const Node& n)
 
 		if (old_index == intentIndex) continue; // the new final intent has no out edges
 
-		for (std::size_t i = 0; i < out_edges_[old_index].size(); i++)
+		for (std::size_t i = 0; i < edges_.size(); i++)
 		{
-			g.add_edge(new_index, old_to_new_map[out_edges_[old_index][i]]);
+			if (edges_[i].from == old_index)
+				g.add_edge(new_index, old_to_new_map[edges_[i].to]);
 		}
 	}
 
@@ -1130,9 +1110,10 @@ Graph::get_out_edges(int i) const
 		real_index = index_from_dag_string_index(i, src_index, sink_index);
 
 	std::vector<std::size_t> out_edges;
-	for (std::size_t j = 0; j < out_edges_[real_index].size(); j++)
+	for (std::size_t j = 0; j < edges_.size(); j++)
 	{
-		out_edges.push_back(index_in_dag_string(out_edges_[real_index][j], src_index, sink_index));
+		if (edges_[j].from == real_index)
+			out_edges.push_back(index_in_dag_string(edges_[j].to, src_index, sink_index));
 	}
 
 	return out_edges;
@@ -1325,39 +1306,44 @@ Graph::fill_sockaddr(sockaddr_x *s) const
 #endif
 	s->sx_addr.s_count = num_nodes();
 
+	// work out the source and sink once rather than for every node
+	std::size_t src_index = -1, sink_index = -1;
+	for (std::size_t j = 0; j < nodes_.size(); j++)
+	{
+		if (is_source(j)) src_index = j;
+		if (is_sink(j)) sink_index = j;
+	}
+
 	for (int i = 0; i < num_nodes(); i++)
 	{
 		node_t* node = (node_t*)&(s->sx_addr.s_addr[i]); // check this
+		std::size_t real_index = index_from_dag_string_index(i, src_index, sink_index);
 
 	    // Set the node's XID and type
-		node->s_xid.s_type = get_node(i).type();
-	    memcpy(&(node->s_xid.s_id), get_node(i).id(), Node::ID_LEN);
-
-	    // Get the node's out edge list
-	    std::vector<std::size_t> out_edges;
-	    if (i == num_nodes()-1) {
-	        out_edges = get_out_edges(-1); // put the source node's edges here
-	    } else {
-	        out_edges = get_out_edges(i);
-	    }
+		node->s_xid.s_type = nodes_[real_index].type();
+	    memcpy(&(node->s_xid.s_id), nodes_[real_index].id(), Node::ID_LEN);
+
+	    // the last node carries the source node's out edges
+	    std::size_t from = (i == num_nodes()-1) ? src_index : real_index;
 
 	    // Set the out edges in the header
-	    for (uint8_t j = 0; j < EDGES_MAX; j++)
+	    uint8_t j = 0;
+	    for (std::size_t e = 0; e < edges_.size() && j < EDGES_MAX; e++)
 	    {
-	        if (j < out_edges.size())
-	            node->s_edge[j] = out_edges[j];
-	        else
-	            node->s_edge[j] = EDGE_UNUSED;
+	        if (edges_[e].from == from)
+	            node->s_edge[j++] = index_in_dag_string(edges_[e].to, src_index, sink_index);
 	    }
+	    for (; j < EDGES_MAX; j++)
+	        node->s_edge[j] = EDGE_UNUSED;
 	}
 }
 
 
 /**
-* @brief Fills an empty graph from a sockaddr_x.
+* @brief Fills a graph from a sockaddr_x.
 *
-* Fills an empty graph from a sockaddr_x. Behavior is undefined if the graph
-* contains nodes or edges prior to this call.
+* Fills a graph from a sockaddr_x. Any nodes or edges already in the graph
+* are discarded.
 *
 * @param s The sockaddr_x.
 */
@@ -1366,35 +1352,31 @@ Graph::from_sockaddr(const sockaddr_x *s)
 {
 	// FIXME: check to be sure it's really a sockaddr_x!
 
+	nodes_.clear();
+	degree_.clear();
+	edges_.clear();
+
+	// every node is new, so the nodes keep their sockaddr indices and the
+	// source goes at the end
 	int num_nodes = s->sx_addr.s_count;
-	// First add nodes to the graph and remember their new indices
-	std::vector<uint8_t> graph_indices;
 	for (int i = 0; i < num_nodes; i++)
 	{
 		const node_t *node = &(s->sx_addr.s_addr[i]);
-		Node n = Node(node->s_xid.s_type, &(node->s_xid.s_id), 0); // 0 means nothing
-		graph_indices.push_back(add_node(n));
+		add_node(Node(node->s_xid.s_type, &(node->s_xid.s_id), 0), true); // 0 means nothing
 	}
-
-	// Add the source node
-	uint8_t src_index = add_node(Node());
+	int src_index = add_node(Node(), true);
 
 	// Add edges
 	for (int i = 0; i < num_nodes; i++)
 	{
 		const node_t *node = &(s->sx_addr.s_addr[i]);
-
-		int from_node;
-		if (i == num_nodes-1)
-			from_node = src_index;
-		else
-			from_node = graph_indices[i];
+		int from_node = (i == num_nodes-1) ? src_index : i;
 
 		for (int j = 0; j < EDGES_MAX; j++)
 		{
 			int to_node = node->s_edge[j];
 
-			if (to_node != EDGE_UNUSED)
+			if (to_node != EDGE_UNUSED && to_node < num_nodes)
 				add_edge(from_node, to_node);
 		}
 	}
@@ -1471,13 +1453,94 @@ std::vector<const Node*>
 Graph::get_nodes_of_type(unsigned int type) const
 {
 	std::vector<const Node*> nodes;
-	std::vector<Node>::const_iterator it;
-	for (it = nodes_.begin(); it != nodes_.end(); ++it) {
-		if (it->type() == type) {
-			nodes.push_back(&*it);
+	for (std::size_t i = 0; i < nodes_.size(); i++) {
+		if (nodes_[i].type() == type) {
+			nodes.push_back(&nodes_[i]);
 			printf("FOUND IT");
 		}
 	}
 
 	return nodes;
 }
+
+
+/**
+* @brief Convert a sockaddr_x to the node list used in XIA headers
+*
+* Write the DAG in s in the same layout as the nodes of an XIA packet header,
+* so it can be handed to click without building a Graph or a DAG string.
+*
+* @param s The sockaddr_x to convert
+* @param nodes Buffer to receive the nodes
+* @param len Size of nodes in bytes
+*
+* @return number of bytes written, 0 if s is invalid or nodes is too small
+*/
+std::size_t
+sockaddr_to_wire(const sockaddr_x *s, void *nodes, std::size_t len)
+{
+	std::size_t n = s->sx_addr.s_count;
+	node_t *out = (node_t*)nodes;
+
+	if (n == 0 || n > NODES_MAX || len < n * sizeof(node_t))
+		return 0;
+
+	for (std::size_t i = 0; i < n; i++)
+	{
+		const node_t *node = &(s->sx_addr.s_addr[i]);
+
+		for (int j = 0; j < EDGES_MAX; j++)
+		{
+			if (node->s_edge[j] != EDGE_UNUSED && node->s_edge[j] >= n)
+				return 0;
+		}
+
+		memcpy(&out[i], node, sizeof(node_t));
+		out[i].s_xid.s_type = htonl(node->s_xid.s_type);
+	}
+
+	return n * sizeof(node_t);
+}
+
+/**
+* @brief Fill a sockaddr_x from the node list used in XIA headers
+*
+* The inverse of sockaddr_to_wire(). Edge visited bits set by routers are
+* cleared.
+*
+* @param nodes The nodes
+* @param len Size of nodes in bytes
+* @param s The sockaddr_x to fill in (allocated by caller)
+*
+* @return 0 on success, -1 if the nodes do not form a valid address
+*/
+int
+wire_to_sockaddr(const void *nodes, std::size_t len, sockaddr_x *s)
+{
+	std::size_t n = len / sizeof(node_t);
+
+	if (n == 0 || n > NODES_MAX || len % sizeof(node_t) != 0)
+		return -1;
+
+	s->sx_family = AF_XIA;
+#ifdef __APPLE__
+	s->sx_len = 0;
+#endif
+	s->sx_addr.s_count = n;
+	memcpy(s->sx_addr.s_addr, nodes, len);
+
+	for (std::size_t i = 0; i < n; i++)
+	{
+		node_t *node = &(s->sx_addr.s_addr[i]);
+
+		node->s_xid.s_type = ntohl(node->s_xid.s_type);
+		for (int j = 0; j < EDGES_MAX; j++)
+		{
+			node->s_edge[j] &= 0x7f;
+			if (node->s_edge[j] != EDGE_UNUSED && node->s_edge[j] >= n)
+				return -1;
+		}
+	}
+
+	return 0;
+}
@@ -16,6 +16,16 @@
 #include "dagaddr.hpp"
 #include <stdlib.h>
 #include <cstdio>
+#include <sys/time.h>
+
+#define BENCH_ITERATIONS 100000
+
+static double elapsed_ns(struct timeval *start)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return ((now.tv_sec - start->tv_sec) * 1e9 + (now.tv_usec - start->tv_usec) * 1e3) / BENCH_ITERATIONS;
+}
 
 int main()
 {
@@ -166,6 +176,15 @@ int main()
 
 	printf("Testing sockaddr_x ^^^\n\n\n");
 
+	printf("Testing header node format vvv\n");
+	node_t nodes[NODES_MAX];
+	sockaddr_x s2;
+	std::size_t len = sockaddr_to_wire(s, nodes, sizeof(nodes));
+	printf("sockaddr_to_wire: %zu bytes\n", len);
+	printf("wire_to_sockaddr: %d\n", wire_to_sockaddr(nodes, len, &s2));
+	printf("g7 round trip: %s\n", Graph(&s2).dag_string() == g7.dag_string() ? "ok" : "FAILED");
+	printf("Testing header node format ^^^\n\n\n");
+
 	printf("Testing replace_final_intent vvv\n");
 	Graph g6_new_intent = Graph(g6);
 	g6_new_intent.replace_final_intent(n_cid);
@@ -205,5 +224,36 @@ int main()
 
 	printf("Testing string parse error checking ^^^\n\n\n");
 
+	printf("Timing address conversions vvv\n");
+	struct timeval start;
+	g7.fill_sockaddr(s);
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		Graph g(s);
+	}
+	printf("Graph(sockaddr_x): %.0f ns\n", elapsed_ns(&start));
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		g7.fill_sockaddr(&s2);
+	}
+	printf("fill_sockaddr: %.0f ns\n", elapsed_ns(&start));
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		Graph g(g7.dag_string());
+	}
+	printf("dag_string + Graph(dag_string): %.0f ns\n", elapsed_ns(&start));
+
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		len = sockaddr_to_wire(s, nodes, sizeof(nodes));
+		wire_to_sockaddr(nodes, len, &s2);
+	}
+	printf("sockaddr_to_wire + wire_to_sockaddr: %.0f ns\n", elapsed_ns(&start));
+	printf("Timing address conversions ^^^\n\n\n");
+
+	free(s);
 	return 0;
 }
@@ -33,6 +33,7 @@
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <poll.h>
+#include <sys/epoll.h>
 
 #include "xia.h"
 
@@ -43,6 +44,8 @@ extern "C" {
 #define MAXBUFLEN    15600 // Note that this limits the size of chunk we can receive TODO: What should this be?
 #define XIA_MAXBUF   MAXBUFLEN
 #define XIA_MAXCHUNK MAXBUFLEN
+#define XIA_MAXCHUNKSIZE (16 * 1024 * 1024)	// largest chunk XputChunk() can stream to click
+#define XIA_MAXFETCHWINDOW 256	// most chunk requests XfetchChunks() keeps outstanding
 
 // for python swig compiles
 #ifndef SOCK_STREAM
@@ -66,14 +69,22 @@ extern "C" {
 // Cache policy
 #define POLICY_LRU				0x00000001
 #define POLICY_FIFO				0x00000002
+#define POLICY_CLOCK			0x00000004
+#define POLICY_S3FIFO			0x00000008
 #define POLICY_REMOVE_ON_EXIT	0x00001000
 #define POLICY_RETAIN_ON_EXIT	0x00002000
+#define POLICY_MERKLE			0x00004000	// CIDs are Merkle tree roots
 #define POLICY_DEFAULT			(POLICY_LRU | POLICY_RETAIN_ON_EXIT)
 
 #define CID_HASH_SIZE 40
 
 #define DEFAULT_CHUNK_SIZE	2000
 
+// content defined chunk sizes
+#define XCDC_MIN_SIZE	(2 * 1024)
+#define XCDC_AVG_SIZE	(8 * 1024)
+#define XCDC_MAX_SIZE	(64 * 1024)
+
 /* CID cache context */
 typedef struct {
     int sockfd;
@@ -81,6 +92,7 @@ typedef struct {
 	unsigned cachePolicy;
     unsigned cacheSize;
 	unsigned ttl;
+	unsigned chunkSize;	// used by XputFile() etc. when given a chunkSize of 0
 } ChunkContext;
 
 typedef struct {
@@ -96,6 +108,44 @@ typedef struct {
 	int status; // 1: ready to be read, 0: waiting for chunk response, -1: failed
 } ChunkStatus;
 
+/* completion callback for XputFileAsync() and XputBufferAsync() */
+typedef void (*XputCallback)(const ChunkInfo *info, unsigned index, int err, void *arg);
+
+/* the chunks of a file in order, and the hosts they can be fetched from */
+typedef struct {
+	unsigned numChunks;
+	ChunkInfo *chunks;		// only cid and size are used
+	unsigned numSources;
+	char **sources;			// DAGs the CIDs are appended to, "RE ( AD:... HID:... )", tried in order
+} ChunkManifest;
+
+/* how XfetchChunks() paces its requests, 0 for the defaults */
+typedef struct {
+	unsigned window;		// requests outstanding at the start
+	unsigned maxWindow;		// most requests outstanding, no more than XIA_MAXFETCHWINDOW
+	unsigned retries;		// times a chunk is requested from a source before trying the next
+} XfetchOptions;
+
+/* chunk sizes for XputFileCDC() and XputBufferCDC(), 0 for the defaults */
+typedef struct {
+	unsigned minSize;		// no cut is made before this many bytes
+	unsigned avgSize;		// rounded down to a power of 2
+	unsigned maxSize;		// a chunk is cut here if the data gave no cut before
+} XchunkOptions;
+
+/* called with each chunk in order, returning non-zero stops the fetch */
+typedef int (*XfetchCallback)(unsigned index, const char *data, unsigned len, void *arg);
+
+/* a chunk being built up by XputChunkAppend() */
+typedef struct {
+	const ChunkContext *ctx;
+	unsigned stream;
+	unsigned length;
+} ChunkStream;
+
+/* completion callback for the asynchronous name functions */
+typedef void (*XresolveCallback)(const char *name, const sockaddr_x *addr, int err, void *arg);
+
 
 // XIA specific addrinfo flags
 #define XAI_DAGHOST	AI_NUMERICHOST	// if set, name is a dag instead of a generic name string
@@ -148,12 +198,18 @@ extern int Xrecv(int sockfd, void *rbuf, size_t len, int flags);
 extern int Xsend(int sockfd, const void *buf, size_t len, int flags);
 extern int Xfcntl(int sockfd, int cmd, ...);
 extern int Xselect(int nfds, fd_set *readfds, fd_set *writefds, fd_set *errorfds, struct timeval *timeout);
+extern int Xepoll_create(int flags);
+extern int Xepoll_ctl(int epfd, int op, int fd, struct epoll_event *event);
+extern int Xepoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout);
+extern int Xepoll_close(int epfd);
 
 extern int XrequestChunk(int sockfd, char* dag, size_t dagLen);
 extern int XrequestChunks(int sockfd, const ChunkStatus *chunks, int numChunks);
 extern int XgetChunkStatus(int sockfd, char* dag, size_t dagLen);
 extern int XgetChunkStatuses(int sockfd, ChunkStatus *statusList, int numCids);
+extern int XwaitChunks(int sockfd, ChunkStatus *statusList, int numCids, int timeout);
 extern int XreadChunk(int sockfd, void *rbuf, size_t len, int flags, char *cid, size_t cidLen);
+extern int XreadChunkAt(int sockfd, void *rbuf, size_t len, size_t offset, char *cid, size_t *chunkSize);
 extern int XpushChunkto(const ChunkContext* ctx, const char* buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo* info);
 extern int XpushBufferto(const ChunkContext *ctx, const char *data, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo **info, unsigned chunkSize);
 extern int XpushFileto(const ChunkContext *ctx, const char *fname, int flags, const struct sockaddr *addr, socklen_t addrlen, ChunkInfo **info, unsigned chunkSize);
@@ -162,9 +218,23 @@ extern int XbindPush(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 
 extern ChunkContext *XallocCacheSlice(unsigned policy, unsigned ttl, unsigned size);
 extern int XfreeCacheSlice(ChunkContext *ctx);
+extern int XsetChunkSize(ChunkContext *ctx, unsigned chunkSize);
 extern int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkInfo *info);
+extern int XputChunkBegin(const ChunkContext *ctx, ChunkStream *cs);
+extern int XputChunkAppend(ChunkStream *cs, const char *data, unsigned length);
+extern int XputChunkCommit(ChunkStream *cs, ChunkInfo *info);
+extern int XputChunkAbort(ChunkStream *cs);
 extern int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo **infoList);
 extern int XputBuffer(ChunkContext *ctx, const char *, unsigned size, unsigned chunkSize, ChunkInfo **infoList);
+extern int XfetchChunks(int sockfd, const ChunkManifest *manifest, const XfetchOptions *opts, XfetchCallback cb, void *arg);
+extern int XfetchFile(int sockfd, const ChunkManifest *manifest, const XfetchOptions *opts, const char *fname);
+extern int XmanifestWrite(const ChunkManifest *manifest, char **buf, size_t *len);
+extern int XmanifestRead(const char *buf, size_t len, ChunkManifest *manifest);
+extern void XmanifestFree(ChunkManifest *manifest);
+extern int XputFileAsync(ChunkContext *ctx, const char *fname, unsigned chunkSize, XputCallback cb, void *arg);
+extern int XputBufferAsync(ChunkContext *ctx, const char *data, size_t len, unsigned chunkSize, XputCallback cb, void *arg);
+extern int XputFileCDC(ChunkContext *ctx, const char *fname, const XchunkOptions *opts, const char *source, ChunkManifest *manifest);
+extern int XputBufferCDC(ChunkContext *ctx, const char *data, size_t len, const XchunkOptions *opts, const char *source, ChunkManifest *manifest);
 extern int XremoveChunk(ChunkContext *ctx, const char *cid);
 extern void XfreeChunkInfo(ChunkInfo *infoList);
 
@@ -177,6 +247,11 @@ extern int Xgetsockopt(int sockfd, int optname, void *optval, socklen_t *optlen)
 extern int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *addrlen);
 extern int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen);
 extern int XregisterName(const char *name, sockaddr_x *addr);
+extern void XflushNameCache();
+extern int XgetDAGbyNameAsync(const char *name, XresolveCallback cb, void *arg);
+extern int XregisterNameAsync(const char *name, sockaddr_x *addr, XresolveCallback cb, void *arg);
+extern int XgetDAGbyNameBatch(const char **names, sockaddr_x *addrs, int *results, int count);
+extern int XregisterNameBatch(const char **names, sockaddr_x *addrs, int *results, int count);
 extern int XrendezvousUpdate(const char *hidstr, sockaddr_x *DAG);
 
 extern int XreadLocalHostAddr(int sockfd, char *localhostAD, unsigned lenAD, char *localhostHID, unsigned lenHID, char *local4ID, unsigned len4ID);
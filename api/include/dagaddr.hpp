@@ -16,6 +16,64 @@
 
 class Graph;
 
+#ifndef SWIG
+/*
+ * Minimal vector for plain (memcpy-able) types that keeps up to N elements
+ * inline and only goes to the heap for unusually large graphs.
+ */
+template <typename T, std::size_t N>
+class SmallVec
+{
+public:
+	SmallVec() : data_((T*)buf_), size_(0), cap_(N) {}
+	SmallVec(const SmallVec& r) : data_((T*)buf_), size_(0), cap_(N) { *this = r; }
+	~SmallVec() { if (data_ != (T*)buf_) free(data_); }
+
+	SmallVec& operator=(const SmallVec& r)
+	{
+		if (this != &r) {
+			reserve(r.size_);
+			memcpy((void*)data_, r.data_, r.size_ * sizeof(T));
+			size_ = r.size_;
+		}
+		return *this;
+	}
+
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+	void clear() { size_ = 0; }
+
+	T& operator[](std::size_t i) { return data_[i]; }
+	const T& operator[](std::size_t i) const { return data_[i]; }
+	T& back() { return data_[size_ - 1]; }
+
+	void push_back(const T& e)
+	{
+		if (size_ == cap_)
+			reserve(cap_ * 2);
+		memcpy((void*)&data_[size_++], &e, sizeof(T));
+	}
+
+	void reserve(std::size_t n)
+	{
+		if (n <= cap_)
+			return;
+		T *p = (T*)malloc(n * sizeof(T));
+		memcpy((void*)p, data_, size_ * sizeof(T));
+		if (data_ != (T*)buf_)
+			free(data_);
+		data_ = p;
+		cap_ = n;
+	}
+
+private:
+	T *data_;
+	std::size_t size_;
+	std::size_t cap_;
+	uint64_t buf_[(N * sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t)];
+};
+#endif
+
 class Node
 {
 public:
@@ -39,23 +97,20 @@ public:
 
 public:
 	Node();
-	Node(const Node& r);
 	Node(uint32_t type, const void* id, int dummy); // NOTE: dummy is so compiler doesn't complain about ambigous constructors  TODO: fix.
 	Node(int type, const std::string id_string); // NOTE: type is an int here because the consts above are ints, otherwise swig will complain again
 	Node(const std::string type_string, const std::string id_string);
 	Node(const std::string node_string);
 
-	~Node();
-
-	const uint32_t& type() const { return ptr_->type; }
-	const unsigned char* id() const { return ptr_->id; }
+	const uint32_t& type() const { return type_; }
+	const unsigned char* id() const { return id_; }
 	std::string type_string() const;
 	std::string id_string() const;
 	std::string to_string() const;
 
-	Node& operator=(const Node& r);
-	bool operator==(const Node& r) const { return ptr_ == r.ptr_; }
-	bool operator!=(const Node& r) const { return ptr_ != r.ptr_; }
+	// true if r is this node or a copy of it, use equal_to() to compare XIDs
+	bool operator==(const Node& r) const { return uid_ == r.uid_; }
+	bool operator!=(const Node& r) const { return uid_ != r.uid_; }
 	Graph operator*(const Node& r) const;
 	Graph operator*(const Graph& r) const;
 	Graph operator+(const Node& r) const;
@@ -69,21 +124,15 @@ public:
 
 	
 
-protected:
-	void acquire() const;
-	void release() const;
-
 private:
-	struct container
-	{
-		uint32_t type;
-		unsigned char id[ID_LEN];
-		std::size_t ref_count;
-	};
-
-	mutable container* ptr_;
-	static container dummy_source_;
-
+	// nodes are plain values so they can be copied around without touching
+	// the heap. uid_ is shared by a node and all of its copies, the dummy
+	// source is always 0.
+	uint32_t type_;
+	unsigned char id_[ID_LEN];
+	uint64_t uid_;
+
+	void init(uint32_t type);
 	void construct_from_strings(const std::string type_string, const std::string id_string);
 };
 
@@ -132,6 +181,7 @@ protected:
 
 	std::size_t source_index() const;
 	std::size_t final_intent_index() const;
+	std::size_t first_out_edge(std::size_t id) const;
 
 	void merge_graph(const Graph& r, std::vector<std::size_t>& node_mapping, bool allow_duplicate_nodes = false);
 
@@ -145,11 +195,31 @@ private:
 	void construct_from_re_string(std::string re_string);
 	int check_re_string(std::string re_string);
 
-	std::vector<Node> nodes_;
-	std::vector<std::vector<std::size_t> > out_edges_;
-	std::vector<std::vector<std::size_t> > in_edges_;
+#ifndef SWIG
+	// edges are kept in one list in the order they were added, which is
+	// also their priority order
+	struct Edge {
+		uint16_t from;
+		uint16_t to;
+	};
+
+	struct Degree {
+		uint16_t in;
+		uint16_t out;
+	};
+
+	// sized so any DAG that fits in a sockaddr_x stays inline
+	SmallVec<Node, NODES_MAX + 1> nodes_;
+	SmallVec<Degree, NODES_MAX + 1> degree_;
+	SmallVec<Edge, NODES_MAX * 2> edges_;
+#endif
 };
 
+// convert between a sockaddr_x and the node list carried in XIA headers
+// (XID types in network byte order, last node is the sink)
+std::size_t sockaddr_to_wire(const sockaddr_x *s, void *nodes, std::size_t len);
+int wire_to_sockaddr(const void *nodes, std::size_t len, sockaddr_x *s);
+
 /**
 * @brief Make a graph by appending a node
 *
@@ -28,6 +28,19 @@ extern "C" {
 #define NS_MAX_PACKET_SIZE 1024
 #define NS_MAX_DAG_LENGTH  1024
 
+// batch packets carry several requests or responses in one datagram
+//  byte 0    NS_TYPE_BATCH or NS_TYPE_RESPONSE_BATCH
+//  byte 1    flags
+//  bytes 2-3 batch id, echoed back by the nameserver
+//  bytes 4-5 record count
+//  followed by count records, each encoded the same way as a single ns packet
+// The response holds one record per request, in the same order. If the answers
+// don't all fit, the nameserver returns as many as it can and the client
+// resends the rest.
+#define NS_MAX_BATCH_PACKET_SIZE 8192
+#define NS_MAX_BATCH_RECORDS     128
+#define NS_BATCH_HEADER_SIZE     6
+
 #define NS_TYPE_REGISTER			0x01
 #define NS_TYPE_QUERY				0x02
 #define NS_TYPE_RQUERY				0x03
@@ -35,6 +48,8 @@ extern "C" {
 #define NS_TYPE_RESPONSE_QUERY		0x05
 #define NS_TYPE_RESPONSE_RQUERY		0x06
 #define NS_TYPE_RESPONSE_ERROR		0x07
+#define NS_TYPE_BATCH				0x08
+#define NS_TYPE_RESPONSE_BATCH		0x09
 
 #define NS_FLAGS_MIGRATE 0x01
 
@@ -52,6 +67,10 @@ extern int XregisterHost(const char *name, sockaddr_x *addr);
 extern int make_ns_packet(ns_pkt *np, char *pkt, int pkt_sz);
 extern void get_ns_packet(char *pkt, int sz, ns_pkt *np);
 
+extern int make_ns_batch(char type, unsigned short id, char *pkt, int pkt_sz);
+extern int add_ns_batch(ns_pkt *np, char *pkt, int len, int pkt_sz);
+extern int get_ns_batch(char *pkt, int sz, unsigned short *id, ns_pkt *records, int max);
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +66,7 @@ int Xclose(int sockfd)
 			LOGF("ERROR removing key files for %s", getTempSID(sockfd));
 		}
 	}
+	epollForget(sockfd);
 	(_f_close)(sockfd);
 	freeSocketState(sockfd);
 
@@ -43,8 +43,9 @@ array allocated by the XputFile() and XputBuffer() functions.
 
 XrequestChunk() and XrequestChunks() bring one or more chunks of content from
 the network to the local machine. XgetChunkStatus() and XgetChunkStatuses()
-check to see if the requested content is available to be read. XreadChunk()
-is then used to get the content into the application. 
+check to see if the requested content is available to be read, and
+XwaitChunks() blocks until some of it is. XreadChunk() is then used to get
+the content into the application. 
 
 Xclose() is used to close a socket.
 
@@ -67,6 +68,9 @@ socket function that will work correctly is select().
 - XgetDAGbyName() convert a name to DAG that can be used by other Xsocket functions
 - XreadLocalHostAddr() look up the AD and HID of the local host
 - XregisterName() register our service/host name with the nameserver
+- XflushNameCache() discard remembered name lookups
+- XgetDAGbyNameAsync() and XgetDAGbyNameBatch() resolve many names in a few round trips
+- XregisterNameAsync() and XregisterNameBatch() register many names in a few round trips
 <h3>Stream Oriented Functions</h3>
 - Xaccept() wait for stream connections
 - Xconnect() connect to a remote DAG
@@ -78,15 +82,28 @@ socket function that will work correctly is select().
 <h3>Content (Chunk) Oriented Functions</h3>
 - XallocCacheSlice() allocate a space in the local content cache
 - XfreeCacheSlice() release the reserved local cache space
+- XsetChunkSize() set the chunk size a cache slice publishes with
 - XputChunk() make a single chunk of content available
+- XputChunkBegin(), XputChunkAppend(), XputChunkCommit(), XputChunkAbort()
+build a chunk too large to pass to XputChunk() in one piece
 - XputFile() make a file available as one or more chunks
 - XputBuffer() make a block of memory available as one or more chunks
+- XputFileAsync(), XputBufferAsync() publish in the background and report
+each chunk as it is acknowledged
+- XputFileCDC(), XputBufferCDC() cut the data where its content says, so
+edited files keep most of their CIDs, and return a manifest of the chunks
 - XfreeChunkInfo() frees the chunk status array allocated by XputFile() and XputBuffer()
 - XrequestChunk(), XrequestChunks() bring one or more chunks of content from
 the network to the local machine
 - XgetChunkStatus(), XgetChunkStatuses() get the rediness status of one or more
 chunks of content
+- XwaitChunks() wait for one of a set of requested chunks to arrive
 - XreadChunk() load a single chunk into memory
+- XreadChunkAt() load part of a chunk into memory
+- XfetchChunks(), XfetchFile() fetch the chunks listed in a manifest with a
+window of requests outstanding
+- XmanifestWrite(), XmanifestRead(), XmanifestFree() convert manifests to and
+from text
 
 
 @todo add description of DAGs (who can provide?)
@@ -0,0 +1,360 @@
+/*
+** Copyright 2013 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file Xepoll.c
+** @brief implements Xepoll_create(), Xepoll_ctl(), Xepoll_wait() and Xepoll_close()
+*/
+#include <sys/epoll.h>
+#include <sys/poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <map>
+#include <deque>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+
+#define XEPOLL_EVENTS (EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP)
+
+// API side view of an Xepoll instance
+// click owns the real interest set, we only keep enough to validate
+// Xepoll_ctl calls and to hold events that didn't fit in the caller's buffer
+typedef struct {
+	std::map<unsigned short, int> ports;		// click port -> Xsocket
+	std::deque<struct epoll_event> pending;
+} EpollState;
+
+static std::map<int, EpollState> epolls;
+static pthread_mutex_t epoll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned short xsocketPort(int sock)
+{
+	struct sockaddr_in sin;
+	socklen_t slen = sizeof(sin);
+
+	if ((_f_getsockname)(sock, (struct sockaddr*)&sin, &slen) < 0)
+		return 0;
+	return sin.sin_port;
+}
+
+static int epollSend(int epfd, xia::X_Epoll_Msg::MsgType type, unsigned short port, const struct epoll_event *event)
+{
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XEPOLL);
+	xsm.set_sequence(0);
+
+	xia::X_Epoll_Msg *msg = xsm.mutable_x_epoll();
+	msg->set_type(type);
+
+	if (port) {
+		xia::X_Epoll_Msg::EpollEvent *ev = msg->add_events();
+		ev->set_port(port);
+		ev->set_flags(event ? (event->events & XEPOLL_EVENTS) : 0);
+		if (event)
+			ev->set_data(event->data.u64);
+	}
+
+	return click_send(epfd, &xsm);
+}
+
+// move queued events into the caller's buffer
+// must be called with epoll_lock held
+static int epollDeliver(EpollState &es, struct epoll_event *events, int maxevents)
+{
+	int n = 0;
+
+	while (n < maxevents && !es.pending.empty()) {
+		events[n++] = es.pending.front();
+		es.pending.pop_front();
+	}
+	return n;
+}
+
+/*!
+** @brief create a persistent, edge-triggered Xsocket event notification instance
+**
+** Unlike Xpoll and Xselect, the set of Xsockets being watched is kept by
+** click and does not need to be sent on every call. Click pushes readiness
+** changes to the returned descriptor in batches as they happen.
+**
+** The returned descriptor is a real kernel fd that becomes readable when
+** click has events waiting, so it can be added to the application's own
+** epoll, poll or select set. It must be released with Xepoll_close().
+**
+** @param flags 0 or EPOLL_CLOEXEC
+**
+** @returns a new epoll descriptor on success
+** @returns -1 on error with errno set
+*/
+int Xepoll_create(int flags)
+{
+	int epfd;
+
+	if (flags & ~EPOLL_CLOEXEC) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if ((epfd = (_f_socket)(AF_INET, SOCK_DGRAM, 0)) == -1) {
+		LOGF("error creating Xepoll socket: %s", strerror(errno));
+		return -1;
+	}
+
+	if (flags & EPOLL_CLOEXEC)
+		(_f_fcntl)(epfd, F_SETFD, FD_CLOEXEC);
+
+	if (epollSend(epfd, xia::X_Epoll_Msg::CREATE, 0, NULL) < 0) {
+		int eno = errno;
+		(_f_close)(epfd);
+		errno = eno;
+		return -1;
+	}
+
+	pthread_mutex_lock(&epoll_lock);
+	epolls[epfd] = EpollState();
+	pthread_mutex_unlock(&epoll_lock);
+
+	return epfd;
+}
+
+/*!
+** @brief add, modify or remove an Xsocket in an Xepoll interest set
+**
+** See the epoll_ctl man page for more detailed information. All Xsockets are
+** edge-triggered, so EPOLLET is implied. EPOLLERR and EPOLLHUP are always
+** reported. When an Xsocket is added or modified, its current state is
+** reported once so that events that happened before registration aren't lost.
+**
+** @param epfd descriptor returned by Xepoll_create
+** @param op EPOLL_CTL_ADD, EPOLL_CTL_MOD or EPOLL_CTL_DEL
+** @param fd the Xsocket to watch
+** @param event events to watch for, and data to return with them
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+*/
+int Xepoll_ctl(int epfd, int op, int fd, struct epoll_event *event)
+{
+	xia::X_Epoll_Msg::MsgType type;
+	int rc = -1;
+
+	if (fd == epfd) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (getSocketType(fd) == XSOCK_INVALID) {
+		// only Xsockets can be watched, put epfd in a kernel epoll set for everything else
+		errno = EPERM;
+		return -1;
+	}
+
+	if (op != EPOLL_CTL_DEL && event == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	unsigned short port = xsocketPort(fd);
+	if (port == 0) {
+		errno = EBADF;
+		return -1;
+	}
+
+	pthread_mutex_lock(&epoll_lock);
+
+	std::map<int, EpollState>::iterator it = epolls.find(epfd);
+	if (it == epolls.end()) {
+		errno = EBADF;
+		goto done;
+	}
+
+	{
+		EpollState &es = it->second;
+		bool present = (es.ports.find(port) != es.ports.end());
+
+		switch (op) {
+		case EPOLL_CTL_ADD:
+			if (present) {
+				errno = EEXIST;
+				goto done;
+			}
+			type = xia::X_Epoll_Msg::CTL_ADD;
+			es.ports[port] = fd;
+			break;
+
+		case EPOLL_CTL_MOD:
+			if (!present) {
+				errno = ENOENT;
+				goto done;
+			}
+			type = xia::X_Epoll_Msg::CTL_MOD;
+			break;
+
+		case EPOLL_CTL_DEL:
+			if (!present) {
+				errno = ENOENT;
+				goto done;
+			}
+			type = xia::X_Epoll_Msg::CTL_DEL;
+			es.ports.erase(port);
+			break;
+
+		default:
+			errno = EINVAL;
+			goto done;
+		}
+	}
+
+	rc = epollSend(epfd, type, port, event);
+
+done:
+	pthread_mutex_unlock(&epoll_lock);
+	return rc;
+}
+
+/*!
+** @brief wait for events on an Xepoll instance
+**
+** See the epoll_wait man page for more detailed information. Events are
+** edge-triggered; an Xsocket is reported again only after its state changes.
+**
+** @param epfd descriptor returned by Xepoll_create
+** @param events buffer to receive the events
+** @param maxevents number of entries in events
+** @param timeout number of milliseconds to wait, -1 to wait forever
+**
+** @returns the number of events returned, 0 if the timeout expired
+** @returns -1 on error with errno set
+*/
+int Xepoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	char buf[XIA_MAXBUF];
+	std::map<int, EpollState>::iterator it;
+	int rc;
+
+	if (maxevents <= 0) {
+		errno = EINVAL;
+		return -1;
+	} else if (events == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	pthread_mutex_lock(&epoll_lock);
+	it = epolls.find(epfd);
+	if (it == epolls.end()) {
+		pthread_mutex_unlock(&epoll_lock);
+		errno = EBADF;
+		return -1;
+	}
+
+	// return anything left over from the last batch before waiting again
+	if ((rc = epollDeliver(it->second, events, maxevents)) > 0) {
+		pthread_mutex_unlock(&epoll_lock);
+		return rc;
+	}
+	pthread_mutex_unlock(&epoll_lock);
+
+	struct pollfd pfd;
+	pfd.fd = epfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if ((rc = (_f_poll)(&pfd, 1, timeout)) <= 0)
+		return rc;
+
+	pthread_mutex_lock(&epoll_lock);
+	it = epolls.find(epfd);
+	if (it == epolls.end()) {
+		// closed out from under us
+		pthread_mutex_unlock(&epoll_lock);
+		errno = EBADF;
+		return -1;
+	}
+	EpollState &es = it->second;
+
+	// drain every batch click has queued for us
+	while ((rc = (_f_recvfrom)(epfd, buf, sizeof(buf), MSG_DONTWAIT, NULL, NULL)) > 0) {
+		xia::XSocketMsg xsm;
+
+		if (!xsm.ParseFromArray(buf, rc) || xsm.type() != xia::XEPOLL) {
+			LOG("unexpected message on Xepoll socket");
+			continue;
+		}
+
+		const xia::X_Epoll_Msg &msg = xsm.x_epoll();
+		for (int i = 0; i < msg.events_size(); i++) {
+			const xia::X_Epoll_Msg::EpollEvent &ev = msg.events(i);
+
+			// the socket may have been removed after click sent the batch
+			if (es.ports.find(ev.port()) == es.ports.end())
+				continue;
+
+			struct epoll_event e;
+			e.events = ev.flags();	// poll and epoll flag values are the same
+			e.data.u64 = ev.data();
+			es.pending.push_back(e);
+		}
+	}
+
+	rc = epollDeliver(es, events, maxevents);
+	pthread_mutex_unlock(&epoll_lock);
+
+	return rc;
+}
+
+/*!
+** @brief release an Xepoll instance
+**
+** @param epfd descriptor returned by Xepoll_create
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+*/
+int Xepoll_close(int epfd)
+{
+	pthread_mutex_lock(&epoll_lock);
+	std::map<int, EpollState>::iterator it = epolls.find(epfd);
+	if (it == epolls.end()) {
+		pthread_mutex_unlock(&epoll_lock);
+		errno = EBADF;
+		return -1;
+	}
+	epolls.erase(it);
+	pthread_mutex_unlock(&epoll_lock);
+
+	epollSend(epfd, xia::X_Epoll_Msg::DESTROY, 0, NULL);
+	return (_f_close)(epfd);
+}
+
+// forget a closed Xsocket in all of the Xepoll instances
+// click does the same on its side when it handles the close
+void epollForget(int sock)
+{
+	pthread_mutex_lock(&epoll_lock);
+	for (std::map<int, EpollState>::iterator it = epolls.begin(); it != epolls.end(); it++) {
+		std::map<unsigned short, int>::iterator pit;
+
+		for (pit = it->second.ports.begin(); pit != it->second.ports.end(); pit++) {
+			if (pit->second == sock) {
+				it->second.ports.erase(pit);
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&epoll_lock);
+}
@@ -0,0 +1,553 @@
+/*
+** Copyright 2013 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file Xfetch.c
+** @brief implements XfetchChunks(), XfetchFile(), XmanifestWrite(),
+** XmanifestRead() and XmanifestFree()
+*/
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+
+#define FETCH_WINDOW		8		// requests outstanding at the start
+#define FETCH_MAX_WINDOW	64
+#define FETCH_RETRIES		3		// requests to one source before moving to the next
+#define FETCH_INITIAL_RTO	1000	// ms before the first RTT sample
+#define FETCH_MIN_RTO		200
+#define FETCH_MAX_RTO		10000
+
+#define MANIFEST_MAGIC		"XIA-MANIFEST 1"
+
+typedef struct {
+	unsigned source;	// index into the manifest's sources
+	unsigned tries;		// requests sent to this source
+	unsigned attempts;	// requests sent in all
+	long sent;			// when the last request went out
+	std::string dag;
+} FetchChunk;
+
+static long nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+** State for one fetch. The window grows by a chunk per chunk received
+** until the first loss and by a chunk per window after that, and is halved
+** at most once per round trip when a request times out or fails. The
+** timeout follows the observed round trip time as in TCP, backing off with
+** the window, and only chunks that were requested once are sampled.
+*/
+typedef struct {
+	int sockfd;
+	const ChunkManifest *m;
+	unsigned maxWindow;
+	unsigned retries;
+
+	double cwnd;
+	double ssthresh;
+	long srtt;			// 0 until the first sample
+	long rttvar;
+	long rto;
+	long recovery;		// losses of requests sent before this don't shrink the window again
+	unsigned preferred;	// the source new chunks are requested from
+
+	std::map<unsigned, FetchChunk> outstanding;
+	std::map<unsigned, std::string> held;	// received out of order
+} FetchState;
+
+static void buildDag(FetchState *fs, unsigned index, FetchChunk &fc)
+{
+	fc.dag = fs->m->sources[fc.source];
+	fc.dag += " CID:";
+	fc.dag += fs->m->chunks[index].cid;
+}
+
+static void sampleRtt(FetchState *fs, long rtt)
+{
+	if (fs->srtt == 0) {
+		fs->srtt = rtt;
+		fs->rttvar = rtt / 2;
+	} else {
+		long err = rtt - fs->srtt;
+		fs->srtt += err / 8;
+		fs->rttvar += ((err < 0 ? -err : err) - fs->rttvar) / 4;
+	}
+	fs->rto = fs->srtt + 4 * fs->rttvar;
+	fs->rto = MAX(fs->rto, FETCH_MIN_RTO);
+	fs->rto = MIN(fs->rto, FETCH_MAX_RTO);
+}
+
+static void grow(FetchState *fs)
+{
+	if (fs->cwnd < fs->ssthresh)
+		fs->cwnd += 1;
+	else
+		fs->cwnd += 1 / fs->cwnd;
+	fs->cwnd = MIN(fs->cwnd, fs->maxWindow);
+}
+
+static void shrink(FetchState *fs, const FetchChunk &fc, long now, bool timeout)
+{
+	if (fc.sent < fs->recovery)
+		return;
+	fs->ssthresh = MAX(fs->cwnd / 2, 1);
+	fs->cwnd = fs->ssthresh;
+	fs->recovery = now;
+	if (timeout)
+		fs->rto = MIN(fs->rto * 2, FETCH_MAX_RTO);
+}
+
+// move a lost chunk on to its next try, -1 once every source has had its turn
+static int retry(FetchState *fs, unsigned index, FetchChunk &fc)
+{
+	if (fc.attempts >= fs->retries * fs->m->numSources)
+		return -1;
+
+	// a source that has let a chunk down this often is passed over by the
+	// other chunks too
+	if (fc.tries >= fs->retries && fc.source == fs->preferred)
+		fs->preferred = (fs->preferred + 1) % fs->m->numSources;
+
+	if (fc.tries >= fs->retries || fc.source != fs->preferred) {
+		fc.source = fs->preferred;
+		fc.tries = 0;
+		buildDag(fs, index, fc);
+	}
+	return 0;
+}
+
+static int sendRequests(FetchState *fs, std::vector<unsigned> &indices, long now)
+{
+	std::vector<ChunkStatus> req(indices.size());
+
+	for (unsigned i = 0; i < indices.size(); i++) {
+		FetchChunk &fc = fs->outstanding[indices[i]];
+
+		req[i].cid = (char *)fc.dag.c_str();
+		req[i].cidLen = fc.dag.size();
+		req[i].status = 0;
+		fc.tries++;
+		fc.attempts++;
+		fc.sent = now;
+	}
+	indices.clear();
+
+	return req.empty() ? 0 : XrequestChunks(fs->sockfd, &req[0], req.size());
+}
+
+// read a chunk click has finished, returns 1 if it arrived, 0 if it should
+// be requested again, -1 on error
+static int readChunk(FetchState *fs, unsigned index, const FetchChunk &fc, std::string &data)
+{
+	unsigned size = fs->m->chunks[index].size;
+	if (size == 0) {
+		// the manifest doesn't give the size, click does with the first slice
+		size_t total = 0;
+		char slice[1];
+
+		if (XreadChunkAt(fs->sockfd, slice, sizeof(slice), 0, (char *)fc.dag.c_str(), &total) < 0)
+			return -1;
+		if (total > XIA_MAXCHUNKSIZE) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+		size = total;
+	}
+	data.resize(size);
+
+	int rc = XreadChunk(fs->sockfd, &data[0], size, 0, (char *)fc.dag.c_str(), fc.dag.size());
+	if (rc < 0) {
+		// the chunk matched its CID, so it is the manifest that is wrong
+		if (errno == EFAULT)
+			errno = EMSGSIZE;
+		return -1;
+	}
+	if (fs->m->chunks[index].size && rc != fs->m->chunks[index].size)
+		return 0;
+
+	data.resize(rc);
+	return 1;
+}
+
+/*!
+** @brief Fetch the chunks of a manifest and hand them to a callback in order.
+**
+** A window of requests is kept outstanding, it grows while chunks arrive
+** and shrinks when requests time out, so the fetch makes use of the
+** available bandwidth without flooding the path. A chunk that times out,
+** fails or doesn't match its CID is requested again, moving on to the next
+** source in the manifest after opts->retries tries from one source.
+**
+** Chunks that arrive out of order are held until the ones before them have
+** been delivered, so at most twice the maximum window of chunks is held in
+** memory.
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param manifest the chunks to fetch, and the sources to fetch them from
+** @param opts window and retry limits, NULL for the defaults
+** @param cb function called with each chunk in order
+** @param arg passed through to cb
+**
+** @returns the number of chunks delivered
+** @returns -1 on error with errno set, ETIMEDOUT if a chunk couldn't be
+** fetched from any source, EMSGSIZE if a chunk is larger than the manifest
+** says, ECANCELED if the callback stopped the fetch.
+** Chunks delivered before the error are not delivered again.
+**
+*/
+int XfetchChunks(int sockfd, const ChunkManifest *manifest, const XfetchOptions *opts,
+		XfetchCallback cb, void *arg)
+{
+	if (validateSocket(sockfd, XSOCK_CHUNK, EAFNOSUPPORT) < 0) {
+		LOGF("Socket %d must be a chunk socket", sockfd);
+		return -1;
+	}
+
+	if (!manifest || !cb || (manifest->numChunks && (!manifest->chunks || !manifest->sources))) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (manifest->numChunks && manifest->numSources == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	FetchState fs;
+	fs.sockfd = sockfd;
+	fs.m = manifest;
+	fs.maxWindow = (opts && opts->maxWindow) ? opts->maxWindow : FETCH_MAX_WINDOW;
+	fs.maxWindow = MIN(fs.maxWindow, XIA_MAXFETCHWINDOW);
+	fs.retries = (opts && opts->retries) ? opts->retries : FETCH_RETRIES;
+	fs.cwnd = (opts && opts->window) ? opts->window : FETCH_WINDOW;
+	fs.cwnd = MIN(fs.cwnd, fs.maxWindow);
+	fs.ssthresh = fs.maxWindow;
+	fs.srtt = 0;
+	fs.rttvar = 0;
+	fs.rto = FETCH_INITIAL_RTO;
+	fs.recovery = 0;
+	fs.preferred = 0;
+
+	unsigned next = 0;		// next chunk to request for the first time
+	unsigned deliver = 0;	// next chunk to hand to the callback
+	std::vector<unsigned> send;
+	std::vector<ChunkStatus> status;
+	std::vector<unsigned> polled;
+	int err = 0;
+
+	while (deliver < manifest->numChunks && !err) {
+		long now = nowMs();
+
+		while (next < manifest->numChunks && fs.outstanding.size() < (unsigned)fs.cwnd &&
+				next - deliver < 2 * fs.maxWindow) {
+			FetchChunk &fc = fs.outstanding[next];
+			fc.source = fs.preferred;
+			fc.tries = 0;
+			fc.attempts = 0;
+			buildDag(&fs, next, fc);
+			send.push_back(next);
+			next++;
+		}
+
+		if (sendRequests(&fs, send, now) < 0) {
+			err = errno;
+			break;
+		}
+
+		if (fs.outstanding.empty())
+			break;
+
+		// one wait covers every outstanding chunk, it returns as soon as
+		// any of them finishes or the oldest one is due to time out
+		status.resize(fs.outstanding.size());
+		polled.clear();
+		long due = fs.rto;
+		unsigned i = 0;
+		for (std::map<unsigned, FetchChunk>::iterator it = fs.outstanding.begin(); it != fs.outstanding.end(); it++, i++) {
+			status[i].cid = (char *)it->second.dag.c_str();
+			status[i].cidLen = it->second.dag.size();
+			status[i].status = 0;
+			polled.push_back(it->first);
+			due = MIN(due, it->second.sent + fs.rto - now);
+		}
+
+		if (XwaitChunks(sockfd, &status[0], status.size(), MAX(due, 1)) < 0) {
+			err = errno;
+			break;
+		}
+
+		now = nowMs();
+
+		for (i = 0; i < polled.size() && !err; i++) {
+			unsigned index = polled[i];
+			FetchChunk &fc = fs.outstanding[index];
+			bool lost = false;
+			bool timeout = false;
+
+			if (status[i].status == READY_TO_READ) {
+				std::string data;
+				int rc = readChunk(&fs, index, fc, data);
+
+				if (rc < 0) {
+					err = errno;
+					break;
+				} else if (rc > 0) {
+					if (fc.attempts == 1)
+						sampleRtt(&fs, now - fc.sent);
+					grow(&fs);
+					fs.held[index].swap(data);
+					fs.outstanding.erase(index);
+					continue;
+				}
+				lost = true;
+
+			} else if (status[i].status & (INVALID_HASH | REQUEST_FAILED)) {
+				lost = true;
+
+			} else if (now - fc.sent > fs.rto) {
+				lost = true;
+				timeout = true;
+			}
+
+			if (lost) {
+				shrink(&fs, fc, now, timeout);
+				if (retry(&fs, index, fc) < 0) {
+					LOGF("Unable to fetch %s", manifest->chunks[index].cid);
+					err = ETIMEDOUT;
+					break;
+				}
+				send.push_back(index);
+			}
+		}
+
+		// hand over whatever is now in order
+		std::map<unsigned, std::string>::iterator h;
+		while (!err && (h = fs.held.find(deliver)) != fs.held.end()) {
+			if (cb(deliver, h->second.data(), h->second.size(), arg) != 0)
+				err = ECANCELED;
+			fs.held.erase(h);
+			deliver++;
+		}
+	}
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return deliver;
+}
+
+static int writeChunk(unsigned /* index */, const char *data, unsigned len, void *arg)
+{
+	return fwrite(data, 1, len, (FILE *)arg) == len ? 0 : -1;
+}
+
+/*!
+** @brief Fetch the chunks of a manifest into a file.
+**
+** Works like XfetchChunks(), writing the chunks to fname in order.
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param manifest the chunks to fetch, and the sources to fetch them from
+** @param opts window and retry limits, NULL for the defaults
+** @param fname the file to create
+**
+** @returns the number of chunks written
+** @returns -1 on error with errno set
+**
+*/
+int XfetchFile(int sockfd, const ChunkManifest *manifest, const XfetchOptions *opts, const char *fname)
+{
+	FILE *fp;
+	int rc;
+
+	if (!fname) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!(fp = fopen(fname, "wb")))
+		return -1;
+
+	rc = XfetchChunks(sockfd, manifest, opts, writeChunk, fp);
+
+	int err = errno;
+	if (fclose(fp) != 0 && rc >= 0)
+		return -1;
+	errno = err;
+	return rc;
+}
+
+/*!
+** @brief Write a manifest out as text.
+**
+** The text starts with a "XIA-MANIFEST 1" line, followed by a
+** "source <dag>" line for each source and a "chunk <cid> <size>" line for
+** each chunk. It can be published as a chunk of its own so a client only
+** needs to be given one CID.
+**
+** @param manifest the manifest to write
+** @param buf set to the text, which should be released with free()
+** @param len set to the length of the text
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+**
+*/
+int XmanifestWrite(const ChunkManifest *manifest, char **buf, size_t *len)
+{
+	if (!manifest || !buf || !len) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	std::string s = MANIFEST_MAGIC "\n";
+	char line[CID_HASH_SIZE + 32];
+
+	for (unsigned i = 0; i < manifest->numSources; i++) {
+		s += "source ";
+		s += manifest->sources[i];
+		s += "\n";
+	}
+	for (unsigned i = 0; i < manifest->numChunks; i++) {
+		snprintf(line, sizeof(line), "chunk %s %d\n", manifest->chunks[i].cid, manifest->chunks[i].size);
+		s += line;
+	}
+
+	if (!(*buf = (char *)malloc(s.size() + 1)))
+		return -1;
+	memcpy(*buf, s.c_str(), s.size() + 1);
+	*len = s.size();
+	return 0;
+}
+
+/*!
+** @brief Parse a manifest written by XmanifestWrite().
+**
+** Lines that aren't understood are skipped so the format can grow.
+**
+** @param buf the text
+** @param len length of the text
+** @param manifest filled in with the sources and chunks, it should be
+** released with XmanifestFree()
+**
+** @returns 0 on success
+** @returns -1 with errno set to EINVAL if buf isn't a manifest
+**
+*/
+int XmanifestRead(const char *buf, size_t len, ChunkManifest *manifest)
+{
+	if (!buf || !manifest) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	std::string text(buf, len);
+	std::vector<std::string> sources;
+	std::vector<ChunkInfo> chunks;
+	size_t pos = 0;
+	bool first = true;
+
+	while (pos < text.size()) {
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string line = text.substr(pos, end - pos);
+		pos = end + 1;
+
+		if (first) {
+			if (line != MANIFEST_MAGIC) {
+				errno = EINVAL;
+				return -1;
+			}
+			first = false;
+
+		} else if (line.compare(0, 7, "source ") == 0) {
+			sources.push_back(line.substr(7));
+
+		} else if (line.compare(0, 6, "chunk ") == 0) {
+			ChunkInfo ci;
+			char cid[CID_HASH_SIZE + 1];
+			int size;
+
+			memset(&ci, 0, sizeof(ci));
+			if (sscanf(line.c_str() + 6, "%40s %d", cid, &size) != 2 ||
+					strlen(cid) != CID_HASH_SIZE || size < 0) {
+				errno = EINVAL;
+				return -1;
+			}
+			strcpy(ci.cid, cid);
+			ci.size = size;
+			chunks.push_back(ci);
+		}
+	}
+
+	if (first) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(manifest, 0, sizeof(ChunkManifest));
+	if (chunks.size()) {
+		if (!(manifest->chunks = (ChunkInfo *)malloc(chunks.size() * sizeof(ChunkInfo))))
+			return -1;
+		memcpy(manifest->chunks, &chunks[0], chunks.size() * sizeof(ChunkInfo));
+		manifest->numChunks = chunks.size();
+	}
+	if (sources.size()) {
+		if (!(manifest->sources = (char **)calloc(sources.size(), sizeof(char *)))) {
+			XmanifestFree(manifest);
+			return -1;
+		}
+		manifest->numSources = sources.size();
+		for (unsigned i = 0; i < sources.size(); i++) {
+			if (!(manifest->sources[i] = strdup(sources[i].c_str()))) {
+				XmanifestFree(manifest);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*!
+** @brief Release a manifest filled in by XmanifestRead().
+**
+** @param manifest the manifest to release
+**
+*/
+void XmanifestFree(ChunkManifest *manifest)
+{
+	if (!manifest)
+		return;
+
+	for (unsigned i = 0; i < manifest->numSources; i++)
+		free(manifest->sources[i]);
+	free(manifest->sources);
+	free(manifest->chunks);
+	memset(manifest, 0, sizeof(ChunkManifest));
+}
@@ -15,7 +15,7 @@
 */
 /*!
 ** @file XgetChunkStatus.c
-** @brief implements XgetChunkStatus() and XgetChunkStatuses()
+** @brief implements XgetChunkStatus(), XgetChunkStatuses() and XwaitChunks()
 */
 
 #include <errno.h>
@@ -23,6 +23,7 @@
 #include "Xinit.h"
 #include "Xutil.h"
 
+static int getStatuses(int sockfd, ChunkStatus *statusList, int numCIDs, bool wait, unsigned timeout);
 
 /*!
 ** @brief Checks the status of the specified CID.
@@ -82,6 +83,46 @@ int XgetChunkStatus(int sockfd, char* dag, size_t /* dagLen */)
 ** @returns -1  if a socket error occurs. In that case errno is set with the appropriate code.
 */
 int XgetChunkStatuses(int sockfd, ChunkStatus *statusList, int numCIDs)
+{
+	return getStatuses(sockfd, statusList, numCIDs, false, 0);
+}
+
+/*!
+** @brief Waits for any of the requested CIDs to finish.
+**
+** XwaitChunks blocks until at least one of the chunks in statusList is no
+** longer in transit and then fills in the status of every chunk, the same as
+** XgetChunkStatuses(). Click answers as soon as it has processed the chunk,
+** so there is no need to sleep and poll for it. Chunks that finished before
+** the call are reported right away.
+**
+** A chunk socket also becomes readable in Xpoll() and Xepoll() when one of
+** its requested chunks finishes, until the chunk has been looked at with
+** XgetChunkStatuses(), XwaitChunks() or XreadChunk().
+**
+** @note non-blocking sockets don't wait, the call behaves like
+** XgetChunkStatuses().
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param statusList list of CIDs to wait on. On return, also contains the
+** status for each of the specified CIDs.
+** @param numCIDs number of CIDs in statusList
+** @param timeout number of milliseconds to wait, -1 waits until a chunk
+** finishes
+**
+** @returns the same bitfield as XgetChunkStatuses(). If every chunk is still
+** WAITING_FOR_CHUNK the timeout expired.
+** @returns -1 if a socket error occurs. In that case errno is set with the appropriate code.
+*/
+int XwaitChunks(int sockfd, ChunkStatus *statusList, int numCIDs, int timeout)
+{
+	if (timeout == 0 || !isBlocking(sockfd))
+		return getStatuses(sockfd, statusList, numCIDs, false, 0);
+
+	return getStatuses(sockfd, statusList, numCIDs, true, timeout < 0 ? 0 : timeout);
+}
+
+static int getStatuses(int sockfd, ChunkStatus *statusList, int numCIDs, bool wait, unsigned timeout)
 {
 	int rc;
 
@@ -125,6 +166,11 @@ int XgetChunkStatuses(int sockfd, ChunkStatus *statusList, int numCIDs)
 
 	x_getchunkstatus_msg->set_payload((const char*)buf, strlen(buf) + 1);
 
+	if (wait) {
+		x_getchunkstatus_msg->set_wait(true);
+		x_getchunkstatus_msg->set_timeout(timeout);
+	}
+
 	std::string p_buf;
 	xsm.SerializeToString(&p_buf);
 
@@ -16,11 +16,16 @@
 */
 /*!
  @file XgetDAGbyName.c
- @brief Implements XgetDAGbyName(), XregisterName(), Xgetpeername() and Xgetsockname()
+ @brief Implements XgetDAGbyName(), XgetNamebyDAG(), XregisterName(), XflushNameCache(), Xgetpeername() and Xgetsockname()
 */
 #include <errno.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
 #include "Xsocket.h"
 #include "Xinit.h"
 #include "Xutil.h"
@@ -29,9 +34,98 @@
 
 #define ETC_HOSTS "/etc/hosts.xia"
 
+// how long (in seconds) the resolver remembers nameserver answers
+#define RESOLVER_TTL		60
+#define RESOLVER_NEG_TTL	5
+#define RESOLVER_MAX_ENTRIES	512
+
+typedef struct {
+	int found;			// 0 if the nameserver said the name/dag doesn't exist
+	sockaddr_x addr;	// forward lookups
+	std::string name;	// reverse lookups
+	time_t expires;
+} ResolverEntry;
+
+typedef std::map<std::string, ResolverEntry> ResolverCache;
+
+static ResolverCache name_cache;	// name -> dag
+static ResolverCache dag_cache;		// dag string -> name
+
+// contents of hosts.xia, reloaded whenever the file changes
+static std::map<std::string, std::string> hosts_table;
+static time_t hosts_mtime;
+static ino_t hosts_ino;
+static off_t hosts_size;
+static int hosts_loaded = 0;
+
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static time_t resolverNow()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/*
+** (re)load the hosts.xia file if it has changed since we last read it
+** must be called with resolver_lock held
+*/
+static void hostsLoad()
+{
+	char line[512];
+	char *linend;
+	char buf[BUF_SIZE];
+	struct stat st;
+
+	const char *path = strcat(XrootDir(buf, BUF_SIZE), ETC_HOSTS);
+
+	if (stat(path, &st) < 0) {
+		hosts_table.clear();
+		hosts_loaded = 0;
+		return;
+	}
+
+	if (hosts_loaded && st.st_mtime == hosts_mtime && st.st_ino == hosts_ino && st.st_size == hosts_size)
+		return;
+
+	hosts_table.clear();
+	hosts_loaded = 0;
+
+	FILE *hostsfp = fopen(path, "r");
+	if (hostsfp == NULL)
+		return;
+
+	while (fgets(line, 511, hostsfp) != NULL) {
+		linend = line+strlen(line)-1;
+		while (linend >= line && (*linend == '\r' || *linend == '\n' || *linend == '\0')) {
+			linend--;
+		}
+		*(linend+1) = '\0';
+
+		char *sep = strchr(line, ' ');
+		if (line[0] == '#' || sep == NULL || sep == line) {
+			continue;
+		}
+
+		// later entries override earlier ones
+		std::string name(line, sep - line);
+		hosts_table[name] = std::string(sep + 1).substr(0, NS_MAX_DAG_LENGTH - 1);
+	}
+	fclose(hostsfp);
+
+	hosts_mtime = st.st_mtime;
+	hosts_ino = st.st_ino;
+	hosts_size = st.st_size;
+	hosts_loaded = 1;
+}
+
 /*!
 ** @brief Lookup a DAG in the hosts.xia file
 **
+** The file is only reread when its modification time, inode or size changes.
+**
 ** @param name The name of an XIA service or host.
 **
 ** @returns a character point to the dag on success
@@ -39,43 +133,151 @@
 **
 */
 char *hostsLookup(const char *name) {
-	char line[512];
-	char *linend;
-	char *dag;
-	char _dag[NS_MAX_DAG_LENGTH];
+	char *dag = NULL;
 
-	// look for an hosts_xia file locally
-	char buf[BUF_SIZE];
-	FILE *hostsfp = fopen(strcat(XrootDir(buf, BUF_SIZE), ETC_HOSTS), "r");
-	int answer_found = 0;
-	if (hostsfp != NULL) {
-		while (fgets(line, 511, hostsfp) != NULL) {
-			linend = line+strlen(line)-1;
-			while (*linend == '\r' || *linend == '\n' || *linend == '\0') {
-				linend--;
-			}
-			*(linend+1) = '\0';
-			if (line[0] == '#') {
-				continue;
-			} else if (!strncmp(line, name, strlen(name))
-						&& line[strlen(name)] == ' ') {
-				strncpy(_dag, line+strlen(name)+1, strlen(line)-strlen(name)-1);
-				_dag[strlen(line)-strlen(name)-1] = '\0';
-				answer_found = 1;
-			}
+	pthread_mutex_lock(&resolver_lock);
+	hostsLoad();
+
+	std::map<std::string, std::string>::iterator it = hosts_table.find(name);
+	if (it != hosts_table.end()) {
+		dag = strdup(it->second.c_str());
+	}
+	pthread_mutex_unlock(&resolver_lock);
+
+	return dag;
+}
+
+/*
+** look for an unexpired entry in one of the resolver caches
+** returns 1 with a copy of the entry in e on a hit, or 0 on a miss
+*/
+static int resolverFind(ResolverCache &cache, const std::string &key, ResolverEntry &e)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&resolver_lock);
+	ResolverCache::iterator it = cache.find(key);
+	if (it != cache.end()) {
+		if (it->second.expires > resolverNow()) {
+			e = it->second;
+			rc = 1;
+		} else {
+			cache.erase(it);
 		}
-		fclose(hostsfp);
-		if (answer_found) {
-			dag = (char*)malloc(sizeof(_dag) + 1);
-			strcpy(dag, _dag);
-			return dag;
+	}
+	pthread_mutex_unlock(&resolver_lock);
+
+	return rc;
+}
+
+// save a nameserver answer, found == 0 records a negative response
+static void resolverStore(ResolverCache &cache, const std::string &key, ResolverEntry &e)
+{
+	time_t now = resolverNow();
+
+	e.expires = now + (e.found ? RESOLVER_TTL : RESOLVER_NEG_TTL);
+
+	pthread_mutex_lock(&resolver_lock);
+	if (cache.size() >= RESOLVER_MAX_ENTRIES && cache.find(key) == cache.end()) {
+		ResolverCache::iterator it = cache.begin();
+		while (it != cache.end()) {
+			if (it->second.expires <= now)
+				cache.erase(it++);
+			else
+				it++;
+		}
+
+		// still full, make room
+		if (cache.size() >= RESOLVER_MAX_ENTRIES)
+			cache.erase(cache.begin());
+	}
+	cache[key] = e;
+	pthread_mutex_unlock(&resolver_lock);
+}
+
+/*!
+** @brief Discard cached name lookups
+**
+** XgetDAGbyName() and XgetNamebyDAG() remember nameserver answers for a short
+** time, including names that were not found. This clears the cache and forces
+** hosts.xia to be reread on the next lookup. Names registered by this process
+** with XregisterName() are removed from the cache automatically.
+**
+** @returns void
+*/
+void XflushNameCache()
+{
+	pthread_mutex_lock(&resolver_lock);
+	name_cache.clear();
+	dag_cache.clear();
+	hosts_loaded = 0;
+	pthread_mutex_unlock(&resolver_lock);
+}
+
+/*
+** try to resolve name without asking the nameserver
+** returns 1 if name is in hosts.xia, is a dag string, or is cached,
+** -1 if it is known not to exist, and 0 if the nameserver must be asked
+*/
+int resolverLookup(const char *name, sockaddr_x *addr)
+{
+	ResolverEntry entry;
+	char *dag;
+
+	// see if name is registered in the local hosts.xia file
+	if((dag = hostsLookup(name))) {
+		Graph g(dag);
+		free(dag);
+
+		// check to see if the returned dag was valid
+		// we may want a better check for this in the future
+		if (g.num_nodes() > 0) {
+			g.fill_sockaddr((sockaddr_x*)addr);
+			return 1;
 		}
-	} else {
-		//printf("XIAResolver file error\n");
 	}
 
-	//printf("Name not found in ./hosts_xia\n");
-	return NULL;
+	if (!strncmp(name, "RE ", 3) || !strncmp(name, "DAG ", 4)) {
+
+        // check to see if name is actually a dag to begin with
+        Graph gcheck(name);
+
+        // check to see if the returned dag was valid
+        // we may want a better check for this in the future
+        if (gcheck.num_nodes() > 0) {
+            gcheck.fill_sockaddr((sockaddr_x*)addr);
+            return 1;
+        }
+    }
+
+	// see if we've asked the name server recently
+	if (!resolverFind(name_cache, name, entry))
+		return 0;
+	if (!entry.found)
+		return -1;
+
+	memcpy(addr, &entry.addr, sizeof(sockaddr_x));
+	return 1;
+}
+
+// remember a nameserver answer for name, addr is NULL if it wasn't found
+void resolverSave(const char *name, const sockaddr_x *addr)
+{
+	ResolverEntry entry;
+
+	entry.found = (addr != NULL);
+	if (addr)
+		memcpy(&entry.addr, addr, sizeof(sockaddr_x));
+	resolverStore(name_cache, name, entry);
+}
+
+// drop cached answers for a name and dag that were just (re)registered
+void resolverForget(const char *name, const char *dag)
+{
+	pthread_mutex_lock(&resolver_lock);
+	name_cache.erase(name);
+	dag_cache.erase(dag);
+	pthread_mutex_unlock(&resolver_lock);
 }
 
 // User passes a buffer and we fill it in
@@ -133,6 +335,19 @@ int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *ad
     }
 	*/
 
+	std::string dag_string = gph.dag_string();
+	ResolverEntry entry;
+
+	if (resolverFind(dag_cache, dag_string, entry)) {
+		if (!entry.found) {
+			LOG("Negative reverse query response cached");
+			return -1;
+		}
+		bzero(name, namelen);
+		strncpy(name, entry.name.c_str(), namelen-1);
+		return 0;
+	}
+
 	// Prepare to talk to the nameserver
 	if ((sock = Xsocket(AF_XIA, SOCK_DGRAM, 0)) < 0)
 		return -1;
@@ -145,8 +360,7 @@ int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *ad
 	}
 
 	//Construct a name-query packet
-	Graph g(addr);
-	char *addrstr = strdup(g.dag_string().c_str());
+	char *addrstr = strdup(dag_string.c_str());
 	if(addrstr == NULL) {
 		LOG("Unable to allocate memory to store DAG");
 		errno = NO_RECOVERY;
@@ -202,9 +416,17 @@ int XgetNamebyDAG(char *name, int namelen, const sockaddr_x *addr, socklen_t *ad
 	Xclose(sock);
 
 	if (result < 0) {
+		if (resp_pkt.type == NS_TYPE_RESPONSE_ERROR) {
+			entry.found = 0;
+			resolverStore(dag_cache, dag_string, entry);
+		}
 		return result;
 	}
 
+	entry.found = 1;
+	entry.name = resp_pkt.name;
+	resolverStore(dag_cache, dag_string, entry);
+
 	bzero(name, namelen);
 	strncpy(name, resp_pkt.name, namelen-1);
 	return 0;
@@ -236,7 +458,6 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 	int result;
 	sockaddr_x ns_dag;
 	char pkt[NS_MAX_PACKET_SIZE];
-	char *dag;
 
 	if (!name || *name == 0) {
 		errno = EINVAL;
@@ -248,36 +469,15 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 		return -1;
 	}
 
-	// see if name is registered in the local hosts.xia file
-	if((dag = hostsLookup(name))) {
-		Graph g(dag);
-		free(dag);
-
-		// check to see if the returned dag was valid
-		// we may want a better check for this in the future
-		if (g.num_nodes() > 0) {
-			std::string s = g.dag_string();
-			g.fill_sockaddr((sockaddr_x*)addr);
+	// see if we can answer from hosts.xia, the name itself, or the resolver cache
+	switch (resolverLookup(name, addr)) {
+		case 1:
 			*addrlen = sizeof(sockaddr_x);
 			return 0;
-		}
+		case -1:
+			return -1;
 	}
 
-	if (!strncmp(name, "RE ", 3) || !strncmp(name, "DAG ", 4)) {
-
-        // check to see if name is actually a dag to begin with
-        Graph gcheck(name);
-
-        // check to see if the returned dag was valid
-        // we may want a better check for this in the future
-        if (gcheck.num_nodes() > 0) {
-            std::string s = gcheck.dag_string();
-            gcheck.fill_sockaddr((sockaddr_x*)addr);
-            *addrlen = sizeof(sockaddr_x);
-            return 0;
-        }
-    }
-
 	// not found locally, check the name server
 	if ((sock = Xsocket(AF_XIA, SOCK_DGRAM, 0)) < 0)
 		return -1;
@@ -334,12 +534,17 @@ int XgetDAGbyName(const char *name, sockaddr_x *addr, socklen_t *addrlen)
 	Xclose(sock);
 
 	if (result < 0) {
+		if (resp_pkt.type == NS_TYPE_RESPONSE_ERROR) {
+			resolverSave(name, NULL);
+		}
 		return result;
 	}
 
 	Graph g(resp_pkt.dag);
 	g.fill_sockaddr(addr);
 	*addrlen = sizeof(sockaddr_x);
+
+	resolverSave(name, addr);
 	return 0;
 }
 
@@ -481,6 +686,9 @@ int _xregister(const char *name, sockaddr_x *DAG, short flags) {
 	switch (resp_pkt.type) {
 	case NS_TYPE_RESPONSE_REGISTER:
 		result = 0;
+
+		// don't hand out a stale or negative answer for the new binding
+		resolverForget(name, dag_string.c_str());
 		break;
 	case NS_TYPE_RESPONSE_ERROR:
 		result = -1;
@@ -683,100 +891,173 @@ int Xgetsockname(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 	return 0;
 }
 
-int make_ns_packet(ns_pkt *np, char *pkt, int pkt_sz)
+// find the strings that follow the type and flags bytes for each packet type
+// returns the number of strings
+static int ns_fields(ns_pkt *np, const char **f[2])
 {
-	char *end = pkt;
-
-	// this had better not happen
-	if (!np || !pkt || pkt_sz == 0)
-		return 0;
-
-	memset(pkt, 0, pkt_sz);
-	pkt[0] = np->type;
-	pkt[1] = np->flags;
-	end += 2;
-
 	switch (np->type) {
 		case NS_TYPE_REGISTER:
-			if (np->name == NULL || np->dag == NULL)
-				return 0;
-			strcpy(end, np->name);
-			end += strlen(np->name) + 1;
-
-			strcpy(end, np->dag);
-			end += strlen(np->dag) + 1;
-			break;
+			f[0] = &np->name;
+			f[1] = &np->dag;
+			return 2;
 
 		case NS_TYPE_QUERY:
-			if (np->name == NULL)
-				return 0;
-			strcpy(end, np->name);
-			end += strlen(np->name) + 1;
-			break;
+		case NS_TYPE_RESPONSE_RQUERY:
+			f[0] = &np->name;
+			return 1;
 
+		case NS_TYPE_RQUERY:
 		case NS_TYPE_RESPONSE_QUERY:
-			if (np->dag == NULL)
-				return 0;
-			strcpy(end, np->dag);
-			end += strlen(np->dag) + 1;
-			break;
+			f[0] = &np->dag;
+			return 1;
 
-		case NS_TYPE_RQUERY:
-			if (np->dag == NULL)
-				return 0;
-			strcpy(end, np->dag);
-			end += strlen(np->dag) + 1;
-			break;
+		default:
+			return 0;
+	}
+}
 
-		case NS_TYPE_RESPONSE_RQUERY:
-			if (np->name == NULL)
-				return 0;
-			strcpy(end, np->name);
-			end += strlen(np->name) + 1;
-			break;
+/*
+** encode a single ns packet or batch record into pkt
+** returns the number of bytes used, or 0 if a required field is missing or
+** the record doesn't fit
+*/
+static int ns_encode(ns_pkt *np, char *pkt, int pkt_sz)
+{
+	const char **f[2];
+	int n = ns_fields(np, f);
+	int len = 2;
 
-		default:
-			break;
+	for (int i = 0; i < n; i++) {
+		if (*f[i] == NULL)
+			return 0;
+		len += strlen(*f[i]) + 1;
+	}
+
+	if (len > pkt_sz)
+		return 0;
+
+	char *end = pkt;
+	*end++ = np->type;
+	*end++ = np->flags;
+
+	for (int i = 0; i < n; i++) {
+		strcpy(end, *f[i]);
+		end += strlen(*f[i]) + 1;
 	}
 
 	return end - pkt;
 }
 
+/*
+** decode a single ns packet or batch record
+** the returned strings point into pkt
+** returns the number of bytes consumed, or -1 if the record is malformed
+*/
+static int ns_decode(char *pkt, int sz, ns_pkt *np)
+{
+	const char **f[2];
+	char *p = pkt + 2;
+
+	if (sz < 2)
+		return -1;
+
+	np->type  = pkt[0];
+	np->flags = pkt[1];
+	np->name  = np->dag = NULL;
+
+	int n = ns_fields(np, f);
+
+	for (int i = 0; i < n; i++) {
+		char *nul = (char *)memchr(p, 0, pkt + sz - p);
+		if (nul == NULL)
+			return -1;
+		*f[i] = p;
+		p = nul + 1;
+	}
+
+	return p - pkt;
+}
+
+int make_ns_packet(ns_pkt *np, char *pkt, int pkt_sz)
+{
+	// this had better not happen
+	if (!np || !pkt || pkt_sz == 0)
+		return 0;
+
+	memset(pkt, 0, pkt_sz);
+	return ns_encode(np, pkt, pkt_sz);
+}
+
 void get_ns_packet(char *pkt, int sz, ns_pkt *np)
 {
-	if (sz < 2) {
+	if (ns_decode(pkt, sz, np) < 0) {
 		// hacky error check
 		np->type = NS_TYPE_RESPONSE_ERROR;
-		return;
+		np->name = np->dag = NULL;
 	}
+}
 
-	np->type  = pkt[0];
-	np->flags = pkt[1];
-	np->name  = np->dag = NULL;
+/*
+** start a new batch packet of type NS_TYPE_BATCH or NS_TYPE_RESPONSE_BATCH
+** returns the length of the (empty) batch
+*/
+int make_ns_batch(char type, unsigned short id, char *pkt, int pkt_sz)
+{
+	if (!pkt || pkt_sz < NS_BATCH_HEADER_SIZE)
+		return 0;
 
-	switch (np->type) {
-		case NS_TYPE_QUERY:
-			np->name = &pkt[2];
-			break;
+	pkt[0] = type;
+	pkt[1] = 0;
+	pkt[2] = id >> 8;
+	pkt[3] = id & 0xff;
+	pkt[4] = pkt[5] = 0;
+	return NS_BATCH_HEADER_SIZE;
+}
 
-		case NS_TYPE_RQUERY:
-			np->dag = &pkt[2];
-			break;
+/*
+** append a record to a batch started with make_ns_batch
+** len is the current length of the batch
+** returns the new length, or 0 if the record doesn't fit
+*/
+int add_ns_batch(ns_pkt *np, char *pkt, int len, int pkt_sz)
+{
+	unsigned count = ((unsigned char)pkt[4] << 8) | (unsigned char)pkt[5];
 
-		case NS_TYPE_REGISTER:
-			np->name = &pkt[2];
-			np->dag = np->name + strlen(np->name) + 1;
-			break;
+	if (count >= NS_MAX_BATCH_RECORDS)
+		return 0;
 
-		case NS_TYPE_RESPONSE_QUERY:
-			np->dag = &pkt[2];
-			break;
+	int rc = ns_encode(np, pkt + len, pkt_sz - len);
+	if (rc == 0)
+		return 0;
 
-		case NS_TYPE_RESPONSE_RQUERY:
-			np->name = &pkt[2];
-			break;
+	count++;
+	pkt[4] = count >> 8;
+	pkt[5] = count & 0xff;
+	return len + rc;
+}
 
-		default:
-			break;
+/*
+** unpack up to max records from a batch packet
+** the returned strings point into pkt
+** returns the number of records, or -1 if the packet is not a valid batch
+*/
+int get_ns_batch(char *pkt, int sz, unsigned short *id, ns_pkt *records, int max)
+{
+	if (sz < NS_BATCH_HEADER_SIZE ||
+			(pkt[0] != NS_TYPE_BATCH && pkt[0] != NS_TYPE_RESPONSE_BATCH))
+		return -1;
+
+	*id = ((unsigned char)pkt[2] << 8) | (unsigned char)pkt[3];
+	int count = ((unsigned char)pkt[4] << 8) | (unsigned char)pkt[5];
+
+	char *p = pkt + NS_BATCH_HEADER_SIZE;
+	int i;
+	for (i = 0; i < count && i < max; i++) {
+		int rc = ns_decode(p, pkt + sz - p, &records[i]);
+		if (rc < 0)
+			return -1;
+		p += rc;
 	}
+
+	return i;
 }
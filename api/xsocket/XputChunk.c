@@ -15,15 +15,30 @@
 */
 /*!
 ** @file XputChunk.c
-** @brief implements XputChunk(), XputFile(), XputBuffer(), XremoveChunk(),
-** XallocCacheSlice(),XfreeCacheSlice(), and XfreeChunkInfo()
+** @brief implements XputChunk(), XputChunkBegin(), XputChunkAppend(),
+** XputChunkCommit(), XputChunkAbort(), XputFile(), XputBuffer(),
+** XputFileAsync(), XputBufferAsync(), XputFileCDC(), XputBufferCDC(),
+** XremoveChunk(), XallocCacheSlice(), XfreeCacheSlice(), XsetChunkSize(),
+** and XfreeChunkInfo()
 */
 
 #include "Xsocket.h"
 #include "Xinit.h"
 #include "Xutil.h"
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+
+#define PUT_WINDOW			8	// put messages in flight before we wait for a reply
+#define PUT_BATCH_CHUNKS	64	// chunks packed into one put message
+
+#define CDC_WINDOW		32	// bytes that affect a 32 bit gear hash
+#define CDC_NORMAL		2	// mask bits added before the average size, taken away after
 
 /*!
 ** @brief Allocate content cache space for use by the XputChunk(),
@@ -32,11 +47,16 @@
 ** Allocate a slice of content cache storage in the local machine to
 ** store content we make available. Multiple cache slices may be allocated
 ** by a single application for different purposes. Once the cache slice is
-** full, old content will be purged on a FIFO basis to make room for new
-** content chunks.`
+** full, content will be purged according to the slice's replacement policy
+** to make room for new content chunks.
 **
-** @param policy Policy to use for the local cache (not currently used, the
-** always uses a FIFO policy at this time).
+** @param policy Policy to use for the local cache. One of POLICY_LRU,
+** POLICY_FIFO, POLICY_CLOCK or POLICY_S3FIFO, optionally combined with
+** POLICY_REMOVE_ON_EXIT or POLICY_RETAIN_ON_EXIT. Adding POLICY_MERKLE
+** publishes chunks under the root of a Merkle tree over the chunk rather
+** than its plain hash, so routers and receivers can check each fragment of
+** a large chunk as it arrives and drop bad ones. Chunks of 512 bytes or
+** less keep their plain hash.
 ** @param ttl Time to live in seconds; 0 means permanent. Once the TTL is
 ** elapsed content will be automatically flushed from the cache. Content may
 ** be flushed before th TTL expires if the cache becomes full.
@@ -68,6 +88,7 @@ ChunkContext *XallocCacheSlice(unsigned policy, unsigned ttl, unsigned size) {
         newCtx->cachePolicy = policy;
         newCtx->cacheSize = size;
 		newCtx->ttl = ttl;
+		newCtx->chunkSize = 0;
         newCtx->sockfd = sockfd;
 //        LOGF("New CTX: sock,policy,size=%d,%d,%d\n", sockfd, policy, size);
         return newCtx;
@@ -99,6 +120,30 @@ int XfreeCacheSlice(ChunkContext *ctx)
 	return rc;
 }
 
+/*!
+** @brief Set the chunk size used when publishing to a cache slice.
+**
+** XputFile(), XputBuffer(), XputFileAsync() and XputBufferAsync() cut their
+** data into chunks of this size when they are called with a chunkSize of 0.
+**
+** @param ctx the cache slice
+** @param chunkSize size of each chunk, 0 returns to DEFAULT_CHUNK_SIZE.
+** Larger values are cut down to XIA_MAXCHUNKSIZE.
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+*/
+int XsetChunkSize(ChunkContext *ctx, unsigned chunkSize)
+{
+	if (!ctx) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	ctx->chunkSize = MIN(chunkSize, XIA_MAXCHUNKSIZE);
+	return 0;
+}
+
 /*!
 ** @brief Publish a single chunk of content.
 **
@@ -112,8 +157,9 @@ int XfreeCacheSlice(ChunkContext *ctx)
 ** chunk(s) will be reoved to make enough space for this chunk.
 **
 ** @param ctx Pointer to the cache slice where this chunk will be stored
-** @param data The data to published. The size of data must be less than
-** XIA_MAXCHUNK or an error will be returned.
+** @param data The data to published. Chunks larger than XIA_MAXCHUNK are
+** streamed to click with XputChunkBegin() and friends, and must not be larger
+** than XIA_MAXCHUNKSIZE or an error will be returned.
 ** @param length Length of the data buffer
 ** @param info Struct to hold metadata returned, include the chunk identifier (CID)
 **
@@ -125,7 +171,7 @@ int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkI
 {
     int rc;
 
-	if (length > XIA_MAXCHUNK) {
+	if (length > XIA_MAXCHUNKSIZE) {
 		errno = EMSGSIZE;
 		LOGF("Chunk size of %d is too large\n", length);
 		return -1;
@@ -140,6 +186,20 @@ int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkI
 	if (length == 0)
 		return 0;
 
+	if (length > XIA_MAXCHUNK) {
+		ChunkStream cs;
+
+		if (XputChunkBegin(ctx, &cs) < 0)
+			return -1;
+		if (XputChunkAppend(&cs, data, length) < 0) {
+			int err = errno;
+			XputChunkAbort(&cs);
+			errno = err;
+			return -1;
+		}
+		return XputChunkCommit(&cs, info);
+	}
+
     //Build request
     xia::XSocketMsg xsm;
     xsm.set_type(xia::XPUTCHUNK);
@@ -180,111 +240,592 @@ int XputChunk(const ChunkContext *ctx, const char *data, unsigned length, ChunkI
     }
 }
 
+/*
+** send one step of a put stream to click and wait for the reply
+*/
+static int putStreamOp(ChunkStream *cs, xia::X_Putchunk_Msg::StreamOp op,
+		const char *data, unsigned length, xia::XSocketMsg *reply)
+{
+	const ChunkContext *ctx = cs->ctx;
+	int rc;
+
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XPUTCHUNK);
+	unsigned seq = seqNo(ctx->sockfd);
+	xsm.set_sequence(seq);
+
+	xia::X_Putchunk_Msg *_msg = xsm.mutable_x_putchunk();
+
+	_msg->set_contextid(ctx->contextID);
+	_msg->set_payload(data, length);
+	_msg->set_ttl(ctx->ttl);
+	_msg->set_cachesize(ctx->cacheSize);
+	_msg->set_cachepolicy(ctx->cachePolicy);
+	_msg->set_op(op);
+	_msg->set_stream(cs->stream);
+
+	if ((rc = click_send(ctx->sockfd, &xsm)) < 0) {
+		LOGF("Error talking to Click: %s", strerror(errno));
+		return -1;
+	}
+
+	if ((rc = click_reply(ctx->sockfd, seq, reply)) < 0) {
+		LOGF("Error getting status from Click: %s", strerror(errno));
+		return -1;
+	}
+
+	if (reply->type() != xia::XPUTCHUNK) {
+		errno = EPROTO;
+		return -1;
+	}
+	return 0;
+}
+
 /*!
-** @brief Publish a file by breaking it into one or more content chunks.
+** @brief Start building a chunk that is too large to hand to XputChunk()
+** in one piece.
 **
-** XputFile() calls XputChunk() internally and has the same requiremts as that
-** function.
+** The chunk is built up in click by XputChunkAppend() and published by
+** XputChunkCommit(), which returns the CID in the same form as XputChunk().
+** Chunks may be up to XIA_MAXCHUNKSIZE bytes. A stream that won't be
+** committed should be released with XputChunkAbort(); closing the cache
+** slice releases any streams left open on it.
 **
-** On success, the CID of the chunk is set to the 40 character hash of the
-** content data. The CID is not a full DAG, and must be converted to a DAG
-** before the client applicatation can request it, otherwise an error will
-** occur.
+** @param ctx Pointer to the cache slice where the chunk will be stored
+** @param cs The stream to initialize
 **
-** If the file causes the cache slice to grow too large, the oldest content
-** chunk(s) will be reoved to make enough space for the new chunk(s).
+** @returns 0 on success
+** @returns -1 on error with errno set
 **
-** @param ctx Pointer to the cache slice where this chunk will be stored
-** @param fname The file to publish.
-** @param chunkSize The maximum requested size of each chunk. This value
-** must not be larger than XIA_MAXCHUNK or an error will be returned.
-** @param info a pointer to an array of ChunkInfo structures. The memory for
-** this array is allocated by the XputFile() function on success and should
-** be free'd with the XfreeChunkInfo() function when it is no longer needed.
+*/
+int XputChunkBegin(const ChunkContext *ctx, ChunkStream *cs)
+{
+	if (ctx == NULL || cs == NULL) {
+		errno = EFAULT;
+		LOG("NULL pointer");
+		return -1;
+	}
+
+	cs->ctx = ctx;
+	cs->stream = 0;
+	cs->length = 0;
+
+	xia::XSocketMsg reply;
+	if (putStreamOp(cs, xia::X_Putchunk_Msg::BEGIN, NULL, 0, &reply) < 0)
+		return -1;
+
+	xia::X_Putchunk_Msg *_msgReply = reply.mutable_x_putchunk();
+	if (!_msgReply->has_stream()) {
+		errno = EMFILE;
+		LOG("Click has no room for another chunk stream");
+		return -1;
+	}
+	cs->stream = _msgReply->stream();
+	return 0;
+}
+
+/*!
+** @brief Add data to the end of a chunk started with XputChunkBegin().
 **
-** @returns The number of chunks created on success with info pointing to an
-** allocated array of ChunkInfo structures.
-** @returns -1 on error
+** The data is sent to click in pieces of at most XIA_MAXCHUNK bytes.
 **
-**/
-int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo **info)
+** @param cs The stream
+** @param data The data to add
+** @param length Length of the data
+**
+** @returns 0 on success
+** @returns -1 on error with errno set, EMSGSIZE if the chunk would grow
+** past XIA_MAXCHUNKSIZE
+**
+*/
+int XputChunkAppend(ChunkStream *cs, const char *data, unsigned length)
 {
-	FILE *fp;
-	struct stat fs;
-	ChunkInfo *infoList;
-	unsigned numChunks;
-	unsigned i;
-	int rc;
-	int count;
-	char *buf;
-
-	if (ctx == NULL) {
+	if (cs == NULL || cs->ctx == NULL || (data == NULL && length)) {
 		errno = EFAULT;
+		LOG("NULL pointer");
 		return -1;
 	}
 
-	if (fname == NULL) {
+	if (length > XIA_MAXCHUNKSIZE - cs->length) {
+		errno = EMSGSIZE;
+		LOGF("Chunk size of %u is too large\n", cs->length + length);
+		return -1;
+	}
+
+	while (length) {
+		unsigned count = MIN(length, XIA_MAXCHUNK);
+		xia::XSocketMsg reply;
+
+		if (putStreamOp(cs, xia::X_Putchunk_Msg::APPEND, data, count, &reply) < 0)
+			return -1;
+		if (!reply.x_putchunk().has_length()) {
+			errno = EBADF;
+			LOG("Unknown chunk stream");
+			return -1;
+		}
+
+		cs->length = reply.x_putchunk().length();
+		data += count;
+		length -= count;
+	}
+	return 0;
+}
+
+/*!
+** @brief Publish a chunk built with XputChunkAppend().
+**
+** @param cs The stream, it can't be used again after this
+** @param info Struct to hold metadata returned, include the chunk identifier (CID)
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+**
+*/
+int XputChunkCommit(ChunkStream *cs, ChunkInfo *info)
+{
+	if (cs == NULL || cs->ctx == NULL || info == NULL) {
 		errno = EFAULT;
+		LOG("NULL pointer");
 		return -1;
 	}
 
-	if (chunkSize == 0)
-		chunkSize =  DEFAULT_CHUNK_SIZE;
-	else if (chunkSize > XIA_MAXBUF)
-		chunkSize = XIA_MAXBUF;
+	xia::XSocketMsg reply;
+	if (putStreamOp(cs, xia::X_Putchunk_Msg::COMMIT, NULL, 0, &reply) < 0)
+		return -1;
 
-	if (stat(fname, &fs) != 0)
+	xia::X_Putchunk_Msg *_msgReply = reply.mutable_x_putchunk();
+	if (!_msgReply->has_cid()) {
+		errno = EBADF;
+		LOG("Unknown chunk stream");
 		return -1;
+	}
+
+	info->size = _msgReply->length();
+	strcpy(info->cid, _msgReply->cid().c_str());
+	info->ttl = _msgReply->ttl();
+	info->timestamp.tv_sec = _msgReply->timestamp();
+	info->timestamp.tv_usec = 0;
+	cs->stream = 0;
+	LOGF(">>>>>> PUT: info->cid: %s \n", _msgReply->cid().c_str());
+	return 0;
+}
 
-	if (!(fp= fopen(fname, "rb")))
+/*!
+** @brief Throw away a chunk started with XputChunkBegin().
+**
+** @param cs The stream
+**
+** @returns 0 on success
+** @returns -1 on error with errno set
+**
+*/
+int XputChunkAbort(ChunkStream *cs)
+{
+	if (cs == NULL || cs->ctx == NULL) {
+		errno = EFAULT;
 		return -1;
+	}
+
+	xia::XSocketMsg reply;
+	int rc = putStreamOp(cs, xia::X_Putchunk_Msg::ABORT, NULL, 0, &reply);
+	cs->stream = 0;
+	cs->length = 0;
+	return rc;
+}
+
+/*
+** Chunks are published through a pipeline: small chunks are packed several
+** to a message, and up to PUT_WINDOW messages are in flight before we wait
+** for the first reply. Click hashes a message's chunks together. The chunks
+** are given by the offset each one ends at.
+*/
+typedef std::vector<size_t> PutCuts;
+
+typedef struct {
+	unsigned seq;
+	unsigned first;		// index of the first chunk in the message
+	unsigned count;
+} PutBatch;
+
+// fill in a chunk's info and report it
+static void putDone(ChunkInfo *info, unsigned index, unsigned size, const std::string &cid,
+		int32_t ttl, int64_t timestamp, XputCallback cb, void *arg)
+{
+	info->size = size;
+	strncpy(info->cid, cid.c_str(), CID_HASH_SIZE);
+	info->cid[CID_HASH_SIZE] = 0;
+	info->ttl = ttl;
+	info->timestamp.tv_sec = timestamp;
+	info->timestamp.tv_usec = 0;
+	if (cb)
+		cb(info, index, 0, arg);
+}
+
+static inline size_t cutStart(const PutCuts &cuts, unsigned i)
+{
+	return i ? cuts[i - 1] : 0;
+}
 
-	numChunks = fs.st_size / chunkSize;
-	if (fs.st_size % chunkSize)
-		numChunks ++;
-	//FIXME: this should be numChunks, sizeof(ChunkInfo)
-	if (!(infoList = (ChunkInfo*)calloc(numChunks, chunkSize))) {
-		fclose(fp);
+// wait for the reply to a batch, returns -1 with errno set if it failed
+static int putReply(const ChunkContext *ctx, const PutBatch &b, const PutCuts &cuts,
+		ChunkInfo *infoList, XputCallback cb, void *arg)
+{
+	xia::XSocketMsg reply;
+
+	if (click_reply(ctx->sockfd, b.seq, &reply) < 0) {
+		LOGF("Error getting status from Click: %s", strerror(errno));
 		return -1;
 	}
 
-	if (!(buf = (char*)malloc(chunkSize))) {
-		free(infoList);
-		fclose(fp);
+	xia::X_Putchunk_Msg *_msgReply = reply.mutable_x_putchunk();
+	if (reply.type() != xia::XPUTCHUNK || _msgReply->cids_size() != (int)b.count) {
+		errno = EPROTO;
 		return -1;
 	}
 
-	i = 0;
-	while (!feof(fp)) {
+	for (unsigned i = 0; i < b.count; i++) {
+		unsigned index = b.first + i;
+		ChunkInfo tmp;
+
+		putDone(infoList ? &infoList[index] : &tmp, index, cuts[index] - cutStart(cuts, index),
+				_msgReply->cids(i), _msgReply->ttl(), _msgReply->timestamp(), cb, arg);
+	}
+	return 0;
+}
+
+/*
+** publish data as the chunks in cuts, filling in infoList if it isn't NULL
+** and calling cb as each chunk is acknowledged. Returns the number of chunks
+** published, or -1 with errno set.
+*/
+static int putPipeline(const ChunkContext *ctx, const char *data, const PutCuts &cuts,
+		ChunkInfo *infoList, XputCallback cb, void *arg)
+{
+	std::deque<PutBatch> inflight;
+	unsigned numChunks = cuts.size();
+	unsigned next = 0;
+	unsigned done = 0;
+	int err = 0;
+
+	while ((next < numChunks && !err) || !inflight.empty()) {
+
+		while (next < numChunks && !err && inflight.size() < PUT_WINDOW) {
+			size_t offset = cutStart(cuts, next);
+			unsigned size = cuts[next] - offset;
+
+			if (size > XIA_MAXCHUNK) {
+				// too big to share a message, stream it on its own
+				ChunkInfo tmp;
+				ChunkInfo *info = infoList ? &infoList[next] : &tmp;
+
+				if (XputChunk(ctx, data + offset, size, info) < 0) {
+					err = errno;
+					break;
+				}
+				if (cb)
+					cb(info, next, 0, arg);
+				next++;
+				done++;
+				continue;
+			}
+
+			xia::XSocketMsg xsm;
+			xsm.set_type(xia::XPUTCHUNK);
+			unsigned seq = seqNo(ctx->sockfd);
+			xsm.set_sequence(seq);
+
+			xia::X_Putchunk_Msg *_msg = xsm.mutable_x_putchunk();
+			_msg->set_contextid(ctx->contextID);
+			_msg->set_ttl(ctx->ttl);
+			_msg->set_cachesize(ctx->cacheSize);
+			_msg->set_cachepolicy(ctx->cachePolicy);
 
-		if ((count = fread(buf, sizeof(char), chunkSize, fp)) > 0) {
+			PutBatch b;
+			b.seq = seq;
+			b.first = next;
+			b.count = 0;
 
-			if ((rc = XputChunk(ctx, buf, count, &infoList[i])) < 0)
+			size_t bytes = 0;
+			while (next < numChunks && b.count < PUT_BATCH_CHUNKS) {
+				size = cuts[next] - cutStart(cuts, next);
+				if (b.count && bytes + size > XIA_MAXCHUNK)
+					break;
+				_msg->add_sizes(size);
+				bytes += size;
+				b.count++;
+				next++;
+			}
+			_msg->set_payload(data + cutStart(cuts, b.first), bytes);
+
+			if (click_send(ctx->sockfd, &xsm) < 0) {
+				LOGF("Error talking to Click: %s", strerror(errno));
+				err = errno;
+				next = b.first;
 				break;
-			i++;
+			}
+			inflight.push_back(b);
+		}
+
+		if (inflight.empty())
+			break;
+
+		// the replies to anything still in flight are collected even after
+		// a failure so they don't pile up in the socket
+		PutBatch b = inflight.front();
+		inflight.pop_front();
+		if (err)
+			putReply(ctx, b, cuts, NULL, NULL, NULL);
+		else if (putReply(ctx, b, cuts, infoList, cb, arg) < 0)
+			err = errno;
+		else
+			done += b.count;
+	}
+
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	return done;
+}
+
+static unsigned putChunkSize(const ChunkContext *ctx, unsigned chunkSize)
+{
+	if (chunkSize == 0)
+		chunkSize = ctx->chunkSize;
+	if (chunkSize == 0)
+		return DEFAULT_CHUNK_SIZE;
+	return MIN(chunkSize, XIA_MAXCHUNKSIZE);
+}
+
+// cut len bytes into chunks of chunkSize, the last one may be shorter
+static void fixedCuts(size_t len, unsigned chunkSize, PutCuts &cuts)
+{
+	cuts.reserve((len + chunkSize - 1) / chunkSize);
+	for (size_t end = chunkSize; end < len + chunkSize; end += chunkSize)
+		cuts.push_back(MIN(end, len));
+}
+
+// map a file for publishing, an empty file maps to NULL
+static int mapFile(const char *fname, const char **data, size_t *len)
+{
+	struct stat fs;
+	int fd;
+
+	if ((fd = open(fname, O_RDONLY)) < 0)
+		return -1;
+	if (fstat(fd, &fs) != 0) {
+		close(fd);
+		return -1;
+	}
+
+	*len = fs.st_size;
+	*data = NULL;
+	if (*len) {
+		void *m = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (m == MAP_FAILED) {
+			close(fd);
+			return -1;
 		}
+		madvise(m, *len, MADV_SEQUENTIAL);
+		*data = (const char *)m;
 	}
+	close(fd);
+	return 0;
+}
+
+/*
+** Content defined chunking, as in FastCDC. A gear hash is rolled over the
+** data, h = (h << 1) + gear[byte], so h only depends on the last CDC_WINDOW
+** bytes. A chunk ends after a byte where the high bits of h are all zero:
+** more of them before the average size and fewer after, so chunk sizes
+** gather around the average. An insert or delete only moves the cuts near
+** it, the chunks after it keep their CIDs.
+**
+** The hash is rolled two bytes at a time, h = (h << 2) + (gear[a] << 1) +
+** gear[b], which halves the chain of dependent operations. The hash after
+** the first byte is h - gear[b] shifted left, so the mask leaves out the top
+** bit and both positions are still checked.
+*/
+typedef struct {
+	size_t minSize;
+	size_t avgSize;
+	size_t maxSize;
+	uint32_t maskS;		// before the average size
+	uint32_t maskL;		// after it
+} CdcParams;
+
+static uint32_t gear[256];
+static uint32_t gearShifted[256];	// gear << 1
+static pthread_once_t gearOnce = PTHREAD_ONCE_INIT;
+
+// the gear values are fixed so every publisher cuts the same data the same
+// way, they are the first outputs of splitmix64
+static void gearFill()
+{
+	uint64_t x = 0;
+
+	for (int i = 0; i < 256; i++) {
+		uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		gear[i] = (uint32_t)((z ^ (z >> 31)) >> 32);
+		gearShifted[i] = gear[i] << 1;
+	}
+}
+
+// bits 30 down, bit 31 is lost when checking the first byte of a pair
+static uint32_t cdcMask(int bits)
+{
+	bits = MAX(1, MIN(bits, 30));
+	return (((uint32_t)1 << bits) - 1) << (31 - bits);
+}
+
+static int cdcParams(const XchunkOptions *opts, CdcParams &p)
+{
+	p.minSize = (opts && opts->minSize) ? opts->minSize : XCDC_MIN_SIZE;
+	p.avgSize = (opts && opts->avgSize) ? opts->avgSize : XCDC_AVG_SIZE;
+	p.maxSize = (opts && opts->maxSize) ? opts->maxSize : XCDC_MAX_SIZE;
+
+	if (p.minSize < CDC_WINDOW || p.minSize >= p.avgSize || p.avgSize >= p.maxSize ||
+			p.maxSize > XIA_MAXCHUNKSIZE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	int bits = 0;
+	while (((size_t)2 << bits) <= p.avgSize)
+		bits++;
+	p.maskS = cdcMask(bits + CDC_NORMAL);
+	p.maskL = cdcMask(bits - CDC_NORMAL);
+	return 0;
+}
+
+// the first cut in [from, to) of a chunk, 0 if there isn't one
+static size_t cdcFind(const unsigned char *data, size_t from, size_t to, uint32_t mask)
+{
+	uint32_t maskShifted = mask << 1;
+	uint32_t h = 0;
+	size_t i;
+
+	for (i = from - (CDC_WINDOW - 1); i < from; i++)
+		h = (h << 1) + gear[data[i]];
+
+	for (; i + 2 <= to; i += 2) {
+		uint32_t g = gear[data[i + 1]];
 
-	if (i != numChunks) {
-		// FIXME: something happened, what do we want to do in this case?
-		rc = -1;
+		h = (h << 2) + gearShifted[data[i]] + g;
+		if (!((h - g) & maskShifted))
+			return i + 1;
+		if (!(h & mask))
+			return i + 2;
 	}
-	else
-		rc = i;
+	if (i < to) {
+		h = (h << 1) + gear[data[i]];
+		if (!(h & mask))
+			return i + 1;
+	}
+	return 0;
+}
+
+// the length of the chunk at the start of data, which has len bytes
+static size_t cdcCut(const unsigned char *data, size_t len, const CdcParams &p)
+{
+	size_t end = MIN(len, p.maxSize);
+	size_t cut;
+
+	if (len <= p.minSize)
+		return len;
+	if ((cut = cdcFind(data, p.minSize, MIN(end, p.avgSize), p.maskS)))
+		return cut;
+	if (end > p.avgSize && (cut = cdcFind(data, p.avgSize, end, p.maskL)))
+		return cut;
+	return end;
+}
+
+static int cdcCuts(const char *data, size_t len, const XchunkOptions *opts, PutCuts &cuts)
+{
+	CdcParams p;
+
+	if (cdcParams(opts, p) < 0)
+		return -1;
+	pthread_once(&gearOnce, gearFill);
+
+	const unsigned char *d = (const unsigned char *)data;
+	cuts.reserve(len / p.avgSize + 1);
+	for (size_t at = 0; at < len; )
+		cuts.push_back(at += cdcCut(d + at, len - at, p));
+	return 0;
+}
+
+static int putMapped(ChunkContext *ctx, const char *data, const PutCuts &cuts, ChunkInfo **info)
+{
+	ChunkInfo *infoList;
+
+	if (!(infoList = (ChunkInfo*)calloc(cuts.size() ? cuts.size() : 1, sizeof(ChunkInfo))))
+		return -1;
 
 	*info = infoList;
-	fclose(fp);
-	free(buf);
+	return putPipeline(ctx, data, cuts, infoList, NULL, NULL);
+}
+
+/*!
+** @brief Publish a file by breaking it into one or more content chunks.
+**
+** XputFile() maps the file and publishes it the same way as XputBuffer().
+**
+** On success, the CID of the chunk is set to the 40 character hash of the
+** content data. The CID is not a full DAG, and must be converted to a DAG
+** before the client applicatation can request it, otherwise an error will
+** occur.
+**
+** If the file causes the cache slice to grow too large, the oldest content
+** chunk(s) will be reoved to make enough space for the new chunk(s).
+**
+** @param ctx Pointer to the cache slice where this chunk will be stored
+** @param fname The file to publish.
+** @param chunkSize The maximum requested size of each chunk, 0 for the
+** slice's chunk size (see XsetChunkSize()). Larger values are cut down to
+** XIA_MAXCHUNKSIZE.
+** @param info a pointer to an array of ChunkInfo structures. The memory for
+** this array is allocated by the XputFile() function on success and should
+** be free'd with the XfreeChunkInfo() function when it is no longer needed.
+**
+** @returns The number of chunks created on success with info pointing to an
+** allocated array of ChunkInfo structures.
+** @returns -1 on error
+**
+**/
+int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo **info)
+{
+	const char *data;
+	size_t len;
+	int rc;
+
+	if (ctx == NULL || fname == NULL || info == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (mapFile(fname, &data, &len) < 0)
+		return -1;
+
+	PutCuts cuts;
+	fixedCuts(len, putChunkSize(ctx, chunkSize), cuts);
+	rc = putMapped(ctx, data, cuts, info);
 
+	if (data)
+		munmap((void *)data, len);
 	return rc;
 }
 
 
 /*!
-** @brief Publish a file by breaking it into one or more content chunks.
+** @brief Publish a buffer by breaking it into one or more content chunks.
 **
-** XputBuffer() calls XputChunk() internally and has the same requiremts as that
-** function.
+** Chunks no larger than XIA_MAXCHUNK are packed several to a message, and
+** several messages are sent before waiting for click to acknowledge them, so
+** publishing many small chunks costs a few round trips rather than one per
+** chunk. Larger chunks are streamed one at a time as in XputChunk().
 **
 ** On success, the CID of the chunk is set to the 40 character hash of the
 ** content data. The CID is not a full DAG, and must be converted to a DAG
@@ -297,8 +838,9 @@ int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo
 ** @param ctx Pointer to the cache slice where this chunk will be stored
 ** @param data The data buffer to be published
 ** @param len length of the data buffer
-** @param chunkSize The maximum requested size of each chunk. This value
-** must not be larger than XIA_MAXCHUNK or an error will be returned.
+** @param chunkSize The maximum requested size of each chunk, 0 for the
+** slice's chunk size (see XsetChunkSize()). Larger values are cut down to
+** XIA_MAXCHUNKSIZE.
 ** @param info a pointer to an array of ChunkInfo structures. The memory for
 ** this array is allocated by the XputBuffer() function on success and should
 ** be free'd with the XfreeChunkInfo() function when it is no longer needed.
@@ -310,58 +852,281 @@ int XputFile(ChunkContext *ctx, const char *fname, unsigned chunkSize, ChunkInfo
 **/
 int XputBuffer(ChunkContext *ctx, const char *data, unsigned len, unsigned chunkSize, ChunkInfo **info)
 {
-	ChunkInfo *infoList;
-	unsigned numChunks;
-	unsigned i;
+	if (ctx == NULL || data == NULL || info == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	PutCuts cuts;
+	fixedCuts(len, putChunkSize(ctx, chunkSize), cuts);
+	return putMapped(ctx, data, cuts, info);
+}
+
+// publish data cut at content defined boundaries and list the chunks in manifest
+static int putCDC(ChunkContext *ctx, const char *data, size_t len, const XchunkOptions *opts,
+		const char *source, ChunkManifest *manifest)
+{
+	ChunkInfo *infoList = NULL;
+	PutCuts cuts;
 	int rc;
-	int count;
-	char *buf;
-	const char *p;
 
-	if (ctx == NULL || data == NULL) {
+	if (cdcCuts(data, len, opts, cuts) < 0)
+		return -1;
+
+	memset(manifest, 0, sizeof(ChunkManifest));
+	if (source) {
+		if (!(manifest->sources = (char **)calloc(1, sizeof(char *))) ||
+				!(manifest->sources[0] = strdup(source))) {
+			XmanifestFree(manifest);
+			return -1;
+		}
+		manifest->numSources = 1;
+	}
+
+	if ((rc = putMapped(ctx, data, cuts, &infoList)) < 0) {
+		int err = errno;
+		free(infoList);
+		XmanifestFree(manifest);
+		errno = err;
+		return -1;
+	}
+	manifest->chunks = infoList;
+	manifest->numChunks = rc;
+	return rc;
+}
+
+/*!
+** @brief Publish a buffer as content defined chunks.
+**
+** Works like XputBuffer(), but rather than cutting the buffer every
+** chunkSize bytes the cuts are chosen by a rolling hash of the data
+** (FastCDC). Inserting or removing bytes only changes the chunks around the
+** edit, so successive versions of a file share most of their CIDs and hit in
+** the caches along the way. Every publisher cuts the same data at the same
+** places.
+**
+** The chunks are listed in order in manifest, ready for XmanifestWrite() and
+** XfetchChunks().
+**
+** @param ctx Pointer to the cache slice where the chunks will be stored
+** @param data The data buffer to be published
+** @param len length of the data buffer
+** @param opts the smallest, average and largest chunk sizes, NULL or 0 for
+** XCDC_MIN_SIZE, XCDC_AVG_SIZE and XCDC_MAX_SIZE. The average is rounded down
+** to a power of 2, and the sizes must increase with the largest no more than
+** XIA_MAXCHUNKSIZE.
+** @param source DAG the chunks can be fetched from, put in the manifest as
+** its only source, or NULL for none
+** @param manifest filled in with the chunks, it should be released with
+** XmanifestFree()
+**
+** @returns The number of chunks created on success
+** @returns -1 on error with errno set, EINVAL if the sizes in opts are wrong
+**
+*/
+int XputBufferCDC(ChunkContext *ctx, const char *data, size_t len, const XchunkOptions *opts,
+		const char *source, ChunkManifest *manifest)
+{
+	if (ctx == NULL || (data == NULL && len) || manifest == NULL) {
 		errno = EFAULT;
 		return -1;
 	}
 
-	if (chunkSize == 0)
-		chunkSize =  DEFAULT_CHUNK_SIZE;
-	else if (chunkSize > XIA_MAXBUF)
-		chunkSize = XIA_MAXBUF;
+	return putCDC(ctx, data, len, opts, source, manifest);
+}
 
-	numChunks = len / chunkSize;
-	if (len % chunkSize)
-		numChunks ++;
+/*!
+** @brief Publish a file as content defined chunks.
+**
+** Works like XputBufferCDC() on the contents of the file, which is mapped
+** rather than read into memory.
+**
+** @param ctx Pointer to the cache slice where the chunks will be stored
+** @param fname The file to publish
+** @param opts the chunk sizes as for XputBufferCDC(), NULL for the defaults
+** @param source DAG the chunks can be fetched from, or NULL
+** @param manifest filled in with the chunks, it should be released with
+** XmanifestFree()
+**
+** @returns The number of chunks created on success
+** @returns -1 on error with errno set
+**
+*/
+int XputFileCDC(ChunkContext *ctx, const char *fname, const XchunkOptions *opts,
+		const char *source, ChunkManifest *manifest)
+{
+	const char *data;
+	size_t len;
+	int rc;
 
-	if (!(infoList = (ChunkInfo*)calloc(numChunks, chunkSize))) {
+	if (ctx == NULL || fname == NULL || manifest == NULL) {
+		errno = EFAULT;
 		return -1;
 	}
 
-	if (!(buf = (char*)malloc(chunkSize))) {
-		free(infoList);
+	if (mapFile(fname, &data, &len) < 0)
+		return -1;
+
+	rc = putCDC(ctx, data, len, opts, source, manifest);
+
+	int err = errno;
+	if (data)
+		munmap((void *)data, len);
+	errno = err;
+	return rc;
+}
+
+typedef struct {
+	ChunkContext *ctx;
+	const char *data;
+	size_t len;
+	unsigned chunkSize;
+	int mapped;			// data is a file mapping to release when done
+	XputCallback cb;
+	void *arg;
+} PutJob;
+
+static void *putThread(void *p)
+{
+	PutJob *job = (PutJob *)p;
+	PutCuts cuts;
+
+	fixedCuts(job->len, job->chunkSize, cuts);
+	int rc = putPipeline(job->ctx, job->data, cuts, NULL, job->cb, job->arg);
+	int err = rc < 0 ? errno : 0;
+
+	if (job->mapped && job->data)
+		munmap((void *)job->data, job->len);
+	job->cb(NULL, rc < 0 ? 0 : rc, err, job->arg);
+	free(job);
+	return NULL;
+}
+
+static int putStart(PutJob *job)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	int rc;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&thread, &attr, putThread, job);
+	pthread_attr_destroy(&attr);
+
+	if (rc != 0) {
+		errno = rc;
 		return -1;
 	}
+	return 0;
+}
 
-	p = data;
-	for (i = 0; i < numChunks; i++) {
-		count = MIN(len, chunkSize);
+/*!
+** @brief Publish a buffer without waiting for it to be acknowledged.
+**
+** The buffer is published by a background thread through the same pipeline
+** as XputBuffer(). cb is called from that thread with the info for each
+** chunk as click acknowledges it, and index set to the chunk's position in
+** the buffer. Chunks may be reported out of order. When the buffer is done
+** cb is called one last time with a NULL info, index set to the number of
+** chunks and err set to 0, or to an errno value if publishing failed part
+** way, in which case index is 0. The info passed to cb is only valid
+** during the call.
+**
+** The buffer must not be changed or freed until the last call to cb, and the
+** cache slice must stay allocated until then.
+**
+** @param ctx Pointer to the cache slice where the chunks will be stored
+** @param data The data buffer to be published
+** @param len length of the data buffer
+** @param chunkSize The maximum requested size of each chunk, 0 for the
+** slice's chunk size (see XsetChunkSize()). Larger values are cut down to
+** XIA_MAXCHUNKSIZE.
+** @param cb function to call as chunks are published
+** @param arg passed through to cb
+**
+** @returns 0 if publishing was started
+** @returns -1 on error with errno set
+**
+*/
+int XputBufferAsync(ChunkContext *ctx, const char *data, size_t len, unsigned chunkSize,
+		XputCallback cb, void *arg)
+{
+	PutJob *job;
 
-		if ((rc = XputChunk(ctx, p, count, &infoList[i])) < 0)
-			break;
-		len -= count;
-		p += chunkSize;
+	if (ctx == NULL || data == NULL || cb == NULL) {
+		errno = EFAULT;
+		return -1;
 	}
 
-	if (i != numChunks) {
-		// FIXME: something happened, what do we want to do in this case?
-		rc = -1;
+	if (!(job = (PutJob *)calloc(1, sizeof(PutJob))))
+		return -1;
+
+	job->ctx = ctx;
+	job->data = data;
+	job->len = len;
+	job->chunkSize = putChunkSize(ctx, chunkSize);
+	job->cb = cb;
+	job->arg = arg;
+
+	if (putStart(job) < 0) {
+		free(job);
+		return -1;
 	}
-	else
-		rc = i;
+	return 0;
+}
 
-	*info = infoList;
-	free(buf);
+/*!
+** @brief Publish a file without waiting for it to be acknowledged.
+**
+** Works like XputBufferAsync() on the contents of the file, which is mapped
+** rather than read into memory. The file should not be changed until the
+** last call to cb.
+**
+** @param ctx Pointer to the cache slice where the chunks will be stored
+** @param fname The file to publish
+** @param chunkSize The maximum requested size of each chunk, 0 for the
+** slice's chunk size (see XsetChunkSize()). Larger values are cut down to
+** XIA_MAXCHUNKSIZE.
+** @param cb function to call as chunks are published
+** @param arg passed through to cb
+**
+** @returns 0 if publishing was started
+** @returns -1 on error with errno set
+**
+*/
+int XputFileAsync(ChunkContext *ctx, const char *fname, unsigned chunkSize,
+		XputCallback cb, void *arg)
+{
+	PutJob *job;
 
-	return rc;
+	if (ctx == NULL || fname == NULL || cb == NULL) {
+		errno = EFAULT;
+		return -1;
+	}
+
+	if (!(job = (PutJob *)calloc(1, sizeof(PutJob))))
+		return -1;
+
+	if (mapFile(fname, &job->data, &job->len) < 0) {
+		free(job);
+		return -1;
+	}
+
+	job->ctx = ctx;
+	job->chunkSize = putChunkSize(ctx, chunkSize);
+	job->mapped = 1;
+	job->cb = cb;
+	job->arg = arg;
+
+	if (putStart(job) < 0) {
+		int err = errno;
+		if (job->data)
+			munmap((void *)job->data, job->len);
+		free(job);
+		errno = err;
+		return -1;
+	}
+	return 0;
 }
 
 /*!
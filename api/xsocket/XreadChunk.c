@@ -15,7 +15,7 @@
 */
 /*!
 ** @file XreadChunk.c
-** @brief implements XreadChunk()
+** @brief implements XreadChunk() and XreadChunkAt()
 */
 
 #include<errno.h>
@@ -23,6 +23,50 @@
 #include "Xinit.h"
 #include "Xutil.h"
 
+/*
+** ask click for up to len bytes of a chunk starting at offset, the reply
+** says how large the whole chunk is
+*/
+static int readSlice(int sockfd, void *rbuf, size_t len, size_t offset, char *cid, size_t *chunkSize)
+{
+	int rc;
+
+	xia::XSocketMsg xsm;
+	xsm.set_type(xia::XREADCHUNK);
+	unsigned seq = seqNo(sockfd);
+	xsm.set_sequence(seq);
+
+	xia::X_Readchunk_Msg *x_readchunk_msg = xsm.mutable_x_readchunk();
+
+	x_readchunk_msg->set_dag(cid);
+	x_readchunk_msg->set_offset(offset);
+	x_readchunk_msg->set_length(MIN(len, XIA_MAXCHUNK));
+
+	if ((rc = click_send(sockfd, &xsm)) < 0) {
+		LOGF("Error talking to Click: %s", strerror(errno));
+		return -1;
+	}
+
+	xsm.Clear();
+	if ((rc = click_reply(sockfd, seq, &xsm)) < 0) {
+		LOGF("Error retrieving status from Click: %s", strerror(errno));
+		return -1;
+	}
+
+	xia::X_Readchunk_Msg *msg = xsm.mutable_x_readchunk();
+	unsigned paylen = msg->payload().size();
+
+	if (paylen > len) {
+		LOGF("Click returned %u bytes, but rbuf is only %lu bytes", paylen, len);
+		errno = EFAULT;
+		return -1;
+	}
+
+	memcpy(rbuf, msg->payload().c_str(), paylen);
+	*chunkSize = msg->has_size() ? msg->size() : paylen;
+	return paylen;
+}
+
 /*!
 ** @brief Reads the contents of the specified CID into rbuf. Must be called
 ** after XrequestChunk() or XrequestChunks().
@@ -34,6 +78,8 @@
 ** client or server application must generate the full DAG that is passed
 ** to this API call.
 **
+** Chunks larger than one message from click are collected a slice at a time.
+**
 ** @param sockfd the control socket (must be of type XSOCK_CHUNK)
 ** @param rbuf buffer to receive the data
 ** @param len length of rbuf
@@ -42,12 +88,14 @@
 ** @param cidLen length of cid (currently unused)
 **
 ** @returns number of bytes in the CID
+** @returns 0 if the chunk hasn't arrived yet
 ** @returns -1 on error with errno set
 **
 */
 int XreadChunk(int sockfd, void *rbuf, size_t len, int /* flags */,
 		char * cid, size_t /* cidLen */)
 {
+	size_t chunkSize;
 	int rc;
 
 	if (validateSocket(sockfd, XSOCK_CHUNK, EAFNOSUPPORT) < 0) {
@@ -64,40 +112,68 @@ int XreadChunk(int sockfd, void *rbuf, size_t len, int /* flags */,
 		return -1;
 	}
 
-	xia::XSocketMsg xsm;
-	xsm.set_type(xia::XREADCHUNK);
-	unsigned seq = seqNo(sockfd);
-	xsm.set_sequence(seq);
-
-	xia::X_Readchunk_Msg *x_readchunk_msg = xsm.mutable_x_readchunk();
-
-	x_readchunk_msg->set_dag(cid);
-
-	std::string p_buf;
-	xsm.SerializeToString(&p_buf);
+	if ((rc = readSlice(sockfd, rbuf, len, 0, cid, &chunkSize)) <= 0)
+		return rc;
 
-	if ((rc = click_send(sockfd, &xsm)) < 0) {
-		LOGF("Error talking to Click: %s", strerror(errno));
+	if (chunkSize > len) {
+		LOGF("CID is %lu bytes, but rbuf is only %lu bytes", chunkSize, len);
+		errno = EFAULT;
 		return -1;
 	}
 
-	xsm.Clear();
-	if ((rc = click_reply(sockfd, seq, &xsm)) < 0) {
-		LOGF("Error retrieving status from Click: %s", strerror(errno));
-		return -1;
+	size_t got = rc;
+	while (got < chunkSize) {
+		if ((rc = readSlice(sockfd, (char *)rbuf + got, chunkSize - got, got, cid, &chunkSize)) < 0)
+			return -1;
+		if (rc == 0) {
+			// the chunk went away between slices
+			errno = EAGAIN;
+			return -1;
+		}
+		got += rc;
 	}
+	return got;
+}
 
-	xia::X_Readchunk_Msg *msg = xsm.mutable_x_readchunk();
-	unsigned paylen = msg->payload().size();
-	const char *payload = msg->payload().c_str();
+/*!
+** @brief Reads part of the specified CID into rbuf. Must be called after
+** XrequestChunk() or XrequestChunks(), and the chunk must be ready.
+**
+** Each call returns at most XIA_MAXCHUNK bytes, so a large chunk can be
+** read into a smaller buffer, or handed on, a piece at a time.
+**
+** @param sockfd the control socket (must be of type XSOCK_CHUNK)
+** @param rbuf buffer to receive the data
+** @param len length of rbuf
+** @param offset where in the chunk to start reading
+** @param cid the CID to retrieve. cid should be a full DAG, not a fragment.
+** @param chunkSize if not NULL, set to the size of the whole chunk
+**
+** @returns number of bytes read, 0 at the end of the chunk or if the
+** chunk hasn't arrived yet
+** @returns -1 on error with errno set
+**
+*/
+int XreadChunkAt(int sockfd, void *rbuf, size_t len, size_t offset, char *cid, size_t *chunkSize)
+{
+	size_t size;
+	int rc;
 
-	if (paylen > len) {
-		LOGF("CID is %u bytes, but rbuf is only %lu bytes", paylen, len);
+	if (validateSocket(sockfd, XSOCK_CHUNK, EAFNOSUPPORT) < 0) {
+		LOGF("Socket %d must be a chunk socket\n", sockfd);
+		return -1;
+	}
+
+	if (!rbuf || !cid) {
+		LOG("null pointer error!");
 		errno = EFAULT;
 		return -1;
 	}
 
-	memcpy(rbuf, payload, paylen);
-	return paylen;
-}
+	if (len == 0)
+		return 0;
 
+	if ((rc = readSlice(sockfd, rbuf, len, offset, cid, &size)) >= 0 && chunkSize)
+		*chunkSize = size;
+	return rc;
+}
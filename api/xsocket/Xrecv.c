@@ -235,10 +235,18 @@ int _xrecvfrom(int sockfd, void *rbuf, size_t len, int flags,
 	}
 
 	if (addr) {
-		Graph g(xrm->sender_dag().c_str());
-
-		// FIXME: validate addr
-		g.fill_sockaddr((sockaddr_x*)addr);
+		if (xrm->has_sender_dag_bin()) {
+			const std::string &dag = xrm->sender_dag_bin();
+
+			if (wire_to_sockaddr(dag.data(), dag.size(), addr) < 0) {
+				LOG("invalid sender address");
+				errno = EINVAL;
+				return -1;
+			}
+		} else {
+			Graph g(xrm->sender_dag().c_str());
+			g.fill_sockaddr(addr);
+		}
 		*addrlen = sizeof(sockaddr_x);
 	}
 
@@ -287,7 +295,7 @@ int _xrecvfromconn(int sockfd, void *rbuf, size_t len, int flags, int *iface)
 		// check to see if addr and the stored addr for the connection are the same
 		g.from_sockaddr(&sa);
 
-		if (g.get_final_intent() == nPeer)
+		if (g.get_final_intent().equal_to(nPeer))
 			break;
 
 		// packet came from a different peer, just discard it and try again
@@ -0,0 +1,606 @@
+/*
+** Copyright 2013 Carnegie Mellon University
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**    http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+/*!
+** @file Xresolver.c
+** @brief implements XgetDAGbyNameAsync(), XregisterNameAsync(), XgetDAGbyNameBatch()
+** and XregisterNameBatch()
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+#include "Xsocket.h"
+#include "Xinit.h"
+#include "Xutil.h"
+#include "xns.h"
+#include "dagaddr.hpp"
+
+#define NS_BATCH_TIMEOUT	1000	// ms to wait for a batch response before resending
+#define NS_BATCH_RETRIES	3
+
+typedef struct {
+	XresolveCallback cb;
+	void *arg;
+} NsWaiter;
+
+// a name query or registration, shared by every caller that asked for it
+typedef struct {
+	char type;					// NS_TYPE_QUERY or NS_TYPE_REGISTER
+	std::string name;
+	std::string dag;			// registrations only
+	std::vector<NsWaiter> waiters;
+	int tries;
+} NsRequest;
+
+// the requests carried in a batch, in the order they were packed
+typedef struct {
+	std::vector<std::string> keys;
+	long sent;
+} NsBatch;
+
+// a finished request waiting for its callbacks to be run
+typedef struct {
+	NsRequest req;
+	int err;
+	sockaddr_x addr;
+} NsDone;
+
+static std::map<std::string, NsRequest> requests;	// all outstanding requests
+static std::deque<std::string> unsent;				// requests waiting to be packed
+static std::map<unsigned short, NsBatch> inflight;	// batches waiting for a response
+static unsigned short next_batch = 0;
+
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t resolver_once = PTHREAD_ONCE_INIT;
+static int resolver_running = 0;
+static int wake_pipe[2] = {-1, -1};
+
+static long nowMs()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static std::string requestKey(char type, const char *name, const char *dag)
+{
+	std::string key(1, type);
+
+	key += name;
+	if (dag) {
+		key += '\0';
+		key += dag;
+	}
+	return key;
+}
+
+// remove a request from the table so its callbacks can be run
+// must be called with resolver_lock held
+static void finish(const std::string &key, int err, const sockaddr_x *addr, std::vector<NsDone> &done)
+{
+	std::map<std::string, NsRequest>::iterator it = requests.find(key);
+	if (it == requests.end())
+		return;
+
+	NsDone d;
+	d.req = it->second;
+	d.err = err;
+	if (addr)
+		memcpy(&d.addr, addr, sizeof(sockaddr_x));
+	done.push_back(d);
+
+	requests.erase(it);
+}
+
+static void runCallbacks(std::vector<NsDone> &done)
+{
+	for (std::vector<NsDone>::iterator it = done.begin(); it != done.end(); it++) {
+		const sockaddr_x *addr = it->err ? NULL : &it->addr;
+
+		for (unsigned i = 0; i < it->req.waiters.size(); i++) {
+			it->req.waiters[i].cb(it->req.name.c_str(), addr, it->err, it->req.waiters[i].arg);
+		}
+	}
+	done.clear();
+}
+
+// match the records in a batch response to the requests that were sent
+// must be called with resolver_lock held
+static void handleResponse(char *pkt, int len, std::vector<NsDone> &done)
+{
+	ns_pkt records[NS_MAX_BATCH_RECORDS];
+	unsigned short id;
+	sockaddr_x addr;
+
+	int n = get_ns_batch(pkt, len, &id, records, NS_MAX_BATCH_RECORDS);
+	if (n < 0 || pkt[0] != NS_TYPE_RESPONSE_BATCH) {
+		LOG("invalid batch response from the nameserver");
+		return;
+	}
+
+	std::map<unsigned short, NsBatch>::iterator bit = inflight.find(id);
+	if (bit == inflight.end()) {
+		// late response to a batch we already resent
+		return;
+	}
+
+	std::vector<std::string> &keys = bit->second.keys;
+	int i;
+
+	for (i = 0; i < n && i < (int)keys.size(); i++) {
+		std::map<std::string, NsRequest>::iterator it = requests.find(keys[i]);
+		if (it == requests.end())
+			continue;
+		NsRequest &r = it->second;
+
+		switch (records[i].type) {
+			case NS_TYPE_RESPONSE_QUERY:
+			{
+				Graph g(records[i].dag);
+				g.fill_sockaddr(&addr);
+				resolverSave(r.name.c_str(), &addr);
+				finish(keys[i], 0, &addr, done);
+				break;
+			}
+
+			case NS_TYPE_RESPONSE_REGISTER:
+			{
+				Graph g(r.dag);
+				g.fill_sockaddr(&addr);
+				resolverForget(r.name.c_str(), r.dag.c_str());
+				finish(keys[i], 0, &addr, done);
+				break;
+			}
+
+			default:
+				if (r.type == NS_TYPE_QUERY) {
+					resolverSave(r.name.c_str(), NULL);
+					finish(keys[i], ENOENT, NULL, done);
+				} else {
+					finish(keys[i], EPERM, NULL, done);
+				}
+				break;
+		}
+	}
+
+	// the nameserver ran out of room, send the rest again right away
+	for (int j = (int)keys.size() - 1; j >= i; j--) {
+		if (requests.find(keys[j]) != requests.end())
+			unsent.push_front(keys[j]);
+	}
+
+	inflight.erase(bit);
+}
+
+// resend or give up on batches that haven't been answered in time
+// must be called with resolver_lock held
+static int expireBatches(long now, std::vector<NsDone> &done)
+{
+	int expired = 0;
+	std::map<unsigned short, NsBatch>::iterator bit = inflight.begin();
+
+	while (bit != inflight.end()) {
+		if (now - bit->second.sent < NS_BATCH_TIMEOUT) {
+			bit++;
+			continue;
+		}
+
+		std::vector<std::string> &keys = bit->second.keys;
+		for (unsigned i = 0; i < keys.size(); i++) {
+			std::map<std::string, NsRequest>::iterator it = requests.find(keys[i]);
+			if (it == requests.end())
+				continue;
+
+			if (++it->second.tries >= NS_BATCH_RETRIES)
+				finish(keys[i], ETIMEDOUT, NULL, done);
+			else
+				unsent.push_back(keys[i]);
+		}
+		inflight.erase(bit++);
+		expired++;
+	}
+	return expired;
+}
+
+// pack everything that is waiting into as few batches as possible
+// must be called with resolver_lock held
+static void packBatches(long now, std::vector<std::string> &pkts, std::vector<NsDone> &done)
+{
+	char pkt[NS_MAX_BATCH_PACKET_SIZE];
+
+	while (!unsent.empty()) {
+		unsigned short id = next_batch++;
+		int len = make_ns_batch(NS_TYPE_BATCH, id, pkt, sizeof(pkt));
+		NsBatch b;
+
+		while (!unsent.empty()) {
+			std::map<std::string, NsRequest>::iterator it = requests.find(unsent.front());
+			if (it == requests.end()) {
+				unsent.pop_front();
+				continue;
+			}
+
+			ns_pkt np;
+			np.type = it->second.type;
+			np.flags = 0;
+			np.name = it->second.name.c_str();
+			np.dag = (np.type == NS_TYPE_REGISTER) ? it->second.dag.c_str() : NULL;
+
+			int rc = add_ns_batch(&np, pkt, len, sizeof(pkt));
+			if (rc == 0) {
+				if (b.keys.empty()) {
+					// too big to ever fit in a batch
+					finish(unsent.front(), EINVAL, NULL, done);
+					unsent.pop_front();
+					continue;
+				}
+				break;
+			}
+			len = rc;
+			b.keys.push_back(unsent.front());
+			unsent.pop_front();
+		}
+
+		if (b.keys.empty())
+			break;
+
+		b.sent = now;
+		inflight[id] = b;
+		pkts.push_back(std::string(pkt, len));
+	}
+}
+
+static void *resolverThread(void *)
+{
+	char pkt[NS_MAX_BATCH_PACKET_SIZE];
+	sockaddr_x ns_dag;
+	int have_ns = 0;
+	std::vector<NsDone> done;
+	std::vector<std::string> pkts;
+
+	int sock = Xsocket(AF_XIA, SOCK_DGRAM, 0);
+
+	while (1) {
+		long now = nowMs();
+		int timeout = -1;
+
+		pthread_mutex_lock(&resolver_lock);
+
+		if (expireBatches(now, done) > 0) {
+			// the nameserver may have moved
+			have_ns = 0;
+		}
+
+		if (!unsent.empty() && !have_ns) {
+			if (sock >= 0 && XreadNameServerDAG(sock, &ns_dag) >= 0) {
+				have_ns = 1;
+			} else {
+				LOG("Unable to find nameserver address");
+				while (!unsent.empty()) {
+					finish(unsent.front(), NO_RECOVERY, NULL, done);
+					unsent.pop_front();
+				}
+			}
+		}
+
+		packBatches(now, pkts, done);
+
+		for (std::map<unsigned short, NsBatch>::iterator it = inflight.begin(); it != inflight.end(); it++) {
+			int t = MAX(0, it->second.sent + NS_BATCH_TIMEOUT - now);
+			if (timeout < 0 || t < timeout)
+				timeout = t;
+		}
+
+		pthread_mutex_unlock(&resolver_lock);
+
+		runCallbacks(done);
+
+		// lost batches are retried when they time out
+		for (unsigned i = 0; i < pkts.size(); i++) {
+			if (Xsendto(sock, pkts[i].data(), pkts[i].size(), 0, (const struct sockaddr*)&ns_dag, sizeof(sockaddr_x)) < 0) {
+				LOGF("Error sending name batch: %s", strerror(errno));
+			}
+		}
+		pkts.clear();
+
+		struct pollfd pfds[2];
+		pfds[0].fd = wake_pipe[0];
+		pfds[0].events = POLLIN;
+		pfds[1].fd = sock;
+		pfds[1].events = POLLIN;
+
+		if (Xpoll(pfds, sock >= 0 ? 2 : 1, timeout) <= 0)
+			continue;
+
+		if (pfds[0].revents & POLLIN) {
+			while (read(wake_pipe[0], pkt, sizeof(pkt)) > 0)
+				;
+		}
+
+		if (pfds[1].revents & POLLIN) {
+			int rc = Xrecvfrom(sock, pkt, sizeof(pkt), 0, NULL, NULL);
+			if (rc > 0) {
+				pthread_mutex_lock(&resolver_lock);
+				handleResponse(pkt, rc, done);
+				pthread_mutex_unlock(&resolver_lock);
+
+				runCallbacks(done);
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void resolverStart()
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+
+	if (pipe(wake_pipe) < 0)
+		return;
+	fcntl(wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_pipe[1], F_SETFL, O_NONBLOCK);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, resolverThread, NULL) == 0)
+		resolver_running = 1;
+	pthread_attr_destroy(&attr);
+}
+
+// queue a query or registration, joining an identical one if it's already outstanding
+static int submit(char type, const char *name, const char *dag, XresolveCallback cb, void *arg)
+{
+	pthread_once(&resolver_once, resolverStart);
+	if (!resolver_running) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	std::string key = requestKey(type, name, dag);
+	NsWaiter w;
+	w.cb = cb;
+	w.arg = arg;
+
+	pthread_mutex_lock(&resolver_lock);
+
+	std::map<std::string, NsRequest>::iterator it = requests.find(key);
+	if (it != requests.end()) {
+		it->second.waiters.push_back(w);
+		pthread_mutex_unlock(&resolver_lock);
+		return 0;
+	}
+
+	NsRequest &r = requests[key];
+	r.type = type;
+	r.name = name;
+	if (dag)
+		r.dag = dag;
+	r.tries = 0;
+	r.waiters.push_back(w);
+	unsent.push_back(key);
+
+	pthread_mutex_unlock(&resolver_lock);
+
+	// kick the resolver thread
+	char c = 0;
+	if (write(wake_pipe[1], &c, 1) < 0 && errno != EAGAIN) {
+		LOGF("unable to wake the resolver: %s", strerror(errno));
+	}
+
+	return 0;
+}
+
+/*!
+** @brief Lookup a DAG without waiting for the answer.
+**
+** Queries are collected by a background resolver thread and sent to the
+** nameserver in batches, so many names can be resolved in a few round trips.
+** If the same name is already being looked up, the caller shares the
+** outstanding query instead of sending a new one.
+**
+** cb is called exactly once with the result. Names that can be answered
+** locally (hosts.xia, DAG strings and cached answers) are reported from the
+** calling thread before XgetDAGbyNameAsync returns; everything else is reported
+** from the resolver thread, so cb should not block.
+**
+** The err argument of the callback is 0 on success, ENOENT if the name isn't
+** registered, ETIMEDOUT if the nameserver didn't respond, or NO_RECOVERY if the
+** nameserver address is unknown. addr is NULL on failure.
+**
+** @param name The name of an XIA service or host.
+** @param cb function to call with the result
+** @param arg passed through to cb
+**
+** @returns 0 if the query was accepted
+** @returns -1 on failure with errno set
+*/
+int XgetDAGbyNameAsync(const char *name, XresolveCallback cb, void *arg)
+{
+	sockaddr_x addr;
+
+	if (!name || *name == 0 || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	switch (resolverLookup(name, &addr)) {
+		case 1:
+			cb(name, &addr, 0, arg);
+			return 0;
+		case -1:
+			cb(name, NULL, ENOENT, arg);
+			return 0;
+	}
+
+	return submit(NS_TYPE_QUERY, name, NULL, cb, arg);
+}
+
+/*!
+** @brief Register a service or hostname without waiting for the answer.
+**
+** Registrations are batched with other queries and registrations in the
+** same way as XgetDAGbyNameAsync(). cb is called from the resolver thread
+** with err set to 0 and addr set to DAG once the nameserver accepts the
+** registration.
+**
+** @param name - The name of an XIA service or host.
+** @param DAG  - the DAG to be bound to name.
+** @param cb function to call with the result
+** @param arg passed through to cb
+**
+** @returns 0 if the registration was accepted
+** @returns -1 on failure with errno set
+*/
+int XregisterNameAsync(const char *name, sockaddr_x *DAG, XresolveCallback cb, void *arg)
+{
+	if (!name || *name == 0 || !DAG || DAG->sx_family != AF_XIA || !cb) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	Graph g(DAG);
+	if (g.num_nodes() <= 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return submit(NS_TYPE_REGISTER, name, g.dag_string().c_str(), cb, arg);
+}
+
+// bookkeeping for the synchronous batch calls
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int remaining;
+} BatchWait;
+
+typedef struct {
+	BatchWait *wait;
+	sockaddr_x *addr;
+	int *result;
+} BatchSlot;
+
+static void batchCallback(const char * /* name */, const sockaddr_x *addr, int err, void *arg)
+{
+	BatchSlot *slot = (BatchSlot *)arg;
+
+	if (addr && slot->addr)
+		memcpy(slot->addr, addr, sizeof(sockaddr_x));
+	slot->result[0] = err;
+
+	pthread_mutex_lock(&slot->wait->lock);
+	if (--slot->wait->remaining == 0)
+		pthread_cond_signal(&slot->wait->cond);
+	pthread_mutex_unlock(&slot->wait->lock);
+}
+
+static int batchRun(char type, const char **names, sockaddr_x *addrs, int *results, int count)
+{
+	BatchWait wait;
+	std::vector<BatchSlot> slots(count);
+	int ok = 0;
+
+	if (!names || !addrs || !results || count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_init(&wait.lock, NULL);
+	pthread_cond_init(&wait.cond, NULL);
+	wait.remaining = count;
+
+	for (int i = 0; i < count; i++) {
+		int rc;
+
+		slots[i].wait = &wait;
+		slots[i].addr = (type == NS_TYPE_QUERY) ? &addrs[i] : NULL;
+		slots[i].result = &results[i];
+
+		if (type == NS_TYPE_QUERY)
+			rc = XgetDAGbyNameAsync(names[i], batchCallback, &slots[i]);
+		else
+			rc = XregisterNameAsync(names[i], &addrs[i], batchCallback, &slots[i]);
+
+		if (rc < 0) {
+			// the callback will never run for this one
+			results[i] = errno;
+			pthread_mutex_lock(&wait.lock);
+			wait.remaining--;
+			pthread_mutex_unlock(&wait.lock);
+		}
+	}
+
+	pthread_mutex_lock(&wait.lock);
+	while (wait.remaining > 0)
+		pthread_cond_wait(&wait.cond, &wait.lock);
+	pthread_mutex_unlock(&wait.lock);
+
+	pthread_cond_destroy(&wait.cond);
+	pthread_mutex_destroy(&wait.lock);
+
+	for (int i = 0; i < count; i++) {
+		if (results[i] == 0)
+			ok++;
+	}
+	return ok;
+}
+
+/*!
+** @brief Lookup the DAGs for a list of names.
+**
+** The names are resolved in as few nameserver round trips as possible using
+** the same batching resolver as XgetDAGbyNameAsync().
+**
+** @param names the names to look up
+** @param addrs receives the DAG for each name that was found
+** @param results receives 0 for each name that was found, otherwise the
+**  error that would have been passed to an XgetDAGbyNameAsync() callback
+** @param count number of entries in names, addrs and results
+**
+** @returns the number of names that were resolved
+** @returns -1 on failure with errno set
+*/
+int XgetDAGbyNameBatch(const char **names, sockaddr_x *addrs, int *results, int count)
+{
+	return batchRun(NS_TYPE_QUERY, names, addrs, results, count);
+}
+
+/*!
+** @brief Register a list of names with the nameserver.
+**
+** @param names the names to register
+** @param addrs the DAG to bind to each name
+** @param results receives 0 for each name that was registered, otherwise an
+**  errno value
+** @param count number of entries in names, addrs and results
+**
+** @returns the number of names that were registered
+** @returns -1 on failure with errno set
+*/
+int XregisterNameBatch(const char **names, sockaddr_x *addrs, int *results, int count)
+{
+	return batchRun(NS_TYPE_REGISTER, names, addrs, results, count);
+}
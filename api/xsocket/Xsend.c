@@ -195,11 +195,16 @@ int _xsendto(int sockfd, const void *buf, size_t len, int flags,
 
 	xia::X_Sendto_Msg *x_sendto_msg = xsm.mutable_x_sendto();
 
-	// FIXME: validate addr
-	Graph g(addr);
-	std::string s = g.dag_string();
+	// send the address in header node format, click can use it directly
+	node_t nodes[NODES_MAX];
+	size_t nlen = sockaddr_to_wire(addr, nodes, sizeof(nodes));
+	if (nlen == 0) {
+		LOG("invalid destination address");
+		errno = EINVAL;
+		return -1;
+	}
 
-	x_sendto_msg->set_ddag(s.c_str());
+	x_sendto_msg->set_ddag_bin(nodes, nlen);
 	x_sendto_msg->set_payload((const char*)buf, len);
 
 	if ((rc = click_send(sockfd, &xsm)) < 0) {
@@ -21,6 +21,7 @@
 #include "Xinit.h"
 #include "Xutil.h"
 #include <errno.h>
+#include <pthread.h>
 
 // for printfing param values
 #include <fcntl.h>
@@ -225,23 +226,23 @@ int validateSocket(int sock, int stype, int err)
 	return -1;
 }
 
+static struct sockaddr_in click_sa;
+static pthread_once_t click_sa_once = PTHREAD_ONCE_INIT;
+
+static void click_sa_init()
+{
+	click_sa.sin_family = PF_INET;
+	click_sa.sin_addr.s_addr = inet_addr("127.0.0.1");
+	click_sa.sin_port = htons(atoi(CLICKPORT));
+}
+
 int click_send(int sockfd, xia::XSocketMsg *xsm)
 {
 	int rc = 0;
-	static int initialized = 0;
-	static struct sockaddr_in sa;
 
 	assert(xsm);
 
-	// FIXME: have I created a race condition here?
-	if (!initialized) {
-
-		sa.sin_family = PF_INET;
-		sa.sin_addr.s_addr = inet_addr("127.0.0.1");
-		sa.sin_port = htons(atoi(CLICKPORT));
-
-		initialized = 1;
-	}
+	pthread_once(&click_sa_once, click_sa_init);
 
 	if (isBlocking(sockfd)) {
 		// make sure click know if it should reply immediately or not
@@ -257,7 +258,7 @@ int click_send(int sockfd, xia::XSocketMsg *xsm)
 	while (remaining > 0) {
 
 		//LOGF("sending to click: seq: %d type: %d", xsm->sequence(), xsm->type());
-		rc = (_f_sendto)(sockfd, p, remaining, 0, (struct sockaddr *)&sa, sizeof(sa));
+		rc = (_f_sendto)(sockfd, p, remaining, 0, (struct sockaddr *)&click_sa, sizeof(click_sa));
 
 		if (rc == -1) {
 			LOGF("click socket failure: errno = %d", errno);
@@ -292,46 +293,13 @@ int click_get(int sock, unsigned seq, char *buf, unsigned buflen, xia::XSocketMs
 		msg->set_blocking(true);
 	}
 
-	while (1) {
-		// see if another thread received and cached our packet
-		if ((rc = getCachedPacket(sock, seq, buf, buflen)) > 0) {
-
-			LOGF("Got cached response with sequence # %d\n", seq);
-			std::string s(buf, rc);
-			msg->ParseFromString(s);
-			break;
-
-		} else {
-
-			// we do this with a blocking socket even if the Xsocket is marked as nonblocking.
-			// The UDP socket is treated as an API call rather than a sock so making it
-			// non-blocking would cause problems
-			rc = (_f_recvfrom)(sock, buf, buflen - 1 , 0, NULL, NULL);
-
-			// LOGF("seq %d received %d bytes\n", seq, rc);
-
-			if (rc < 0) {
-				if (isBlocking(sock) || (errno != EWOULDBLOCK && errno != EAGAIN)) {
-					LOGF("error(%d) getting reply data from click", errno);
-				}
-				rc = -1;
-				break;
-
-			} else {
-				std::string s(buf, rc);
-				msg->ParseFromString(s);
-				assert(msg);
-				unsigned sn = msg->sequence();
-
-				if (sn == seq)
-					break;
-
-				// these are not the data you were looking for
-				LOGF("Expected packet %u, received %u, caching packet\n", seq, sn);
-				cachePacket(sock, sn, buf, buflen);
-				msg->Clear();
-			}
+	// replies meant for other threads sharing the socket are handed off to
+	// them by the state layer, so we only ever see our own here
+	if ((rc = recvReply(sock, seq, buf, buflen, msg)) < 0) {
+		if (isBlocking(sock) || (errno != EWOULDBLOCK && errno != EAGAIN)) {
+			LOGF("error(%d) getting reply data from click", errno);
 		}
+		rc = -1;
 	}
 
 	return rc;
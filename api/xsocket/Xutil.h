@@ -79,11 +79,18 @@ int getDebug(int sock);
 void setRecvTimeout(int sock, struct timeval *timeout);
 void getRecvTimeout(int sock, struct timeval *timeout);
 unsigned seqNo(int sock);
-void cachePacket(int sock, unsigned seq, char *buf, unsigned buflen);
-int getCachedPacket(int sock, unsigned seq, char *buf, unsigned buflen);
+int recvReply(int sock, unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg);
 int connectDgram(int sock, sockaddr_x *addr);
 const sockaddr_x *dgramPeer(int sock);
 
+// implementation is in Xepoll.c
+void epollForget(int sock);
+
+// resolver cache, implementation is in XgetDAGbyName.c
+int resolverLookup(const char *name, sockaddr_x *addr);
+void resolverSave(const char *name, const sockaddr_x *addr);
+void resolverForget(const char *name, const char *dag);
+
 int _xsendto(int sockfd, const void *buf, size_t len, int flags, const sockaddr_x *addr, socklen_t addrlen);
 int _xrecvfromconn(int sockfd, void *buf, size_t len, int flags);
 
@@ -21,14 +21,74 @@
 #include <map>
 #include <string>
 #include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "Xsocket.h"
 #include "Xinit.h"
 #include "Xutil.h"
 
 using namespace std;
 
+// Replies from click are demultiplexed by sequence number. Only one thread at
+// a time reads the control socket; a thread that is already waiting for its
+// reply sleeps on a futex in its own slot and the reader hands the reply over
+// through the slot without taking any locks. A waiter takes the first free
+// slot from seq % REPLY_SLOTS on, so requests that hash together don't block
+// each other.
+//
+// Replies that show up before their owner has started waiting are parked in a
+// small mutex protected overflow table instead. If every slot is taken, a
+// waiter sleeps on m_wakeups[seq % REPLY_SLOTS], which is bumped whenever the
+// overflow table gains a reply for that bucket or the reader leaves.
+#define REPLY_SLOTS 64
+
+// limit on replies nobody has claimed yet
+#define REPLY_OVERFLOW_MAX 1024
+
+// reply slot states
+#define SLOT_EMPTY		0
+#define SLOT_BUSY		1	// being updated, held only long enough to copy the reply
+#define SLOT_WAITING	2	// a thread is sleeping on the slot waiting for seq
+#define SLOT_FULL		3	// the reply for seq has arrived
+#define SLOT_KICK		4	// the waiter should recheck the overflow table and reader
+
+typedef struct {
+	int state;
+	unsigned seq;
+	string data;
+} ReplySlot;
+
+static inline int slotState(int *p)
+{
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void setSlotState(int *p, int v)
+{
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+static inline bool casSlotState(int *p, int from, int to)
+{
+	return __atomic_compare_exchange_n(p, &from, to, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void futexWait(int *p, int val)
+{
+	syscall(SYS_futex, p, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void futexWake(int *p, int n)
+{
+	syscall(SYS_futex, p, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
 class SocketState
 {
 public:
@@ -50,8 +110,7 @@ public:
 
 	unsigned seqNo();
 
-	int getPacket(unsigned seq, char *buf, unsigned buflen);
-	void insertPacket(unsigned seq, char *buf, unsigned buflen);
+	int recvReply(int sock, unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg);
 
 	void setDebug(int debug) { m_debug = debug; };
 	int getDebug() { return m_debug; };
@@ -71,6 +130,17 @@ public:
 
 	void init();
 private:
+	int takeReply(ReplySlot *slot, char *buf, unsigned buflen, xia::XSocketMsg *msg);
+	int takeOverflow(unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg);
+	void storeReply(unsigned seq, const char *buf, unsigned len);
+	ReplySlot *claimSlot(unsigned seq);
+	ReplySlot *findSlot(unsigned seq);
+	void kickSlot(unsigned seq);
+	void releaseSlot(ReplySlot *slot);
+	void releaseReader();
+	void wakeWaiter();
+	void wakeUnslotted(unsigned bucket);
+
 	int m_transportType;
 	int m_protocol;
 	int m_connected;
@@ -82,7 +152,15 @@ private:
 	unsigned m_sequence;
 	struct timeval m_timeout;
 	pthread_mutex_t m_sequence_lock;
-	map<unsigned, string> m_packets;
+
+	int m_reader;	// 1 while a thread owns reading from the control socket
+	ReplySlot m_replies[REPLY_SLOTS];
+	int m_wakeups[REPLY_SLOTS];		// bumped to wake threads that couldn't get a slot
+	int m_unslotted[REPLY_SLOTS];	// number of threads sleeping on each m_wakeups
+
+	int m_overflow;	// number of entries in m_overflow_replies
+	pthread_mutex_t m_overflow_lock;
+	map<unsigned, string> m_overflow_replies;
 
 
 };
@@ -102,8 +180,9 @@ SocketState::~SocketState()
 {
 	if (m_peer)
 		free(m_peer);
-	m_packets.clear();
+	m_overflow_replies.clear();
 	pthread_mutex_destroy(&m_sequence_lock);
+	pthread_mutex_destroy(&m_overflow_lock);
 }
 
 void SocketState::init()
@@ -120,6 +199,16 @@ void SocketState::init()
 	m_timeout.tv_sec = 0;
 	m_timeout.tv_usec = 0;
 	pthread_mutex_init(&m_sequence_lock, NULL);
+
+	m_reader = 0;
+	m_overflow = 0;
+	pthread_mutex_init(&m_overflow_lock, NULL);
+	for (int i = 0; i < REPLY_SLOTS; i++) {
+		m_replies[i].state = SLOT_EMPTY;
+		m_replies[i].seq = 0;
+		m_wakeups[i] = 0;
+		m_unslotted[i] = 0;
+	}
 }
 
 void SocketState::setTempSID(const char *sid)
@@ -137,29 +226,278 @@ void SocketState::setTempSID(const char *sid)
 	strcpy(m_temp_sid, sid);
 }
 
-int SocketState::getPacket(unsigned seq, char *buf, unsigned buflen)
+// copy a reply that another thread stored for us out of our slot
+// the caller must own the slot (state is SLOT_BUSY)
+int SocketState::takeReply(ReplySlot *slot, char *buf, unsigned buflen, xia::XSocketMsg *msg)
 {
-	int rc = 0;
-	map<unsigned, string>::iterator it;
+	int rc = MIN(buflen, slot->data.size());
+
+	memcpy(buf, slot->data.data(), rc);
+	slot->data.clear();
+	setSlotState(&slot->state, SLOT_EMPTY);
 
-	it = m_packets.find(seq);
-	if (it != m_packets.end()) {
-		string s = it->second;
+	msg->ParseFromArray(buf, rc);
+	return rc;
+}
 
-printf("getting a packet\n");
-		rc = MIN(buflen, s.size());
-		memcpy(buf, s.c_str(), rc);
+// look for a reply that arrived before we started waiting for it
+int SocketState::takeOverflow(unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg)
+{
+	int rc = -1;
 
-		m_packets.erase(seq);
+	if (slotState(&m_overflow) == 0)
+		return -1;
+
+	pthread_mutex_lock(&m_overflow_lock);
+	map<unsigned, string>::iterator it = m_overflow_replies.find(seq);
+	if (it != m_overflow_replies.end()) {
+		rc = MIN(buflen, it->second.size());
+		memcpy(buf, it->second.data(), rc);
+		m_overflow_replies.erase(it);
+		__atomic_sub_fetch(&m_overflow, 1, __ATOMIC_SEQ_CST);
 	}
+	pthread_mutex_unlock(&m_overflow_lock);
 
+	if (rc >= 0)
+		msg->ParseFromArray(buf, rc);
 	return rc;
 }
 
-void SocketState::insertPacket(unsigned seq, char *buf, unsigned buflen)
+// take the first free slot at or after seq's own, NULL if they are all in use
+ReplySlot *SocketState::claimSlot(unsigned seq)
+{
+	for (unsigned i = 0; i < REPLY_SLOTS; i++) {
+		ReplySlot *slot = &m_replies[(seq + i) % REPLY_SLOTS];
+
+		if (casSlotState(&slot->state, SLOT_EMPTY, SLOT_BUSY)) {
+			slot->seq = seq;
+			setSlotState(&slot->state, SLOT_WAITING);
+			return slot;
+		}
+	}
+	return NULL;
+}
+
+// find the slot a thread is waiting for seq in
+// the answer can go stale at once, callers recheck seq once they own the slot
+ReplySlot *SocketState::findSlot(unsigned seq)
+{
+	for (unsigned i = 0; i < REPLY_SLOTS; i++) {
+		ReplySlot *slot = &m_replies[(seq + i) % REPLY_SLOTS];
+		int st = slotState(&slot->state);
+
+		if (st != SLOT_EMPTY && slot->seq == seq)
+			return slot;
+	}
+	return NULL;
+}
+
+// hand a reply read by the current reader to the thread that is waiting for it
+void SocketState::storeReply(unsigned seq, const char *buf, unsigned len)
+{
+	ReplySlot *slot = findSlot(seq);
+
+	while (slot) {
+		int st = slotState(&slot->state);
+
+		if (st == SLOT_BUSY) {
+			sched_yield();
+			continue;
+
+		} else if ((st == SLOT_WAITING || st == SLOT_KICK) && slot->seq == seq) {
+			if (!casSlotState(&slot->state, st, SLOT_BUSY))
+				continue;
+
+			if (slot->seq == seq) {
+				slot->data.assign(buf, len);
+				setSlotState(&slot->state, SLOT_FULL);
+				futexWake(&slot->state, 1);
+				return;
+			}
+
+			// the slot was recycled while we were looking at it
+			setSlotState(&slot->state, st);
+		}
+		break;
+	}
+
+	// nobody is waiting in the slot for this reply (yet)
+	pthread_mutex_lock(&m_overflow_lock);
+	if (m_overflow_replies.size() >= REPLY_OVERFLOW_MAX) {
+		// drop the oldest unclaimed reply so unsolicited messages can't pile up
+		m_overflow_replies.erase(m_overflow_replies.begin());
+		__atomic_sub_fetch(&m_overflow, 1, __ATOMIC_SEQ_CST);
+	}
+	m_overflow_replies[seq].assign(buf, len);
+	__atomic_add_fetch(&m_overflow, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&m_overflow_lock);
+
+	// the owner may have started waiting after we looked for its slot
+	kickSlot(seq);
+	wakeUnslotted(seq % REPLY_SLOTS);
+}
+
+// wake the thread waiting for seq so it rechecks the overflow table and reader
+void SocketState::kickSlot(unsigned seq)
 {
-	std::string s(buf, buflen);
-	m_packets[seq] = s;
+	ReplySlot *slot = findSlot(seq);
+
+	if (slot && slot->seq == seq && casSlotState(&slot->state, SLOT_WAITING, SLOT_KICK))
+		futexWake(&slot->state, 1);
+}
+
+// wake the threads in bucket that found every slot taken so they look again
+void SocketState::wakeUnslotted(unsigned bucket)
+{
+	__atomic_add_fetch(&m_wakeups[bucket], 1, __ATOMIC_SEQ_CST);
+	if (slotState(&m_unslotted[bucket]) > 0)
+		futexWake(&m_wakeups[bucket], INT_MAX);
+}
+
+// stop waiting in a slot we registered in
+void SocketState::releaseSlot(ReplySlot *slot)
+{
+	while (1) {
+		int st = slotState(&slot->state);
+
+		if (st == SLOT_BUSY) {
+			sched_yield();
+		} else if (casSlotState(&slot->state, st, SLOT_EMPTY)) {
+			break;
+		}
+	}
+}
+
+// give up ownership of the control socket and wake a waiting thread so it can take over
+void SocketState::releaseReader()
+{
+	setSlotState(&m_reader, 0);
+	wakeWaiter();
+}
+
+// wake a thread sleeping in a slot, or failing that the ones without, so
+// that someone takes over reading
+void SocketState::wakeWaiter()
+{
+	for (int i = 0; i < REPLY_SLOTS; i++) {
+		if (casSlotState(&m_replies[i].state, SLOT_WAITING, SLOT_KICK)) {
+			futexWake(&m_replies[i].state, 1);
+			return;
+		}
+	}
+	for (int i = 0; i < REPLY_SLOTS; i++) {
+		if (slotState(&m_unslotted[i]) > 0) {
+			wakeUnslotted(i);
+			return;
+		}
+	}
+}
+
+// wait for the reply to request seq
+//
+// The first waiting thread becomes the reader and pulls replies off the socket
+// until it gets its own, handing the others off as it goes. The remaining
+// threads sleep until either their reply is handed to them or the reader
+// leaves and they are asked to take over.
+int SocketState::recvReply(int sock, unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg)
+{
+	ReplySlot *slot = NULL;
+	unsigned bucket = seq % REPLY_SLOTS;
+	bool registered = false;
+	int wakeups = 0;
+	int rc;
+
+	while (1) {
+		if (!registered) {
+			// with every slot taken we can still be the reader or find our
+			// reply in the overflow table, we just sleep on m_wakeups instead
+			if ((slot = claimSlot(seq)) != NULL) {
+				registered = true;
+			} else {
+				__atomic_add_fetch(&m_unslotted[bucket], 1, __ATOMIC_SEQ_CST);
+				wakeups = slotState(&m_wakeups[bucket]);
+			}
+
+		} else {
+			int st = slotState(&slot->state);
+
+			if (st == SLOT_FULL) {
+				casSlotState(&slot->state, SLOT_FULL, SLOT_BUSY);
+				return takeReply(slot, buf, buflen, msg);
+
+			} else if (st == SLOT_BUSY) {
+				sched_yield();
+				continue;
+
+			} else if (st == SLOT_KICK) {
+				setSlotState(&slot->state, SLOT_WAITING);
+			}
+		}
+
+		if ((rc = takeOverflow(seq, buf, buflen, msg)) >= 0) {
+			if (registered)
+				releaseSlot(slot);
+			else
+				__atomic_sub_fetch(&m_unslotted[bucket], 1, __ATOMIC_SEQ_CST);
+
+			// we may have been woken to take over reading, pass that on
+			if (slotState(&m_reader) == 0)
+				wakeWaiter();
+			return rc;
+		}
+
+		if (casSlotState(&m_reader, 0, 1)) {
+			if (!registered)
+				__atomic_sub_fetch(&m_unslotted[bucket], 1, __ATOMIC_SEQ_CST);
+			break;
+		}
+
+		if (registered) {
+			futexWait(&slot->state, SLOT_WAITING);
+		} else {
+			futexWait(&m_wakeups[bucket], wakeups);
+			__atomic_sub_fetch(&m_unslotted[bucket], 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	// we are the reader now
+	while (1) {
+		// the previous reader may have handed us our reply just before leaving
+		if (registered && casSlotState(&slot->state, SLOT_FULL, SLOT_BUSY)) {
+			rc = takeReply(slot, buf, buflen, msg);
+			registered = false;
+			break;
+		}
+		if ((rc = takeOverflow(seq, buf, buflen, msg)) >= 0)
+			break;
+
+		// we do this with a blocking socket even if the Xsocket is marked as nonblocking.
+		// The UDP socket is treated as an API call rather than a sock so making it
+		// non-blocking would cause problems
+		rc = (_f_recvfrom)(sock, buf, buflen - 1 , 0, NULL, NULL);
+
+		if (rc < 0)
+			break;
+
+		msg->ParseFromArray(buf, rc);
+		unsigned sn = msg->sequence();
+
+		if (sn == seq)
+			break;
+
+		// these are not the data you were looking for
+		LOGF("Expected packet %u, received %u, handing it off\n", seq, sn);
+		storeReply(sn, buf, rc);
+		msg->Clear();
+	}
+
+	int eno = errno;
+	if (registered)
+		releaseSlot(slot);
+	releaseReader();
+	errno = eno;
+
+	return rc;
 }
 
 unsigned SocketState::seqNo()
@@ -427,24 +765,17 @@ unsigned seqNo(int sock)
 		return 0;
 }
 
-void cachePacket(int sock, unsigned seq, char *buf, unsigned buflen)
+int recvReply(int sock, unsigned seq, char *buf, unsigned buflen, xia::XSocketMsg *msg)
 {
-printf("adding cached packet\n");
 	SocketState *sstate = SocketMap::getMap()->get(sock);
-	if (sstate) {
-		sstate->insertPacket(seq, buf, buflen);
-	}
-}
 
-int getCachedPacket(int sock, unsigned seq, char *buf, unsigned buflen)
-{
-	int rc = 0;
-	SocketState *sstate = SocketMap::getMap()->get(sock);
-
-	if (sstate) {
-		rc = sstate->getPacket(seq, buf, buflen);
-	}
+	if (sstate)
+		return sstate->recvReply(sock, seq, buf, buflen, msg);
 
+	// no state to demultiplex with, just take the next reply
+	int rc = (_f_recvfrom)(sock, buf, buflen - 1 , 0, NULL, NULL);
+	if (rc >= 0)
+		msg->ParseFromArray(buf, rc);
 	return rc;
 }
 
@@ -0,0 +1,97 @@
+#include <sys/epoll.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include "Xsocket.h"
+#include "../Xinit.h"
+
+int test(int epfd, int maxevents, int timeout)
+{
+	struct epoll_event events[10];
+	int e;
+
+	printf("epfd:%d maxevents:%d timeout:%d\n", epfd, maxevents, timeout);
+
+	time_t start = time(NULL);
+	errno = 0;
+	int rc = Xepoll_wait(epfd, events, maxevents, timeout);
+	e = errno;
+	time_t end = time(NULL);
+
+	printf("rc:%d errno:%d, elapsed:%d\n", rc, e, (int)(end - start));
+
+	for (int i = 0; i < rc; i++)
+		printf("sock:%d flags:%x\n", events[i].data.fd, events[i].events);
+	printf("\n");
+
+	return rc;
+}
+
+int ctl(int epfd, int op, int sock, unsigned flags)
+{
+	struct epoll_event ev;
+
+	ev.events = flags;
+	ev.data.fd = sock;
+
+	errno = 0;
+	int rc = Xepoll_ctl(epfd, op, sock, &ev);
+	printf("ctl op:%d sock:%d flags:%x rc:%d errno:%d\n", op, sock, flags, rc, errno);
+
+	return rc;
+}
+
+int main()
+{
+	get_conf();
+
+	int epfd = Xepoll_create(0);
+	printf("epoll fd = %d\n", epfd);
+
+	printf("bad parameters\n");
+	test(epfd, 0, 1000);
+	test(999, 1, 1000);
+
+	printf("empty interest set (timeout)\n");
+	test(epfd, 10, 1000);
+
+	int s0 = Xsocket(AF_XIA, SOCK_DGRAM, 0);
+	int s1 = Xsocket(AF_XIA, SOCK_DGRAM, 0);
+	int s2 = Xsocket(AF_XIA, SOCK_STREAM, 0);
+	printf("sockets = %d %d %d\n", s0, s1, s2);
+
+	printf("non-xsocket (EPERM)\n");
+	ctl(epfd, EPOLL_CTL_ADD, 2, EPOLLIN);
+
+	printf("datagram sockets are writable as soon as they are added\n");
+	ctl(epfd, EPOLL_CTL_ADD, s0, EPOLLIN | EPOLLOUT);
+	ctl(epfd, EPOLL_CTL_ADD, s1, EPOLLOUT);
+	test(epfd, 10, 1000);
+
+	printf("edge triggered, nothing changed (timeout)\n");
+	test(epfd, 10, 1000);
+
+	printf("duplicate add (EEXIST)\n");
+	ctl(epfd, EPOLL_CTL_ADD, s0, EPOLLIN);
+
+	printf("unconnected stream socket (timeout)\n");
+	ctl(epfd, EPOLL_CTL_ADD, s2, EPOLLOUT);
+	test(epfd, 10, 1000);
+
+	printf("events split over several calls\n");
+	ctl(epfd, EPOLL_CTL_MOD, s0, EPOLLOUT);
+	ctl(epfd, EPOLL_CTL_MOD, s1, EPOLLOUT);
+	test(epfd, 1, 1000);
+	test(epfd, 1, 1000);
+
+	printf("delete, then delete again (ENOENT)\n");
+	ctl(epfd, EPOLL_CTL_DEL, s1, 0);
+	ctl(epfd, EPOLL_CTL_DEL, s1, 0);
+
+	Xclose(s0);
+	Xclose(s1);
+	Xclose(s2);
+	Xepoll_close(epfd);
+
+	return 0;
+}
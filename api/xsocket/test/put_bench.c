@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "Xsocket.h"
+#include "../Xinit.h"
+
+// publish throughput of XputChunk() one at a time, XputBuffer(),
+// XputBufferAsync() and XputBufferCDC()
+//
+// usage: put_bench [total bytes] [chunk size]
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int finished;
+static int asyncErr;
+static unsigned asyncChunks;
+
+double now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+void report(const char *name, int chunks, size_t bytes, double elapsed)
+{
+	if (chunks < 0) {
+		printf("%-16s failed: %s\n", name, strerror(errno));
+		return;
+	}
+	printf("%-16s %8d chunks %10.3f s %10.1f MB/s %10.0f chunks/s\n", name, chunks, elapsed,
+			bytes / elapsed / 1e6, chunks / elapsed);
+}
+
+void done(const ChunkInfo *info, unsigned index, int err, void * /* arg */)
+{
+	if (info)
+		return;
+
+	pthread_mutex_lock(&lock);
+	asyncChunks = index;
+	asyncErr = err;
+	finished = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+int main(int argc, char **argv)
+{
+	size_t total = argc > 1 ? strtoul(argv[1], NULL, 0) : 64 * 1024 * 1024;
+	unsigned chunkSize = argc > 2 ? strtoul(argv[2], NULL, 0) : 8192;
+	ChunkInfo *info;
+	double start;
+	int rc;
+
+	get_conf();
+
+	char *data = (char *)malloc(total);
+	if (!data) {
+		printf("unable to allocate %lu bytes\n", total);
+		return 1;
+	}
+	for (size_t i = 0; i < total; i++)
+		data[i] = rand();
+
+	ChunkContext *ctx = XallocCacheSlice(POLICY_FIFO | POLICY_REMOVE_ON_EXIT, 0, 2 * total);
+	if (!ctx) {
+		printf("unable to allocate a cache slice\n");
+		return 1;
+	}
+
+	printf("%lu bytes in %u byte chunks\n", total, chunkSize);
+
+	// one round trip per chunk, as XputBuffer() used to work
+	start = now();
+	rc = 0;
+	for (size_t off = 0; off < total; off += chunkSize) {
+		ChunkInfo ci;
+		if (XputChunk(ctx, data + off, MIN(total - off, chunkSize), &ci) < 0) {
+			rc = -1;
+			break;
+		}
+		rc++;
+	}
+	report("XputChunk loop", rc, total, now() - start);
+
+	start = now();
+	rc = XputBuffer(ctx, data, total, chunkSize, &info);
+	report("XputBuffer", rc, total, now() - start);
+	XfreeChunkInfo(info);
+
+	ChunkManifest manifest;
+	start = now();
+	rc = XputBufferCDC(ctx, data, total, NULL, NULL, &manifest);
+	report("XputBufferCDC", rc, total, now() - start);
+	if (rc >= 0)
+		XmanifestFree(&manifest);
+
+	start = now();
+	if (XputBufferAsync(ctx, data, total, chunkSize, done, NULL) < 0) {
+		report("XputBufferAsync", -1, total, 0);
+	} else {
+		pthread_mutex_lock(&lock);
+		while (!finished)
+			pthread_cond_wait(&cond, &lock);
+		pthread_mutex_unlock(&lock);
+
+		errno = asyncErr;
+		report("XputBufferAsync", asyncErr ? -1 : (int)asyncChunks, total, now() - start);
+	}
+
+	XfreeCacheSlice(ctx);
+	free(data);
+	return 0;
+}
@@ -420,6 +420,42 @@ TEST(XgetDAGbyName, BadName)
 	EXPECT_EQ(-1, XgetDAGbyName(BAD_NAME, &sa, &len));
 }
 
+TEST(XgetDAGbyName, RegisterAfterMiss)
+{
+	sockaddr_x sa;
+	socklen_t len = sizeof(sa);
+	const char *name = "cached.miss.name";
+
+	// the miss is remembered, but registering the name must replace it
+	EXPECT_EQ(-1, XgetDAGbyName(name, &sa, &len));
+	Graph g(TEST_DAG);
+	g.fill_sockaddr(&sa);
+	EXPECT_EQ(0, XregisterName(name, &sa));
+	memset(&sa, 0, sizeof(sa));
+	EXPECT_EQ(0, XgetDAGbyName(name, &sa, &len));
+	Graph g1(&sa);
+	EXPECT_EQ(3, g1.num_nodes());
+}
+
+TEST(XgetDAGbyName, Batch)
+{
+	const char *names[] = { "batch1.test.name", "batch2.test.name", "batch1.test.name", BAD_NAME };
+	sockaddr_x sa[4];
+	int results[4];
+	Graph g(TEST_DAG);
+
+	for (int i = 0; i < 4; i++)
+		g.fill_sockaddr(&sa[i]);
+	EXPECT_EQ(3, XregisterNameBatch(names, sa, results, 3));
+
+	memset(sa, 0, sizeof(sa));
+	EXPECT_EQ(3, XgetDAGbyNameBatch(names, sa, results, 4));
+	EXPECT_EQ(0, results[2]);
+	EXPECT_EQ(ENOENT, results[3]);
+	Graph g1(&sa[1]);
+	EXPECT_EQ(3, g1.num_nodes());
+}
+
 // Xgetaddrinfo ***************************************************************
 
 class XgetaddrinfoTest : public ::testing::Test {
@@ -6,6 +6,7 @@
 #include <click/confparse.hh>
 #include <click/packet_anno.hh>
 #include <click/xiacontentheader.hh>
+#include <click/xiaheader.hh>
 #include <click/string.hh>
 #include <clicknet/xia.h>
 #include <click/packet.hh>
@@ -16,6 +17,8 @@
 CLICK_DECLS
 
 XIACache::XIACache()
+    : _pit_lifetime(1, 0), _pit_aggregated(0), _pit_fanout(0),
+      _store_size(STORE_SIZE)
 {
     cp_xid_type("CID", &_cid_type);   
     // oldPartial=contentTable;
@@ -42,6 +45,17 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
     int pkt_size=0;
 	int malicious=0;
     bool cache_content_from_network =true;
+    uint32_t cache_size = CACHESIZE;
+    String policy = "s3fifo";
+    uint32_t train_budget = TRAIN_BUDGET;
+    uint32_t train_threshold = TRAIN_THRESHOLD;
+    bool admission = true;
+    uint32_t pace_rate = PACE_RATE;
+    uint32_t pace_total = PACE_TOTAL;
+    uint32_t pace_queue = PACE_QUEUE;
+    int prefetch = PREFETCH_DEPTH;
+    uint32_t prefetch_rate = PREFETCH_RATE;
+    uint32_t prefetch_memory = PREFETCH_MEMORY;
 
     if (cp_va_kparse(conf, this, errh,
 		"LOCAL_ADDR", cpkP+cpkM, cpXIAPath, &local_addr,
@@ -49,9 +63,50 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
 		"CACHE_CONTENT_FROM_NETWORK", cpkP, cpBool, &cache_content_from_network,
 		"PACKET_SIZE", 0, cpInteger, &pkt_size,
 		"MALICIOUS", 0, cpInteger, &malicious,
+		"CACHE_SIZE", 0, cpUnsigned, &cache_size,
+		"CACHE_POLICY", 0, cpWord, &policy,
+		"TRAIN_BUDGET", 0, cpUnsigned, &train_budget,
+		"TRAIN_THRESHOLD", 0, cpUnsigned, &train_threshold,
+		"PIT_LIFETIME", 0, cpTimestamp, &_pit_lifetime,
+		"ADMISSION", 0, cpBool, &admission,
+		"STORE_FILE", 0, cpFilename, &_store_file,
+		"STORE_SIZE", 0, cpUnsigned64, &_store_size,
+		"PARTIAL_TIMEOUT", 0, cpTimestamp, &_content_module->_partial_timeout,
+		"PACE_RATE", 0, cpUnsigned, &pace_rate,
+		"PACE_TOTAL", 0, cpUnsigned, &pace_total,
+		"PACE_QUEUE", 0, cpUnsigned, &pace_queue,
+		"PREFETCH", 0, cpInteger, &prefetch,
+		"PREFETCH_RATE", 0, cpUnsigned, &prefetch_rate,
+		"PREFETCH_MEMORY", 0, cpUnsigned, &prefetch_memory,
 		cpEnd) < 0)
 	return -1;   
 
+	// size and replacement policy of the cache used for chunks seen while forwarding
+	int p = CReplacer::parse_policy(policy);
+	if (p < 0)
+		return errh->error("CACHE_POLICY must be one of lru, fifo, clock or s3fifo");
+	_content_module->_cache.set_policy(p);
+	_content_module->_cache_size = cache_size;
+	_content_module->_admission_enabled = admission;
+	// chunk popularity is taken from requests passing through when we see them
+	_content_module->_record_responses = (ninputs() < 3);
+
+	// pre-built responses for frequently requested chunks
+	_content_module->_train_budget = train_budget;
+	_content_module->_train_threshold = train_threshold;
+
+	// pacing of responses to each requester
+	_content_module->_pacer.set_rate(pace_rate);
+	_content_module->_pacer.set_total(pace_total);
+	_content_module->_pacer.set_limit(pace_queue);
+
+	// fetching ahead of readers of manifests
+	if (prefetch < 0)
+		return errh->error("PREFETCH must not be negative");
+	_content_module->_prefetch.set_depth(prefetch);
+	_content_module->_prefetch.set_rate(prefetch_rate);
+	_content_module->_prefetch.set_memory(prefetch_memory);
+
 	// Tell the content module whether or not it is malicious
 	_content_module->malicious = malicious;
 
@@ -86,7 +141,25 @@ XIACache::configure(Vector<String> &conf, ErrorHandler *errh)
     return 0;
 }
 
+int
+XIACache::initialize(ErrorHandler *errh)
+{
+    _content_module->initialize(this);
+    if (!_store_file)
+	return 0;
 
+    // the route table is configured by now, so stored chunks can be routed here
+    CStore *store = new CStore;
+    if (store->open(_store_file, _store_size, errh) < 0) {
+	delete store;
+	return -1;
+    }
+    _content_module->_store = store;
+    int n = _content_module->restore_routes();
+    if (n)
+	click_chatter("%s: restored %d chunks from %s", declaration().c_str(), n, _store_file.c_str());
+    return 0;
+}
 
 void XIACache::push(int port, Packet *p)
 {
@@ -105,6 +178,36 @@ void XIACache::push(int port, Packet *p)
 
     XID dstID(__dstID);
     XID srcID(__srcID);
+
+    if (port == 2) {
+	// a request passing through, hold it back if the chunk is already on its way
+	if (dst_xid_type == _cid_type) {
+	    _content_module->_admission.record(dstID);
+	    _content_module->_cache_misses++;
+
+	    // our own request for a chunk we have part of only asks for the rest
+	    Vector<Packet *> ranges;
+	    if (hdr->snode >= 2 && XID(hdr->node[hdr->dnode + hdr->snode - 2].xid) == _local_hid
+		    && _content_module->request_missing(p, dstID, ranges)) {
+		p->kill();
+		for (int i = 0; i < ranges.size(); i++)
+		    pit_request(ranges[i], dstID);
+		_content_module->_range_requests += ranges.size();
+		return;
+	    }
+	    // not for the chunks we prefetch ourselves, or they would prefetch more.
+	    // A reader asking for a chunk whose prefetch is still in flight is
+	    // aggregated onto it below.
+	    if (srcID != _local_hid) {
+		_content_module->_prefetch.claim(dstID);
+		_content_module->prefetch_after(p, dstID, true);
+	    }
+	    pit_request(p, dstID);
+	}
+	else
+	    output(2).push(p);
+	return;
+    }
     
 
 
@@ -115,7 +218,16 @@ void XIACache::push(int port, Packet *p)
 		XID dsthdr(hdr->node[i].xid);
 // 		click_chatter("PUT/REMOVE/FWD: dnode: %d, snode: %d,  i: %d, ID -> %s\n", hdr->dnode , hdr->snode, i, dsthdr.unparse().c_str() );
 	}
+
+	// neither cache nor fan out a fragment that fails its Merkle proof
+	if (port == 0 && !_content_module->verify_fragment(p, srcID)) {
+	    p->kill();
+	    return;
+	}
 	
+	if (port == 0 && _pit.size())
+	    pit_response(p, srcID);
+
 	__dstID =  hdr->node[hdr->dnode - 2].xid;
 	XID dstHID(__dstID);
 // 	click_chatter("dstHID: %s\n", dstHID.unparse().c_str() );
@@ -144,6 +256,144 @@ void XIACache::push(int port, Packet *p)
     }
 }
 
+void
+XIACache::pit_request(Packet *p, const XID &cid)
+{
+    // a range request only brings back part of the chunk, so it neither
+    // waits on another request nor has others wait on it
+    ContentHeader ch(p);
+    if (ch.chunk_offset() || ch.range_length()) {
+	output(2).push(p);
+	return;
+    }
+
+    const struct click_xia *hdr = p->xia_header();
+    String requester((const char *)(hdr->node + hdr->dnode), hdr->snode * sizeof(click_xia_xid_node));
+    Timestamp now = Timestamp::now();
+
+    HashTable<XID, PendingRequest>::iterator it = _pit.find(cid);
+    if (it != _pit.end() && it->second.expires > now) {
+	PendingRequest &pr = it->second;
+
+	// once the response is flowing, late requesters would miss its start
+	if (!pr.responding) {
+	    int i;
+	    for (i = 0; i < pr.requesters.size(); i++)
+		if (pr.requesters[i] == requester)
+		    break;
+	    if (i == pr.requesters.size()) {
+		pr.requesters.push_back(requester);
+		_pit_aggregated++;
+		p->kill();
+		return;
+	    }
+	}
+	// otherwise this is a retransmission, let it through
+	output(2).push(p);
+	return;
+    }
+
+    if (it == _pit.end() && _pit.size() >= PIT_MAX_ENTRIES) {
+	pit_expire(now);
+	if (_pit.size() >= PIT_MAX_ENTRIES) {
+	    output(2).push(p);
+	    return;
+	}
+    }
+
+    PendingRequest &pr = _pit[cid];
+    pr.requesters.clear();
+    pr.requesters.push_back(requester);
+    pr.expires = now + _pit_lifetime;
+    pr.responding = false;
+    output(2).push(p);
+}
+
+// compare the XIDs of two node lists, ignoring the edges routers mark visited
+static bool
+same_nodes(const click_xia_xid_node *a, const click_xia_xid_node *b, int n)
+{
+    for (int i = 0; i < n; i++)
+	if (memcmp(&a[i].xid, &b[i].xid, sizeof(a[i].xid)) != 0)
+	    return false;
+    return true;
+}
+
+void
+XIACache::pit_response(Packet *p, const XID &cid)
+{
+    HashTable<XID, PendingRequest>::iterator it = _pit.find(cid);
+    if (it == _pit.end())
+	return;
+
+    Timestamp now = Timestamp::now();
+    PendingRequest &pr = it->second;
+    if (pr.expires <= now) {
+	_pit.erase(it);
+	return;
+    }
+    pr.responding = true;
+    pr.expires = now + _pit_lifetime;
+
+    // send a copy of each fragment to everyone but the requester it is addressed to
+    const struct click_xia *hdr = p->xia_header();
+    for (int i = 0; i < pr.requesters.size(); i++) {
+	const String &r = pr.requesters[i];
+	int n = r.length() / sizeof(click_xia_xid_node);
+
+	if (n == hdr->dnode && same_nodes((const click_xia_xid_node *)r.data(), hdr->node, n))
+	    continue;
+
+	WritablePacket *q = readdress(p, r);
+	if (q) {
+	    _pit_fanout++;
+	    output(0).push(q);
+	}
+    }
+}
+
+void
+XIACache::pit_expire(const Timestamp &now)
+{
+    HashTable<XID, PendingRequest>::iterator it = _pit.begin();
+    while (it != _pit.end()) {
+	if (it->second.expires <= now)
+	    it = _pit.erase(it);
+	else
+	    ++it;
+    }
+}
+
+// copy a response fragment, addressed to dst instead
+WritablePacket *
+XIACache::readdress(Packet *p, const String &dst)
+{
+    const struct click_xia *hdr = p->xia_header();
+    size_t hlen = XIAHeader::hdr_size(hdr->dnode + hdr->snode);
+    const unsigned char *rest = reinterpret_cast<const unsigned char *>(hdr) + hlen;
+    size_t restlen = p->end_data() - rest;
+    uint8_t dnode = dst.length() / sizeof(click_xia_xid_node);
+    size_t slen = hdr->snode * sizeof(click_xia_xid_node);
+
+    WritablePacket *q = Packet::make(Packet::default_headroom, 0,
+	    sizeof(struct click_xia) + dst.length() + slen + restlen, 0);
+    if (!q)
+	return 0;
+
+    struct click_xia *xiah = reinterpret_cast<struct click_xia *>(q->data());
+    *xiah = *hdr;
+    xiah->dnode = dnode;
+    xiah->last = -1;	// same as a freshly built header
+    xiah->hlim = 250;
+    memcpy(xiah->node, dst.data(), dst.length());
+    memcpy(xiah->node + dnode, hdr->node + hdr->dnode, slen);
+    memcpy(xiah->node + dnode + hdr->snode, rest, restlen);
+
+    q->set_xia_header(xiah, XIAHeader::hdr_size(dnode + hdr->snode));
+    q->timestamp_anno() = Timestamp::now();
+    return q;
+}
+
 int
 XIACache::set_malicious(int m)
 {
@@ -156,7 +406,15 @@ int XIACache::get_malicious()
 	return _content_module->malicious;
 }
 
-enum {H_MOVE, MALICIOUS};
+enum {H_MOVE, MALICIOUS, CACHE_POLICY, CACHE_SIZE, CACHE_USED, CACHE_CHUNKS, CACHE_EVICTIONS, CACHE_MEMORY,
+	H_TRAIN_BUDGET, H_TRAIN_THRESHOLD, H_TRAIN_BYTES, H_TRAIN_COUNT, H_TRAIN_HITS,
+	H_PIT_LIFETIME, H_PIT_COUNT, H_PIT_AGGREGATED, H_PIT_FANOUT,
+	H_ADMISSION, H_ADMITTED, H_REJECTED, H_CACHE_HITS, H_CACHE_MISSES, H_CACHE_HIT_RATE,
+	H_STORE_CAPACITY, H_STORE_BYTES, H_STORE_COUNT, H_STORE_WRITES, H_STORE_DROPS, H_STORE_READS,
+	H_PARTIAL_TIMEOUT, H_EXPIRED, H_RANGE_REQUESTS, H_MERKLE_REJECTED,
+	H_PACE_RATE, H_PACE_TOTAL, H_PACE_QUEUE, H_PACE_QUEUED, H_PACE_FLOWS, H_PACE_SENT, H_PACE_DROPS,
+	H_PREFETCH, H_PREFETCH_RATE, H_PREFETCH_MEMORY, H_PREFETCH_MANIFESTS, H_PREFETCH_OUTSTANDING,
+	H_PREFETCH_SENT, H_PREFETCH_HITS, H_PREFETCH_REFUSED};
 
 int XIACache::write_param(const String &conf, Element *e, void *vparam,
                 ErrorHandler *errh)
@@ -172,14 +430,100 @@ int XIACache::write_param(const String &conf, Element *e, void *vparam,
             f->_local_addr = local_addr;
             //click_chatter("%s",local_addr.unparse().c_str());
             f->_local_hid = local_addr.xid(local_addr.destination_node());
-            
-            
+
+            // trains carry the old address as their source
+            f->_content_module->clear_trains();
         } break;
 
 		case MALICIOUS: {
 			f->set_malicious(atoi(conf.c_str()));
 		} break;
 
+		case CACHE_POLICY: {
+			int p = CReplacer::parse_policy(cp_uncomment(conf));
+			if (p < 0)
+				return errh->error("policy must be one of lru, fifo, clock or s3fifo");
+			f->_content_module->_cache.set_policy(p);
+		} break;
+
+		case CACHE_SIZE: {
+			uint32_t size;
+			if (!cp_unsigned(cp_uncomment(conf), &size))
+				return errh->error("size must be an unsigned integer");
+			f->_content_module->_cache_size = size;
+			f->_content_module->MakeSpace(0);
+		} break;
+
+		case H_TRAIN_BUDGET: {
+			uint32_t budget;
+			if (!cp_unsigned(cp_uncomment(conf), &budget))
+				return errh->error("budget must be an unsigned integer");
+			XIAContentModule *cm = f->_content_module;
+			cm->_train_budget = budget;
+			while (cm->_train_bytes > cm->_train_budget)
+				cm->drop_train(cm->_train_lru.back());
+		} break;
+
+		case H_TRAIN_THRESHOLD: {
+			uint32_t threshold;
+			if (!cp_unsigned(cp_uncomment(conf), &threshold))
+				return errh->error("threshold must be an unsigned integer");
+			f->_content_module->_train_threshold = threshold;
+		} break;
+
+		case H_PIT_LIFETIME: {
+			Timestamp lifetime;
+			if (!cp_time(cp_uncomment(conf), &lifetime))
+				return errh->error("lifetime must be a time");
+			f->_pit_lifetime = lifetime;
+		} break;
+
+		case H_PARTIAL_TIMEOUT: {
+			Timestamp timeout;
+			if (!cp_time(cp_uncomment(conf), &timeout))
+				return errh->error("timeout must be a time");
+			f->_content_module->_partial_timeout = timeout;
+		} break;
+
+		case H_PACE_RATE:
+		case H_PACE_TOTAL:
+		case H_PACE_QUEUE: {
+			uint32_t v;
+			if (!cp_unsigned(cp_uncomment(conf), &v))
+				return errh->error("value must be an unsigned integer");
+			CPacer &pacer = f->_content_module->_pacer;
+			if ((intptr_t)vparam == H_PACE_RATE)
+				pacer.set_rate(v);
+			else if ((intptr_t)vparam == H_PACE_TOTAL)
+				pacer.set_total(v);
+			else
+				pacer.set_limit(v);
+			// let whatever is queued go at the new rate
+			f->_content_module->run_pacer();
+		} break;
+
+		case H_PREFETCH:
+		case H_PREFETCH_RATE:
+		case H_PREFETCH_MEMORY: {
+			uint32_t v;
+			if (!cp_unsigned(cp_uncomment(conf), &v))
+				return errh->error("value must be an unsigned integer");
+			CPrefetch &prefetch = f->_content_module->_prefetch;
+			if ((intptr_t)vparam == H_PREFETCH)
+				prefetch.set_depth(v);
+			else if ((intptr_t)vparam == H_PREFETCH_RATE)
+				prefetch.set_rate(v);
+			else
+				prefetch.set_memory(v);
+		} break;
+
+		case H_ADMISSION: {
+			bool admission;
+			if (!cp_bool(cp_uncomment(conf), &admission))
+				return errh->error("admission must be true or false");
+			f->_content_module->_admission_enabled = admission;
+		} break;
+
         default: break;
     }
     return 0;
@@ -193,6 +537,111 @@ XIACache::read_handler(Element *e, void *thunk)
 		case MALICIOUS:
 			return String(c->get_malicious());
 
+		case CACHE_POLICY:
+			return CReplacer::unparse_policy(c->_content_module->_cache.policy());
+		case CACHE_SIZE:
+			return String(c->_content_module->_cache_size);
+		case CACHE_USED:
+			return String(c->_content_module->_cache.bytes());
+		case CACHE_CHUNKS:
+			return String(c->_content_module->_cache.count());
+		case CACHE_EVICTIONS:
+			return String(c->_content_module->_cache.evictions());
+		case CACHE_MEMORY: {
+			CArena &a = c->_content_module->_arena;
+			return "used " + String(a.used_bytes()) + "\nslabs " + String(a.slab_bytes())
+				+ "\nlarge " + String(a.large_bytes()) + "\nfailed " + String(a.failures()) + "\n";
+		}
+		case H_TRAIN_BUDGET:
+			return String((unsigned long)c->_content_module->_train_budget);
+		case H_TRAIN_THRESHOLD:
+			return String(c->_content_module->_train_threshold);
+		case H_TRAIN_BYTES:
+			return String((unsigned long)c->_content_module->_train_bytes);
+		case H_TRAIN_COUNT:
+			return String(c->_content_module->_trains.size());
+		case H_TRAIN_HITS:
+			return String(c->_content_module->_train_hits);
+		case H_PIT_LIFETIME:
+			return c->_pit_lifetime.unparse();
+		case H_PIT_COUNT:
+			return String(c->_pit.size());
+		case H_PIT_AGGREGATED:
+			return String(c->_pit_aggregated);
+		case H_PIT_FANOUT:
+			return String(c->_pit_fanout);
+		case H_ADMISSION:
+			return String(c->_content_module->_admission_enabled);
+		case H_ADMITTED:
+			return String(c->_content_module->_admitted);
+		case H_REJECTED:
+			return String(c->_content_module->_rejected);
+		case H_CACHE_HITS:
+			return String(c->_content_module->_cache_hits);
+		case H_CACHE_MISSES:
+			return String(c->_content_module->_cache_misses);
+		case H_PARTIAL_TIMEOUT:
+			return c->_content_module->_partial_timeout.unparse();
+		case H_EXPIRED:
+			return String(c->_content_module->_expired);
+		case H_RANGE_REQUESTS:
+			return String(c->_content_module->_range_requests);
+		case H_MERKLE_REJECTED:
+			return String(c->_content_module->_merkle_rejected);
+		case H_PACE_RATE:
+			return String(c->_content_module->_pacer.rate());
+		case H_PACE_TOTAL:
+			return String(c->_content_module->_pacer.total());
+		case H_PACE_QUEUE:
+			return String((unsigned long)c->_content_module->_pacer.limit());
+		case H_PACE_QUEUED:
+			return String((unsigned long)c->_content_module->_pacer.queued());
+		case H_PACE_FLOWS:
+			return String(c->_content_module->_pacer.flows());
+		case H_PACE_SENT:
+			return String(c->_content_module->_pacer.sent());
+		case H_PACE_DROPS:
+			return String(c->_content_module->_pacer.drops());
+		case H_PREFETCH:
+			return String(c->_content_module->_prefetch.depth());
+		case H_PREFETCH_RATE:
+			return String(c->_content_module->_prefetch.rate());
+		case H_PREFETCH_MEMORY:
+			return String((unsigned long)c->_content_module->_prefetch.memory());
+		case H_PREFETCH_MANIFESTS:
+			return String(c->_content_module->_prefetch.manifests());
+		case H_PREFETCH_OUTSTANDING:
+			return String((unsigned long)c->_content_module->_prefetch.outstanding());
+		case H_PREFETCH_SENT:
+			return String(c->_content_module->_prefetch.sent());
+		case H_PREFETCH_HITS:
+			return String(c->_content_module->_prefetch.hits());
+		case H_PREFETCH_REFUSED:
+			return String(c->_content_module->_prefetch.refused());
+		case H_STORE_CAPACITY:
+		case H_STORE_BYTES:
+		case H_STORE_COUNT:
+		case H_STORE_WRITES:
+		case H_STORE_DROPS:
+		case H_STORE_READS: {
+			CStore *st = c->_content_module->_store;
+			if (!st)
+				return "0";
+			switch ((intptr_t)thunk) {
+				case H_STORE_CAPACITY: return String(st->capacity());
+				case H_STORE_BYTES: return String(st->bytes());
+				case H_STORE_COUNT: return String(st->count());
+				case H_STORE_WRITES: return String(st->writes());
+				case H_STORE_DROPS: return String(st->drops());
+				default: return String(st->reads());
+			}
+		}
+		case H_CACHE_HIT_RATE: {
+			XIAContentModule *cm = c->_content_module;
+			unsigned long total = cm->_cache_hits + cm->_cache_misses;
+			return String(total ? (double)cm->_cache_hits / total : 0.0);
+		}
+
 		default:
 			return "<error>";
     }
@@ -202,6 +651,65 @@ void XIACache::add_handlers() {
     add_write_handler("local_addr", write_param, (void *)H_MOVE);
 	add_write_handler("malicious", write_param, (void*)MALICIOUS);
 	add_read_handler("malicious", read_handler, (void*)MALICIOUS);
+	add_write_handler("cache_policy", write_param, (void*)CACHE_POLICY);
+	add_read_handler("cache_policy", read_handler, (void*)CACHE_POLICY);
+	add_write_handler("cache_size", write_param, (void*)CACHE_SIZE);
+	add_read_handler("cache_size", read_handler, (void*)CACHE_SIZE);
+	add_read_handler("cache_used", read_handler, (void*)CACHE_USED);
+	add_read_handler("cache_chunks", read_handler, (void*)CACHE_CHUNKS);
+	add_read_handler("cache_evictions", read_handler, (void*)CACHE_EVICTIONS);
+	add_read_handler("cache_memory", read_handler, (void*)CACHE_MEMORY);
+	add_write_handler("train_budget", write_param, (void*)H_TRAIN_BUDGET);
+	add_read_handler("train_budget", read_handler, (void*)H_TRAIN_BUDGET);
+	add_write_handler("train_threshold", write_param, (void*)H_TRAIN_THRESHOLD);
+	add_read_handler("train_threshold", read_handler, (void*)H_TRAIN_THRESHOLD);
+	add_read_handler("train_bytes", read_handler, (void*)H_TRAIN_BYTES);
+	add_read_handler("train_count", read_handler, (void*)H_TRAIN_COUNT);
+	add_read_handler("train_hits", read_handler, (void*)H_TRAIN_HITS);
+	add_write_handler("pit_lifetime", write_param, (void*)H_PIT_LIFETIME);
+	add_read_handler("pit_lifetime", read_handler, (void*)H_PIT_LIFETIME);
+	add_read_handler("pit_count", read_handler, (void*)H_PIT_COUNT);
+	add_read_handler("pit_aggregated", read_handler, (void*)H_PIT_AGGREGATED);
+	add_read_handler("pit_fanout", read_handler, (void*)H_PIT_FANOUT);
+	add_write_handler("admission", write_param, (void*)H_ADMISSION);
+	add_read_handler("admission", read_handler, (void*)H_ADMISSION);
+	add_read_handler("admitted", read_handler, (void*)H_ADMITTED);
+	add_read_handler("rejected", read_handler, (void*)H_REJECTED);
+	add_read_handler("cache_hits", read_handler, (void*)H_CACHE_HITS);
+	add_read_handler("cache_misses", read_handler, (void*)H_CACHE_MISSES);
+	add_read_handler("cache_hit_rate", read_handler, (void*)H_CACHE_HIT_RATE);
+	add_write_handler("partial_timeout", write_param, (void*)H_PARTIAL_TIMEOUT);
+	add_read_handler("partial_timeout", read_handler, (void*)H_PARTIAL_TIMEOUT);
+	add_read_handler("expired", read_handler, (void*)H_EXPIRED);
+	add_read_handler("range_requests", read_handler, (void*)H_RANGE_REQUESTS);
+	add_read_handler("store_capacity", read_handler, (void*)H_STORE_CAPACITY);
+	add_read_handler("store_bytes", read_handler, (void*)H_STORE_BYTES);
+	add_read_handler("store_count", read_handler, (void*)H_STORE_COUNT);
+	add_read_handler("store_writes", read_handler, (void*)H_STORE_WRITES);
+	add_read_handler("store_drops", read_handler, (void*)H_STORE_DROPS);
+	add_read_handler("store_reads", read_handler, (void*)H_STORE_READS);
+	add_read_handler("merkle_rejected", read_handler, (void*)H_MERKLE_REJECTED);
+	add_write_handler("pace_rate", write_param, (void*)H_PACE_RATE);
+	add_read_handler("pace_rate", read_handler, (void*)H_PACE_RATE);
+	add_write_handler("pace_total", write_param, (void*)H_PACE_TOTAL);
+	add_read_handler("pace_total", read_handler, (void*)H_PACE_TOTAL);
+	add_write_handler("pace_queue", write_param, (void*)H_PACE_QUEUE);
+	add_read_handler("pace_queue", read_handler, (void*)H_PACE_QUEUE);
+	add_read_handler("pace_queued", read_handler, (void*)H_PACE_QUEUED);
+	add_read_handler("pace_flows", read_handler, (void*)H_PACE_FLOWS);
+	add_read_handler("pace_sent", read_handler, (void*)H_PACE_SENT);
+	add_read_handler("pace_drops", read_handler, (void*)H_PACE_DROPS);
+	add_write_handler("prefetch", write_param, (void*)H_PREFETCH);
+	add_read_handler("prefetch", read_handler, (void*)H_PREFETCH);
+	add_write_handler("prefetch_rate", write_param, (void*)H_PREFETCH_RATE);
+	add_read_handler("prefetch_rate", read_handler, (void*)H_PREFETCH_RATE);
+	add_write_handler("prefetch_memory", write_param, (void*)H_PREFETCH_MEMORY);
+	add_read_handler("prefetch_memory", read_handler, (void*)H_PREFETCH_MEMORY);
+	add_read_handler("prefetch_manifests", read_handler, (void*)H_PREFETCH_MANIFESTS);
+	add_read_handler("prefetch_outstanding", read_handler, (void*)H_PREFETCH_OUTSTANDING);
+	add_read_handler("prefetch_sent", read_handler, (void*)H_PREFETCH_SENT);
+	add_read_handler("prefetch_hits", read_handler, (void*)H_PREFETCH_HITS);
+	add_read_handler("prefetch_refused", read_handler, (void*)H_PREFETCH_REFUSED);
 }
 
 
@@ -9,6 +9,11 @@
 #include <click/handlercall.hh>
 #include <click/xiapath.hh>
 #include "xiacontentmodule.hh"
+#include <click/timestamp.hh>
+#include <click/vector.hh>
+
+#define PIT_MAX_ENTRIES	4096
+#define STORE_SIZE	(1024*1024*1024ULL)
 
 #if CLICK_USERLEVEL
 #include <list>
@@ -26,6 +31,84 @@ XIATransport:   input port[0]:  get CID request or reponse from network, should
 output[0] : if the cache has the chunk, it will serve the CID request by pushing chunk pkts to RouteEngine
 input port[1]:  connect with RPC, in server, the RPC will pushCID into cache before serve it.
 output port[1]: connect with RPC, in client, when a chunk is complete, cache will push it to RPC (higher level)
+
+CACHE_SIZE: bytes of chunks kept from forwarded traffic (default 1GB)
+CACHE_POLICY: replacement policy for those chunks, lru, fifo, clock or s3fifo (default s3fifo)
+Handlers cache_policy and cache_size can be read and written, cache_used, cache_chunks
+and cache_evictions are read only. cache_memory reports the chunk payload
+bytes in use, held in slabs and allocated outside the slabs, and the number of
+chunks dropped because their payload could not be allocated.
+
+TRAIN_BUDGET: bytes of pre-built responses kept for hot chunks, 0 disables them (default 16MB)
+TRAIN_THRESHOLD: requests for a chunk before its response is pre-built (default 4)
+Handlers train_budget and train_threshold can be read and written, train_bytes,
+train_count and train_hits are read only.
+
+input port[2]:  CID requests being forwarded by this router, optional
+output port[2]: the same requests, minus those that were aggregated
+Requests for a CID that is already being fetched through this router are held
+back and answered from the response to the first request as it passes through
+(an NDN style pending interest table). A requester asking again is forwarded,
+in case its earlier request or response was lost. Byte range requests are
+always forwarded.
+PIT_LIFETIME: how long a pending request aggregates others (default 1s)
+Handler pit_lifetime can be read and written, pit_count, pit_aggregated and
+pit_fanout are read only.
+
+ADMISSION: when the cache is full, only cache a chunk passing through if it is
+requested more often than the chunk it would replace (TinyLFU, default true)
+Handler admission can be read and written, admitted and rejected count the
+admission decisions, cache_hits, cache_misses and cache_hit_rate count requests
+served here against CID requests forwarded through port 2.
+
+PARTIAL_TIMEOUT: how long a partly received chunk is kept without receiving
+more of it (default 10s). Chunks cached for local applications are dropped when
+their ttl passes, or when they go unrequested for a minute. Handler
+partial_timeout can be read and written, expired counts the chunks dropped.
+When a request of this host's own for a partly received chunk passes port 2
+again, it is replaced by requests for just the byte ranges still missing.
+A range asked for in the last second isn't asked for again.
+Servers and caches answer a range request with only the fragments covering it.
+Handler range_requests counts the range requests sent, it is read only.
+
+STORE_FILE: file of a disk tier behind the cache, chunks cached while forwarding
+are also written to it in the background and are served from it once they leave
+memory. Routes for the chunks it holds are restored when the router starts.
+STORE_SIZE: size of a new STORE_FILE, an existing one keeps its size (default 1GB)
+Handlers store_capacity, store_bytes, store_count, store_writes, store_drops and
+store_reads are read only.
+
+PACE_RATE: bytes/sec of responses sent to any one requester, 0 sends them
+unpaced (default 12500000, 100Mb/s). A requester can take bursts of up to the
+window it gives in its request (32KB if it doesn't). Requesters waiting for
+responses take turns.
+PACE_TOTAL: bytes/sec of responses to all requesters together, 0 for no limit
+(default 0)
+PACE_QUEUE: bytes of responses waiting to be paced out, fragments beyond it are
+dropped (default 32MB)
+A request for a chunk that is still being sent to the same requester only gets
+the fragments already sent again. Handlers pace_rate, pace_total and
+pace_queue can be read and written, pace_queued, pace_flows, pace_sent and
+pace_drops are read only.
+
+PREFETCH: chunks to fetch ahead of a reader, 0 disables prefetching (default 0)
+Chunks that are manifests (text starting "XIA-MANIFEST 1") are remembered as
+they are cached. A request for the manifest or for a chunk it lists has the
+next PREFETCH chunks of the manifest requested from the same place, as does a
+request carrying a prefetch hint. Prefetching needs port 2.
+PREFETCH_RATE: bytes/sec of prefetching, 0 for no limit (default 1250000, 10Mb/s)
+PREFETCH_MEMORY: bytes prefetched and not yet requested, released when they
+are requested or after 30s (default 64MB)
+Handlers prefetch, prefetch_rate and prefetch_memory can be read and written,
+prefetch_manifests, prefetch_outstanding, prefetch_sent, prefetch_hits and
+prefetch_refused are read only.
+
+Response fragments of chunks with Merkle tree CIDs carry a proof, and are only
+cached or passed to pending requesters once it checks out against the CID.
+Handler merkle_rejected counts the fragments dropped, it is read only.
+
+Locally cached content is limited per cache slice
+using the size and policy given by the application.
 */
 
 class XIAContentModule;    
@@ -35,9 +118,10 @@ class XIACache : public Element {
     XIACache();
     ~XIACache();
     const char *class_name() const		{ return "XIACache"; }
-    const char *port_count() const		{ return "2/2"; }
+    const char *port_count() const		{ return "2-3/="; }
     const char *processing() const		{ return PUSH; }
     int configure(Vector<String> &, ErrorHandler *);         
+    int initialize(ErrorHandler *);
     void push(int port, Packet *);            
     XID local_hid() { return _local_hid; };
     XIAPath local_addr() { return _local_addr; };
@@ -48,6 +132,26 @@ class XIACache : public Element {
 	int get_malicious();
 
   private:
+    // a chunk request forwarded upstream, and everyone else waiting for it
+    struct PendingRequest {
+	Vector<String> requesters;	// source nodes of each requester
+	Timestamp expires;
+	bool responding;			// response fragments are passing through
+    };
+
+    void pit_request(Packet *p, const XID &cid);
+    void pit_response(Packet *p, const XID &cid);
+    void pit_expire(const Timestamp &now);
+    WritablePacket *readdress(Packet *p, const String &dst);
+
+    HashTable<XID, PendingRequest> _pit;
+    Timestamp _pit_lifetime;
+    unsigned long _pit_aggregated;
+    unsigned long _pit_fanout;
+
+    String _store_file;
+    uint64_t _store_size;
+
     uint32_t _cid_type;
     XID _local_hid;
     XIAPath _local_addr;
@@ -0,0 +1,378 @@
+/*
+ * xiachunkstore.{cc,hh} -- log-structured disk tier for the XIA chunk cache
+ */
+
+#include <click/config.h>
+#include <click/glue.hh>
+#include <click/error.hh>
+#include "xiachunkstore.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+CLICK_DECLS
+
+CStore::CStore()
+    : _fd(-1), _map(0), _size(0), _cap(0), _head(0), _bytes(0),
+      _queued(0), _running(false), _stop(false), _writes(0), _drops(0), _reads(0)
+{
+    pthread_mutex_init(&_lock, NULL);
+    pthread_cond_init(&_cond, NULL);
+}
+
+CStore::~CStore()
+{
+    close();
+    pthread_mutex_destroy(&_lock);
+    pthread_cond_destroy(&_cond);
+}
+
+/*
+ * open the store at path, creating a size byte file if there isn't one,
+ * and rebuild the index from what is already there
+ */
+int
+CStore::open(const String &path, uint64_t size, ErrorHandler *errh)
+{
+    struct stat st;
+
+    _fd=::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (_fd<0)
+	return errh->error("%s: %s", path.c_str(), strerror(errno));
+    if (fstat(_fd, &st)<0) {
+	errh->error("%s: %s", path.c_str(), strerror(errno));
+	close();
+	return -1;
+    }
+
+    bool fresh=(st.st_size==0);
+    if (fresh) {
+	if (size < CSTORE_HEADER_SIZE + 16*CSTORE_ALIGN) {
+	    errh->error("%s: STORE_SIZE is too small", path.c_str());
+	    close();
+	    return -1;
+	}
+	if (ftruncate(_fd, size)<0) {
+	    errh->error("%s: %s", path.c_str(), strerror(errno));
+	    close();
+	    return -1;
+	}
+    } else
+	size=st.st_size;	// an existing store keeps its size
+
+    void *m=mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (m==MAP_FAILED) {
+	errh->error("%s: %s", path.c_str(), strerror(errno));
+	close();
+	return -1;
+    }
+    _map=(unsigned char *)m;
+    _size=size;
+    _cap=(size - CSTORE_HEADER_SIZE) & ~(uint64_t)(CSTORE_ALIGN-1);
+
+    Header *h=header();
+    if (h->magic==0) {
+	h->magic=CSTORE_MAGIC;
+	h->version=CSTORE_VERSION;
+	h->size=size;
+	h->head=0;
+    } else if (h->magic!=CSTORE_MAGIC || h->version!=CSTORE_VERSION || h->size!=size) {
+	errh->error("%s: not a chunk store", path.c_str());
+	close();
+	return -1;
+    } else
+	rebuild();
+
+    _stop=false;
+    if (pthread_create(&_writer, NULL, writer_thread, this)!=0) {
+	errh->error("%s: unable to start the writer thread", path.c_str());
+	close();
+	return -1;
+    }
+    _running=true;
+    return 0;
+}
+
+/*
+ * finish the queued writes and release the file
+ */
+void
+CStore::close()
+{
+    if (_running) {
+	pthread_mutex_lock(&_lock);
+	_stop=true;
+	pthread_cond_signal(&_cond);
+	pthread_mutex_unlock(&_lock);
+	pthread_join(_writer, NULL);
+	_running=false;
+    }
+    if (_map) {
+	msync(_map, _size, MS_SYNC);
+	munmap(_map, _size);
+	_map=0;
+    }
+    if (_fd>=0) {
+	::close(_fd);
+	_fd=-1;
+    }
+    _index.clear();
+    _log.clear();
+    _bytes=0;
+}
+
+uint64_t
+CStore::record_size(uint32_t length)
+{
+    return (sizeof(Record) + (uint64_t)length + CSTORE_ALIGN - 1) & ~(uint64_t)(CSTORE_ALIGN-1);
+}
+
+uint32_t
+CStore::checksum(const char *data, uint32_t length)
+{
+    uint64_t a=0, b=0;
+    uint32_t w, i;
+
+    for (i=0; i + sizeof(w) <= length; i+=sizeof(w)) {
+	memcpy(&w, data + i, sizeof(w));
+	a+=w;
+	b+=a;
+    }
+    for (; i<length; i++) {
+	a+=(unsigned char)data[i];
+	b+=a;
+    }
+    return (uint32_t)(a ^ b ^ (b >> 32));
+}
+
+/*
+ * Only the last cycle of the log, the capacity's worth of records before the
+ * written head, can be intact. Within it records are found by following
+ * their lengths; where there isn't a record for the position we expect
+ * (the partly overwritten start, or the unused end of a cycle) the scan
+ * steps forward one alignment unit at a time.
+ */
+void
+CStore::rebuild()
+{
+    uint64_t end=header()->head;
+    uint64_t pos=end > _cap ? end - _cap : 0;
+
+    while (pos < end) {
+	uint64_t phys=pos % _cap;
+	Record *r=record(pos);
+
+	if (phys + sizeof(Record) <= _cap && r->magic==CSTORE_RECORD_MAGIC && r->pos==pos) {
+	    uint64_t len=record_size(r->length);
+	    if (len <= _cap - phys && pos + len <= end) {
+		XID xid(r->xid);
+		HashTable<XID, Entry>::iterator it=_index.find(xid);
+		if (it!=_index.end())
+		    _bytes-=record_size(it->second.length);
+
+		Entry e={pos, r->length, true};
+		_index.set(xid, e);
+		_log.push_back(std::make_pair(pos, xid));
+		_bytes+=len;
+		pos+=len;
+		continue;
+	    }
+	}
+	pos+=CSTORE_ALIGN;
+    }
+    _head=end;
+}
+
+/*
+ * mark the records the writer has finished as readable
+ */
+void
+CStore::reap()
+{
+    std::vector<std::pair<uint64_t, XID> > done;
+
+    pthread_mutex_lock(&_lock);
+    done.swap(_done);
+    pthread_mutex_unlock(&_lock);
+
+    for (size_t i=0; i<done.size(); i++) {
+	HashTable<XID, Entry>::iterator it=_index.find(done[i].second);
+	if (it!=_index.end() && it->second.pos==done[i].first)
+	    it->second.ready=true;
+    }
+}
+
+bool
+CStore::contains(const XID &xid)
+{
+    return _index.find(xid)!=_index.end();
+}
+
+/*
+ * the stored payload of a chunk, it points into the map and stays valid
+ * until the next append
+ */
+const char *
+CStore::lookup(const XID &xid, uint32_t *length, int *merkle_leaf)
+{
+    if (!_map)
+	return 0;
+    reap();
+
+    HashTable<XID, Entry>::iterator it=_index.find(xid);
+    if (it==_index.end() || !it->second.ready)
+	return 0;
+
+    Record *r=record(it->second.pos);
+    const char *data=reinterpret_cast<const char *>(r + 1);
+    if (r->magic!=CSTORE_RECORD_MAGIC || r->pos!=it->second.pos ||
+	    r->length!=it->second.length || checksum(data, r->length)!=r->sum) {
+	// torn by a crash before it reached the disk
+	_bytes-=record_size(it->second.length);
+	_index.erase(it);
+	return 0;
+    }
+
+    _reads++;
+    *length=r->length;
+    if (merkle_leaf)
+	*merkle_leaf=r->merkle;
+    return data;
+}
+
+/*
+ * queue a chunk to be written, CIDs whose records it will overwrite are
+ * dropped from the index and returned in evicted
+ */
+bool
+CStore::append(const XID &xid, const char *data, uint32_t length, Vector<XID> &evicted,
+	       int merkle_leaf)
+{
+    if (!_map)
+	return false;
+    reap();
+
+    if (_index.find(xid)!=_index.end())
+	return true;
+
+    uint64_t len=record_size(length);
+    size_t limit=_cap/2 < CSTORE_MAX_QUEUED ? _cap/2 : CSTORE_MAX_QUEUED;
+
+    // the queue limit also guarantees we never overwrite a record that is
+    // still waiting to be written
+    pthread_mutex_lock(&_lock);
+    bool full=(_queued + len > limit);
+    pthread_mutex_unlock(&_lock);
+    if (full || len > _cap) {
+	_drops++;
+	return false;
+    }
+
+    char *copy=(char *)malloc(length ? length : 1);
+    if (!copy) {
+	_drops++;
+	return false;
+    }
+    memcpy(copy, data, length);
+
+    // records don't wrap around the end of the file
+    uint64_t pos=_head;
+    uint64_t phys=pos % _cap;
+    if (phys + len > _cap)
+	pos+=_cap - phys;
+
+    while (!_log.empty() && _log.front().first + _cap < pos + len) {
+	HashTable<XID, Entry>::iterator it=_index.find(_log.front().second);
+	if (it!=_index.end() && it->second.pos==_log.front().first) {
+	    _bytes-=record_size(it->second.length);
+	    evicted.push_back(it->first);
+	    _index.erase(it);
+	}
+	_log.pop_front();
+    }
+
+    Entry e={pos, length, false};
+    _index.set(xid, e);
+    _log.push_back(std::make_pair(pos, xid));
+    _bytes+=len;
+    _head=pos + len;
+
+    Pending p;
+    p.pos=pos;
+    p.xid=xid;
+    p.data=copy;
+    p.length=length;
+    p.merkle=merkle_leaf;
+
+    pthread_mutex_lock(&_lock);
+    _queue.push_back(p);
+    _queued+=len;
+    pthread_cond_signal(&_cond);
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+void
+CStore::cids(Vector<XID> &out)
+{
+    for (HashTable<XID, Entry>::iterator it=_index.begin(); it!=_index.end(); ++it)
+	out.push_back(it->first);
+}
+
+/*
+ * runs on the writer thread, the record header is completed last so a
+ * record is only found on restart once its payload is in place
+ */
+void
+CStore::write(const Pending &p)
+{
+    Record *r=record(p.pos);
+
+    r->magic=0;
+    memcpy(r + 1, p.data, p.length);
+    r->length=p.length;
+    r->pos=p.pos;
+    r->xid=p.xid.xid();
+    r->sum=checksum(p.data, p.length);
+    r->merkle=p.merkle;
+    __sync_synchronize();
+    r->magic=CSTORE_RECORD_MAGIC;
+
+    header()->head=p.pos + record_size(p.length);
+    free(p.data);
+}
+
+void *
+CStore::writer_thread(void *arg)
+{
+    CStore *s=(CStore *)arg;
+
+    pthread_mutex_lock(&s->_lock);
+    while (1) {
+	while (s->_queue.empty() && !s->_stop)
+	    pthread_cond_wait(&s->_cond, &s->_lock);
+	if (s->_queue.empty())
+	    break;
+
+	Pending p=s->_queue.front();
+	s->_queue.pop_front();
+	pthread_mutex_unlock(&s->_lock);
+
+	s->write(p);
+
+	pthread_mutex_lock(&s->_lock);
+	s->_queued-=record_size(p.length);
+	s->_done.push_back(std::make_pair(p.pos, p.xid));
+	s->_writes++;
+    }
+    pthread_mutex_unlock(&s->_lock);
+    return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel)
+ELEMENT_PROVIDES(XIAChunkStore)
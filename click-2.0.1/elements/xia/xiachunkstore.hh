@@ -0,0 +1,127 @@
+#ifndef CLICK_XIACHUNKSTORE_HH
+#define CLICK_XIACHUNKSTORE_HH
+#include <click/config.h>
+#include <click/xid.hh>
+#include <click/hashtable.hh>
+#include <click/vector.hh>
+#include <click/string.hh>
+#include <clicknet/xia.h>
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#define CSTORE_MAGIC		0x53484358	// "XCHS"
+#define CSTORE_RECORD_MAGIC	0x52484358	// "XCHR"
+#define CSTORE_VERSION		1
+#define CSTORE_HEADER_SIZE	4096
+#define CSTORE_ALIGN		512
+#define CSTORE_MAX_QUEUED	(64*1024*1024)	// bytes waiting for the writer
+
+CLICK_DECLS
+class ErrorHandler;
+
+/*
+ * Disk tier for the router cache, a log-structured file of chunks.
+ *
+ * The file is memory mapped and used as a circular log. Chunks are appended
+ * at the head; once the log wraps, the oldest records are overwritten, so the
+ * store evicts in FIFO order. The CID index lives in memory only and is
+ * rebuilt from the record headers when the file is reopened.
+ *
+ * Appends only reserve space and queue a copy of the chunk; a writer thread
+ * copies it into the map, so disk writes stay off the forwarding path. A
+ * chunk can be looked up once its write has completed. The header records
+ * how far the log has been written, so a restart only scans the last cycle.
+ */
+class CStore {
+    public:
+	CStore();
+	~CStore();
+
+	int open(const String &path, uint64_t size, ErrorHandler *errh);
+	void close();
+
+	bool contains(const XID &xid);
+	const char *lookup(const XID &xid, uint32_t *length, int *merkle_leaf = 0);
+	bool append(const XID &xid, const char *data, uint32_t length, Vector<XID> &evicted,
+		    int merkle_leaf = 0);
+	void cids(Vector<XID> &out);
+
+	uint64_t capacity() const { return _cap; }
+	uint64_t bytes() const { return _bytes; }
+	int count() const { return _index.size(); }
+	unsigned long writes() const { return _writes; }
+	unsigned long drops() const { return _drops; }
+	unsigned long reads() const { return _reads; }
+
+    private:
+	struct Header {
+	    uint32_t magic;
+	    uint32_t version;
+	    uint64_t size;		// file size
+	    uint64_t head;		// log position everything before has been written
+	};
+
+	struct Record {
+	    uint32_t magic;
+	    uint32_t length;		// payload bytes
+	    uint64_t pos;		// log position, physical offset is pos % capacity
+	    click_xia_xid xid;
+	    uint32_t sum;		// payload checksum
+	    uint32_t merkle;		// leaf shift of a Merkle tree CID, 0 for a flat one
+	};
+
+	struct Entry {
+	    uint64_t pos;
+	    uint32_t length;
+	    bool ready;			// the writer has finished with it
+	};
+
+	struct Pending {
+	    uint64_t pos;
+	    XID xid;
+	    char *data;
+	    uint32_t length;
+	    int merkle;
+	};
+
+	int _fd;
+	unsigned char *_map;
+	uint64_t _size;
+	uint64_t _cap;			// bytes of log after the header
+	uint64_t _head;			// log position of the next record
+	uint64_t _bytes;
+
+	HashTable<XID, Entry> _index;
+	std::deque<std::pair<uint64_t, XID> > _log;	// indexed records, oldest first
+
+	// shared with the writer thread
+	pthread_t _writer;
+	pthread_mutex_t _lock;
+	pthread_cond_t _cond;
+	std::deque<Pending> _queue;
+	std::vector<std::pair<uint64_t, XID> > _done;
+	size_t _queued;
+	bool _running;
+	bool _stop;
+
+	unsigned long _writes;
+	unsigned long _drops;
+	unsigned long _reads;
+
+	Header *header() { return reinterpret_cast<Header *>(_map); }
+	Record *record(uint64_t pos) { return reinterpret_cast<Record *>(_map + CSTORE_HEADER_SIZE + pos % _cap); }
+	static uint64_t record_size(uint32_t length);
+	static uint32_t checksum(const char *data, uint32_t length);
+
+	void rebuild();
+	void reap();
+	void write(const Pending &p);
+	static void *writer_thread(void *arg);
+
+	CStore(const CStore &);
+	CStore &operator=(const CStore &);
+};
+
+CLICK_ENDDECLS
+#endif
@@ -2,33 +2,64 @@
 #include <click/xiacontentheader.hh>
 #include <click/config.h>
 #include <click/glue.hh>
+#include <click/confparse.hh>
 CLICK_DECLS
 
 #define CACHE_DEBUG 1
 
 unsigned int XIAContentModule::PKTSIZE = PACKETSIZE;
 XIAContentModule::XIAContentModule(XIATransport *transport)
+    : _cache(POLICY_S3FIFO), _pace_timer(pace_hook, this), _expiry_timer(expiry_hook, this)
 {
     _transport = transport;
-    _timer=0;
+    _cache_size = CACHESIZE;
+    _partial_timeout=Timestamp::make_sec(PARTIAL_TIMEOUT);
+    _refresh_interval=Timestamp::make_sec(REFRESH_INTERVAL);
+    _expired=0;
+    _local_added=0;
+    _local_removed=0;
+    _local_filter.reset(0);
+    _train_bytes=0;
+    _train_budget=TRAIN_BUDGET;
+    _train_threshold=TRAIN_THRESHOLD;
+    _train_hits=0;
+    _admission_enabled=true;
+    _record_responses=true;
+    _admitted=0;
+    _rejected=0;
+    _cache_hits=0;
+    _cache_misses=0;
+    _merkle_rejected=0;
+    _range_requests=0;
+    _store=0;
 }
 
 XIAContentModule::~XIAContentModule()
 {
+    clear_trains();
+    delete _store;
+
     HashTable<XID,CChunk*>::iterator it;
     CChunk * chunk = NULL;
     for(it=_partialTable.begin(); it!=_partialTable.end(); it++) {
         chunk=it->second;
         delete chunk;
     }
-    for(it=_oldPartial.begin(); it!=_oldPartial.end(); it++) {
-        chunk=it->second;
-        delete chunk;
-    }
     for(it=_contentTable.begin(); it!=_contentTable.end(); it++) {
         chunk=it->second;
         delete chunk;
     }
+
+    HashTable<int, cacheMeta*>::iterator mit;
+    for(mit=_cacheMetaTable.begin(); mit!=_cacheMetaTable.end(); mit++) {
+        struct cacheMeta *cm=mit->second;
+        HashTable<XID, struct contentMeta*>::iterator cit;
+        for(cit=cm->contentMetaTable->begin(); cit!=cm->contentMetaTable->end(); cit++)
+            free(cit->second);
+        delete cm->contentMetaTable;
+        delete cm->queue;
+        free(cm);
+    }
 }
 
 Packet * XIAContentModule::makeChunkResponse(CChunk * chunk, Packet *p_in)
@@ -39,18 +70,13 @@ Packet * XIAContentModule::makeChunkResponse(CChunk * chunk, Packet *p_in)
     encap.set_dst_path(hdr.dst_path());
     encap.set_src_path(hdr.src_path());
     encap.set_nxt(CLICK_XIA_NXT_CID);
-    encap.set_plen(chunk->GetSize());
 
     ContentHeaderEncap  contenth(0, 0, 0, chunk->GetSize());
+    if (chunk->merkle_leaf())
+        contenth.set_merkle_leaf(chunk->merkle_leaf());
 
-    uint16_t hdrsize = encap.hdr_size()+ contenth.hlen();
-    //build packet
-    WritablePacket *p = Packet::make(hdrsize, chunk->GetPayload() , chunk->GetSize(), 20 );
-
-    p=contenth.encap(p);		// add XIA header
-    p=encap.encap( p, false );
-
-    return p;
+    CResponse response(encap, contenth);
+    return response.make(chunk->GetPayload(), chunk->GetSize());
 }
 
 
@@ -76,18 +102,12 @@ Packet * XIAContentModule::makeChunkPush(CChunk * chunk, Packet *p_in)
     encap.set_dst_path(hdr.dst_path());
     encap.set_src_path(hdr.src_path());
     encap.set_nxt(CLICK_XIA_NXT_CID);
-    encap.set_plen(chunk->GetSize());
 
 //     ContentHeaderEncap  *contenth = ContentHeaderEncap::MakePushHeader(0,  chunk->GetSize() ); //contenth(0, 0, 0, chunk->GetSize());
     ContentHeaderEncap  contenth( offset, offset, length, chunkSize, ContentHeader::OP_PUSH, contextID, ttl, cacheSize, cachePolicy);
     
-    
-    uint16_t hdrsize = encap.hdr_size()+ contenth.hlen();
-    //build packet
-    WritablePacket *p = Packet::make(hdrsize, chunk->GetPayload() , chunk->GetSize(), 20 );
-
-    p=contenth.encap(p);		// add XIA header
-    p=encap.encap( p, false );
+    CResponse response(encap, contenth);
+    WritablePacket *p = response.make(chunk->GetPayload(), chunk->GetSize());
 	
     if(CACHE_DEBUG)
       click_chatter("Push message built in contentmodule \n");
@@ -147,6 +167,7 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
         ContentHeader ch(p);
         if(it!=_contentTable.end() && (content[dstCID]=1)  /* This is an intended assignemnt */
                 && (ch.opcode()==ContentHeader::OP_REQUEST)) { /* Filter out redundant request for RPT reliability */
+            it->second->touch();
             XIAHeaderEncap encap;
             XIAHeader hdr(p);
 
@@ -165,19 +186,18 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
 
             encap.set_src_path(srcPath);
             encap.set_dst_path(dstPath);
-            encap.set_plen(s);
             encap.set_nxt(CLICK_XIA_NXT_CID);
 
             ContentHeaderEncap  contenth(0, 0, 0, s);
+            if (it->second->merkle_leaf())
+                contenth.set_merkle_leaf(it->second->merkle_leaf());
 
-            uint16_t hdrsize = encap.hdr_size()+ contenth.hlen();
-            WritablePacket *newp = Packet::make(hdrsize, pl , s, 20 );
-
-            newp=contenth.encap(newp);
-            newp=encap.encap( newp, false );	      // add XIA header
+            CResponse response(encap, contenth);
+            WritablePacket *newp = response.make(pl, s);
 	    
 // 	    click_chatter("Found in my local cache! CID: %s, Local Address: %s\n", dstCID.unparse().c_str(),  _transport->local_hid().unparse().c_str());
-            _transport->checked_output_push(1 , newp);
+            if (newp)
+                _transport->checked_output_push(1 , newp);
             //std::cout<<"In client"<<std::endl;
             //std::cout<<"payload: "<<pl<<std::endl;
             //std::cout<<"have pushed out"<<std::endl;
@@ -187,7 +207,29 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
     }
 #endif
     // server, router
+    if(it==_contentTable.end() && _store)
+        it=promote(dstCID);
+    _admission.record(dstCID);
     if(it!=_contentTable.end()) {
+        _cache_hits++;
+        _prefetch.claim(dstCID);
+    }
+    prefetch_after(p, dstCID, true);
+
+    // a retransmitted request only needs the fragments that went out before
+    // it, the rest are still queued. A range request names the bytes it is
+    // missing itself, so all of them are sent again.
+    ContentHeader req(p);
+    uint32_t window=req.window();
+    uint32_t first=req.chunk_offset();
+    uint32_t want=req.range_length();
+    bool range=(first || want);
+    int upto=range ? -1 : _pacer.queued_from(srcHID, dstCID);
+
+    if(it!=_contentTable.end() && !range && serve_train(p, dstCID, it->second, srcHID, window, upto)) {
+        it->second->touch();
+        p->kill();
+    } else if(it!=_contentTable.end()) {
         //std::cout<<"look up cache in router or server"<<std::endl;
         XIAHeaderEncap encap;
         XIAHeader hdr(p);
@@ -196,6 +238,7 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
         //std::cout<<"payload: "<<pl<<std::endl;
         unsigned int s=it->second->GetSize();
         //std::cout<<"chunk size: "<<s<<std::endl;
+        it->second->touch();
         myown_source = _transport->local_addr();
         handle_t _cid=myown_source.add_node(dstCID);
         myown_source.add_edge(myown_source.source_node(), _cid);
@@ -208,23 +251,34 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
 
         // add content header   dataoffset
         unsigned int cp=0;
-        ContentHeaderEncap  dummy_contenth(0, 0, 0, 0);
+        ContentHeaderEncap  contenth(0, 0, 0, s);
+        if (it->second->merkle_leaf())
+            contenth.set_merkle_leaf(it->second->merkle_leaf());
+        CResponse response(encap, contenth, it->second->merkle_tree());
+
+        // Merkle fragments start on a leaf, so a range is widened to whole leaves
+        unsigned int end=s;
+        if (range) {
+            cp=first < s ? first : s;
+            if (want && want < s - cp)
+                end=cp + want;
+            if (it->second->merkle_leaf())
+                cp&=~((1U << it->second->merkle_leaf()) - 1);
+        }
 
-        while(cp < s) {
-            uint16_t hdrsize = encap.hdr_size()+ dummy_contenth.hlen();
-            int l= (s-cp) < (PKTSIZE - hdrsize) ? (s-cp) : (PKTSIZE - hdrsize);
-            ContentHeaderEncap  contenth(0, cp, l, s);
+        Timestamp now=Timestamp::now();
+        for(int i=0; cp < end && (upto<0 || i<upto); i++) {
+            uint16_t l = response.fragment_length(cp, s, PKTSIZE);
             //build packet
-            WritablePacket *newp = Packet::make(hdrsize, pl + cp , l, 20 );
-            newp=contenth.encap(newp);
-            encap.set_plen(l);	// add XIA header
-            newp=encap.encap( newp, false );
+            WritablePacket *newp = response.make_fragment(pl, cp, l);
+            if (!newp)
+                break;
 // 	    click_chatter("Found in router cache! CID: %s, Local Address: %s\n", dstCID.unparse().c_str(),  _transport->local_hid().unparse().c_str());
 	    
-            _transport->checked_output_push(0 , newp);
-            //std::cout<<"have pushed out"<<std::endl;
             cp += l;
+            send_response(srcHID, window, dstCID, i, cp >= end, range || upto >= 0, newp, now);
         }
+        run_pacer();
         p->kill();
     } else { //printf("dstID is not found in cache, pkt killed\n");
         //std::cout<<"not found, kill pkt"<<std::endl;
@@ -233,7 +287,125 @@ void XIAContentModule::process_request(Packet *p, const XID & srcHID, const XID
     }
 }
 
-void XIAContentModule::cache_incoming_forward(Packet *p, const XID& srcCID)
+/*
+ * answer a request for a hot chunk from its pre-built response train,
+ * building the train once the chunk has been requested often enough
+ */
+bool XIAContentModule::serve_train(Packet *p, const XID &cid, CChunk *chunk, const XID &dst,
+                                   uint32_t window, int upto)
+{
+    const click_xia *xiah=p->xia_header();
+    CTrain *train=0;
+
+    if (_train_budget==0 || !xiah)
+        return false;
+
+    HashTable<XID, CTrain*>::iterator it=_trains.find(cid);
+    if (it!=_trains.end()) {
+        train=it->second;
+        if (train->chunk()!=chunk) {	// the chunk was replaced since
+            drop_train(train);
+            train=0;
+        }
+    }
+
+    if (!train) {
+        if (chunk->requested() < _train_threshold || chunk->GetSize() > _train_budget)
+            return false;
+
+        XIAPath myown_source=_transport->local_addr();
+        handle_t _cid=myown_source.add_node(cid);
+        myown_source.add_edge(myown_source.source_node(), _cid);
+        myown_source.add_edge(myown_source.destination_node(), _cid);
+        myown_source.set_destination_node(_cid);
+
+        // size the fragments for a destination a little longer than this one
+        int max_dnode=xiah->snode + 2;
+        if (max_dnode > 255)
+            max_dnode=255;
+        train=new CTrain(cid, chunk, myown_source, max_dnode, PKTSIZE);
+
+        _trains.set(cid, train);
+        _train_lru.push_front(train);
+        _train_bytes+=train->bytes();
+        while (_train_bytes > _train_budget && _train_lru.back()!=train)
+            drop_train(_train_lru.back());
+        if (_train_bytes > _train_budget) {
+            drop_train(train);
+            return false;
+        }
+    } else if (_train_lru.front()!=train) {
+        _train_lru.erase(train);
+        _train_lru.push_front(train);
+    }
+
+    if (xiah->snode > train->max_dnode())
+        return false;
+
+    // the requester's source address becomes our destination as is
+    const click_xia_xid_node *requester=xiah->node + xiah->dnode;
+    Timestamp now=Timestamp::now();
+    int n=train->fragments();
+    if (upto>=0 && upto<n)
+        n=upto;
+    for (int i=0; i<n; i++) {
+        WritablePacket *newp=train->make(i, requester, xiah->snode, now);
+        if (!newp)
+            break;
+        send_response(dst, window, cid, i, i==train->fragments() - 1, upto>=0, newp, now);
+    }
+    run_pacer();
+    _train_hits++;
+    return true;
+}
+
+/*
+ * hand a response fragment to the pacer, or straight to the network when
+ * responses aren't paced
+ */
+void XIAContentModule::send_response(const XID &dst, uint32_t window, const XID &cid, int index,
+                                     bool last, bool resend, Packet *p, const Timestamp &now)
+{
+    if (!_pacer.rate())
+        _transport->checked_output_push(0 , p);
+    else if (!_pacer.enqueue(dst, window, cid, index, last, resend, p, now))
+        p->kill();
+}
+
+void XIAContentModule::run_pacer()
+{
+    Timestamp now=Timestamp::now();
+    Vector<Packet *> out;
+
+    _pacer.dequeue(now, out);
+    for (int i=0; i<out.size(); i++)
+        _transport->checked_output_push(0 , out[i]);
+
+    Timestamp next=_pacer.next(now);
+    if (next)
+        _pace_timer.schedule_at(next);
+}
+
+void XIAContentModule::pace_hook(Timer *, void *thunk)
+{
+    static_cast<XIAContentModule *>(thunk)->run_pacer();
+}
+
+void XIAContentModule::drop_train(CTrain *train)
+{
+    _trains.erase(train->cid());
+    _train_lru.erase(train);
+    _train_bytes-=train->bytes();
+    delete train;
+}
+
+void XIAContentModule::clear_trains()
+{
+    while (!_train_lru.empty())
+        drop_train(_train_lru.front());
+}
+
+void XIAContentModule::cache_incoming_forward(Packet *p, const XID& srcCID, bool prefetched)
 {
     XIAHeader xhdr(p);  // parse xia header and locate nodes and payload
     ContentHeader ch(p);
@@ -244,59 +416,136 @@ void XIAContentModule::cache_incoming_forward(Packet *p, const XID& srcCID)
     int chunkSize=ch.chunk_length();
 
     //std::cout<<"dst is not myself"<<std::endl;
+    // without the requests, each response passing through stands for one
+    if(_record_responses && offset==0)
+        _admission.record(srcCID);
+
+    CChunk *completed=0;
     HashTable<XID,CChunk*>::iterator it;
     it=_contentTable.find(srcCID);
     if (it!=_contentTable.end()) {  //already in contentTable
-        content[it->first]=1;
+        it->second->touch();
     } else {
         it=_partialTable.find(srcCID);
         if(it!=_partialTable.end()) { //found in partialTable
-            partial[it->first]=1;
             CChunk *chunk=it->second;
+            if(chunk->merkle_leaf()!=ch.merkle_leaf()) {
+                p->kill();
+                return;
+            }
+            chunk->touch();
             chunk->fill(payload, offset, length);
             if(chunk->full()) {
                 _contentTable[srcCID]=chunk;
-                content[srcCID]=1;
                 addRoute(srcCID);
-                partial.erase(it->first);
                 _partialTable.erase(it);
+                if(_store)
+                    store(chunk);
+                completed=chunk;
             }
         } else {                     //first pkt of a chunk
-            CChunk *chunk=new CChunk(srcCID, chunkSize);
+            if(!prefetched && !admit(srcCID, chunkSize)) {
+                p->kill();
+                return;
+            }
+            MakeSpace(chunkSize);
+            CChunk *chunk=new CChunk(srcCID, chunkSize, &_arena);
+            if(!chunk->GetPayload()) {  // arena is out of memory, counted there
+                delete chunk;
+                p->kill();
+                return;
+            }
+            chunk->set_merkle_leaf(ch.merkle_leaf());
             chunk->fill(payload, offset, length);//  allocate space for new chunk
-            MakeSpace(chunkSize);  //lru
 
             if(chunk->full()) {
                 _contentTable[srcCID]=chunk;
-                content[srcCID]=1;
                 //modify routing table	  //add
                 addRoute(srcCID);
+                if(_store)
+                    store(chunk);
+                completed=chunk;
             } else {
                 _partialTable[srcCID]=chunk;
-                partial[srcCID]=1;
+                expire_after(chunk, _partial_timeout);
             }
-            usedSize += chunkSize;
-        }
-    }
-    //lru refresh
-    //printf("lru refresh\n");
-    //std::cout<<timer<<std::endl;
-    _timer++;
-    if(_timer>=REFRESH) {
-        HashTable<XID,int>::iterator iter;
-        for(iter=content.begin(); iter!=content.end(); iter++) {
-            iter->second=0;
-        }
-        for(iter=partial.begin(); iter!=partial.end(); iter++) {
-            iter->second=0;
+            _cache.insert(chunk);
         }
-        _timer=0;
     }
+    if(completed && _prefetch.depth() &&
+            _prefetch.add_manifest(srcCID, completed->GetPayload(), completed->GetSize()))
+        prefetch_after(p, srcCID, false);
     p->kill();
     //printf("end: dstHID is not myself\n");
 
 }
 
+/*
+ * fetch the chunks a reader of cid will want next into the cache. p is a
+ * request for cid, or the response that completed cid when it is a manifest.
+ */
+void XIAContentModule::prefetch_after(Packet *p, const XID &cid, bool request)
+{
+    if(!_prefetch.depth())
+        return;
+
+    Vector<XID> cids;
+    Vector<uint32_t> sizes;
+    _prefetch.following(cid, cids, sizes);
+    // hints are only taken for chunks, and only from a request headed for
+    // cid, since they are fetched along the path it was taking
+    const struct click_xia *xh=p->xia_header();
+    if(request && xh->dnode>0 && XID(xh->node[xh->dnode - 1].xid)==cid) {
+        ContentHeader ch(p);
+        XID hint[CONTENT_PREFETCH_MAX];
+        int n=ch.prefetch(hint, CONTENT_PREFETCH_MAX);
+        for(int i=0; i<n && cids.size()<_prefetch.depth(); i++) {
+            if(hint[i].xid().type!=htonl(CLICK_XIA_XID_TYPE_CID))
+                continue;
+            cids.push_back(hint[i]);
+            sizes.push_back(0);
+        }
+    }
+
+    Timestamp now=Timestamp::now();
+    for(int i=0; i<cids.size(); i++) {
+        const XID &next=cids[i];
+        if(next==cid || _prefetch.pending(next) || _contentTable.find(next)!=_contentTable.end() ||
+                _partialTable.find(next)!=_partialTable.end() || (_store && _store->contains(next)))
+            continue;
+        if(!_prefetch.reserve(next, sizes[i] ? sizes[i] : PREFETCH_HINT_SIZE, now))
+            break;
+        send_prefetch(p, request, next);
+    }
+}
+
+/*
+ * request cid from wherever p's chunk came from, the path to that chunk with
+ * cid in its place
+ */
+void XIAContentModule::send_prefetch(Packet *p, bool request, const XID &cid)
+{
+    XIAHeader hdr(p);
+    XIAHeaderEncap encap;
+    encap.set_nxt(CLICK_XIA_NXT_CID);
+    encap.set_dst_path(request ? hdr.dst_path() : hdr.src_path());
+    encap.set_src_path(_transport->local_addr());
+    if(encap.hdr()->dnode==0)
+        return;
+    encap.hdr()->node[encap.hdr()->dnode - 1].xid=cid.xid();
+
+    WritablePacket *q=WritablePacket::make(256, 0, 0, 20);
+    if(!q)
+        return;
+    ContentHeaderEncap *chdr=ContentHeaderEncap::MakeRequestHeader();
+    q=chdr->encap(q);
+    if(q)
+        q=encap.encap(q, true);
+    delete chdr;
+    if(q)
+        _transport->checked_output_push(0, q);
+}
+
 void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool local_putcid, bool pushcid)
 {
     XIAHeader xhdr(p);  // parse xia header and locate nodes and payload
@@ -312,7 +561,7 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
     uint32_t cachePolicy=ch.cachePolicy();
     uint32_t ttl=ch.ttl();
 
-    HashTable<XID,CChunk*>::iterator it,oit;
+    HashTable<XID,CChunk*>::iterator it;
     bool chunkFull=false;
     CChunk* chunk;
 #ifdef CLIENTCACHE
@@ -320,9 +569,9 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 
     if(cacheEntry==NULL){
         struct cacheMeta *cm=(struct cacheMeta *)malloc(sizeof(cacheMeta));
-        cm->curSize=0;
         cm->maxSize=cacheSize;
         cm->policy=cachePolicy;
+        cm->queue=new CReplacer(cachePolicy & POLICY_MASK, contextID);
         cm->contentMetaTable=new HashTable<XID, struct contentMeta*>();
         _cacheMetaTable[contextID]=cm;
         if(CACHE_DEBUG){
@@ -330,7 +579,6 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
         }
     }
         HashTable<XID,CChunk*>::iterator cit;
-        _timer++;
         cit=_contentTable.find(srcCID);
         if(cit!=_contentTable.end()) { // content exists alreaady
 // 	  click_chatter("Found the Chunk! Push: %d Put:%d\n", pushcid, local_putcid);
@@ -345,21 +593,12 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 		  _transport->checked_output_push(1 , newp);
 	      }else
 		click_chatter("Why is a partial chunk in contentTable?\n");
-
-	      if(_timer>=REFRESH) {
-                _timer = 0;
-                cache_management();
-		}
 	      
 	    }else{
 	      if (!local_putcid)
 		  content[srcCID]=1;
+	      cit->second->touch();
 	      p->kill();
-
-	      if(_timer>=REFRESH) {
-		  _timer = 0;
-		  cache_management();
-	      }
 	      return;
 	    }
         }
@@ -369,30 +608,29 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
     if(it!=_partialTable.end()) { //already in partial table
         //std::cout<<"found in partial table"<<std::endl;
         chunk=it->second;
+        if(chunk->merkle_leaf()!=ch.merkle_leaf()) {
+            p->kill();
+            return;
+        }
         chunk->fill(payload, offset, length);
         if(chunk->full()) {
             chunkFull=true;
             _partialTable.erase(it);
         }
-    } else {
-        oit=_oldPartial.find(srcCID);
-        if(oit!=_oldPartial.end()) { //already in old partial table
-            chunk=oit->second;
-            chunk->fill(payload, offset, length);
-            _oldPartial.erase(oit);
-            if(chunk->full()) {
-                chunkFull=true;
-            } else {
-                _partialTable[srcCID]=chunk;
-            }
-        } else {			//first pkt to the client
-            chunk=new CChunk(srcCID, chunkSize);
-            chunk->fill(payload, offset, length);
-            if(chunk->full()){
-                chunkFull=true;
-            }else{
-                _partialTable[srcCID]=chunk;
-            }
+    } else {			//first pkt to the client
+        chunk=new CChunk(srcCID, chunkSize, &_arena);
+        if(!chunk->GetPayload()) {
+            delete chunk;
+            p->kill();
+            return;
+        }
+        chunk->set_merkle_leaf(ch.merkle_leaf());
+        chunk->fill(payload, offset, length);
+        if(chunk->full()){
+            chunkFull=true;
+        }else{
+            _partialTable[srcCID]=chunk;
+            expire_after(chunk, _partial_timeout);
         }
     }
     if(chunkFull) { //have built the whole chunk pkt
@@ -407,7 +645,6 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 #ifdef CLIENTCACHE
         if (local_putcid || _cache_content_from_network) {
             struct cacheMeta *cm= _cacheMetaTable[contextID];
-            cm->curSize+=chunkSize;
             struct contentMeta *ctm=(struct contentMeta *)malloc(sizeof(contentMeta));
             ctm->chunkSize=chunkSize;
             ctm->ttl=ttl;
@@ -416,6 +653,7 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
             (*cmTable)[srcCID]=ctm;
             
             _contentTable[srcCID]=chunk;
+            cm->queue->insert(chunk);
             if (local_putcid) {
                 assert(ContentHeader::OP_LOCAL_PUTCID>1);
                 content[srcCID]= ContentHeader::OP_LOCAL_PUTCID;
@@ -425,6 +663,14 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
 
             addRoute(srcCID);
             applyLocalCachePolicy(contextID);
+
+            // unrequested chunks and those past their ttl are dropped later
+            if (_contentTable.get(srcCID)==chunk && (!local_putcid || ttl>0)) {
+                Timestamp delay=_refresh_interval;
+                if (ttl>0 && Timestamp::make_sec(ttl)<delay)
+                    delay=Timestamp::make_sec(ttl);
+                expire_after(chunk, delay);
+            }
         } else {
             if (CACHE_DEBUG)
                 click_chatter("LOCAL %s delete CID %s",_transport->local_hid().unparse().c_str(), srcCID.unparse().c_str());
@@ -434,126 +680,73 @@ void XIAContentModule::cache_incoming_local(Packet* p, const XID& srcCID, bool l
         delete chunk;
 #endif
     }
-    if(_timer>=REFRESH) {
-        _timer=0;
-        //trigger cache_management();
-        cache_management();
-    }
-
-
     p->kill();
 }
 
 /** 
- * @brief Clean up local cache based on policy 
+ * @brief Evict chunks from a context until it is back under its quota
+ *
+ * The order chunks are evicted in is set by the context's policy.
  *
  * @returns Void
  */ 
 void XIAContentModule::applyLocalCachePolicy(int contextID){
 #ifdef CLIENTCACHE
-    struct cacheMeta *cm=_cacheMetaTable[contextID];
-    switch(cm->policy){
-    case POLICY_FIFO:
+    struct cacheMeta *cm=_cacheMetaTable.get(contextID);
+    if(cm==NULL)
+        return;
+
     if(CACHE_DEBUG){
-        click_chatter("Cache Size %d/%d\n", cm->curSize, cm->maxSize);
+        click_chatter("Cache Size %lu/%d\n", cm->queue->bytes(), cm->maxSize);
     }
-    if(cm->maxSize!=0 && cm->curSize>cm->maxSize){
-        bool done=false;
-        HashTable<XID, struct contentMeta*> *cmTable=cm->contentMetaTable;
-        /* Remove expired content until curSize < maxSize */
-        struct contentMeta *cPtr;
-        int chunkSize;
-        HashTable<XID,CChunk*>::iterator cit;
-        cit=_contentTable.begin();
-        while(cit!=_contentTable.end()) {
-            int contentType=content[cit->first];
-            if(contentType == ContentHeader::OP_LOCAL_PUTCID){
-                cPtr=(*cmTable)[cit->first];
-                if(isExpiredContent(cPtr)){
-                    chunkSize=cPtr->chunkSize;
-                    cm->curSize-=chunkSize;
-                    cmTable->erase(cit->first);
-                    content.erase(cit->first);
-                    if(CACHE_DEBUG){
-                    click_chatter("RM [%s] Size: %d\n", cit->first.unparse().c_str(), 
-                            chunkSize);
-                    }
-                    _contentTable.erase(cit);
-                    free(cPtr);
-                    if(cm->curSize < cm->maxSize){
-                        done=true;                        
-                        break;
-                    }
-                }       
-            }
-            cit++;
-        }
-        /* Remove old but active contents to make space for new one */
-        if(!done){
-            while(cm->curSize>cm->maxSize){
-                const XID *minID=findOldestContent(contextID);
-                if(minID!=NULL){
-                    const XID tmp=*minID;
-                    cPtr=(*cmTable)[tmp];
-                    chunkSize=cPtr->chunkSize;
-                    cm->curSize-=chunkSize;
-                    cmTable->erase(tmp);
-                    content.erase(tmp);
-                    if(CACHE_DEBUG){
-                    click_chatter("RM [%s] Size: %d\n", _contentTable.find(tmp)->first.unparse().c_str(), 
-                            chunkSize);
-                    }
-                    _contentTable.erase(tmp);
-                    free(cPtr);
-                }
-            }
+    if(cm->maxSize==0)
+        return;
+
+    while(cm->queue->bytes() > (unsigned)cm->maxSize) {
+        CChunk *chunk=cm->queue->victim();
+        if(chunk==NULL)
+            break;
+
+        XID cid=chunk->id();
+        struct contentMeta *cPtr=cm->contentMetaTable->get(cid);
+        if(cPtr!=NULL){
+            cm->contentMetaTable->erase(cid);
+            free(cPtr);
         }
-    }
-    break;
-        default:
-    break;
+        if(CACHE_DEBUG){
+            click_chatter("RM [%s] Size: %d\n", cid.unparse().c_str(), chunk->GetSize());
+        }
+        content.erase(cid);
+        delRoute(cid);
+        _contentTable.erase(cid);
+        delete chunk;
     }
 #endif
 }
 
 /**
- * @brief check if a content is expired
- * 
- * @returns True if it is expired
- */
-bool XIAContentModule::isExpiredContent(struct contentMeta* cm){
-    int ttl=cm->ttl;
-    struct timeval *thisTime=&(cm->timestamp);    
-    struct timeval curTime;
-    gettimeofday(&curTime,NULL);
-    if(thisTime->tv_sec+ttl >= curTime.tv_sec){
-        return true;
-    }else{
-        return false;
-    }
-}
+ * @brief remove a chunk from the replacement queue it is charged to
+ *
+ * Used when a chunk leaves the cache other than by being evicted.
+ */
+void XIAContentModule::uncharge(CChunk *chunk)
+{
+    CReplacer *q=chunk->queue();
+    if(q==NULL)
+        return;
 
-const XID* XIAContentModule::findOldestContent(int contextID){
-    struct cacheMeta *cm=_cacheMetaTable[contextID];
-    HashTable<XID,CChunk*>::iterator cit;
-    cit=_contentTable.begin();
-    const XID *minID=NULL;
-    struct timeval minTime;
-    gettimeofday(&minTime, NULL);
-    HashTable<XID, struct contentMeta*>* cmTable=cm->contentMetaTable;
-    struct contentMeta *cPtr;
-    while(cit!=_contentTable.end()) {
-        int contentType=content[cit->first];
-        if(contentType == ContentHeader::OP_LOCAL_PUTCID){
-            cPtr=(*cmTable)[cit->first];
-            if(cPtr->timestamp.tv_sec<=minTime.tv_sec){
-                minTime=cPtr->timestamp;
-                minID=&(cit->first);
-            }
+    q->remove(chunk);
+    if(q->context()<0)
+        return;
+
+    struct cacheMeta *cm=_cacheMetaTable.get(q->context());
+    if(cm!=NULL){
+        struct contentMeta *cPtr=cm->contentMetaTable->get(chunk->id());
+        if(cPtr!=NULL){
+            cm->contentMetaTable->erase(chunk->id());
+            free(cPtr);
         }
-        cit++;
     }
-    return minID;
 }
 
 void XIAContentModule::cache_incoming_remove(Packet *p, const XID& srcCID){
@@ -564,61 +757,206 @@ void XIAContentModule::cache_incoming_remove(Packet *p, const XID& srcCID){
     struct cacheMeta *cm=_cacheMetaTable[contextID];
     if(cm!=NULL){
         HashTable<XID, struct contentMeta*> *cmTable=cm->contentMetaTable;
-        struct contentMeta* cPtr=(*cmTable)[srcCID];
-        if(cPtr!=NULL){
-            int chunkSize=cPtr->chunkSize;
-            cm->curSize-=chunkSize;
-            cmTable->erase(srcCID);
-            content.erase(srcCID);
+        struct contentMeta* cPtr=cmTable->get(srcCID);
+        CChunk *chunk=_contentTable.get(srcCID);
+        if(cPtr!=NULL && chunk!=NULL){
             if(CACHE_DEBUG){
-            click_chatter("RMCID Request [%s] Size: %d\n", _contentTable.find(srcCID)->first.unparse().c_str(), 
-                            chunkSize);
+            click_chatter("RMCID Request [%s] Size: %d\n", srcCID.unparse().c_str(), 
+                            cPtr->chunkSize);
             }
+            uncharge(chunk);
+            content.erase(srcCID);
             delRoute(srcCID);
             _contentTable.erase(srcCID);
-            free(cPtr);
+            delete chunk;
             if(CACHE_DEBUG){
-            click_chatter("Cache Size %d/%d\n", cm->curSize, cm->maxSize);
+            click_chatter("Cache Size %lu/%d\n", cm->queue->bytes(), cm->maxSize);
             }
         }
     }
     
 }
 
-void XIAContentModule::cache_management()
+void XIAContentModule::initialize(Element *owner)
 {
-    HashTable<XID,CChunk*>::iterator cit;
-    HashTable<XID,CChunk*>::iterator it;
-    CChunk *chunk = NULL;
+    _expiry_timer.initialize(owner);
+    _pace_timer.initialize(owner);
+    if(_routeTable)
+        _routeTable->add_local_index(this);
+}
 
-    for(it=_oldPartial.begin(); it!=_oldPartial.end(); it++) {
-        chunk=it->second;
-        if (CACHE_DEBUG)
-            click_chatter("oldPartial %s delete CID %s",_transport->local_hid().unparse().c_str(), chunk->id().unparse().c_str());
-        delete chunk;
+/*
+ * is cid served from this node, asked by the route table for CIDs it has no
+ * route for
+ */
+bool XIAContentModule::local_contains(const XID &cid)
+{
+    if(!_local_filter.may_contain(cid))
+        return false;
+    return _contentTable.find(cid)!=_contentTable.end() || (_store && _store->contains(cid));
+}
+
+void XIAContentModule::addRoute(const XID &cid)
+{
+    if (CACHE_DEBUG)
+        click_chatter("Add route %s", cid.unparse().c_str());
+    _local_filter.add(cid);
+    if(++_local_added > _local_filter.capacity())
+        rebuild_local_filter();
+}
+
+void XIAContentModule::delRoute(const XID &cid)
+{
+    if (CACHE_DEBUG)
+        click_chatter("Del route %s", cid.unparse().c_str());
+    if(++_local_removed > _local_added/2 && _local_removed > LOCAL_FILTER_MIN_BITS/LOCAL_FILTER_BITS_PER_CID)
+        rebuild_local_filter();
+}
+
+/*
+ * start the filter again from the chunks held now, sized with room for as
+ * many again
+ */
+void XIAContentModule::rebuild_local_filter()
+{
+    Vector<XID> stored;
+    if(_store)
+        _store->cids(stored);
+
+    size_t n=_contentTable.size() + stored.size();
+    _local_filter.reset(2*n);
+    for(HashTable<XID,CChunk*>::iterator it=_contentTable.begin(); it!=_contentTable.end(); ++it)
+        _local_filter.add(it->first);
+    for(int i=0; i<stored.size(); i++)
+        _local_filter.add(stored[i]);
+    _local_added=n;
+    _local_removed=0;
+}
+
+/*
+ * have the expiry wheel look at a chunk again after delay
+ */
+void XIAContentModule::expire_after(CChunk *chunk, const Timestamp &delay)
+{
+    Timestamp now=Timestamp::now();
+
+    chunk->_active=false;
+    chunk->_expiry=_expiry.schedule(chunk->id(), now + delay, now);
+    if(_expiry_timer.initialized() && !_expiry_timer.scheduled())
+        _expiry_timer.schedule_at(_expiry.next());
+}
+
+/*
+ * drop a partial chunk that has received nothing for a whole timeout
+ */
+void XIAContentModule::expire_partial(CChunk *chunk, const Timestamp &now)
+{
+    if(chunk->_active) {
+        chunk->_active=false;
+        chunk->_expiry=_expiry.schedule(chunk->id(), now + _partial_timeout, now);
+        return;
     }
-    _oldPartial.clear();
-    _oldPartial=_partialTable;
-    /* Never delete chunk in the _partialTable here
-       because the chunks are still used in the _oldPartialTable
-       This have created a bug before.  */
-    _partialTable.clear();
-#ifdef CLIENTCACHE
-    cit=_contentTable.begin();
-    while(cit!=_contentTable.end()) {
-        int contentType=content[cit->first];
-        if( contentType == 0 ) {
-            HashTable<XID, CChunk*>::iterator pit=cit;
-            _oldPartial[pit->first]=pit->second;
-            delRoute(pit->first);
-            content.erase(pit->first);
-            _contentTable.erase(pit);
-        }else if(contentType != ContentHeader::OP_LOCAL_PUTCID){
-            content[cit->first]=0;
-        }
-        cit++;
+
+    if (CACHE_DEBUG)
+        click_chatter("partial %s delete CID %s",_transport->local_hid().unparse().c_str(), chunk->id().unparse().c_str());
+    _partialTable.erase(chunk->id());
+    uncharge(chunk);
+    delete chunk;
+    _expired++;
+}
+
+/*
+ * drop a chunk cached for the client once its ttl has passed, or when it
+ * has not been requested for a whole refresh interval. Content put by a
+ * local application only goes when its ttl does.
+ */
+void XIAContentModule::expire_content(CChunk *chunk, const Timestamp &now)
+{
+    XID cid=chunk->id();
+    CReplacer *q=chunk->queue();
+    struct cacheMeta *cm=(q && q->context()>=0) ? _cacheMetaTable.get(q->context()) : NULL;
+    struct contentMeta *ctm=cm ? cm->contentMetaTable->get(cid) : NULL;
+
+    chunk->_expiry=0;
+    if(ctm==NULL)	// a router cache chunk that was partial, replacement takes care of it
+        return;
+
+    Timestamp when=now + _refresh_interval;
+    if(ctm->ttl>0) {
+        Timestamp dies=Timestamp(ctm->timestamp) + Timestamp::make_sec(ctm->ttl);
+        if(now>=dies) {
+            remove_local(chunk);
+            return;
+        }
+        if(dies<when)
+            when=dies;
     }
-#endif
+
+    int type=content.get(cid);
+    if(type!=ContentHeader::OP_LOCAL_PUTCID) {
+        if(type==0) {
+            remove_local(chunk);
+            return;
+        }
+        content[cid]=0;
+    } else if(ctm->ttl<=0)
+        return;
+
+    chunk->_expiry=_expiry.schedule(cid, when, now);
+}
+
+/*
+ * remove a chunk cached for the client, releasing its context once that is
+ * empty. The context is set up again by the next chunk put into it.
+ */
+void XIAContentModule::remove_local(CChunk *chunk)
+{
+    XID cid=chunk->id();
+    CReplacer *q=chunk->queue();
+    int contextID=q ? q->context() : -1;
+
+    if (CACHE_DEBUG)
+        click_chatter("expire %s delete CID %s",_transport->local_hid().unparse().c_str(), cid.unparse().c_str());
+    uncharge(chunk);
+    content.erase(cid);
+    delRoute(cid);
+    _contentTable.erase(cid);
+    delete chunk;
+    _expired++;
+
+    struct cacheMeta *cm=contextID>=0 ? _cacheMetaTable.get(contextID) : NULL;
+    if(cm!=NULL && cm->contentMetaTable->size()==0 && cm->queue->count()==0) {
+        _cacheMetaTable.erase(contextID);
+        delete cm->contentMetaTable;
+        delete cm->queue;
+        free(cm);
+    }
+}
+
+void XIAContentModule::run_expiry()
+{
+    Timestamp now=Timestamp::now();
+    Vector<CExpiry::Entry> due;
+
+    _expiry.advance(now, due);
+    for(int i=0; i<due.size(); i++) {
+        CChunk *chunk=_partialTable.get(due[i].cid);
+        if(chunk!=NULL && chunk->_expiry==due[i].serial) {
+            expire_partial(chunk, now);
+            continue;
+        }
+        chunk=_contentTable.get(due[i].cid);
+        if(chunk!=NULL && chunk->_expiry==due[i].serial)
+            expire_content(chunk, now);
+    }
+
+    if(!_expiry.empty())
+        _expiry_timer.schedule_at(_expiry.next());
+}
+
+void XIAContentModule::expiry_hook(Timer *, void *thunk)
+{
+    static_cast<XIAContentModule *>(thunk)->run_expiry();
 }
 
 /* source ID is the content */
@@ -632,8 +970,11 @@ void XIAContentModule::cache_incoming(Packet *p, const XID& srcCID, const XID& d
     if (CACHE_DEBUG){
         click_chatter("--Cache incoming--%s %s", srcCID.unparse().c_str(), _transport->local_hid().unparse().c_str());
 	}
+    // a chunk this router prefetched is addressed to it, but is cached like
+    // one passing through
+    bool prefetched = !local_putcid && dstHID==_transport->local_hid() && _prefetch.pending(srcCID);
     //FIXME: This comparison is just wrong. dstHID that is passed is hardcoded and sometimes different types are being compared
-    if(local_putcid || dstHID==_transport->local_hid()){
+    if(local_putcid || (dstHID==_transport->local_hid() && !prefetched)){
       
         // cache in client: if it is local putCID() then store content. Otherwise, should return the whole chunk if possible
 // 	printf("cache_incoming_local - local HID: %s, Dest HID: %s\n", _transport->local_hid().unparse().c_str(), dstHID.unparse().c_str());
@@ -646,196 +987,1529 @@ void XIAContentModule::cache_incoming(Packet *p, const XID& srcCID, const XID& d
     else{
         // cache in server, router
 // 	printf("cache_incoming_forward - local HID: %s, Dest HID: %s\n", _transport->local_hid().unparse().c_str(), dstHID.unparse().c_str());
-        cache_incoming_forward(p, srcCID);
+        cache_incoming_forward(p, srcCID, prefetched);
 	}
 }
 
-int
-XIAContentModule::MakeSpace(int chunkSize)
+/*
+ * a request of ours for a chunk that has partly arrived already, after a
+ * timeout, becomes requests for only the ranges still missing, leaving out
+ * those asked for recently. false if p should go out as it is.
+ */
+bool XIAContentModule::request_missing(Packet *p, const XID &cid, Vector<Packet *> &out)
 {
-    while( usedSize + chunkSize > MAXSIZE) {
-        HashTable<XID,int>::iterator i;
-        for(i=partial.begin(); i!=partial.end(); i++)
-            if(i->second==0)
-                break;
-
-
-        if(i!=partial.end()) {
-            HashTable<XID,CChunk*>::iterator iter = _partialTable.find(i->first);
-            usedSize-=iter->second->GetSize();
-
-            CChunk *t=iter->second;
-
-            _partialTable.erase(iter);
-            partial.erase(i);
+    HashTable<XID,CChunk*>::iterator it=_partialTable.find(cid);
+    if(it==_partialTable.end())
+        return false;
 
-            delete t;
-            continue;
-        }
+    ContentHeader ch(p);
+    if(ch.opcode()!=ContentHeader::OP_REQUEST || ch.chunk_offset() || ch.range_length())
+        return false;
 
-        for(i=content.begin(); i!=content.end(); i++) {
-            if(i->second==0)
+    CChunk *chunk=it->second;
+    uint32_t start[RANGE_MAX_GAPS], end[RANGE_MAX_GAPS];
+    int n=chunk->missing(start, end, RANGE_MAX_GAPS);
+    if(!chunk->_asked)
+        chunk->_asked=new CChunk::CAsk[RANGE_MAX_GAPS];
+
+    // a gap inside a range asked for less than RANGE_RETRY_MSEC ago is left
+    // to that request, so timeouts don't pile up requests on a lossy path
+    Timestamp now=Timestamp::now();
+    Timestamp retry=Timestamp::make_msec(RANGE_RETRY_MSEC);
+    CChunk::CAsk asked[RANGE_MAX_GAPS];
+    int nasked=0;
+
+    XIAHeader hdr(p);
+    const uint8_t *payload=hdr.payload();
+    for(int i=0; i<n; i++) {
+        int a;
+        for(a=0; a<chunk->_nasked; a++) {
+            const CChunk::CAsk &k=chunk->_asked[a];
+            if(k.start<=start[i] && end[i]<=k.end && now - k.at < retry)
                 break;
         }
-
-        if(i!=content.end()) {
-            HashTable<XID,CChunk*>::iterator iter=_contentTable.find(i->first);
-            usedSize-=iter->second->GetSize();
-            // modify the routin table	     //delete
-            delRoute(iter->first);
-            CChunk *t=iter->second;
-            _contentTable.erase(iter);
-            content.erase(i);
-            delete t;
+        if(a<chunk->_nasked) {
+            asked[nasked++]=chunk->_asked[a];
             continue;
         }
 
-        HashTable<XID,CChunk*>::iterator iter=_partialTable.begin();
-        if(iter!=_partialTable.end()) {
-            usedSize-=iter->second->GetSize();
-            CChunk *t=iter->second;
-            _partialTable.erase(iter);
-            partial.erase(i);
-            delete t;
-            continue;
-        }
+        WritablePacket *q=WritablePacket::make(256, payload, p->end_data() - payload, 20);
+        if(!q)
+            break;
 
-        iter=_contentTable.begin();
-        usedSize-=iter->second->GetSize();
-        //modify routing table	   //delete
+        ContentHeaderEncap *chdr=ContentHeaderEncap::MakeRangeRequestHeader(start[i], end[i] - start[i]);
+        if(ch.window())
+            chdr->set_window(ch.window());
+        XIAHeaderEncap encap(hdr);
+        q=chdr->encap(q);
+        if(q)
+            q=encap.encap(q, true);
+        delete chdr;
+        if(!q)
+            break;
 
-        delRoute(iter->first);
-        CChunk *t=iter->second;
-        _contentTable.erase(iter);
-        content.erase(iter->first);
-        delete t;
+        q->copy_annotations(p);
+        out.push_back(q);
+        CChunk::CAsk k={start[i], end[i], now};
+        asked[nasked++]=k;
     }
-    return 0;
-}
 
-CPart::CPart(unsigned int off, unsigned int len)
-{
-    offset=off;
-    length=len;
+    for(int i=0; i<nasked; i++)
+        chunk->_asked[i]=asked[i];
+    chunk->_nasked=nasked;
+    return nasked>0;
 }
 
-CChunk::CChunk(XID _xid, int chunkSize): deleted(false)
+/*
+ * check a response fragment from the network against its CID before it is
+ * cached or passed on, only fragments of Merkle tree CIDs can be checked
+ * on their own
+ */
+bool XIAContentModule::verify_fragment(Packet *p, const XID &cid)
 {
-    size=chunkSize;
-    complete=false;
-    payload=new char[size];
-    xid=_xid;
-}
+    ContentHeader ch(p);
+    int shift=ch.merkle_leaf();
+    if(!shift)
+        return true;
 
-CChunk::~CChunk()
-{
-    /* TODO: Memory leak prevention -- CPartList has to be deallocated */
-    delete payload;
+    XIAHeader xhdr(p);
+    const unsigned char *payload=xhdr.payload();
+    const unsigned char *end=p->end_data();
+    unsigned char proof[MERKLE_MAX_LEVELS * MERKLE_HASH_LEN];
+    int nproof=0;
+
+    const click_xia_ext *h=ch.hdr();
+    if(h->nxt==CLICK_XIA_NXT_MERKLE)
+        nproof=XIAMerkleTree::read_proof(reinterpret_cast<const click_xia_ext *>(reinterpret_cast<const unsigned char *>(h) + h->hlen),
+                end, proof, MERKLE_MAX_LEVELS);
+
+    if(nproof<0 || payload + ch.length() > end ||
+            !XIAMerkleTree::verify(cid.xid().id, ch.chunk_length(), shift, ch.chunk_offset(),
+                payload, ch.length(), proof, nproof)) {
+        _merkle_rejected++;
+        if (CACHE_DEBUG)
+            click_chatter("dropping fragment at %u of %s, its proof does not match", ch.chunk_offset(), cid.unparse().c_str());
+        return false;
+    }
+    return true;
 }
 
-void CChunk::Merge(CPartList::iterator it)
+/*
+ * decide whether a chunk passing through is worth caching, it has to be
+ * requested more often than the chunk it would push out
+ */
+bool
+XIAContentModule::admit(const XID &cid, unsigned int size)
 {
-    //std::cout<<"enter Merge: offset is "<< it->offset <<std::endl;
-    CPartList::iterator post_it;
-    post_it=it;
-    post_it++;
+    if(!_admission_enabled || _cache.bytes() + size <= _cache_size)
+        return true;
 
-    while(1) {
-        if(post_it==parts.end()) break;
-        if(post_it->v.offset > it->v.offset+it->v.length) {
-            break;
-        } else {
-            unsigned int l=it->v.offset+it->v.length;
-            unsigned int _l=post_it->v.offset+post_it->v.length;
-            if(l>_l) {
-                CPartListNode *n = post_it.get();
-                parts.erase(post_it);
-                delete n;
-            } else {
-                it->v.length= _l - it->v.offset;
-                CPartListNode *n = post_it.get();
-                parts.erase(post_it);
-                delete n;
-            }
-            post_it=it;
-            post_it++;
-        }
+    CChunk *victim=_cache.peek();
+    if(victim==NULL || _admission.prefer(cid, victim->id())) {
+        _admitted++;
+        return true;
     }
+    _rejected++;
+    return false;
 }
 
+/*
+ * evict chunks from the router cache until there is room for chunkSize
+ * more bytes
+ */
 int
-CChunk::fill(const unsigned char *_payload, unsigned int offset, unsigned int length)
+XIAContentModule::MakeSpace(int chunkSize)
 {
-    //  std::cout<<"enter fill, payload is "<<_payload<<std::endl;
-
-    CPartList::iterator it, post_it;
-    CPart p(offset, length);
-    char *off = payload + offset ;
-
-    for( it=parts.begin(); it!=parts.end(); it++ ) {
-        if(it->v.offset > offset)break;
-    }
-    if(it==parts.end()) {  //end
-        if(it==parts.begin()) { //empty
-            //std::cout<<"push back"<<std::endl;
-            memcpy(off, _payload, length);
-            parts.push_back(new CPartListNode(p));
-        } else {            //not empty
-            it--;
-            if( it->v.offset + it->v.length < offset + length) {
-                memcpy(off, _payload, length);
-                //std::cout<<"off is "<<off<<std::endl;
-                //std::cout<<"push back"<<std::endl;
-                parts.push_back(new CPartListNode(p));
-                Merge(it);
-            }
-        }
-    } else { //not end
-        if(it==parts.begin()) { //begin
-            memcpy(off, _payload, length);
-            //std::cout<<"push front"<<std::endl;
-            parts.push_front(new CPartListNode(p));
-            it=parts.begin();
-            Merge(it);
-        } else {	//not begin
-            it--;
-            if(offset <= it->v.offset + it->v.length ) { //overlap with previous interval
-                if( offset+length <= it->v.offset + it->v.length ) { //cover
-                } else { //not cover
-                    memcpy(off, _payload, length);
-                    it->v.length = (offset+length) - it->v.offset;
-                    Merge(it);
-                }
-            } else { // not overlap with previous interval
-                memcpy(off,_payload, length);
-                //std::cout<<"insert"<<std::endl;
-                parts.insert(post_it, new CPartListNode(p));
-                post_it=it;
-                post_it++;
-                Merge(post_it);
-            }
+    while(_cache.bytes() + chunkSize > _cache_size) {
+        CChunk *chunk=_cache.victim();
+        if(chunk==NULL)
+            break;
+
+        XID cid=chunk->id();
+        if(_contentTable.get(cid)==chunk) {
+            // modify the routin table	     //delete, unless the disk tier still serves it
+            if(!_store || !_store->contains(cid))
+                delRoute(cid);
+            _contentTable.erase(cid);
+        } else {
+            if(_partialTable.get(cid)==chunk)
+                _partialTable.erase(cid);
         }
+        delete chunk;
     }
-    //  std::cout<<"leave fill: list size is "<<parts.size()<<std::endl;
     return 0;
 }
 
-
-bool
-CChunk::full()
+CBloom::CBloom()
+    : _bits(0), _mask(0), _capacity(0)
 {
-    if(complete==true) return true;
+}
 
-    CPartList::iterator it;
-    it= parts.begin();
+CBloom::~CBloom()
+{
+    delete[] _bits;
+}
 
-    if( it->v.offset==0 && it->v.length==size) {
-        complete=true;
+void
+CBloom::reset(size_t n)
+{
+    size_t nbits=LOCAL_FILTER_MIN_BITS;
+    while(nbits < n*LOCAL_FILTER_BITS_PER_CID && nbits < 0x80000000U)
+        nbits*=2;
+
+    if(nbits!=(size_t)_mask + 1 || !_bits) {
+        delete[] _bits;
+        _bits=new uint32_t[nbits/32];
+        _mask=nbits - 1;
+    }
+    memset(_bits, 0, nbits/8);
+    _capacity=nbits/LOCAL_FILTER_BITS_PER_CID;
+}
+
+/*
+ * CIDs are SHA-1 hashes, so slices of them serve as the hash values. The
+ * admission sketch takes the leading bytes, this takes the trailing ones.
+ */
+void
+CBloom::add(const XID &xid)
+{
+    const uint8_t *id=xid.xid().id + CLICK_XIA_XID_ID_LEN - LOCAL_FILTER_HASHES*sizeof(uint32_t);
+    for(int i=0; i<LOCAL_FILTER_HASHES; i++) {
+        uint32_t h;
+        memcpy(&h, id + i*sizeof(uint32_t), sizeof(uint32_t));
+        h&=_mask;
+        _bits[h/32]|=1U << (h%32);
+    }
+}
+
+bool
+CBloom::may_contain(const XID &xid) const
+{
+    const uint8_t *id=xid.xid().id + CLICK_XIA_XID_ID_LEN - LOCAL_FILTER_HASHES*sizeof(uint32_t);
+    for(int i=0; i<LOCAL_FILTER_HASHES; i++) {
+        uint32_t h;
+        memcpy(&h, id + i*sizeof(uint32_t), sizeof(uint32_t));
+        h&=_mask;
+        if(!(_bits[h/32] & (1U << (h%32))))
+            return false;
+    }
+    return true;
+}
+
+CExpiry::CExpiry()
+    : _cur(0), _count(0), _serial(0)
+{
+}
+
+/*
+ * add an entry for cid in the slot covering when, returns the serial the
+ * chunk should keep
+ */
+uint32_t
+CExpiry::schedule(const XID &cid, const Timestamp &when, const Timestamp &now)
+{
+    Entry e;
+    e.cid=cid;
+    if(++_serial==0)
+        _serial=1;
+    e.serial=_serial;
+
+    if(_count==0)
+        _base=now;
+    Timestamp::value_type ticks=1;
+    if(when>_base)
+        ticks=((when - _base).msecval() + EXPIRY_TICK_MSEC - 1) / EXPIRY_TICK_MSEC;
+    if(ticks<1)
+        ticks=1;
+    else if(ticks>EXPIRY_SLOTS-1)
+        ticks=EXPIRY_SLOTS-1;
+
+    _slots[(_cur + ticks) % EXPIRY_SLOTS].push_back(e);
+    _count++;
+    return e.serial;
+}
+
+/*
+ * move the wheel on to now, collecting the entries of every slot passed
+ */
+void
+CExpiry::advance(const Timestamp &now, Vector<Entry> &due)
+{
+    Timestamp tick=Timestamp::make_msec(EXPIRY_TICK_MSEC);
+
+    for(int n=0; n<EXPIRY_SLOTS && _count>0 && _base + tick<=now; n++) {
+        _cur=(_cur + 1) % EXPIRY_SLOTS;
+        _base+=tick;
+        Vector<Entry> &slot=_slots[_cur];
+        for(int i=0; i<slot.size(); i++)
+            due.push_back(slot[i]);
+        _count-=slot.size();
+        slot.clear();
+    }
+}
+
+Timestamp
+CExpiry::next() const
+{
+    return _base + Timestamp::make_msec(EXPIRY_TICK_MSEC);
+}
+
+/*
+ * write a completed chunk behind to the disk tier; chunks it pushes out of
+ * the store lose their route unless they are still in memory
+ */
+void
+XIAContentModule::store(CChunk *chunk)
+{
+    Vector<XID> evicted;
+
+    _store->append(chunk->id(), chunk->GetPayload(), chunk->GetSize(), evicted, chunk->merkle_leaf());
+    for(int i=0; i<evicted.size(); i++)
+        if(_contentTable.find(evicted[i])==_contentTable.end())
+            delRoute(evicted[i]);
+}
+
+/*
+ * bring a chunk the disk tier holds back into the router cache
+ */
+HashTable<XID,CChunk*>::iterator
+XIAContentModule::promote(const XID &cid)
+{
+    uint32_t length;
+    int merkle_leaf;
+    const char *data=_store->lookup(cid, &length, &merkle_leaf);
+    if(data==NULL)
+        return _contentTable.end();
+
+    MakeSpace(length);
+    CChunk *chunk=new CChunk(cid, length, &_arena);
+    if(!chunk->GetPayload()) {
+        delete chunk;
+        return _contentTable.end();
+    }
+    chunk->set_merkle_leaf(merkle_leaf);
+    chunk->fill(reinterpret_cast<const unsigned char *>(data), 0, length);
+    _contentTable[cid]=chunk;
+    _cache.insert(chunk);
+    return _contentTable.find(cid);
+}
+
+/*
+ * after a restart, serve the CIDs found in the disk tier from this node,
+ * adding them in one pass without reporting each one
+ */
+int
+XIAContentModule::restore_routes()
+{
+    rebuild_local_filter();
+    return _store->count();
+}
+
+CResponse::CResponse(const XIAHeaderEncap &encap, const ContentHeaderEncap &contenth,
+                     const XIAMerkleTree *merkle)
+    : _merkle(merkle)
+{
+    _xia_len=encap.hdr_size();
+    _len=_xia_len + contenth.hlen();
+    _hdr=new unsigned char[_len];
+    memcpy(_hdr, encap.hdr(), _xia_len);
+    memcpy(_hdr + _xia_len, contenth.hdr(), contenth.hlen());
+
+    _chunk_offset=find_value(ContentHeader::CHUNK_OFFSET, sizeof(uint32_t));
+    _length=find_value(ContentHeader::LENGTH, sizeof(uint16_t));
+    _now=Timestamp::now();
+}
+
+CResponse::~CResponse()
+{
+    delete[] _hdr;
+}
+
+/*
+ * locate the value of key in the serialized content header, the entries
+ * are laid out as (1 + value length, key, value)
+ */
+size_t
+CResponse::find_value(uint8_t key, size_t len) const
+{
+    size_t i=_xia_len + offsetof(struct click_xia_ext, data);
+
+    while (i + 2 <= _len && _hdr[i]!=0) {
+        size_t vlen=_hdr[i] - 1;
+        if (_hdr[i+1]==key && vlen==len && i + 2 + vlen <= _len)
+            return i + 2;
+        i+=2 + vlen;
+    }
+    return 0;
+}
+
+WritablePacket *
+CResponse::make(const char *payload, uint32_t length, const unsigned char *proof, int nproof) const
+{
+    size_t proof_len=XIAMerkleTree::proof_size(nproof);
+    WritablePacket *p=Packet::make(Packet::default_headroom, 0, _len + proof_len + length, 0);
+    if (!p)
+        return 0;
+
+    unsigned char *d=p->data();
+    memcpy(d, _hdr, _len);
+    if (nproof) {
+        // chain the proof on after the content header
+        reinterpret_cast<click_xia_ext *>(d + _xia_len)->nxt=CLICK_XIA_NXT_MERKLE;
+        XIAMerkleTree::write_proof(d + _len, proof, nproof);
+    }
+    memcpy(d + _len + proof_len, payload, length);
+
+    click_xia *xiah=reinterpret_cast<click_xia *>(d);
+    xiah->plen=htons(length);
+    p->set_xia_header(xiah, _xia_len);
+    p->timestamp_anno()=_now;
+    return p;
+}
+
+WritablePacket *
+CResponse::make_fragment(const char *chunk, uint32_t offset, uint16_t length) const
+{
+    unsigned char proof[MERKLE_MAX_LEVELS * MERKLE_HASH_LEN];
+    int nproof=0;
+
+    if (_merkle && (nproof=_merkle->proof(offset, length, proof)) < 0)
+        return 0;
+
+    WritablePacket *p=make(chunk + offset, length, proof, nproof);
+    if (!p)
+        return 0;
+
+    // content header values are kept in host order
+    if (_chunk_offset)
+        memcpy(p->data() + _chunk_offset, &offset, sizeof(offset));
+    if (_length)
+        memcpy(p->data() + _length, &length, sizeof(length));
+    return p;
+}
+
+/*
+ * the payload of the fragment starting at offset for packets of pktsize
+ * bytes, a Merkle tree fragment holds whole leaves and its proof
+ */
+uint16_t
+CResponse::fragment_length(uint32_t offset, uint32_t size, size_t pktsize) const
+{
+    size_t room=pktsize > _len ? pktsize - _len : 1;
+    uint32_t l;
+
+    if (_merkle) {
+        // a fragment starting part way through a range request may only be
+        // aligned for a lower level
+        int level=_merkle->fragment_level(room);
+        while (level>0 && (offset & ((1U << (_merkle->leaf_shift() + level)) - 1)))
+            level--;
+        l=_merkle->fragment_length(offset, level);
+    }
+    else
+        l=(size - offset) < room ? (size - offset) : room;
+    return l < 0xffff ? l : 0xffff;
+}
+
+CTrain::CTrain(const XID &cid, CChunk *chunk, const XIAPath &source, uint8_t max_dnode, unsigned pktsize)
+    : _cid(cid), _chunk(chunk), _max_dnode(max_dnode)
+{
+    XIAHeaderEncap encap;
+    encap.set_src_path(source);
+    encap.set_nxt(CLICK_XIA_NXT_CID);
+    _fixed=*encap.hdr();
+
+    const char *pl=chunk->GetPayload();
+    unsigned int s=chunk->GetSize();
+    ContentHeaderEncap contenth(0, 0, 0, s);
+    if (chunk->merkle_leaf())
+	contenth.set_merkle_leaf(chunk->merkle_leaf());
+    CResponse response(encap, contenth, chunk->merkle_tree());
+
+    // the built header has no destination nodes, leave room for the largest
+    // destination this train will be used for
+    size_t dlen=max_dnode * sizeof(click_xia_xid_node);
+    size_t room=pktsize > dlen ? pktsize - dlen : 1;
+
+    // fragments vary in size once they carry proofs, find the total first
+    Vector<WritablePacket *> built;
+    _bytes=0;
+    for (unsigned int cp=0; cp < s; ) {
+	uint16_t len=response.fragment_length(cp, s, room);
+	WritablePacket *p=response.make_fragment(pl, cp, len);
+	if (!p)
+	    break;
+	built.push_back(p);
+	_plen.push_back(len);
+	_bytes+=p->length() - sizeof(click_xia);
+	cp+=len;
+    }
+    _buf=new unsigned char[_bytes ? _bytes : 1];
+
+    uint32_t at=0;
+    for (int i=0; i < built.size(); i++) {
+	WritablePacket *p=built[i];
+	_frag.push_back(at);
+	memcpy(_buf + at, p->data() + sizeof(click_xia), p->length() - sizeof(click_xia));
+	at+=p->length() - sizeof(click_xia);
+	p->kill();
+    }
+    _frag.push_back(at);
+}
+
+CTrain::~CTrain()
+{
+    delete[] _buf;
+}
+
+WritablePacket *
+CTrain::make(int i, const click_xia_xid_node *dst, uint8_t dnode, const Timestamp &now) const
+{
+    size_t dlen=dnode * sizeof(click_xia_xid_node);
+    size_t flen=_frag[i+1] - _frag[i];
+
+    WritablePacket *p=Packet::make(Packet::default_headroom, 0, sizeof(click_xia) + dlen + flen, 0);
+    if (!p)
+	return 0;
+
+    click_xia *xiah=reinterpret_cast<click_xia *>(p->data());
+    *xiah=_fixed;
+    xiah->dnode=dnode;
+    xiah->plen=htons(_plen[i]);
+    memcpy(xiah->node, dst, dlen);
+    memcpy(xiah->node + dnode, _buf + _frag[i], flen);
+
+    p->set_xia_header(xiah, XIAHeader::hdr_size(dnode + _fixed.snode));
+    p->timestamp_anno()=now;
+    return p;
+}
+
+CPacer::CPacer()
+    : _rate(PACE_RATE), _total(PACE_TOTAL), _limit(PACE_QUEUE), _queued(0),
+      _total_tokens(0), _sent(0), _drops(0)
+{
+}
+
+CPacer::~CPacer()
+{
+    clear();
+}
+
+void
+CPacer::clear()
+{
+    for (HashTable<XID, Flow*>::iterator it=_flows.begin(); it!=_flows.end(); ++it) {
+	Flow *f=it->second;
+	for (size_t i=0; i<f->queue.size(); i++)
+	    f->queue[i].p->kill();
+	delete f;
+    }
+    _flows.clear();
+    _active.__clear();
+    _idle.__clear();
+    _queued=0;
+}
+
+/*
+ * the first fragment of cid's response to dst that is still queued, -1 if
+ * none of it is
+ */
+int
+CPacer::queued_from(const XID &dst, const XID &cid)
+{
+    Flow *f=_flows.get(dst);
+    if (!f)
+	return -1;
+    HashTable<XID, int>::iterator it=f->sending.find(cid);
+    return it==f->sending.end() ? -1 : it->second;
+}
+
+/*
+ * queue fragment index of cid's response to dst, resent fragments don't
+ * move queued_from(); returns false if the queue is full
+ */
+bool
+CPacer::enqueue(const XID &dst, uint32_t window, const XID &cid, int index, bool last,
+		bool resend, Packet *p, const Timestamp &now)
+{
+    if (_queued + p->length() > _limit) {
+	_drops++;
+	return false;
+    }
+
+    Flow *f=_flows.get(dst);
+    if (!f) {
+	f=new Flow;
+	f->dst=dst;
+	f->window=window ? window : PACE_WINDOW;
+	f->tokens=f->window;
+	f->filled=now;
+	_flows.set(dst, f);
+	_active.push_back(f);
+    } else if (f->queue.empty()) {
+	_idle.erase(f);
+	_active.push_back(f);
+    }
+    if (window)
+	f->window=window;
+
+    Entry e;
+    e.p=p;
+    e.cid=cid;
+    e.index=index;
+    e.last=last;
+    e.resend=resend;
+    f->queue.push_back(e);
+    if (!resend && f->sending.find(cid)==f->sending.end())
+	f->sending.set(cid, index);
+
+    _queued+=p->length();
+    return true;
+}
+
+void
+CPacer::fill(Flow *f, const Timestamp &now)
+{
+    Timestamp::value_type usec=(now - f->filled).usecval();
+    if (usec<=0)
+	return;
+    if (usec>10000000)
+	usec=10000000;		// more than enough to fill any window
+
+    int64_t add=(int64_t)usec * _rate / 1000000;
+    if (add==0)
+	return;
+    f->tokens+=add;
+    f->filled=now;
+    if (f->tokens > (int64_t)f->window)
+	f->tokens=f->window;
+}
+
+int64_t
+CPacer::total_depth() const
+{
+    int64_t depth=(int64_t)_total * PACE_TOTAL_MSEC / 1000;
+    return depth > PACE_WINDOW ? depth : PACE_WINDOW;
+}
+
+void
+CPacer::fill_total(const Timestamp &now)
+{
+    Timestamp::value_type usec=(now - _total_filled).usecval();
+    if (!_total || usec<=0)
+	return;
+    if (usec>10000000)
+	usec=10000000;
+
+    int64_t add=(int64_t)usec * _total / 1000000;
+    if (add==0)
+	return;
+    _total_tokens+=add;
+    _total_filled=now;
+    if (_total_tokens > total_depth())
+	_total_tokens=total_depth();
+}
+
+/*
+ * forget requesters that have been idle long enough for their buckets to
+ * refill, a new flow starts with a full bucket anyway
+ */
+void
+CPacer::prune(const Timestamp &now)
+{
+    while (!_idle.empty()) {
+	Flow *f=_idle.front();
+	fill(f, now);
+	if (f->tokens < (int64_t)f->window)
+	    break;
+
+	_idle.pop_front();
+	_flows.erase(f->dst);
+	delete f;
+    }
+}
+
+/*
+ * take the fragments that may go now, a round robin over the requesters
+ */
+void
+CPacer::dequeue(const Timestamp &now, Vector<Packet *> &out)
+{
+    fill_total(now);
+    for (List<Flow, &Flow::link>::iterator it=_active.begin(); it!=_active.end(); ++it)
+	fill(it.get(), now);
+
+    bool progress=true;
+    while (progress && !_active.empty()) {
+	progress=false;
+
+	List<Flow, &Flow::link>::iterator it=_active.begin();
+	while (it!=_active.end()) {
+	    Flow *f=it.get();
+	    ++it;
+
+	    Entry &e=f->queue.front();
+	    int64_t len=e.p->length();
+
+	    // a fragment larger than the bucket goes once the bucket is full
+	    if (_rate && f->tokens < len && f->tokens < (int64_t)f->window)
+		continue;
+	    if (_rate && _total && _total_tokens < len && _total_tokens < total_depth()) {
+		progress=false;
+		break;
+	    }
+
+	    f->tokens-=len;
+	    _total_tokens-=len;
+	    _queued-=len;
+	    _sent++;
+	    out.push_back(e.p);
+
+	    if (!e.resend) {
+		if (e.last)
+		    f->sending.erase(e.cid);
+		else
+		    f->sending.set(e.cid, e.index + 1);
+	    }
+	    f->queue.pop_front();
+
+	    if (f->queue.empty()) {
+		// anything left over belongs to a response that was cut short
+		f->sending.clear();
+		_active.erase(f);
+		_idle.push_back(f);
+	    }
+	    progress=true;
+	}
+    }
+
+    prune(now);
+}
+
+/*
+ * when the next fragment can go
+ */
+Timestamp
+CPacer::next(const Timestamp &now) const
+{
+    if (_active.empty())
+	return Timestamp();
+    if (!_rate)
+	return now;
+
+    int64_t wait=-1;
+    for (List<Flow, &Flow::link>::const_iterator it=_active.begin(); it!=_active.end(); ++it) {
+	const Flow *f=it.get();
+	int64_t need=f->queue.front().p->length();
+	if (need > (int64_t)f->window)
+	    need=f->window;
+	need-=f->tokens;
+
+	int64_t usec=need > 0 ? need * 1000000 / _rate + 1 : 0;
+	if (wait<0 || usec<wait)
+	    wait=usec;
+    }
+
+    if (_total) {
+	int64_t need=_active.front()->queue.front().p->length();
+	if (need > total_depth())
+	    need=total_depth();
+	need-=_total_tokens;
+	int64_t usec=need > 0 ? need * 1000000 / _total + 1 : 0;
+	if (usec > wait)
+	    wait=usec;
+    }
+    return now + Timestamp::make_usec(wait);
+}
+
+CPrefetch::CPrefetch()
+    : _depth(PREFETCH_DEPTH), _rate(PREFETCH_RATE), _memory(PREFETCH_MEMORY), _outstanding(0),
+      _tokens(0), _sent(0), _hits(0), _refused(0)
+{
+}
+
+CPrefetch::~CPrefetch()
+{
+    clear();
+}
+
+void
+CPrefetch::clear()
+{
+    while (!_lru.empty())
+	drop_manifest(_lru.back());
+    _pending.clear();
+    _outstanding=0;
+}
+
+/*
+ * A manifest starts with PREFETCH_MAGIC and has a "chunk <40 hex digits>
+ * <size>" line for each of its chunks, other lines are skipped. The
+ * manifest's own CID is placed before its first chunk, so a request for it
+ * prefetches the start of the content.
+ */
+bool
+CPrefetch::add_manifest(const XID &cid, const char *data, uint32_t length)
+{
+    size_t magic=strlen(PREFETCH_MAGIC);
+    if (length < magic || length > PREFETCH_MAX_MANIFEST || memcmp(data, PREFETCH_MAGIC, magic)!=0)
+	return false;
+    if (_manifests.find(cid)!=_manifests.end())
+	return true;
+
+    Manifest *m=new Manifest;
+    m->cid=cid;
+    const char *end=data + length;
+    for (const char *line=data + magic; line < end; ) {
+	const char *eol=(const char *)memchr(line, '\n', end - line);
+	if (!eol)
+	    eol=end;
+
+	XID x;
+	if (eol - line > 47 && memcmp(line, "chunk ", 6)==0 && line[46]==' ' &&
+		cp_xid(String("CID:") + String(line + 6, 40), &x)) {
+	    uint32_t size=0;
+	    for (const char *d=line + 47; d < eol && *d>='0' && *d<='9'; d++)
+		size=size*10 + (*d - '0');
+	    m->cids.push_back(x);
+	    m->sizes.push_back(size);
+	}
+	line=eol + 1;
+    }
+    if (m->cids.empty()) {
+	delete m;
+	return false;
+    }
+
+    while (_manifests.size() >= PREFETCH_MANIFESTS)
+	drop_manifest(_lru.back());
+    _manifests.set(cid, m);
+    _lru.push_front(m);
+
+    Place start={m, -1};
+    _places.set(cid, start);
+    for (int i=0; i<m->cids.size(); i++) {
+	Place p={m, i};
+	_places.set(m->cids[i], p);
+    }
+    return true;
+}
+
+void
+CPrefetch::drop_manifest(Manifest *m)
+{
+    HashTable<XID, Place>::iterator it;
+    for (int i=0; i<m->cids.size(); i++) {
+	it=_places.find(m->cids[i]);
+	if (it!=_places.end() && it->second.m==m)
+	    _places.erase(it);
+    }
+    it=_places.find(m->cid);
+    if (it!=_places.end() && it->second.m==m)
+	_places.erase(it);
+
+    _manifests.erase(m->cid);
+    _lru.erase(m);
+    delete m;
+}
+
+void
+CPrefetch::following(const XID &cid, Vector<XID> &cids, Vector<uint32_t> &sizes) const
+{
+    HashTable<XID, Place>::const_iterator it=_places.find(cid);
+    if (it==_places.end())
+	return;
+
+    const Manifest *m=it->second.m;
+    for (int i=it->second.index + 1; i<m->cids.size() && i<=it->second.index + _depth; i++) {
+	cids.push_back(m->cids[i]);
+	sizes.push_back(m->sizes[i]);
+    }
+}
+
+/*
+ * The bucket holds up to a second's worth of bytes and may go into debt
+ * for the chunk that empties it, so any chunk size gets through.
+ */
+bool
+CPrefetch::reserve(const XID &cid, uint32_t size, const Timestamp &now)
+{
+    sweep(now);
+
+    if (_rate) {
+	Timestamp::value_type usec=(now - _filled).usecval();
+	if (usec>1000000)
+	    usec=1000000;
+	if (usec>0) {
+	    _tokens+=(int64_t)usec * _rate / 1000000;
+	    _filled=now;
+	    if (_tokens > (int64_t)_rate)
+		_tokens=_rate;
+	}
+    }
+
+    if ((_rate && _tokens<=0) || _outstanding + size > _memory) {
+	_refused++;
+	return false;
+    }
+
+    _tokens-=size;
+    _outstanding+=size;
+    _sent++;
+    Entry e={size, now + Timestamp::make_sec(PREFETCH_LIFETIME), false};
+    _pending.set(cid, e);
+    return true;
+}
+
+bool
+CPrefetch::claim(const XID &cid)
+{
+    HashTable<XID, Entry>::iterator it=_pending.find(cid);
+    if (it==_pending.end() || it->second.claimed)
+	return false;
+
+    _outstanding-=it->second.size;
+    it->second.size=0;
+    it->second.claimed=true;
+    _hits++;
+    return true;
+}
+
+/*
+ * release the budget of prefetched chunks nobody asked for, at most once a
+ * second
+ */
+void
+CPrefetch::sweep(const Timestamp &now)
+{
+    if (now - _swept < Timestamp::make_sec(1))
+	return;
+    _swept=now;
+
+    for (HashTable<XID, Entry>::iterator it=_pending.begin(); it!=_pending.end(); ) {
+	if (it->second.expires <= now) {
+	    _outstanding-=it->second.size;
+	    it=_pending.erase(it);
+	} else
+	    ++it;
+    }
+}
+
+CChunk::CChunk(XID _xid, int chunkSize, CArena *arena): deleted(false), _queue(0), _qid(0), _freq(0), _requests(0),
+      _merkle_shift(0), _merkle(0), _expiry(0), _active(false), _asked(0), _nasked(0)
+{
+    size=chunkSize;
+    complete=false;
+    _arena=arena;
+    payload=_arena ? _arena->alloc(size) : new char[size];
+    xid=_xid;
+    _ranges=_inline_ranges;
+    _nranges=0;
+    _max_ranges=CCHUNK_INLINE_RANGES;
+}
+
+CChunk::~CChunk()
+{
+    if (_queue)
+        _queue->remove(this);
+    if (_arena)
+        _arena->free(payload, size);
+    else
+        delete[] payload;
+    if (_ranges!=_inline_ranges)
+        ::free(_ranges);
+    delete _merkle;
+    delete[] _asked;
+}
+
+/*
+ * record that [start, end) has been received, merging it with any ranges it
+ * overlaps or touches
+ */
+void CChunk::add_range(uint32_t start, uint32_t end)
+{
+    // fragments usually arrive in order and just extend the last range
+    if (_nranges>0 && start>=_ranges[_nranges-1].start && start<=_ranges[_nranges-1].end) {
+        if (end>_ranges[_nranges-1].end)
+            _ranges[_nranges-1].end=end;
+        return;
+    }
+
+    // lo is the first range that ends at or after start, hi the first one
+    // that starts after end, everything in between merges with the new range
+    unsigned lo=0, hi=_nranges;
+    while (lo<hi) {
+        unsigned mid=(lo+hi)/2;
+        if (_ranges[mid].end<start)
+            lo=mid+1;
+        else
+            hi=mid;
+    }
+    hi=lo;
+    while (hi<_nranges && _ranges[hi].start<=end)
+        hi++;
+
+    if (lo==hi) {
+        if (_nranges==_max_ranges) {
+            CRange *r=(CRange *)malloc(2*_max_ranges*sizeof(CRange));
+            memcpy(r, _ranges, _nranges*sizeof(CRange));
+            if (_ranges!=_inline_ranges)
+                ::free(_ranges);
+            _ranges=r;
+            _max_ranges*=2;
+        }
+        memmove(&_ranges[lo+1], &_ranges[lo], (_nranges-lo)*sizeof(CRange));
+        _ranges[lo].start=start;
+        _ranges[lo].end=end;
+        _nranges++;
+    } else {
+        if (_ranges[lo].start<start)
+            start=_ranges[lo].start;
+        if (_ranges[hi-1].end>end)
+            end=_ranges[hi-1].end;
+        _ranges[lo].start=start;
+        _ranges[lo].end=end;
+        memmove(&_ranges[lo+1], &_ranges[hi], (_nranges-hi)*sizeof(CRange));
+        _nranges-=hi-lo-1;
+    }
+}
+
+int
+CChunk::fill(const unsigned char *_payload, unsigned int offset, unsigned int length)
+{
+    if (!payload || offset>size || length>size-offset)
+        return -1;
+    if (length==0)
+        return 0;
+
+    memcpy(payload+offset, _payload, length);
+    add_range(offset, offset+length);
+    _active=true;
+    return 0;
+}
+
+
+XIAMerkleTree *
+CChunk::merkle_tree()
+{
+    if (!_merkle_shift || !full())
+        return 0;
+    if (!_merkle)
+        _merkle=new XIAMerkleTree(reinterpret_cast<const unsigned char *>(payload), size, _merkle_shift);
+    return _merkle;
+}
+
+bool
+CChunk::full()
+{
+    if(complete==true) return true;
+
+    if (size==0 || (_nranges==1 && _ranges[0].start==0 && _ranges[0].end==size)) {
+        complete=true;
         return true;
     }
     return false;
 }
 
+int
+CChunk::missing(uint32_t *start, uint32_t *end, int max) const
+{
+    uint32_t at=0;
+    int n=0;
+
+    for (unsigned i=0; i<=_nranges; i++) {
+        uint32_t next=i<_nranges ? _ranges[i].start : size;
+        if (next>at) {
+            if (n==max) {
+                end[n-1]=size;
+                break;
+            }
+            start[n]=at;
+            end[n]=next;
+            n++;
+        }
+        if (i<_nranges)
+            at=_ranges[i].end;
+    }
+    return n;
+}
+
+CArena::CArena()
+    : _slab_bytes(0), _large_bytes(0), _used_bytes(0), _failures(0)
+{
+    for (int i=0; i<ARENA_CLASSES; i++) {
+        _partial[i]=0;
+        _full[i]=0;
+        _empty[i]=0;
+    }
+}
+
+CArena::~CArena()
+{
+    for (int i=0; i<ARENA_CLASSES; i++) {
+        while (_partial[i]) {
+            Slab *s=_partial[i];
+            unlink(&_partial[i], s);
+            ::free(s);
+        }
+        while (_full[i]) {
+            Slab *s=_full[i];
+            unlink(&_full[i], s);
+            ::free(s);
+        }
+    }
+}
+
+unsigned
+CArena::block_size(int cls)
+{
+    // 1K, 1.5K, 2K, 3K, 4K, ...
+    return (cls&1) ? (3*ARENA_MIN_BLOCK/2)<<(cls/2) : ARENA_MIN_BLOCK<<(cls/2);
+}
+
+int
+CArena::size_class(unsigned size)
+{
+    if (size>ARENA_MAX_BLOCK)
+        return -1;
+    int cls=0;
+    while (block_size(cls)<size)
+        cls++;
+    return cls;
+}
+
+unsigned
+CArena::slab_size(int cls)
+{
+    unsigned want=ARENA_SLAB_BLOCKS*block_size(cls);
+    unsigned sz=ARENA_MIN_SLAB;
+    while (sz<want)
+        sz*=2;
+    return sz;
+}
+
+unsigned
+CArena::slab_blocks(int cls)
+{
+    return (slab_size(cls)-sizeof(Slab))/block_size(cls);
+}
+
+void
+CArena::link(Slab **list, Slab *s)
+{
+    s->prev=0;
+    s->next=*list;
+    if (*list)
+        (*list)->prev=s;
+    *list=s;
+}
+
+void
+CArena::unlink(Slab **list, Slab *s)
+{
+    if (s->prev)
+        s->prev->next=s->next;
+    else
+        *list=s->next;
+    if (s->next)
+        s->next->prev=s->prev;
+}
+
+char *
+CArena::alloc(unsigned size)
+{
+    int cls=size_class(size);
+    if (cls<0) {
+        char *p=(char *)malloc(size);
+        if (p)
+            _large_bytes+=size;
+        else
+            _failures++;
+        return p;
+    }
+
+    Slab *s=_partial[cls];
+    if (!s) {
+        void *mem;
+        if (posix_memalign(&mem, slab_size(cls), slab_size(cls))!=0) {
+            _failures++;
+            return 0;
+        }
+        s=(Slab *)mem;
+        s->used=0;
+        s->free=0;
+        s->unused=(char *)mem+sizeof(Slab);
+        link(&_partial[cls], s);
+        _slab_bytes+=slab_size(cls);
+        _empty[cls]++;
+    }
+
+    char *p;
+    if (s->free) {
+        p=(char *)s->free;
+        s->free=*(void **)p;
+    } else {
+        p=s->unused;
+        s->unused+=block_size(cls);
+    }
+
+    if (s->used++==0)
+        _empty[cls]--;
+    if (s->used==slab_blocks(cls)) {
+        unlink(&_partial[cls], s);
+        link(&_full[cls], s);
+    }
+
+    _used_bytes+=block_size(cls);
+    return p;
+}
+
+void
+CArena::free(char *p, unsigned size)
+{
+    if (!p)
+        return;
+
+    int cls=size_class(size);
+    if (cls<0) {
+        _large_bytes-=size;
+        ::free(p);
+        return;
+    }
+
+    Slab *s=(Slab *)((uintptr_t)p & ~(uintptr_t)(slab_size(cls)-1));
+    if (s->used==slab_blocks(cls)) {
+        unlink(&_full[cls], s);
+        link(&_partial[cls], s);
+    }
+
+    *(void **)p=s->free;
+    s->free=p;
+    _used_bytes-=block_size(cls);
+
+    if (--s->used==0) {
+        if (_empty[cls]>0) {
+            // already have a spare slab for this class
+            unlink(&_partial[cls], s);
+            ::free(s);
+            _slab_bytes-=slab_size(cls);
+        } else
+            _empty[cls]++;
+    }
+}
+
+CReplacer::CReplacer(int policy, int context)
+    : _context(context), _bytes(0), _small_bytes(0), _count(0), _evictions(0)
+{
+    set_policy(policy);
+}
+
+CReplacer::~CReplacer()
+{
+    // the chunks belong to the content tables, just detach them
+    while(!_small.empty())
+        unlink(_small.front());
+    while(!_main.empty())
+        unlink(_main.front());
+}
+
+void
+CReplacer::set_policy(int policy)
+{
+    switch(policy) {
+    case POLICY_LRU:
+    case POLICY_FIFO:
+    case POLICY_CLOCK:
+    case POLICY_S3FIFO:
+        _policy=policy;
+        break;
+    default:
+        _policy=POLICY_LRU;
+        break;
+    }
+}
+
+int
+CReplacer::parse_policy(const String &s)
+{
+    String p=s.lower();
+    if(p=="lru")
+        return POLICY_LRU;
+    else if(p=="fifo")
+        return POLICY_FIFO;
+    else if(p=="clock")
+        return POLICY_CLOCK;
+    else if(p=="s3fifo" || p=="s3-fifo")
+        return POLICY_S3FIFO;
+    return -1;
+}
+
+String
+CReplacer::unparse_policy(int policy)
+{
+    switch(policy) {
+    case POLICY_LRU:	return "lru";
+    case POLICY_FIFO:	return "fifo";
+    case POLICY_CLOCK:	return "clock";
+    case POLICY_S3FIFO:	return "s3fifo";
+    default:			return "unknown";
+    }
+}
+
+/*
+ * start tracking a newly cached chunk
+ */
+void
+CReplacer::insert(CChunk *c)
+{
+    if(c->_queue)
+        c->_queue->remove(c);
+
+    c->_queue=this;
+    c->_freq=0;
+    _bytes+=c->GetSize();
+    _count++;
+
+    if(_policy==POLICY_S3FIFO && _ghost_count.get(c->id())==0) {
+        c->_qid=Q_SMALL;
+        _small_bytes+=c->GetSize();
+        _small.push_front(c);
+    } else {
+        // chunks that were evicted from the small queue recently have proven
+        // themselves, so they go straight into the main queue
+        c->_qid=Q_MAIN;
+        _main.push_front(c);
+    }
+}
+
+/*
+ * note a cache hit
+ */
+void
+CReplacer::touch(CChunk *c)
+{
+    switch(_policy) {
+    case POLICY_LRU:
+        if(c->_qid==Q_MAIN && _main.front()!=c) {
+            _main.erase(c);
+            _main.push_front(c);
+        }
+        break;
+    case POLICY_CLOCK:
+        c->_freq=1;
+        break;
+    case POLICY_S3FIFO:
+        if(c->_freq<S3FIFO_MAX_FREQ)
+            c->_freq++;
+        break;
+    default:
+        break;
+    }
+}
+
+void
+CReplacer::remove(CChunk *c)
+{
+    if(c->_queue==this)
+        unlink(c);
+}
+
+void
+CReplacer::unlink(CChunk *c)
+{
+    if(c->_qid==Q_SMALL) {
+        _small.erase(c);
+        _small_bytes-=c->GetSize();
+    } else {
+        _main.erase(c);
+    }
+    _bytes-=c->GetSize();
+    _count--;
+    c->_queue=0;
+    c->_qid=Q_NONE;
+}
+
+void
+CReplacer::add_ghost(const XID &xid)
+{
+    // keep about as many ghosts as there are cached chunks
+    unsigned max=_count > S3FIFO_MIN_GHOSTS ? _count : S3FIFO_MIN_GHOSTS;
+
+    _ghosts.push_back(xid);
+    _ghost_count[xid]++;
+
+    while(_ghosts.size() > max) {
+        const XID &old=_ghosts.front();
+        HashTable<XID, int>::iterator it=_ghost_count.find(old);
+        if(it!=_ghost_count.end() && --it->second<=0)
+            _ghost_count.erase(it);
+        _ghosts.pop_front();
+    }
+}
+
+/*
+ * choose a chunk to evict and stop tracking it
+ * the caller is responsible for removing it from the content tables
+ */
+CChunk *
+CReplacer::victim()
+{
+    CChunk *c;
+
+    while(1) {
+        // S3-FIFO drains the small queue while it is over its share, chunks
+        // that were hit while there are promoted instead of evicted
+        // (the small queue is also drained after a switch away from S3-FIFO)
+        if(!_small.empty() && (_policy!=POLICY_S3FIFO || _main.empty() ||
+                _small_bytes*100 >= _bytes*S3FIFO_SMALL_PERCENT)) {
+            c=_small.back();
+            if(_policy==POLICY_S3FIFO && c->_freq>1) {
+                _small.pop_back();
+                _small_bytes-=c->GetSize();
+                c->_qid=Q_MAIN;
+                c->_freq=0;
+                _main.push_front(c);
+                continue;
+            }
+            if(_policy==POLICY_S3FIFO)
+                add_ghost(c->id());
+            break;
+        }
+
+        if(_main.empty())
+            return 0;
+
+        c=_main.back();
+        if((_policy==POLICY_CLOCK || _policy==POLICY_S3FIFO) && c->_freq>0) {
+            // second chance
+            c->_freq--;
+            _main.pop_back();
+            _main.push_front(c);
+            continue;
+        }
+        break;
+    }
+
+    unlink(c);
+    _evictions++;
+    return c;
+}
+
+/*
+ * the chunk victim() would most likely evict next, without changing any
+ * state; chunks that are due a second chance are skipped, up to PEEK_MAX
+ */
+CChunk *
+CReplacer::peek()
+{
+    CChunk *c;
+    int n;
+
+    if(!_small.empty() && (_policy!=POLICY_S3FIFO || _main.empty() ||
+            _small_bytes*100 >= _bytes*S3FIFO_SMALL_PERCENT)) {
+        if(_policy!=POLICY_S3FIFO)
+            return _small.back();
+        for(c=_small.back(), n=0; c && n<PEEK_MAX; c=c->_qlink.prev(), n++)
+            if(c->_freq<=1)
+                return c;
+    }
+
+    if(_main.empty())
+        return _small.empty() ? 0 : _small.back();
+
+    if(_policy==POLICY_CLOCK || _policy==POLICY_S3FIFO) {
+        for(c=_main.back(), n=0; c && n<PEEK_MAX; c=c->_qlink.prev(), n++)
+            if(c->_freq==0)
+                return c;
+    }
+    return _main.back();
+}
+
+CAdmission::CAdmission()
+    : _samples(0)
+{
+    memset(_sketch, 0, sizeof(_sketch));
+    memset(_doorkeeper, 0, sizeof(_doorkeeper));
+}
+
+void
+CAdmission::hashes(const XID &xid, uint32_t h[ADMIT_DEPTH])
+{
+    const uint8_t *id=xid.xid().id;
+    for(int i=0; i<ADMIT_DEPTH; i++)
+        memcpy(&h[i], id + i*sizeof(uint32_t), sizeof(uint32_t));
+}
+
+void
+CAdmission::record(const XID &xid)
+{
+    uint32_t h[ADMIT_DEPTH];
+    hashes(xid, h);
+
+    // the first request only goes into the doorkeeper
+    bool seen=true;
+    for(int i=0; i<ADMIT_DEPTH; i++) {
+        uint32_t bit=h[i] & (ADMIT_DOORKEEPER_BITS-1);
+        if(!(_doorkeeper[bit/32] & (1U << (bit%32)))) {
+            _doorkeeper[bit/32] |= 1U << (bit%32);
+            seen=false;
+        }
+    }
+
+    if(seen) {
+        // conservative update, only raise the smallest counters
+        unsigned min=count(h);
+        for(int i=0; i<ADMIT_DEPTH; i++) {
+            uint8_t &c=_sketch[i][h[i] & (ADMIT_WIDTH-1)];
+            if(c==min && c<ADMIT_MAX_COUNT)
+                c++;
+        }
+    }
+
+    if(++_samples>=ADMIT_SAMPLE)
+        age();
+}
+
+unsigned
+CAdmission::count(const uint32_t h[ADMIT_DEPTH]) const
+{
+    unsigned min=ADMIT_MAX_COUNT;
+    for(int i=0; i<ADMIT_DEPTH; i++) {
+        uint8_t c=_sketch[i][h[i] & (ADMIT_WIDTH-1)];
+        if(c<min)
+            min=c;
+    }
+    return min;
+}
+
+/*
+ * 0 for CIDs never seen, otherwise one more than the sketch count
+ */
+unsigned
+CAdmission::estimate(const XID &xid) const
+{
+    uint32_t h[ADMIT_DEPTH];
+    hashes(xid, h);
+
+    for(int i=0; i<ADMIT_DEPTH; i++) {
+        uint32_t bit=h[i] & (ADMIT_DOORKEEPER_BITS-1);
+        if(!(_doorkeeper[bit/32] & (1U << (bit%32))))
+            return 0;
+    }
+    return count(h) + 1;
+}
+
+void
+CAdmission::age()
+{
+    for(int i=0; i<ADMIT_DEPTH; i++)
+        for(int j=0; j<ADMIT_WIDTH; j++)
+            _sketch[i][j]>>=1;
+    memset(_doorkeeper, 0, sizeof(_doorkeeper));
+    _samples=0;
+}
+
 CLICK_ENDDECLS
 //ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(XIAChunkStore XIAMerkleTree)
 ELEMENT_PROVIDES(XIAContentModule)
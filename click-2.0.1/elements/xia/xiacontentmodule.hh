@@ -7,42 +7,136 @@
 #include <clicknet/xia.h>
 #include <click/hashtable.hh>
 #include <click/xiapath.hh>
+#include <click/timestamp.hh>
+#include <click/vector.hh>
+#include <click/timer.hh>
 #include <map>
+#include <deque>
 
 #include "xiaxidroutetable.hh"
 #include "xiatransport.hh"
+#include "xiachunkstore.hh"
+#include <click/xiamerkletree.hh>
 
-#define CACHESIZE 1024*1024*1024    //only for router cache (endhost cahe is virtually unlimited, but is periodically refreshed)
+#define CACHESIZE 1024*1024*1024    //default router cache size (endhost cahe is limited per context, and is periodically refreshed)
 #define CLIENTCACHE
 #define PACKETSIZE 1024		
 
-#define POLICY_FIFO 1
+// replacement policies, these match the cache slice policies in the API
+#define POLICY_LRU		0x00000001
+#define POLICY_FIFO		0x00000002
+#define POLICY_CLOCK	0x00000004
+#define POLICY_S3FIFO	0x00000008
+#define POLICY_MASK		0x00000fff
+#define POLICY_MERKLE		0x00004000	// publish with Merkle tree CIDs
+
+#define S3FIFO_SMALL_PERCENT	10	// share of the cache given to new chunks
+#define S3FIFO_MAX_FREQ			3
+#define S3FIFO_MIN_GHOSTS		64
+#define PEEK_MAX			8	// chunks CReplacer::peek() looks past
+
+#define ARENA_MIN_BLOCK		1024
+#define ARENA_MAX_BLOCK		(256*1024)	// larger payloads come straight from malloc
+#define ARENA_MIN_SLAB		(64*1024)
+#define ARENA_SLAB_BLOCKS	8			// slabs hold at least this many blocks
+#define ARENA_CLASSES		17
+
+#define CCHUNK_INLINE_RANGES	4
+#define RANGE_MAX_GAPS		8	// missing ranges of a partial chunk asked for one by one
+#define RANGE_RETRY_MSEC	1000	// before a missing range is asked for again
+
+#define ADMIT_DEPTH		4			// count-min sketch rows
+#define ADMIT_WIDTH		(64*1024)	// counters per row, a power of 2
+#define ADMIT_DOORKEEPER_BITS	(512*1024)	// a power of 2
+#define ADMIT_SAMPLE		(8*ADMIT_WIDTH)	// requests between agings
+#define ADMIT_MAX_COUNT		15
+
+#define TRAIN_BUDGET		(16*1024*1024)	// bytes of pre-built responses
+#define TRAIN_THRESHOLD		4			// requests before a chunk gets a train
+
+#define EXPIRY_SLOTS		64
+#define EXPIRY_TICK_MSEC	1000
+#define PARTIAL_TIMEOUT		10	// seconds without data before a partial chunk is dropped
+#define REFRESH_INTERVAL	60	// seconds a chunk cached for the client survives unrequested
+
+#define PACE_RATE		(12500*1000)	// bytes/sec to one requester (100Mb/s), 0 to send unpaced
+#define PACE_TOTAL		0			// bytes/sec to all requesters, 0 for no limit
+#define PACE_WINDOW		(32*1024)	// burst for requesters that don't give a window
+#define PACE_QUEUE		(32*1024*1024)	// bytes of responses waiting to be paced out
+#define PACE_TOTAL_MSEC		20			// the shared bucket holds this long at PACE_TOTAL
+
+#define PREFETCH_DEPTH		0			// chunks fetched ahead of a reader, 0 disables prefetching
+#define PREFETCH_RATE		(1250*1000)	// bytes/sec of prefetching (10Mb/s)
+#define PREFETCH_MEMORY		(64*1024*1024)	// bytes prefetched and not yet requested
+#define PREFETCH_LIFETIME	30			// seconds a prefetched chunk waits to be requested
+#define PREFETCH_MANIFESTS	256			// manifests remembered
+#define PREFETCH_MAX_MANIFEST	(4*1024*1024)	// largest chunk read as a manifest
+#define PREFETCH_HINT_SIZE	(64*1024)	// charged for a hinted chunk of unknown size
+#define PREFETCH_MAGIC		"XIA-MANIFEST 1\n"
+
+#define LOCAL_FILTER_MIN_BITS	(64*1024)	// a power of 2
+#define LOCAL_FILTER_BITS_PER_CID	16
+#define LOCAL_FILTER_HASHES	4
 
 #define HASH_KEYSIZE 20
 
 CLICK_DECLS
 class XIAContentModule;
 class XIATransport;
+class CReplacer;
+class XIAHeaderEncap;
+class ContentHeaderEncap;
 
-class CPart{
-    public: 
-	CPart(unsigned int,unsigned int);
-	~CPart(){}
-	unsigned int offset;
-	unsigned int length;
-};
+/*
+ * Size-classed slab allocator for chunk payloads, owned by the cache.
+ *
+ * Block sizes go up in steps of 2^n and 1.5 * 2^n, so no more than a third
+ * of a block is wasted. Slabs are aligned to their size, which lets free()
+ * find a block's slab from its address. Empty slabs are released, apart from
+ * one per class that is kept to absorb churn.
+ */
+class CArena {
+    public:
+	CArena();
+	~CArena();
 
-struct CPartListNode {
-	CPart v;
- 	List_member<CPartListNode> link;
-	CPartListNode(CPart p) : v(p) {}
-};
+	char *alloc(unsigned size);
+	void free(char *p, unsigned size);
+
+	unsigned long slab_bytes() const { return _slab_bytes; }
+	unsigned long large_bytes() const { return _large_bytes; }
+	unsigned long used_bytes() const { return _used_bytes; }
+	unsigned long failures() const { return _failures; }
+
+    private:
+	struct Slab {
+	    Slab *next;
+	    Slab *prev;
+	    unsigned used;
+	    void *free;		// blocks returned to this slab
+	    char *unused;	// start of the blocks never handed out
+	};
+
+	Slab *_partial[ARENA_CLASSES];	// slabs with room
+	Slab *_full[ARENA_CLASSES];
+	unsigned _empty[ARENA_CLASSES];	// empty slabs kept in _partial
+	unsigned long _slab_bytes;
+	unsigned long _large_bytes;
+	unsigned long _used_bytes;
+	unsigned long _failures;	// allocations refused, each one a dropped chunk
 
-typedef List<CPartListNode, &CPartListNode::link> CPartList;
+	static int size_class(unsigned size);
+	static unsigned block_size(int cls);
+	static unsigned slab_size(int cls);
+	static unsigned slab_blocks(int cls);
+
+	static void link(Slab **list, Slab *s);
+	static void unlink(Slab **list, Slab *s);
+};
 
 class CChunk{
     public:
-	CChunk(XID, int);
+	CChunk(XID, int, CArena *arena = 0);
 	~CChunk();
 	int fill(const unsigned char* , unsigned int, unsigned int);
 	bool full();
@@ -55,15 +149,449 @@ class CChunk{
 	    return payload;
 	}
 	XID id() { return xid; };
+	CReplacer *queue() { return _queue; }
+	void touch();
+	uint32_t requested() { return ++_requests; }
+
+	// Merkle tree CID, the tree is built the first time it is needed to
+	// serve the chunk
+	int merkle_leaf() const { return _merkle_shift; }
+	void set_merkle_leaf(int shift) { _merkle_shift=shift; }
+	XIAMerkleTree *merkle_tree();
+
+	// the byte ranges not received yet, at most max of them, the last
+	// one running to the end of the chunk if there are more gaps
+	int missing(uint32_t *start, uint32_t *end, int max) const;
     private:
 	XID xid;
 	bool complete;
 	unsigned int size;
 	char* payload;
-	CPartList parts; 
+	CArena *_arena;
 	bool deleted;
 
-	void Merge(CPartList::iterator);
+	// received byte ranges, sorted and not touching each other
+	struct CRange {
+	    uint32_t start;
+	    uint32_t end;
+	};
+	CRange _inline_ranges[CCHUNK_INLINE_RANGES];
+	CRange *_ranges;
+	unsigned _nranges;
+	unsigned _max_ranges;
+
+	void add_range(uint32_t start, uint32_t end);
+
+	// replacement state, managed by the CReplacer the chunk is charged to
+	List_member<CChunk> _qlink;
+	CReplacer *_queue;
+	uint8_t _qid;
+	uint8_t _freq;
+
+	uint32_t _requests;
+
+	uint8_t _merkle_shift;	// 0 for a flat CID
+	XIAMerkleTree *_merkle;
+
+	// expiry state, managed by XIAContentModule
+	uint32_t _expiry;	// serial of the chunk's entry in the expiry wheel, 0 if none
+	bool _active;		// filled since that entry was made
+
+	// ranges asked for by XIAContentModule::request_missing(), and when,
+	// allocated the first time the chunk is asked for
+	struct CAsk {
+	    uint32_t start;
+	    uint32_t end;
+	    Timestamp at;
+	};
+	CAsk *_asked;
+	int _nasked;
+
+	friend class CReplacer;
+	friend class XIAContentModule;
+};
+
+/*
+ * Chunk replacement engine. Chunks are linked into intrusive queues so
+ * admission, hits and eviction are all O(1).
+ *
+ * LRU moves chunks to the front on every hit, FIFO ignores hits, CLOCK
+ * gives hit chunks a second pass and S3-FIFO admits new chunks to a small
+ * probationary queue, only promoting the ones that are hit again and
+ * remembering recently dropped ones in a ghost queue.
+ */
+class CReplacer {
+    public:
+	CReplacer(int policy = POLICY_LRU, int context = -1);
+	~CReplacer();
+
+	void insert(CChunk *);
+	void touch(CChunk *);
+	CChunk *peek();
+	void remove(CChunk *);
+	CChunk *victim();	// unlinks and returns the next chunk to evict
+
+	int policy() const { return _policy; }
+	void set_policy(int policy);
+	int context() const { return _context; }
+	unsigned long bytes() const { return _bytes; }
+	unsigned count() const { return _count; }
+	unsigned long evictions() const { return _evictions; }
+
+	static int parse_policy(const String &);
+	static String unparse_policy(int);
+
+    private:
+	typedef List<CChunk, &CChunk::_qlink> CChunkList;
+
+	enum { Q_NONE = 0, Q_SMALL, Q_MAIN };
+
+	int _policy;
+	int _context;
+	CChunkList _small;
+	CChunkList _main;
+	unsigned long _bytes;
+	unsigned long _small_bytes;
+	unsigned _count;
+	unsigned long _evictions;
+
+	// S3-FIFO ghost queue, chunks recently evicted from _small
+	std::deque<XID> _ghosts;
+	HashTable<XID, int> _ghost_count;
+
+	void unlink(CChunk *);
+	void add_ghost(const XID &);
+};
+
+inline void CChunk::touch()
+{
+	if (_queue)
+	    _queue->touch(this);
+}
+
+/*
+ * Serialized headers shared by all fragments of one chunk response.
+ *
+ * The XIA and content headers are built once per response. Each fragment
+ * is then made with a single allocation and a single copy of its slice of
+ * the chunk; make_fragment() patches in the payload length, chunk offset and
+ * length, make() only the payload length.
+ *
+ * Given the chunk's Merkle tree, fragments are cut at the tree's leaves and
+ * each one carries its proof in extension headers after the content header.
+ */
+class CResponse {
+    public:
+	CResponse(const XIAHeaderEncap &encap, const ContentHeaderEncap &contenth,
+		  const XIAMerkleTree *merkle = 0);
+	~CResponse();
+
+	WritablePacket *make(const char *payload, uint32_t length,
+			     const unsigned char *proof = 0, int nproof = 0) const;
+	WritablePacket *make_fragment(const char *chunk, uint32_t offset, uint16_t length) const;
+	uint16_t fragment_length(uint32_t offset, uint32_t size, size_t pktsize) const;
+	size_t hdr_size() const { return _len; }
+
+    private:
+	const XIAMerkleTree *_merkle;
+	unsigned char *_hdr;
+	size_t _xia_len;	// XIA header, followed by the content header
+	size_t _len;
+	size_t _chunk_offset;	// where the patched values live in _hdr, 0 if absent
+	size_t _length;
+	Timestamp _now;
+
+	size_t find_value(uint8_t key, size_t len) const;
+
+	CResponse(const CResponse &);
+	CResponse &operator=(const CResponse &);
+};
+
+/*
+ * Pre-built response train for a frequently requested chunk.
+ *
+ * Each fragment is stored as everything that follows the destination nodes
+ * in its XIA header: the source nodes, the content header and the payload
+ * slice. Serving a request writes the fixed header and the requester's
+ * address and appends the stored fragment. Fragments are sized for
+ * destinations of up to max_dnode() nodes.
+ */
+class CTrain {
+    public:
+	CTrain(const XID &cid, CChunk *chunk, const XIAPath &source, uint8_t max_dnode, unsigned pktsize);
+	~CTrain();
+
+	const XID &cid() const { return _cid; }
+	CChunk *chunk() const { return _chunk; }	// identity only, may be stale
+	uint8_t max_dnode() const { return _max_dnode; }
+	size_t bytes() const { return _bytes; }
+	int fragments() const { return _plen.size(); }
+
+	WritablePacket *make(int i, const click_xia_xid_node *dst, uint8_t dnode, const Timestamp &now) const;
+
+    private:
+	XID _cid;
+	CChunk *_chunk;
+	click_xia _fixed;
+	uint8_t _max_dnode;
+	unsigned char *_buf;
+	size_t _bytes;
+	Vector<uint32_t> _frag;		// start of each fragment in _buf, plus the end
+	Vector<uint16_t> _plen;
+
+	List_member<CTrain> _link;
+
+	CTrain(const CTrain &);
+	CTrain &operator=(const CTrain &);
+
+	friend class XIAContentModule;
+};
+
+/*
+ * Paces chunk responses out to their requesters.
+ *
+ * Each requester has a queue of response fragments and a token bucket that
+ * fills at the pacing rate and holds up to the window the requester put in
+ * its request, so it never gets more than that back to back. Requesters
+ * with something queued take turns, one fragment each, and an optional
+ * shared bucket limits them all together.
+ *
+ * Fragments are numbered within their response. A request for a chunk that
+ * is still queued to the same requester is a retransmission, and only the
+ * fragments sent before it need to go again; queued_from() says where the
+ * queued ones start.
+ */
+class CPacer {
+    public:
+	CPacer();
+	~CPacer();
+
+	void set_rate(uint32_t rate)	{ _rate=rate; }
+	void set_total(uint32_t total)	{ _total=total; }
+	void set_limit(size_t limit)	{ _limit=limit; }
+	uint32_t rate() const		{ return _rate; }
+	uint32_t total() const		{ return _total; }
+	size_t limit() const		{ return _limit; }
+
+	int queued_from(const XID &dst, const XID &cid);
+	bool enqueue(const XID &dst, uint32_t window, const XID &cid, int index, bool last,
+		     bool resend, Packet *p, const Timestamp &now);
+	void dequeue(const Timestamp &now, Vector<Packet *> &out);
+	Timestamp next(const Timestamp &now) const;	// zero when nothing is queued
+	void clear();
+
+	size_t queued() const		{ return _queued; }
+	int flows() const		{ return _flows.size(); }
+	unsigned long sent() const	{ return _sent; }
+	unsigned long drops() const	{ return _drops; }
+
+    private:
+	struct Entry {
+	    Packet *p;
+	    XID cid;
+	    int index;
+	    bool last;
+	    bool resend;
+	};
+
+	struct Flow {
+	    XID dst;
+	    std::deque<Entry> queue;
+	    HashTable<XID, int> sending;	// first fragment still queued of each response
+	    int64_t tokens;
+	    uint32_t window;
+	    Timestamp filled;
+	    List_member<Flow> link;
+	};
+
+	HashTable<XID, Flow*> _flows;
+	List<Flow, &Flow::link> _active;	// flows with something queued
+	List<Flow, &Flow::link> _idle;		// emptied flows, kept until their buckets refill
+	uint32_t _rate;
+	uint32_t _total;
+	size_t _limit;
+	size_t _queued;
+	int64_t _total_tokens;
+	Timestamp _total_filled;
+	unsigned long _sent;
+	unsigned long _drops;
+
+	void fill(Flow *f, const Timestamp &now);
+	void fill_total(const Timestamp &now);
+	int64_t total_depth() const;
+	void prune(const Timestamp &now);
+
+	CPacer(const CPacer &);
+	CPacer &operator=(const CPacer &);
+};
+
+/*
+ * Manifest driven prefetching.
+ *
+ * Manifests (see XmanifestWrite() in the API) are recognised as they are
+ * cached, and the chunks they list are remembered in order. A request for
+ * one of them, or one carrying a prefetch hint, has the chunks after it
+ * fetched into the cache ahead of the reader. What is fetched is limited by
+ * a token bucket of bytes/sec and by the bytes fetched but not yet requested,
+ * which are released when the chunk is requested or after PREFETCH_LIFETIME.
+ */
+class CPrefetch {
+    public:
+	CPrefetch();
+	~CPrefetch();
+
+	void set_depth(int depth)	{ _depth=depth; }
+	void set_rate(uint32_t rate)	{ _rate=rate; }
+	void set_memory(size_t memory)	{ _memory=memory; }
+	int depth() const		{ return _depth; }
+	uint32_t rate() const		{ return _rate; }
+	size_t memory() const		{ return _memory; }
+
+	// remember the chunks listed in a manifest, false if it isn't one
+	bool add_manifest(const XID &cid, const char *data, uint32_t length);
+
+	// the chunks after cid in a manifest, up to depth() of them
+	void following(const XID &cid, Vector<XID> &cids, Vector<uint32_t> &sizes) const;
+
+	// start fetching cid if the budget allows, false if it doesn't
+	bool reserve(const XID &cid, uint32_t size, const Timestamp &now);
+	bool pending(const XID &cid) const { return _pending.find(cid)!=_pending.end(); }
+	// a request for cid arrived, true if it was prefetched. Its budget is
+	// released, but it stays pending until it expires so a response still
+	// on its way is cached.
+	bool claim(const XID &cid);
+	void clear();
+
+	int manifests() const		{ return _manifests.size(); }
+	size_t outstanding() const	{ return _outstanding; }
+	unsigned long sent() const	{ return _sent; }
+	unsigned long hits() const	{ return _hits; }
+	unsigned long refused() const	{ return _refused; }
+
+    private:
+	struct Manifest {
+	    XID cid;
+	    Vector<XID> cids;
+	    Vector<uint32_t> sizes;
+	    List_member<Manifest> link;
+	};
+	struct Place {
+	    Manifest *m;
+	    int index;
+	};
+	struct Entry {
+	    uint32_t size;
+	    Timestamp expires;
+	    bool claimed;
+	};
+
+	HashTable<XID, Manifest*> _manifests;
+	List<Manifest, &Manifest::link> _lru;		// most recently added first
+	HashTable<XID, Place> _places;
+	HashTable<XID, Entry> _pending;
+	int _depth;
+	uint32_t _rate;
+	size_t _memory;
+	size_t _outstanding;
+	int64_t _tokens;
+	Timestamp _filled;
+	Timestamp _swept;
+	unsigned long _sent;
+	unsigned long _hits;
+	unsigned long _refused;
+
+	void drop_manifest(Manifest *m);
+	void sweep(const Timestamp &now);
+
+	CPrefetch(const CPrefetch &);
+	CPrefetch &operator=(const CPrefetch &);
+};
+
+/*
+ * TinyLFU admission filter for chunks cached while forwarding.
+ *
+ * Request frequencies are estimated with a count-min sketch. A doorkeeper
+ * Bloom filter absorbs the first request for each CID, so content that is
+ * only asked for once never reaches the sketch. Every ADMIT_SAMPLE requests
+ * the counts are halved and the doorkeeper is cleared, so that old
+ * popularity fades. CIDs are SHA-1 hashes, so their bytes are used directly
+ * as the hash values.
+ */
+class CAdmission {
+    public:
+	CAdmission();
+
+	void record(const XID &xid);
+	unsigned estimate(const XID &xid) const;
+
+	// should candidate replace victim in the cache
+	bool prefer(const XID &candidate, const XID &victim) const {
+	    return estimate(candidate) > estimate(victim);
+	}
+
+    private:
+	uint8_t _sketch[ADMIT_DEPTH][ADMIT_WIDTH];
+	uint32_t _doorkeeper[ADMIT_DOORKEEPER_BITS / 32];
+	uint32_t _samples;
+
+	static void hashes(const XID &xid, uint32_t h[ADMIT_DEPTH]);
+	unsigned count(const uint32_t h[ADMIT_DEPTH]) const;
+	void age();
+};
+
+/*
+ * Timing wheel of chunk expiry times, one slot per EXPIRY_TICK_MSEC.
+ *
+ * Entries name a chunk by CID and a serial the chunk keeps, so an entry
+ * left behind by a chunk that has since gone is ignored when it comes due.
+ * Times past the end of the wheel go in its last slot; the owner decides
+ * again what to do with them when they come round.
+ */
+class CExpiry {
+    public:
+	struct Entry {
+	    XID cid;
+	    uint32_t serial;
+	};
+
+	CExpiry();
+
+	uint32_t schedule(const XID &cid, const Timestamp &when, const Timestamp &now);
+	void advance(const Timestamp &now, Vector<Entry> &due);
+	Timestamp next() const;
+	bool empty() const { return _count==0; }
+	int size() const { return _count; }
+
+    private:
+	Vector<Entry> _slots[EXPIRY_SLOTS];
+	Timestamp _base;	// when the current slot came due
+	int _cur;
+	int _count;
+	uint32_t _serial;
+};
+
+/*
+ * Bloom filter of the CIDs a content module serves, so that route lookups
+ * for CIDs it doesn't have rarely reach its tables. It can't forget a CID,
+ * so the owner rebuilds it once enough of them have gone.
+ */
+class CBloom {
+    public:
+	CBloom();
+	~CBloom();
+
+	void reset(size_t n);	// empty, sized for n CIDs
+	void add(const XID &xid);
+	bool may_contain(const XID &xid) const;
+	size_t capacity() const { return _capacity; }
+
+    private:
+	uint32_t *_bits;
+	uint32_t _mask;
+	size_t _capacity;
+
+	CBloom(const CBloom &);
+	CBloom &operator=(const CBloom &);
 };
 
 /* Client local cache*/
@@ -74,30 +602,33 @@ struct contentMeta{
 };
 
 struct cacheMeta{
-    int curSize;
     int maxSize;
     int policy;
+    CReplacer *queue;   // chunks charged to this context
     HashTable <XID, struct contentMeta*> *contentMetaTable;
 };
 
 
-class XIAContentModule {
+class XIAContentModule : public XIAXIDLocalIndex {
     friend class XIATransport;
     friend class XIACache;
     public:
     typedef XIAPath::handle_t handle_t;        
     XIAContentModule(XIATransport* transport);
     ~XIAContentModule();
+    void initialize(Element *owner);
+    bool local_contains(const XID &cid);
     void cache_incoming(Packet *p, const XID &, const XID &, int port);
     void process_request(Packet *p, const XID &, const XID &);
+    bool verify_fragment(Packet *p, const XID &cid);
+    bool request_missing(Packet *p, const XID &cid, Vector<Packet *> &out);
 
 	int malicious; // Respond to CID requests with bad data if set to 1
 
     protected:
     void cache_incoming_local(Packet *p, const XID& srcCID, bool local_putcid, bool pushcid);
-    void cache_incoming_forward(Packet *p, const XID& srcCID);
+    void cache_incoming_forward(Packet *p, const XID& srcCID, bool prefetched = false);
     void cache_incoming_remove(Packet *p, const XID& srcCID);
-    void cache_management();
     private:
     XIATransport* _transport;
     XIAPath _local_addr;
@@ -105,19 +636,76 @@ class XIAContentModule {
     bool _cache_content_from_network;
     HashTable<XID,CChunk*> _partialTable;
     HashTable<XID, CChunk*>_contentTable;
-    HashTable<XID, CChunk*>_oldPartial; /* only used in client. When refresh timer is
-	fired,  _oldPartial is cleared and everything in _partialTable goes to _oldPartial.
-	It takes two timers to clear on-going partial chunk transfers.  */
 
     HashTable<int, cacheMeta*> _cacheMetaTable;
     
-    unsigned int usedSize;
-    static const unsigned int MAXSIZE=CACHESIZE;
+    // router cache, holds chunks cached while forwarding
+    CReplacer _cache;
+    CArena _arena;	// payload storage for all chunks
+    unsigned int _cache_size;
     static unsigned int PKTSIZE;    
-    //lru    
-    static const int REFRESH=1000000;
-    int _timer;
-    HashTable<XID, int> partial;
+
+    // admission to the router cache
+    CAdmission _admission;
+    bool _admission_enabled;
+    bool _record_responses;	// count passing responses, when requests aren't seen
+    unsigned long _admitted;
+    unsigned long _rejected;
+    unsigned long _cache_hits;
+    unsigned long _cache_misses;
+    unsigned long _merkle_rejected;	// fragments whose proof didn't check out
+    unsigned long _range_requests;	// requests for the missing part of a partial chunk
+
+    bool admit(const XID &cid, unsigned int size);
+
+    // disk tier behind the router cache, only when XIACache has STORE_FILE
+    CStore *_store;
+
+    void store(CChunk *chunk);
+    HashTable<XID,CChunk*>::iterator promote(const XID &cid);
+    int restore_routes();
+
+    // response trains for hot chunks, most recently used first
+    HashTable<XID, CTrain*> _trains;
+    List<CTrain, &CTrain::_link> _train_lru;
+    size_t _train_bytes;
+    size_t _train_budget;
+    unsigned int _train_threshold;
+    unsigned long _train_hits;
+
+    bool serve_train(Packet *p, const XID &cid, CChunk *chunk, const XID &dst, uint32_t window, int upto);
+    void drop_train(CTrain *train);
+    void clear_trains();
+
+    // paced transmission of responses to the network
+    CPacer _pacer;
+    Timer _pace_timer;
+
+    void send_response(const XID &dst, uint32_t window, const XID &cid, int index, bool last,
+		       bool resend, Packet *p, const Timestamp &now);
+    void run_pacer();
+    static void pace_hook(Timer *, void *);
+
+    // fetching the chunks a reader will ask for next
+    CPrefetch _prefetch;
+
+    void prefetch_after(Packet *p, const XID &cid, bool request);
+    void send_prefetch(Packet *p, bool request, const XID &cid);
+
+    // time driven expiry of partial chunks and of chunks cached for the client
+    Timer _expiry_timer;
+    CExpiry _expiry;
+    Timestamp _partial_timeout;
+    Timestamp _refresh_interval;
+    unsigned long _expired;
+
+    void expire_after(CChunk *chunk, const Timestamp &delay);
+    void expire_partial(CChunk *chunk, const Timestamp &now);
+    void expire_content(CChunk *chunk, const Timestamp &now);
+    void remove_local(CChunk *chunk);
+    void run_expiry();
+    static void expiry_hook(Timer *, void *);
+
     HashTable<XID, int> content;   
     Packet *makeChunkResponse(CChunk * chunk, Packet *p_in);
     Packet *makeChunkPush(CChunk * chunk, Packet *p_in);
@@ -125,21 +713,17 @@ class XIAContentModule {
 
     //Cache Policy
     void applyLocalCachePolicy(int);
-    const XID* findOldestContent(int);
-    bool isExpiredContent(struct contentMeta* cm);
-
-    //modify routing table
-    void addRoute(const XID &cid) {
-	String cmd=cid.unparse() + " " + String(DESTINED_FOR_LOCALHOST);
-	click_chatter("Add route %s", cid.unparse().c_str());
-	HandlerCall::call_write(_routeTable, "add", cmd);
-    } 
-
-    void delRoute(const XID &cid) {
-	String cmd= cid.unparse();
-	click_chatter("Del route %s", cid.unparse().c_str());
-	HandlerCall::call_write(_routeTable, "remove", cmd);
-    }    
+    void uncharge(CChunk *chunk);
+
+    // CIDs served here, the route table asks local_contains() rather than
+    // having a route for each one
+    CBloom _local_filter;
+    size_t _local_added;	// since the filter was last rebuilt
+    size_t _local_removed;
+
+    void addRoute(const XID &cid);
+    void delRoute(const XID &cid);
+    void rebuild_local_filter();    
 };
 
 CLICK_ENDDECLS
@@ -0,0 +1,476 @@
+/*
+ * xiahash.{cc,hh} -- SHA-1 and hex conversion for CIDs
+ */
+
+#include <click/config.h>
+#include "xiahash.hh"
+#include <string.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define XIAHASH_X86 1
+# include <cpuid.h>
+# include <immintrin.h>
+#endif
+CLICK_DECLS
+
+static const uint32_t sha1_init[5] = {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+static inline uint32_t
+load_be32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void
+store_be32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t
+rol32(uint32_t v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+/*
+ * the last one or two blocks of a message, holding its trailing bytes and
+ * the padding
+ */
+static int
+sha1_tail(const unsigned char *data, size_t len, unsigned char tail[128])
+{
+    size_t rest = len % 64;
+    int blocks = rest < 56 ? 1 : 2;
+    uint64_t bits = (uint64_t)len * 8;
+
+    memcpy(tail, data + len - rest, rest);
+    tail[rest] = 0x80;
+    memset(tail + rest + 1, 0, blocks * 64 - rest - 1);
+    for (int i = 0; i < 8; i++)
+	tail[blocks * 64 - 1 - i] = bits >> (8 * i);
+    return blocks;
+}
+
+static void
+sha1_digest(const uint32_t state[5], unsigned char digest[XIAHash::DIGEST_LEN])
+{
+    for (int i = 0; i < 5; i++)
+	store_be32(digest + 4 * i, state[i]);
+}
+
+
+// portable C
+
+static void
+sha1_blocks_generic(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+    uint32_t w[16];
+
+    for (; blocks; blocks--, data += 64) {
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+	for (int t = 0; t < 80; t++) {
+	    uint32_t f, k;
+	    if (t < 16)
+		w[t] = load_be32(data + 4 * t);
+	    else
+		w[t & 15] = rol32(w[(t - 3) & 15] ^ w[(t - 8) & 15] ^ w[(t - 14) & 15] ^ w[t & 15], 1);
+
+	    if (t < 20) {
+		f = (b & c) | (~b & d);
+		k = 0x5a827999;
+	    } else if (t < 40) {
+		f = b ^ c ^ d;
+		k = 0x6ed9eba1;
+	    } else if (t < 60) {
+		f = (b & c) | (b & d) | (c & d);
+		k = 0x8f1bbcdc;
+	    } else {
+		f = b ^ c ^ d;
+		k = 0xca62c1d6;
+	    }
+
+	    uint32_t tmp = rol32(a, 5) + f + e + k + w[t & 15];
+	    e = d;
+	    d = c;
+	    c = rol32(b, 30);
+	    b = a;
+	    a = tmp;
+	}
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+    }
+}
+
+
+#if XIAHASH_X86
+
+// SHA extensions, four rounds per instruction
+
+/*
+ * one group of four rounds, i is the group number and f the round function.
+ * Message words for later groups are prepared alongside.
+ */
+#define SHANI_GROUP(i, f)						\
+    do {								\
+	if ((i) < 4)							\
+	    m[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * (i))), mask); \
+	if ((i) == 0)							\
+	    e[0] = _mm_add_epi32(e[0], m[0]);				\
+	else								\
+	    e[(i) & 1] = _mm_sha1nexte_epu32(e[(i) & 1], m[(i) & 3]);	\
+	e[((i) + 1) & 1] = abcd;					\
+	if ((i) >= 3 && (i) <= 18)					\
+	    m[((i) + 1) & 3] = _mm_sha1msg2_epu32(m[((i) + 1) & 3], m[(i) & 3]); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e[(i) & 1], f);		\
+	if ((i) >= 1 && (i) <= 16)					\
+	    m[((i) - 1) & 3] = _mm_sha1msg1_epu32(m[((i) - 1) & 3], m[(i) & 3]); \
+	if ((i) >= 2 && (i) <= 17)					\
+	    m[((i) - 2) & 3] = _mm_xor_si128(m[((i) - 2) & 3], m[(i) & 3]); \
+    } while (0)
+
+__attribute__((target("sha,sse4.1")))
+static void
+sha1_blocks_shani(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd, e[2], m[4];
+
+    abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+    e[0] = _mm_set_epi32(state[4], 0, 0, 0);
+
+    for (; blocks; blocks--, data += 64) {
+	__m128i abcd_save = abcd, e_save = e[0];
+
+	SHANI_GROUP(0, 0);  SHANI_GROUP(1, 0);  SHANI_GROUP(2, 0);  SHANI_GROUP(3, 0);
+	SHANI_GROUP(4, 0);  SHANI_GROUP(5, 1);  SHANI_GROUP(6, 1);  SHANI_GROUP(7, 1);
+	SHANI_GROUP(8, 1);  SHANI_GROUP(9, 1);  SHANI_GROUP(10, 2); SHANI_GROUP(11, 2);
+	SHANI_GROUP(12, 2); SHANI_GROUP(13, 2); SHANI_GROUP(14, 2); SHANI_GROUP(15, 3);
+	SHANI_GROUP(16, 3); SHANI_GROUP(17, 3); SHANI_GROUP(18, 3); SHANI_GROUP(19, 3);
+
+	e[0] = _mm_sha1nexte_epu32(e[0], e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = _mm_extract_epi32(e[0], 3);
+}
+
+#undef SHANI_GROUP
+
+
+// AVX2, one message per 32 bit lane
+
+#define AVX2_ROL(v, n)	_mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+/*
+ * run blocks blocks of each of LANES messages, lane j's blocks start at
+ * data[j]. state[i] holds word i of every lane's state.
+ */
+__attribute__((target("avx2")))
+static void
+sha1_blocks_avx2(uint32_t state[5][XIAHash::LANES], const unsigned char *const data[XIAHash::LANES], size_t blocks)
+{
+    __m256i s[5], w[16];
+
+    for (int i = 0; i < 5; i++)
+	s[i] = _mm256_loadu_si256((const __m256i *)state[i]);
+
+    for (size_t blk = 0; blk < blocks; blk++) {
+	__m256i a = s[0], b = s[1], c = s[2], d = s[3], e = s[4];
+	size_t off = blk * 64;
+
+	for (int t = 0; t < 80; t++) {
+	    __m256i f, k;
+	    if (t < 16)
+		w[t] = _mm256_set_epi32(load_be32(data[7] + off + 4 * t), load_be32(data[6] + off + 4 * t),
+					load_be32(data[5] + off + 4 * t), load_be32(data[4] + off + 4 * t),
+					load_be32(data[3] + off + 4 * t), load_be32(data[2] + off + 4 * t),
+					load_be32(data[1] + off + 4 * t), load_be32(data[0] + off + 4 * t));
+	    else {
+		__m256i x = _mm256_xor_si256(_mm256_xor_si256(w[(t - 3) & 15], w[(t - 8) & 15]),
+					     _mm256_xor_si256(w[(t - 14) & 15], w[t & 15]));
+		w[t & 15] = AVX2_ROL(x, 1);
+	    }
+
+	    if (t < 20) {
+		f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_andnot_si256(b, d));
+		k = _mm256_set1_epi32(0x5a827999);
+	    } else if (t < 40) {
+		f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+		k = _mm256_set1_epi32(0x6ed9eba1);
+	    } else if (t < 60) {
+		f = _mm256_or_si256(_mm256_and_si256(b, c), _mm256_and_si256(d, _mm256_or_si256(b, c)));
+		k = _mm256_set1_epi32(0x8f1bbcdc);
+	    } else {
+		f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+		k = _mm256_set1_epi32(0xca62c1d6);
+	    }
+
+	    __m256i tmp = _mm256_add_epi32(_mm256_add_epi32(AVX2_ROL(a, 5), f),
+					   _mm256_add_epi32(_mm256_add_epi32(e, k), w[t & 15]));
+	    e = d;
+	    d = c;
+	    c = AVX2_ROL(b, 30);
+	    b = a;
+	    a = tmp;
+	}
+
+	s[0] = _mm256_add_epi32(s[0], a);
+	s[1] = _mm256_add_epi32(s[1], b);
+	s[2] = _mm256_add_epi32(s[2], c);
+	s[3] = _mm256_add_epi32(s[3], d);
+	s[4] = _mm256_add_epi32(s[4], e);
+    }
+
+    for (int i = 0; i < 5; i++)
+	_mm256_storeu_si256((__m256i *)state[i], s[i]);
+}
+
+#undef AVX2_ROL
+
+static bool
+cpu_has(int k)
+{
+    unsigned eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+	return false;
+    bool sse41 = ecx & bit_SSE4_1;
+    bool ssse3 = ecx & bit_SSSE3;
+    // the OS has to save the AVX registers
+    bool ymm = false;
+    if ((ecx & bit_OSXSAVE) && (ecx & bit_AVX)) {
+	unsigned lo, hi;
+	__asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	ymm = (lo & 6) == 6;
+    }
+
+    if (__get_cpuid_max(0, 0) < 7)
+	return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    if (k == XIAHash::KERNEL_SHANI)
+	return (ebx & bit_SHA) && sse41 && ssse3;
+    if (k == XIAHash::KERNEL_AVX2)
+	return (ebx & bit_AVX2) && ymm;
+    return false;
+}
+
+#endif
+
+static int
+best_kernel()
+{
+#if XIAHASH_X86
+    if (cpu_has(XIAHash::KERNEL_SHANI))
+	return XIAHash::KERNEL_SHANI;
+    if (cpu_has(XIAHash::KERNEL_AVX2))
+	return XIAHash::KERNEL_AVX2;
+#endif
+    return XIAHash::KERNEL_GENERIC;
+}
+
+static int the_kernel = best_kernel();
+
+int
+XIAHash::kernel()
+{
+    return the_kernel;
+}
+
+const char *
+XIAHash::kernel_name()
+{
+    switch (the_kernel) {
+    case KERNEL_SHANI:
+	return "sha-ni";
+    case KERNEL_AVX2:
+	return "avx2";
+    default:
+	return "generic";
+    }
+}
+
+bool
+XIAHash::set_kernel(int k)
+{
+#if XIAHASH_X86
+    if (k == KERNEL_SHANI || k == KERNEL_AVX2) {
+	if (!cpu_has(k))
+	    return false;
+	the_kernel = k;
+	return true;
+    }
+#endif
+    if (k != KERNEL_GENERIC)
+	return false;
+    the_kernel = k;
+    return true;
+}
+
+static void
+sha1_blocks(uint32_t state[5], const unsigned char *data, size_t blocks)
+{
+#if XIAHASH_X86
+    if (the_kernel == XIAHash::KERNEL_SHANI) {
+	sha1_blocks_shani(state, data, blocks);
+	return;
+    }
+#endif
+    sha1_blocks_generic(state, data, blocks);
+}
+
+void
+XIAHash::sha1(const void *data, size_t len, unsigned char digest[DIGEST_LEN])
+{
+    const unsigned char *p = (const unsigned char *)data;
+    uint32_t state[5];
+    unsigned char tail[128];
+
+    memcpy(state, sha1_init, sizeof(state));
+    sha1_blocks(state, p, len / 64);
+    int blocks = sha1_tail(p, len, tail);
+    sha1_blocks(state, tail, blocks);
+    sha1_digest(state, digest);
+}
+
+/*
+ * Each lane takes the next message once it has finished its last one. All
+ * lanes run together for as many blocks as the lane with the fewest left
+ * in its current stretch, either the message itself or its padded tail.
+ * Idle lanes repeat a busy lane's input and their result is thrown away.
+ */
+void
+XIAHash::sha1_many(int n, const unsigned char *const data[], const size_t len[],
+		   unsigned char digests[][DIGEST_LEN])
+{
+#if XIAHASH_X86
+    if (the_kernel == KERNEL_AVX2 && n > 1) {
+	uint32_t state[5][LANES];
+	unsigned char tail[LANES][128];
+	const unsigned char *next[LANES];
+	size_t left[LANES];		// blocks left in the current stretch
+	int tail_blocks[LANES];		// still to do after it, -1 when done
+	int job[LANES];
+	int jobs = 0, busy = 0;
+
+	for (int j = 0; j < LANES; j++)
+	    job[j] = -1;
+
+	while (true) {
+	    for (int j = 0; j < LANES; j++) {
+		if (job[j] >= 0 || jobs == n)
+		    continue;
+		job[j] = jobs++;
+		busy++;
+		for (int i = 0; i < 5; i++)
+		    state[i][j] = sha1_init[i];
+		int tb = sha1_tail(data[job[j]], len[job[j]], tail[j]);
+		next[j] = data[job[j]];
+		left[j] = len[job[j]] / 64;
+		tail_blocks[j] = tb;
+		if (left[j] == 0) {
+		    next[j] = tail[j];
+		    left[j] = tb;
+		    tail_blocks[j] = -1;
+		}
+	    }
+	    if (busy == 0)
+		break;
+
+	    const unsigned char *in[LANES];
+	    size_t run = 0;
+	    int any = -1;
+	    for (int j = 0; j < LANES; j++)
+		if (job[j] >= 0 && (run == 0 || left[j] < run)) {
+		    run = left[j];
+		    any = j;
+		}
+	    for (int j = 0; j < LANES; j++)
+		in[j] = job[j] >= 0 ? next[j] : next[any];
+
+	    sha1_blocks_avx2(state, in, run);
+
+	    for (int j = 0; j < LANES; j++) {
+		if (job[j] < 0)
+		    continue;
+		next[j] += run * 64;
+		left[j] -= run;
+		if (left[j])
+		    continue;
+		if (tail_blocks[j] > 0) {
+		    next[j] = tail[j];
+		    left[j] = tail_blocks[j];
+		    tail_blocks[j] = -1;
+		    continue;
+		}
+		uint32_t s[5];
+		for (int i = 0; i < 5; i++)
+		    s[i] = state[i][j];
+		sha1_digest(s, digests[job[j]]);
+		job[j] = -1;
+		busy--;
+	    }
+	}
+	return;
+    }
+#endif
+    for (int i = 0; i < n; i++)
+	sha1(data[i], len[i], digests[i]);
+}
+
+static const char hex_digits[] = "0123456789abcdef";
+
+void
+XIAHash::hex(const unsigned char *in, size_t len, char *out)
+{
+    for (size_t i = 0; i < len; i++) {
+	out[2 * i] = hex_digits[in[i] >> 4];
+	out[2 * i + 1] = hex_digits[in[i] & 15];
+    }
+}
+
+String
+XIAHash::hex(const unsigned char *in, size_t len)
+{
+    String s = String::make_garbage(2 * len);
+    hex(in, len, s.mutable_data());
+    return s;
+}
+
+static inline int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+	return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+	return c - 'a' + 10;
+    return -1;
+}
+
+bool
+XIAHash::unhex(const char *in, size_t len, unsigned char *out)
+{
+    if (len % 2)
+	return false;
+    for (size_t i = 0; i < len / 2; i++) {
+	int hi = hex_value(in[2 * i]), lo = hex_value(in[2 * i + 1]);
+	if (hi < 0 || lo < 0)
+	    return false;
+	out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+CLICK_ENDDECLS
+ELEMENT_PROVIDES(XIAHash)
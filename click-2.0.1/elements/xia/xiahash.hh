@@ -0,0 +1,39 @@
+#ifndef CLICK_XIAHASH_HH
+#define CLICK_XIAHASH_HH
+#include <click/config.h>
+#include <click/string.hh>
+#include <stddef.h>
+#include <stdint.h>
+CLICK_DECLS
+
+/*
+ * SHA-1 for computing and checking CIDs.
+ *
+ * The kernel is picked at startup from what the CPU supports: the SHA
+ * extensions, an 8 lane AVX2 kernel that hashes several buffers at once,
+ * or portable C. sha1_many() hashes a batch of buffers, in parallel lanes
+ * where the kernel has them. The hex functions convert digests to and from
+ * the form used in CID strings.
+ */
+class XIAHash {
+  public:
+    enum { DIGEST_LEN = 20, LANES = 8 };
+    enum { KERNEL_GENERIC, KERNEL_AVX2, KERNEL_SHANI };
+
+    static void sha1(const void *data, size_t len, unsigned char digest[DIGEST_LEN]);
+    static void sha1_many(int n, const unsigned char *const data[], const size_t len[],
+			  unsigned char digests[][DIGEST_LEN]);
+
+    static int kernel();
+    static const char *kernel_name();
+    static bool set_kernel(int k);	// false if the CPU can't run it
+
+    // hex writes 2*len characters and no terminator, unhex fails on a non
+    // hex digit
+    static void hex(const unsigned char *in, size_t len, char *out);
+    static bool unhex(const char *in, size_t len, unsigned char *out);
+    static String hex(const unsigned char *in, size_t len);
+};
+
+CLICK_ENDDECLS
+#endif
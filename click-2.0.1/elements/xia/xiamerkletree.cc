@@ -0,0 +1,339 @@
+// -*- c-basic-offset: 4; related-file-name: "../../include/click/xiamerkletree.hh" -*-
+/*
+ * xiamerkletree.cc -- Merkle tree CIDs for per-fragment chunk verification
+ */
+
+#include <click/config.h>
+#include <click/glue.hh>
+#include <click/xiamerkletree.hh>
+#include "xiahash.hh"
+#include <string.h>
+CLICK_DECLS
+
+#define MERKLE_BATCH	64	// hashes handed to sha1_many() at a time
+
+XIAMerkleTree::XIAMerkleTree(const unsigned char *data, uint32_t length, int leaf_shift)
+    : _length(length), _shift(leaf_shift), _levels(0), _nnodes(0)
+{
+    uint32_t n=length ? ((length - 1) >> leaf_shift) + 1 : 1;
+
+    while (1) {
+	_count[_levels]=n;
+	_start[_levels]=_nnodes;
+	_nnodes+=n;
+	_levels++;
+	if (n==1)
+	    break;
+	n=(n + 1) / 2;
+    }
+
+    _nodes=new unsigned char[_nnodes * MERKLE_HASH_LEN];
+    hash_leaves(data, length, leaf_shift, _count[0], _nodes);
+    for (int k=1; k<_levels; k++)
+	combine(_nodes + _start[k-1] * MERKLE_HASH_LEN, _count[k-1],
+		_nodes + _start[k] * MERKLE_HASH_LEN);
+    hash_root(_nodes + _start[_levels - 1] * MERKLE_HASH_LEN, length, leaf_shift, _root);
+}
+
+XIAMerkleTree::~XIAMerkleTree()
+{
+    delete[] _nodes;
+}
+
+int
+XIAMerkleTree::fragment_level(size_t room) const
+{
+    for (int j=_levels - 1; j>0; j--) {
+	uint64_t flen=(uint64_t)1 << (_shift + j);
+	if (flen > _length)
+	    flen=_length;
+	if (flen + proof_size(_levels - 1 - j) <= room)
+	    return j;
+    }
+    return 0;
+}
+
+uint32_t
+XIAMerkleTree::fragment_length(uint32_t offset, int level) const
+{
+    uint64_t flen=(uint64_t)1 << (_shift + level);
+    if (offset >= _length)
+	return 0;
+    return flen < _length - offset ? flen : _length - offset;
+}
+
+int
+XIAMerkleTree::proof(uint32_t offset, uint32_t length, unsigned char *out) const
+{
+    uint32_t first, leaves;
+    int j=fragment(_length, _shift, offset, length, &first, &leaves);
+    if (j<0)
+	return -1;
+
+    int n=0;
+    uint32_t idx=first >> j;
+    for (int k=j; k<_levels - 1; k++) {
+	uint32_t sib=idx ^ 1;
+	if (sib < _count[k]) {
+	    memcpy(out + n * MERKLE_HASH_LEN, _nodes + (_start[k] + sib) * MERKLE_HASH_LEN, MERKLE_HASH_LEN);
+	    n++;
+	}
+	idx>>=1;
+    }
+    return n;
+}
+
+/*
+ * the leaf size a publisher should use for a chunk, it grows with the chunk
+ * so that the tree stays small
+ */
+int
+XIAMerkleTree::leaf_shift(uint32_t length)
+{
+    int shift=MERKLE_LEAF_SHIFT;
+    while (shift < 31 && (((uint64_t)length + ((uint64_t)1 << shift) - 1) >> shift) > MERKLE_MAX_LEAVES)
+	shift++;
+    return shift;
+}
+
+void
+XIAMerkleTree::root(const unsigned char *data, uint32_t length, int leaf_shift,
+		    unsigned char out[MERKLE_HASH_LEN])
+{
+    XIAMerkleTree t(data, length, leaf_shift);
+    memcpy(out, t.root(), MERKLE_HASH_LEN);
+}
+
+/*
+ * check a fragment of a chunk against the chunk's root, only what the
+ * fragment covers is hashed
+ */
+bool
+XIAMerkleTree::verify(const unsigned char *root, uint32_t chunk_length, int leaf_shift,
+		      uint32_t offset, const unsigned char *data, uint32_t length,
+		      const unsigned char *proof, int nproof)
+{
+    uint32_t first, leaves;
+    if (leaf_shift <= 0 || leaf_shift >= 32)
+	return false;
+    int j=fragment(chunk_length, leaf_shift, offset, length, &first, &leaves);
+    if (j<0)
+	return false;
+
+    unsigned char stack[MERKLE_BATCH * MERKLE_HASH_LEN];
+    unsigned char *h=leaves <= MERKLE_BATCH ? stack : new unsigned char[leaves * MERKLE_HASH_LEN];
+
+    // the fragment's own node, the pairing inside an aligned run is the
+    // same as in the whole tree
+    hash_leaves(data, length, leaf_shift, leaves, h);
+    for (uint32_t n=leaves; n > 1; )
+	n=combine(h, n, h);
+
+    uint32_t count=chunk_length ? ((chunk_length - 1) >> leaf_shift) + 1 : 1;
+    for (int k=0; k<j; k++)
+	count=(count + 1) / 2;
+
+    int used=0;
+    bool ok=true;
+    for (uint32_t idx=first >> j; count > 1; idx>>=1, count=(count + 1) / 2) {
+	if ((idx ^ 1) >= count)
+	    continue;		// no sibling, the node moves up as it is
+	if (used==nproof) {
+	    ok=false;
+	    break;
+	}
+	const unsigned char *sib=proof + used * MERKLE_HASH_LEN;
+	if (idx & 1)
+	    hash_node(sib, h, h);
+	else
+	    hash_node(h, sib, h);
+	used++;
+    }
+
+    if (ok && used==nproof) {
+	hash_root(h, chunk_length, leaf_shift, h);
+	ok=memcmp(h, root, MERKLE_HASH_LEN)==0;
+    } else
+	ok=false;
+    if (h!=stack)
+	delete[] h;
+    return ok;
+}
+
+size_t
+XIAMerkleTree::proof_size(int nproof)
+{
+    int hdrs=(nproof + MERKLE_PROOF_PER_HDR - 1) / MERKLE_PROOF_PER_HDR;
+    return hdrs * (sizeof(click_xia_ext) + 2) + nproof * MERKLE_HASH_LEN;
+}
+
+void
+XIAMerkleTree::write_proof(unsigned char *out, const unsigned char *proof, int nproof)
+{
+    while (nproof > 0) {
+	int k=nproof < MERKLE_PROOF_PER_HDR ? nproof : MERKLE_PROOF_PER_HDR;
+	click_xia_ext *e=reinterpret_cast<click_xia_ext *>(out);
+
+	nproof-=k;
+	e->nxt=nproof ? CLICK_XIA_NXT_MERKLE : CLICK_XIA_NXT_NO;
+	e->hlen=sizeof(click_xia_ext) + 2 + k * MERKLE_HASH_LEN;
+	e->data[0]=k;
+	e->data[1]=0;
+	memcpy(e->data + 2, proof, k * MERKLE_HASH_LEN);
+
+	proof+=k * MERKLE_HASH_LEN;
+	out+=e->hlen;
+    }
+}
+
+int
+XIAMerkleTree::read_proof(const click_xia_ext *hdr, const unsigned char *end,
+			  unsigned char *out, int max)
+{
+    const unsigned char *p=reinterpret_cast<const unsigned char *>(hdr);
+    int n=0;
+
+    while (1) {
+	const click_xia_ext *e=reinterpret_cast<const click_xia_ext *>(p);
+	if (p + sizeof(click_xia_ext) + 2 > end || p + e->hlen > end)
+	    return -1;
+
+	int k=e->data[0];
+	if (e->hlen!=sizeof(click_xia_ext) + 2 + k * MERKLE_HASH_LEN || n + k > max)
+	    return -1;
+	memcpy(out + n * MERKLE_HASH_LEN, e->data + 2, k * MERKLE_HASH_LEN);
+	n+=k;
+
+	if (e->nxt!=CLICK_XIA_NXT_MERKLE)
+	    return n;
+	p+=e->hlen;
+    }
+}
+
+/*
+ * find the leaves a fragment covers and the level of its node, -1 if it is
+ * not an aligned run of leaves or the end of the chunk
+ */
+int
+XIAMerkleTree::fragment(uint32_t chunk_length, int leaf_shift, uint32_t offset,
+			uint32_t length, uint32_t *first, uint32_t *leaves)
+{
+    uint32_t leaf=(uint32_t)1 << leaf_shift;
+    bool tail;
+
+    if ((offset & (leaf - 1)) || offset > chunk_length || length > chunk_length - offset)
+	return -1;
+    tail=(offset + length==chunk_length);
+
+    if (length==0) {
+	if (chunk_length!=0)
+	    return -1;
+	*leaves=1;
+    } else {
+	if (!tail && (length & (leaf - 1)))
+	    return -1;
+	*leaves=((length - 1) >> leaf_shift) + 1;
+    }
+    *first=offset >> leaf_shift;
+
+    int j=0;
+    while (((uint32_t)1 << j) < *leaves)
+	j++;
+    if ((*first & (((uint32_t)1 << j) - 1)) || (!tail && *leaves!=((uint32_t)1 << j)))
+	return -1;
+    return j;
+}
+
+void
+XIAMerkleTree::hash_leaves(const unsigned char *data, uint32_t length, int leaf_shift,
+			   uint32_t n, unsigned char *out)
+{
+    const unsigned char *ptr[MERKLE_BATCH];
+    size_t len[MERKLE_BATCH];
+    uint32_t leaf=(uint32_t)1 << leaf_shift;
+
+    // each leaf is copied after its 0x00 prefix, the copy is cheap next to
+    // hashing it
+    size_t room=(length < leaf ? length : leaf) + 1;
+    unsigned char *buf=new unsigned char[(n < MERKLE_BATCH ? n : MERKLE_BATCH) * room];
+
+    for (uint32_t i=0; i<n; ) {
+	int b=0;
+	for (; b<MERKLE_BATCH && i + b < n; b++) {
+	    uint32_t at=(i + b) << leaf_shift;
+	    size_t l=length - at < leaf ? length - at : leaf;
+	    unsigned char *in=buf + b * room;
+	    in[0]=0x00;
+	    memcpy(in + 1, data + at, l);
+	    ptr[b]=in;
+	    len[b]=l + 1;
+	}
+	XIAHash::sha1_many(b, ptr, len, reinterpret_cast<unsigned char (*)[MERKLE_HASH_LEN]>(out + i * MERKLE_HASH_LEN));
+	i+=b;
+    }
+    delete[] buf;
+}
+
+void
+XIAMerkleTree::hash_node(const unsigned char *left, const unsigned char *right,
+			 unsigned char *out)
+{
+    unsigned char in[1 + 2 * MERKLE_HASH_LEN];
+
+    in[0]=0x01;
+    memcpy(in + 1, left, MERKLE_HASH_LEN);
+    memcpy(in + 1 + MERKLE_HASH_LEN, right, MERKLE_HASH_LEN);
+    XIAHash::sha1(in, sizeof(in), out);
+}
+
+/*
+ * the CID, the top node bound to the chunk length and leaf size. out may be
+ * the same as top
+ */
+void
+XIAMerkleTree::hash_root(const unsigned char *top, uint32_t length, int leaf_shift,
+			 unsigned char *out)
+{
+    unsigned char in[1 + 4 + 1 + MERKLE_HASH_LEN];
+
+    in[0]=0x02;
+    in[1]=length >> 24;
+    in[2]=length >> 16;
+    in[3]=length >> 8;
+    in[4]=length;
+    in[5]=leaf_shift;
+    memcpy(in + 6, top, MERKLE_HASH_LEN);
+    XIAHash::sha1(in, sizeof(in), out);
+}
+
+/*
+ * hash a level's nodes in pairs into the next level and return its size,
+ * out may be the same as in
+ */
+uint32_t
+XIAMerkleTree::combine(const unsigned char *in, uint32_t n, unsigned char *out)
+{
+    unsigned char buf[MERKLE_BATCH][1 + 2 * MERKLE_HASH_LEN];
+    const unsigned char *ptr[MERKLE_BATCH];
+    size_t len[MERKLE_BATCH];
+    uint32_t pairs=n / 2;
+
+    for (uint32_t i=0; i<pairs; ) {
+	int b=0;
+	for (; b<MERKLE_BATCH && i + b < pairs; b++) {
+	    buf[b][0]=0x01;
+	    memcpy(buf[b] + 1, in + 2 * (i + b) * MERKLE_HASH_LEN, 2 * MERKLE_HASH_LEN);
+	    ptr[b]=buf[b];
+	    len[b]=sizeof(buf[b]);
+	}
+	XIAHash::sha1_many(b, ptr, len, reinterpret_cast<unsigned char (*)[MERKLE_HASH_LEN]>(out + i * MERKLE_HASH_LEN));
+	i+=b;
+    }
+    if (n & 1)
+	memmove(out + pairs * MERKLE_HASH_LEN, in + (n - 1) * MERKLE_HASH_LEN, MERKLE_HASH_LEN);
+    return (n + 1) / 2;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel XIAHash)
+ELEMENT_PROVIDES(XIAMerkleTree)
@@ -0,0 +1,88 @@
+// -*- c-basic-offset: 4 -*-
+/*
+ * xiamerkletreetest.{cc,hh} -- regression test element for Merkle tree CIDs
+ */
+
+#include <click/config.h>
+#include "xiamerkletreetest.hh"
+#include <click/xiamerkletree.hh>
+#include <click/error.hh>
+#include <string.h>
+CLICK_DECLS
+
+#define CHECK(x) if (!(x)) return errh->error("%s:%d: test %<%s%> failed", __FILE__, __LINE__, #x);
+
+XIAMerkleTreeTest::XIAMerkleTreeTest()
+{
+}
+
+XIAMerkleTreeTest::~XIAMerkleTreeTest()
+{
+}
+
+int
+XIAMerkleTreeTest::initialize(ErrorHandler *errh)
+{
+    const int shift=MERKLE_LEAF_SHIFT;
+    const uint32_t leaf=1 << shift;
+    const uint32_t length=5 * leaf + 100;	// six leaves, the last one short
+    unsigned char data[length];
+    unsigned char proof[MERKLE_MAX_LEVELS * MERKLE_HASH_LEN];
+
+    for (uint32_t i=0; i<length; i++)
+	data[i]=i * 7 + (i >> 8);
+
+    XIAMerkleTree t(data, length, shift);
+    const unsigned char *root=t.root();
+
+    // every leaf, and the aligned runs of leaves, verify
+    for (uint32_t off=0; off<length; off+=leaf) {
+	uint32_t len=length - off < leaf ? length - off : leaf;
+	int n=t.proof(off, len, proof);
+	CHECK(n >= 0);
+	CHECK(XIAMerkleTree::verify(root, length, shift, off, data + off, len, proof, n));
+    }
+    int n=t.proof(0, 4 * leaf, proof);
+    CHECK(n==1);
+    CHECK(XIAMerkleTree::verify(root, length, shift, 0, data, 4 * leaf, proof, n));
+    CHECK(XIAMerkleTree::verify(root, length, shift, 0, data, length, proof, 0));
+
+    // changed data
+    unsigned char bad[length];
+    memcpy(bad, data, length);
+    bad[leaf + 3]^=1;
+    n=t.proof(leaf, leaf, proof);
+    CHECK(!XIAMerkleTree::verify(root, length, shift, leaf, bad + leaf, leaf, proof, n));
+    CHECK(!XIAMerkleTree::verify(root, length, shift, 0, bad, length, proof, 0));
+
+    // the packet's chunk length and leaf size are part of the CID
+    CHECK(!XIAMerkleTree::verify(root, length + 1, shift, 0, data, length, proof, 0));
+    XIAMerkleTree wide(data, length, shift + 1);
+    CHECK(!XIAMerkleTree::verify(root, length, shift + 1, 0, data, length, proof, 0));
+    CHECK(memcmp(wide.root(), root, MERKLE_HASH_LEN)!=0);
+
+    // an interior node sent as a one leaf chunk: 0x01 followed by the two
+    // children of the four leaf subtree at the start
+    unsigned char forged[1 + 2 * MERKLE_HASH_LEN];
+    forged[0]=0x01;
+    CHECK(t.proof(0, 2 * leaf, proof)==2);
+    memcpy(forged + 1 + MERKLE_HASH_LEN, proof, MERKLE_HASH_LEN);
+    CHECK(t.proof(2 * leaf, 2 * leaf, proof)==2);
+    memcpy(forged + 1, proof, MERKLE_HASH_LEN);
+    XIAMerkleTree sub(data, 4 * leaf, shift);
+    CHECK(!XIAMerkleTree::verify(sub.root(), sizeof(forged), shift, 0, forged, sizeof(forged), proof, 0));
+    CHECK(!XIAMerkleTree::verify(root, sizeof(forged), shift, 0, forged, sizeof(forged), proof, 0));
+
+    // a one leaf chunk verifies without a proof
+    XIAMerkleTree one(data, leaf, shift);
+    n=one.proof(0, leaf, proof);
+    CHECK(n==0);
+    CHECK(XIAMerkleTree::verify(one.root(), leaf, shift, 0, data, leaf, proof, 0));
+
+    errh->message("All tests pass!");
+    return 0;
+}
+
+CLICK_ENDDECLS
+ELEMENT_REQUIRES(userlevel XIAMerkleTree)
+EXPORT_ELEMENT(XIAMerkleTreeTest)
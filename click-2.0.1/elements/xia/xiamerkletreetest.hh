@@ -0,0 +1,37 @@
+// -*- c-basic-offset: 4 -*-
+#ifndef CLICK_XIAMERKLETREETEST_HH
+#define CLICK_XIAMERKLETREETEST_HH
+#include <click/element.hh>
+CLICK_DECLS
+
+/*
+=c
+
+XIAMerkleTreeTest()
+
+=s test
+
+runs regression tests for Merkle tree CIDs
+
+=d
+
+XIAMerkleTreeTest checks at initialization time that fragments of a chunk
+verify against its Merkle tree CID, and that altered fragments, lengths,
+leaf sizes and interior nodes passed off as data do not. It does not route
+packets.
+
+*/
+
+class XIAMerkleTreeTest : public Element { public:
+
+    XIAMerkleTreeTest();
+    ~XIAMerkleTreeTest();
+
+    const char *class_name() const		{ return "XIAMerkleTreeTest"; }
+
+    int initialize(ErrorHandler *errh);
+
+};
+
+CLICK_ENDDECLS
+#endif
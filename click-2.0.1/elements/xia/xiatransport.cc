@@ -80,6 +80,13 @@ static void say(const char *fmt, ...)
 	}
 }
 
+int
+XIATransport::initialize(ErrorHandler *)
+{
+    _content_module->initialize(this);
+    return 0;
+}
+
 void XIATransport::push(int port, Packet *p)
 {
 	//TODO:remove
@@ -100,8 +107,12 @@ void XIATransport::push(int port, Packet *p)
     XID srcID(__srcID);
 
 
-    if(src_xid_type==_cid_type)  //store, this is chunk response
-   	_content_module->cache_incoming(p, srcID, dstID, port);
+    if(src_xid_type==_cid_type) {  //store, this is chunk response
+	if (port == 0 && !_content_module->verify_fragment(p, srcID))
+	    p->kill();
+	else
+	    _content_module->cache_incoming(p, srcID, dstID, port);
+    }
     else if(dst_xid_type==_cid_type)  //look_up,  chunk request
    	_content_module->process_request(p, srcID, dstID);
     else
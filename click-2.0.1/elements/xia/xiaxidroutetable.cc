@@ -65,6 +65,44 @@ int XIAXIDRouteTable::get_enabled()
 	return _principal_type_enabled;
 }
 
+/*
+ * add a route for xid, failing if there is one already unless replace is
+ * set. The next hop is copied.
+ */
+int
+XIAXIDRouteTable::add_route(const XID &xid, int port, unsigned flags, const XID *nexthop, bool replace)
+{
+	HashTable<XID, XIARouteData*>::iterator it = _rts.find(xid);
+	if (it != _rts.end()) {
+		if (!replace)
+			return -1;
+		XIARouteData *old = it.value();
+		delete old->nexthop;
+		delete old;
+	}
+
+	XIARouteData *xrd = new XIARouteData();
+	xrd->port = port;
+	xrd->flags = flags;
+	xrd->nexthop = nexthop ? new XID(*nexthop) : NULL;
+	_rts.set(xid, xrd);
+	return 0;
+}
+
+int
+XIAXIDRouteTable::remove_route(const XID &xid)
+{
+	HashTable<XID, XIARouteData*>::iterator it = _rts.find(xid);
+	if (it == _rts.end())
+		return -1;
+
+	XIARouteData *xrd = it.value();
+	_rts.erase(it);
+	delete xrd->nexthop;
+	delete xrd;
+	return 0;
+}
+
 void
 XIAXIDRouteTable::add_handlers()
 {
@@ -208,17 +246,10 @@ XIAXIDRouteTable::set_handler4(const String &conf, Element *e, void *thunk, Erro
 			if (nexthop) delete nexthop;
 			return errh->error("invalid XID: ", xid_str.c_str());
 		}
-		if (add_mode && table->_rts.find(xid) != table->_rts.end()) {
-			if (nexthop) delete nexthop;
+		int r = table->add_route(xid, port, flags, nexthop, !add_mode);
+		delete nexthop;
+		if (r < 0)
 			return errh->error("duplicate XID: ", xid_str.c_str());
-		}
-
-		XIARouteData *xrd = new XIARouteData();
-		
-		xrd->port = port;
-		xrd->flags = flags;
-		xrd->nexthop = nexthop;
-		table->_rts[xid] = xrd;
 	}
 
 	return 0;
@@ -247,15 +278,8 @@ XIAXIDRouteTable::remove_handler(const String &xid_str, Element *e, void *, Erro
 		XID xid;
 		if (!cp_xid(xid_str, &xid, e))
 			return errh->error("invalid XID: ", xid_str.c_str());
-		HashTable<XID, XIARouteData*>::iterator it = table->_rts.find(xid);
-		if (it == table->_rts.end())
+		if (table->remove_route(xid) < 0)
 			return errh->error("nonexistent XID: ", xid_str.c_str());
-
-		XIARouteData *xrd = (XIARouteData*)it.value();
-
-		// FIXME: delete the nxthop xid if any
-		table->_rts.erase(it);
-		delete xrd;
 	}
 	return 0;
 }
@@ -587,6 +611,11 @@ XIAXIDRouteTable::lookup_route(int in_ether_port, Packet *p)
 		}
 		else
 		{
+			// served from this router without a route of its own
+			for (int i = 0; i < _local.size(); i++)
+				if (_local[i]->local_contains(node.xid))
+					return DESTINED_FOR_LOCALHOST;
+
 			// no match -- use default route
 			// check if outgoing packet
 			if(_rtdata.port != DESTINED_FOR_LOCALHOST && _rtdata.port != FALLBACK && _rtdata.nexthop != NULL) {
@@ -24,6 +24,8 @@ XIAXIDRouteTable(AD0 0, HID2 1, - 2)
 It outputs AD0 packets to port 0, HID2 packets to port 1, and other packets to port 2.
 If the packet has already arrived at the destination node, the packet will be destroyed,
 so use the XIACheckDest element before using this element.
+XIDs with no route are also looked up in the elements that serve XIDs locally,
+like the chunk cache, before the default route is used.
 
 =a StaticIPLookup, IPRouteTable
 */
@@ -45,6 +47,17 @@ typedef struct {
 	XID *nexthop;
 } XIARouteData;
 
+/*
+ * Something in the router that serves XIDs itself, like the chunk cache.
+ * The table asks it about XIDs it has no route for, so that it doesn't
+ * need a route for each of them.
+ */
+class XIAXIDLocalIndex {
+  public:
+    virtual ~XIAXIDLocalIndex() { }
+    virtual bool local_contains(const XID &xid) = 0;
+};
+
 class XIAXIDRouteTable : public Element { public:
 
     XIAXIDRouteTable();
@@ -62,6 +75,11 @@ class XIAXIDRouteTable : public Element { public:
 	int set_enabled(int e);
 	int get_enabled();
 
+	// for elements in the same router, without going through the handlers
+	int add_route(const XID &xid, int port, unsigned flags = 0, const XID *nexthop = NULL, bool replace = false);
+	int remove_route(const XID &xid);
+	void add_local_index(XIAXIDLocalIndex *index)	{ _local.push_back(index); }
+
 protected:
     int lookup_route(int in_ether_port, Packet *);
     int process_xcmp_redirect(Packet *);
@@ -79,6 +97,7 @@ protected:
 private:
 	HashTable<XID, XIARouteData*> _rts;
 	XIARouteData _rtdata;
+	Vector<XIAXIDLocalIndex *> _local;
     uint32_t _drops;
 
 	int _principal_type_enabled;
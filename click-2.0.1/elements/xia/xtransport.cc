@@ -11,6 +11,8 @@
 #include <click/xiacontentheader.hh>
 #include "xiatransport.hh"
 #include "xtransport.hh"
+#include "xiahash.hh"
+#include <click/xiamerkletree.hh>
 #include <click/xiatransportheader.hh>
 
 #include <fstream>
@@ -202,6 +204,9 @@ XTRANSPORT::run_timer(Timer *timer)
 						// for alerting non-blocking connects
 						ProcessPollEvent(_sport, POLLHUP);
 					}
+					if (sk->epolling) {
+						ProcessEpollEvent(_sport, POLLHUP);
+					}
 
 				}
 			} else if (sk->migrateack_waiting == true && sk->expiry <= now ) {
@@ -313,6 +318,15 @@ XTRANSPORT::run_timer(Timer *timer)
 			}
 
 
+			// give up on a chunk wait that timed out
+			if (sk->pending_chunk_wait && sk->chunk_wait_expiry) {
+				if (sk->chunk_wait_expiry <= now) {
+					ReturnChunkWait(sk);
+				} else if (sk->chunk_wait_expiry < earlist_pending_expiry || earlist_pending_expiry == now) {
+					earlist_pending_expiry = sk->chunk_wait_expiry;
+				}
+			}
+
 			// check for CID request cases
 			for (HashTable<XID, bool>::iterator it = sk->XIDtoTimerOn.begin(); it != sk->XIDtoTimerOn.end(); ++it ) {
 				XID requested_cid = it->first;
@@ -354,6 +368,8 @@ XTRANSPORT::run_timer(Timer *timer)
 		_timer.reschedule_at(earlist_pending_expiry);
 	}
 
+	FlushEpollEvents();
+
 //	pthread_mutex_unlock(&_lock);
 }
 
@@ -410,6 +426,7 @@ XTRANSPORT::copy_cid_req_packet(Packet *p, sock *sk) {
 	WritablePacket *copy = WritablePacket::make(256, xiahdr.payload(), xiahdr.plen(), 20);
 
 	ContentHeaderEncap *chdr = ContentHeaderEncap::MakeRequestHeader();
+	chdr->set_window(CHUNK_RECV_WINDOW);
 
 	copy = chdr->encap(copy);
 	copy = xiah.encap(copy, false);
@@ -427,7 +444,7 @@ XTRANSPORT::copy_cid_response_packet(Packet *p, sock *sk) {
 	XIAHeaderEncap xiah;
 	copy_common(sk, xiahdr, xiah);
 
-	WritablePacket *copy = WritablePacket::make(256, xiahdr.payload(), xiahdr.plen(), 20);
+	WritablePacket *copy = WritablePacket::make(256, xiahdr.payload(), p->end_data() - xiahdr.payload(), 20);
 
 	ContentHeader chdr(p);
 	ContentHeaderEncap *new_chdr = new ContentHeaderEncap(chdr.opcode(), chdr.chunk_offset(), chdr.length());
@@ -744,13 +761,13 @@ int XTRANSPORT::read_from_recv_buf(xia::XSocketMsg *xia_socket_msg, sock *sk) {
 			}
 
 			// this part is the same for everyone
-			String src_path = xiah.src_path().unparse();
-
+			// hand back the source nodes as they appear in the header so
+			// the API doesn't have to parse a DAG string
 			uint16_t iface = SRC_PORT_ANNO(p);
 
 			x_recvfrom_msg->set_interface_id(iface);
 			x_recvfrom_msg->set_payload(payload.c_str(), payload.length());
-			x_recvfrom_msg->set_sender_dag(src_path.c_str());
+			x_recvfrom_msg->set_sender_dag_bin(xiah.hdr()->node + xiah.hdr()->dnode, xiah.hdr()->snode * sizeof(click_xia_xid_node));
 			x_recvfrom_msg->set_bytes_returned(data_size);
 
 			if (!peek) {
@@ -867,6 +884,9 @@ void XTRANSPORT::ProcessAPIPacket(WritablePacket *p_in)
 	case xia::XPOLL:
 		Xpoll(_sport, &xia_socket_msg);
 		break;
+	case xia::XEPOLL:
+		Xepoll(_sport, &xia_socket_msg);
+		break;
 	case xia::XPUSHCHUNKTO:
 		XpushChunkto(_sport, &xia_socket_msg, p_in);
 		break;
@@ -946,6 +966,7 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 		xsm.set_type(xia::XRECV);
 		xia::X_Recvfrom_Msg *x_recvfrom_msg = xsm.mutable_x_recvfrom();
 		x_recvfrom_msg->set_sender_dag(src_path.c_str());
+		x_recvfrom_msg->set_sender_dag_bin(xiah.hdr()->node + xiah.hdr()->dnode, xiah.hdr()->snode * sizeof(click_xia_xid_node));
 		x_recvfrom_msg->set_payload(str.c_str(), str.length());
 
 		std::string p_buf;
@@ -967,6 +988,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 					// tell API we are readable
 					ProcessPollEvent(port, POLLIN);
 				}
+				if (sk->epolling) {
+					ProcessEpollEvent(port, POLLIN);
+				}
 				check_for_and_handle_pending_recv(sk);
 			}
 		}
@@ -1000,6 +1024,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 				// tell API we are readable
 				ProcessPollEvent(_dport, POLLIN);
 			}
+			if (sk->epolling) {
+				ProcessEpollEvent(_dport, POLLIN);
+			}
 			check_for_and_handle_pending_recv(sk);
 			/*
 			xia::XSocketMsg xsm;
@@ -1094,6 +1121,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 					ProcessPollEvent(_dport, POLLIN|POLLOUT);
 					click_chatter("sending pollout after syn received\n");
 				}
+				if (sk->epolling) {
+					ProcessEpollEvent(_dport, POLLIN|POLLOUT);
+				}
 
 			// Mark these src & dst XID pair
 			XIDpairToConnectPending.set(xid_pair, true);
@@ -1178,6 +1208,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 				// tell API we are writble now
 				ProcessPollEvent(_dport, POLLOUT);
 			}
+			if (sk->epolling) {
+				ProcessEpollEvent(_dport, POLLOUT);
+			}
 
 			//sk->expiry = Timestamp::now() + Timestamp::make_msec(_ackdelay_ms);
 
@@ -1496,6 +1529,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 						// tell API we are readable
 						ProcessPollEvent(_dport, POLLIN);
 					}
+					if (sk->epolling) {
+						ProcessEpollEvent(_dport, POLLIN);
+					}
 					check_for_and_handle_pending_recv(sk);
 				}
 
@@ -1603,6 +1639,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 				// tell API we had an error
 				ProcessPollEvent(_dport, POLLHUP);
 			}
+			if (sk->epolling) {
+				ProcessEpollEvent(_dport, POLLHUP);
+			}
 		}
 		else {
 			click_chatter("UNKNOWN dport = %d hdr=%d\n", _dport, thdr.pkt_info());
@@ -1668,6 +1707,9 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 				// tell API we are readable
 				ProcessPollEvent(_dport, POLLIN);
 			}
+			if (sk->epolling) {
+				ProcessEpollEvent(_dport, POLLIN);
+			}
 			check_for_and_handle_pending_recv(sk);
 		}
 
@@ -1676,6 +1718,23 @@ void XTRANSPORT::ProcessNetworkPacket(WritablePacket *p_in)
 	}
 }
 
+/*
+ * does a complete chunk hash to its CID, either the SHA-1 of the data or the
+ * root of its Merkle tree
+ */
+static bool chunk_matches_cid(const XID &cid, const unsigned char *data, size_t len, int merkle_leaf)
+{
+	unsigned char digest[HASH_KEYSIZE];
+
+	if (cid.xid().type != htonl(CLICK_XIA_XID_TYPE_CID) || merkle_leaf >= 32)
+		return false;
+	if (merkle_leaf)
+		XIAMerkleTree::root(data, len, merkle_leaf, digest);
+	else
+		XIAHash::sha1(data, len, digest);
+	return memcmp(digest, cid.xid().id, HASH_KEYSIZE) == 0;
+}
+
 void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 {
  	_errh->debug("Got packet from cache");		
@@ -1696,21 +1755,10 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 	
 	if (ch.opcode()==ContentHeader::OP_PUSH) {
 		// compute the hash and verify it matches the CID
-		String hash = "CID:";
-		char hexBuf[3];
-		int i = 0;
-		SHA1_ctx sha_ctx;
-		unsigned char digest[HASH_KEYSIZE];
-		SHA1_init(&sha_ctx);
-		SHA1_update(&sha_ctx, (unsigned char *)xiah.payload(), xiah.plen());
-		SHA1_final(digest, &sha_ctx);
-		for(i = 0; i < HASH_KEYSIZE; i++) {
-			sprintf(hexBuf, "%02x", digest[i]);
-			hash.append(const_cast<char *>(hexBuf), 2);
-		}
+		bool valid = chunk_matches_cid(source_cid, xiah.payload(), p_in->end_data() - xiah.payload(), ch.merkle_leaf());
 
 // 		int status = READY_TO_READ;
-		if (hash != source_cid.unparse()) {
+		if (!valid) {
 			click_chatter("CID with invalid hash received: %s\n", source_cid.unparse().c_str());
 // 			status = INVALID_HASH;
 		}
@@ -1737,7 +1785,7 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 		xia_socket_msg.set_type(xia::XRECVCHUNKFROM);
 		xia::X_Recvchunkfrom_Msg *x_recvchunkfrom_msg = xia_socket_msg.mutable_x_recvchunkfrom();
 		x_recvchunkfrom_msg->set_cid(source_cid.unparse().c_str());
-		x_recvchunkfrom_msg->set_payload((const char*)xiah.payload(), xiah.plen());
+		x_recvchunkfrom_msg->set_payload((const char*)xiah.payload(), p_in->end_data() - xiah.payload());
 		x_recvchunkfrom_msg->set_cachepolicy(ch.cachePolicy());
 		x_recvchunkfrom_msg->set_ttl(ch.ttl());
 		x_recvchunkfrom_msg->set_cachesize(ch.cacheSize());
@@ -1805,27 +1853,25 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 		}
 
 		// compute the hash and verify it matches the CID
-		String hash = "CID:";
-		char hexBuf[3];
-		int i = 0;
-		SHA1_ctx sha_ctx;
-		unsigned char digest[HASH_KEYSIZE];
-		SHA1_init(&sha_ctx);
-		SHA1_update(&sha_ctx, (unsigned char *)xiah.payload(), xiah.plen());
-		SHA1_final(digest, &sha_ctx);
-		for(i = 0; i < HASH_KEYSIZE; i++) {
-			sprintf(hexBuf, "%02x", digest[i]);
-			hash.append(const_cast<char *>(hexBuf), 2);
-		}
+		bool valid = chunk_matches_cid(source_cid, xiah.payload(), p_in->end_data() - xiah.payload(), ch.merkle_leaf());
 
 		int status = READY_TO_READ;
-		if (hash != source_cid.unparse()) {
+		if (!valid) {
 			click_chatter("CID with invalid hash received: %s\n", source_cid.unparse().c_str());
 			status = INVALID_HASH;
 		}
 
 		// Update the status of CID request
 		sk->XIDtoStatus.set(source_cid, status);
+		sk->XIDtoDone.set(source_cid, true);
+
+		// wake up anyone waiting on the chunk rather than have them poll
+		if (sk->pending_chunk_wait && ChunkWaitedOn(sk, source_cid))
+			ReturnChunkWait(sk);
+		if (sk->polling)
+			ProcessPollEvent(_dport, POLLIN);
+		if (sk->epolling)
+			ProcessEpollEvent(_dport, POLLIN);
 
 		// Check if the ReadCID() was called for this CID
 		HashTable<XID, bool>::iterator it4;
@@ -1835,9 +1881,12 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 			// There is an entry
 			bool read_cid_req = it4->second;
 
-			if (read_cid_req == true) {
+			// chunks too large for one message wait for XreadChunk to
+			// collect them a slice at a time
+			if (read_cid_req == true && p_in->end_data() - xiah.payload() <= READ_CHUNK_SLICE) {
 				// Send pkt up
 				sk->XIDtoReadReq.erase(it4);
+				sk->XIDtoDone.erase(source_cid);
 
 				portToSock.set(_dport, sk);
 				if(_dport != sk->port) {
@@ -1852,6 +1901,7 @@ void XTRANSPORT::ProcessCachePacket(WritablePacket *p_in)
 				xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg.mutable_x_readchunk();
 				x_readchunk_msg->set_dag(src_path.c_str());
 				x_readchunk_msg->set_payload((const char*)xiah.payload(), xiah.plen());
+				x_readchunk_msg->set_size(xiah.plen());
 
 				std::string p_buf;
 				xia_socket_msg.SerializeToString(&p_buf);
@@ -1945,6 +1995,9 @@ void XTRANSPORT::push(int port, Packet *p_input)
 		break;
 	}
 
+	// send out any epoll notifications generated by this packet
+	FlushEpollEvents();
+
 //	pthread_mutex_unlock(&_lock);
 }
 
@@ -2292,6 +2345,12 @@ void XTRANSPORT::Xclose(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 	}
 
 	xcmp_listeners.remove(_sport);
+	RemoveEpollInterest(_sport);
+
+	if (sk->pending_chunk_wait) {
+		delete sk->pending_chunk_wait;
+		sk->pending_chunk_wait = NULL;
+	}
 
 	ReturnResult(_sport, xia_socket_msg);
 }
@@ -2809,6 +2868,55 @@ void XTRANSPORT::CreatePollEvent(unsigned short _sport, xia::X_Poll_Msg *msg)
 }
 
 
+// returns the subset of flags that the socket can satisfy right now
+// a missing socket is reported as POLLNVAL
+unsigned int XTRANSPORT::PollFlags(sock *sk, unsigned int flags)
+{
+	unsigned flags_out = 0;
+
+	if (!sk) {
+		// no socket state, we'll return an error right away
+		return POLLNVAL;
+	}
+
+	// is there any read data?
+	if (flags & POLLIN) {
+		if (sk->sock_type == SOCK_STREAM) {
+			if (sk->recv_base < sk->next_recv_seqnum) {
+				_errh->debug("Xpoll: read STREAM data avaialable on %d\n", sk->port);
+				flags_out |= POLLIN;
+			}
+
+		} else if (sk->sock_type == SOCK_DGRAM || sk->sock_type == SOCK_RAW) {
+			if (sk->recv_buffer_count > 0) {
+				flags_out |= POLLIN;
+			}
+
+		} else if (sk->sock_type == XSOCKET_CHUNK) {
+			// a requested chunk finished and hasn't been looked at yet
+			if (!sk->XIDtoDone.empty()) {
+				flags_out |= POLLIN;
+			}
+		}
+	}
+
+	if (flags & POLLOUT) {
+		// see if the socket is writable
+		// FIXME should we be looking for anything else (send window, etc...)
+		if (sk->sock_type == SOCK_STREAM) {
+			if (sk->isConnected) {
+				flags_out |= POLLOUT;
+			}
+
+		} else {
+			// assume POLLOUT is always set for datagram sockets
+			flags_out |= POLLOUT;
+		}
+	}
+
+	return flags_out;
+}
+
 void XTRANSPORT::Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 {
 	xia::X_Poll_Msg *poll_in = xia_socket_msg->mutable_x_poll();
@@ -2837,45 +2945,7 @@ void XTRANSPORT::Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 			}
 
 			sock *sk = portToSock.get(port);
-			unsigned flags_out = 0;
-
-			if (!sk) {
-				// no socket state, we'll return an error right away
-				// printf("No socket state found for %d\n", port);
-				flags_out = POLLNVAL;
-			
-			} else {
-				// is there any read data?
-				if (flags & POLLIN) {
-					if (sk->sock_type == SOCK_STREAM) {
-						if (sk->recv_base < sk->next_recv_seqnum) {
-							_errh->debug("Xpoll: read STREAM data avaialable on %d\n", port);
-							flags_out |= POLLIN;
-						}
-
-					} else if (sk->sock_type == SOCK_DGRAM || sk->sock_type == SOCK_RAW) {
-						if (sk->recv_buffer_count > 0) {
-//							_errh->debug("Xpoll: read DGRAM data avaialable on %d\n", port);
-							flags_out |= POLLIN;
-						}
-					}
-				}
-
-				if (flags & POLLOUT) {
-					// see if the socket is writable
-					// FIXME should we be looking for anything else (send window, etc...)
-					if (sk->sock_type == SOCK_STREAM) {
-						if (sk->isConnected) {
-							// printf("stream socket is connected, so setting POLLOUT: %d\n", port);
-							flags_out |= POLLOUT;
-						}
-
-					} else {
-						// printf("assume POLLOUT is always set for datagram sockets: %d\n", port);
-						flags_out |= POLLOUT;
-					}
-				}
-			}
+			unsigned flags_out = PollFlags(sk, flags);
 
 			if (flags_out) {
 				// the socket can respond to the poll immediately
@@ -2906,6 +2976,193 @@ void XTRANSPORT::Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 }
 
 
+// record an edge for every Xepoll instance watching the socket
+// the edges are coalesced and sent to the API in one batch per instance by FlushEpollEvents
+void XTRANSPORT::ProcessEpollEvent(unsigned short _sport, unsigned int flags_out)
+{
+	for (HashTable<unsigned short, EpollInstance>::iterator it = epoll_instances.begin(); it != epoll_instances.end(); it++) {
+		EpollInstance &ei = it->second;
+
+		HashTable<unsigned short, EpollInterest>::iterator iit = ei.interest.find(_sport);
+		if (iit == ei.interest.end())
+			continue;
+
+		// errors are always reported, everything else has to be asked for
+		unsigned int flags = flags_out & (iit->second.events | POLLHUP | POLLERR | POLLNVAL);
+		if (!flags)
+			continue;
+
+		ei.ready[_sport] |= flags;
+		epoll_dirty.set(it->first, true);
+	}
+}
+
+// push the pending edges of each dirty Xepoll instance to its control socket
+void XTRANSPORT::FlushEpollEvents()
+{
+	if (epoll_dirty.empty())
+		return;
+
+	for (HashTable<unsigned short, bool>::iterator dit = epoll_dirty.begin(); dit != epoll_dirty.end(); dit++) {
+		unsigned short epport = dit->first;
+
+		HashTable<unsigned short, EpollInstance>::iterator it = epoll_instances.find(epport);
+		if (it == epoll_instances.end())
+			continue;
+
+		EpollInstance &ei = it->second;
+		if (ei.ready.empty())
+			continue;
+
+		xia::XSocketMsg xsm;
+		xsm.set_type(xia::XEPOLL);
+		xsm.set_sequence(0);
+		xia::X_Epoll_Msg *msg = xsm.mutable_x_epoll();
+		msg->set_type(xia::X_Epoll_Msg::EVENTS);
+
+		// Xepoll_wait reads each batch into an XIA_MAXBUF buffer, so split
+		// the edges over as many messages as it takes to stay under that.
+		// The API drains every queued batch before delivering, and anything
+		// past maxevents is handed out on its next call.
+		size_t base = xsm.ByteSize();
+		size_t used = base;
+
+		for (HashTable<unsigned short, unsigned int>::iterator rit = ei.ready.begin(); rit != ei.ready.end(); rit++) {
+			xia::X_Epoll_Msg::EpollEvent *ev = msg->add_events();
+			ev->set_port(rit->first);
+			ev->set_flags(rit->second);
+
+			HashTable<unsigned short, EpollInterest>::iterator iit = ei.interest.find(rit->first);
+			if (iit != ei.interest.end())
+				ev->set_data(iit->second.data);
+
+			// tag and length byte in front of each event
+			size_t evsize = ev->ByteSize() + 2;
+			if (used + evsize > EPOLL_BATCH_BYTES && msg->events_size() > 1) {
+				xia::X_Epoll_Msg::EpollEvent carry = *ev;
+				msg->mutable_events()->RemoveLast();
+				ReturnResult(epport, &xsm, msg->events_size(), 0);
+
+				msg->clear_events();
+				*msg->add_events() = carry;
+				used = base;
+			}
+			used += evsize;
+		}
+		ei.ready.clear();
+
+		ReturnResult(epport, &xsm, msg->events_size(), 0);
+	}
+
+	epoll_dirty.clear();
+}
+
+// drop a socket that is being closed from every interest set
+void XTRANSPORT::RemoveEpollInterest(unsigned short _sport)
+{
+	sock *sk = portToSock.get(_sport);
+
+	if (!sk || !sk->epolling)
+		return;
+
+	for (HashTable<unsigned short, EpollInstance>::iterator it = epoll_instances.begin(); it != epoll_instances.end(); it++) {
+		if (it->second.interest.erase(_sport))
+			it->second.ready.erase(_sport);
+	}
+	sk->epolling = 0;
+}
+
+void XTRANSPORT::DestroyEpollInstance(unsigned short _epport)
+{
+	HashTable<unsigned short, EpollInstance>::iterator it = epoll_instances.find(_epport);
+
+	if (it == epoll_instances.end())
+		return;
+
+	for (HashTable<unsigned short, EpollInterest>::iterator iit = it->second.interest.begin(); iit != it->second.interest.end(); iit++) {
+		sock *sk = portToSock.get(iit->first);
+		if (sk && sk->epolling)
+			sk->epolling--;
+	}
+
+	epoll_instances.erase(it);
+	epoll_dirty.erase(_epport);
+}
+
+/*
+** Handler for the Xepoll API calls
+**
+** _sport is the epoll control socket. Unlike Xpoll, the interest set persists
+** across calls, so the API only tells us about changes to it. None of the
+** requests are acknowledged; readiness is reported asynchronously as batches
+** of EVENTS messages.
+*/
+void XTRANSPORT::Xepoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
+{
+	xia::X_Epoll_Msg *msg = xia_socket_msg->mutable_x_epoll();
+
+	switch (msg->type()) {
+	case xia::X_Epoll_Msg::CREATE:
+		epoll_instances[_sport];
+		break;
+
+	case xia::X_Epoll_Msg::DESTROY:
+		DestroyEpollInstance(_sport);
+		break;
+
+	case xia::X_Epoll_Msg::CTL_ADD:
+	case xia::X_Epoll_Msg::CTL_MOD:
+	case xia::X_Epoll_Msg::CTL_DEL:
+	{
+		HashTable<unsigned short, EpollInstance>::iterator it = epoll_instances.find(_sport);
+		if (it == epoll_instances.end()) {
+			_errh->debug("Xepoll: no epoll instance for control port %d\n", _sport);
+			break;
+		}
+		EpollInstance &ei = it->second;
+
+		for (int i = 0; i < msg->events_size(); i++) {
+			const xia::X_Epoll_Msg::EpollEvent &ev = msg->events(i);
+			unsigned short port = ev.port();
+			sock *sk = portToSock.get(port);
+			bool present = (ei.interest.find(port) != ei.interest.end());
+
+			if (msg->type() == xia::X_Epoll_Msg::CTL_DEL) {
+				if (present) {
+					ei.interest.erase(port);
+					ei.ready.erase(port);
+					if (sk && sk->epolling)
+						sk->epolling--;
+				}
+				continue;
+			}
+
+			EpollInterest interest;
+			interest.events = ev.flags();
+			interest.data = ev.data();
+			ei.interest.set(port, interest);
+
+			if (!present && sk)
+				sk->epolling++;
+
+			// report the current state once so the app doesn't miss an edge
+			// that happened before it registered interest
+			unsigned flags = PollFlags(sk, interest.events);
+			if (flags) {
+				ei.ready[port] |= flags;
+				epoll_dirty.set(_sport, true);
+			}
+		}
+		break;
+	}
+
+	default:
+		_errh->debug("Xepoll: unexpected message type %d\n", msg->type());
+		break;
+	}
+}
+
+
 void XTRANSPORT::Xchangead(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
 {
 	UNUSED(_sport);
@@ -3339,18 +3596,50 @@ void XTRANSPORT::Xsend(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, W
 	ReturnResult(_sport, xia_socket_msg, rc, ec);
 }
 
+/*
+** build a path from a DAG sent by the API in XIA header node format
+** returns false if the nodes don't form a valid address
+*/
+static bool parse_dag_bin(XIAPath &path, const std::string &dag)
+{
+	struct click_xia_xid_node nodes[MAX_DAG_NODES];
+	size_t n = dag.size() / sizeof(click_xia_xid_node);
+
+	if (n == 0 || n > MAX_DAG_NODES || dag.size() % sizeof(click_xia_xid_node) != 0)
+		return false;
+
+	memcpy(nodes, dag.data(), dag.size());
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = 0; j < CLICK_XIA_XID_EDGE_NUM; j++) {
+			size_t idx = nodes[i].edge[j].idx;
+			if (idx != CLICK_XIA_XID_EDGE_UNUSED && idx >= n)
+				return false;
+		}
+	}
+
+	path.parse_node(nodes, n);
+	return true;
+}
+
 void XTRANSPORT::Xsendto(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in)
 {
 	int rc = 0, ec = 0;
 
 	xia::X_Sendto_Msg *x_sendto_msg = xia_socket_msg->mutable_x_sendto();
 
-	String dest(x_sendto_msg->ddag().c_str());
 	int pktPayloadSize = x_sendto_msg->payload().size();
 	//click_chatter("\n SENDTO ddag:%s, payload:%s, length=%d\n",xia_socket_msg.ddag().c_str(), xia_socket_msg.payload().c_str(), pktPayloadSize);
 
 	XIAPath dst_path;
-	dst_path.parse(dest);
+	if (x_sendto_msg->has_ddag_bin()) {
+		if (!parse_dag_bin(dst_path, x_sendto_msg->ddag_bin())) {
+			ReturnResult(_sport, xia_socket_msg, -1, EINVAL);
+			return;
+		}
+	} else {
+		String dest(x_sendto_msg->ddag().c_str());
+		dst_path.parse(dest);
+	}
 
 	//Find DAG info for this DGRAM
 	sock *sk = portToSock.get(_sport);
@@ -3605,6 +3894,7 @@ void XTRANSPORT::XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socke
 
 		//Add Content header
 		ContentHeaderEncap *chdr = ContentHeaderEncap::MakeRequestHeader();
+		chdr->set_window(CHUNK_RECV_WINDOW);
 		p = chdr->encap(just_payload_part);
 		p = xiah.encap(p, true);
 		delete chdr;
@@ -3649,20 +3939,47 @@ void XTRANSPORT::XgetChunkStatus(unsigned short _sport, xia::XSocketMsg *xia_soc
 {
 	xia::X_Getchunkstatus_Msg *x_getchunkstatus_msg = xia_socket_msg->mutable_x_getchunkstatus();
 
-	int numCids = x_getchunkstatus_msg->dag_size();
-	String pktPayload(x_getchunkstatus_msg->payload().c_str(), x_getchunkstatus_msg->payload().size());
+	//Find DAG info for this DGRAM
+	sock *sk = portToSock.get(_sport);
 
-	// send CID-Requests
-	for (int i = 0; i < numCids; i++) {
-		String dest = x_getchunkstatus_msg->dag(i).c_str();
-		//click_chatter("CID-Request for %s  (size=%d) \n", dest.c_str(), dag_size);
-		//click_chatter("\n\n (%s) hi 3 \n\n", (_local_addr.unparse()).c_str());
+	// only one wait at a time, an older one gets the statuses as they are now
+	if (sk->pending_chunk_wait)
+		ReturnChunkWait(sk);
+
+	int done = ChunkStatuses(sk, x_getchunkstatus_msg);
+
+	if (x_getchunkstatus_msg->wait() && done == 0 && x_getchunkstatus_msg->dag_size() > 0) {
+		// hold on to the request until ProcessCachePacket finishes one of
+		// the chunks or the timeout expires
+		xia::XSocketMsg *xsm_cpy = new xia::XSocketMsg();
+		xsm_cpy->CopyFrom(*xia_socket_msg);
+		sk->pending_chunk_wait = xsm_cpy;
+
+		if (x_getchunkstatus_msg->timeout() > 0) {
+			sk->chunk_wait_expiry = Timestamp::now() + Timestamp::make_msec(x_getchunkstatus_msg->timeout());
+			if (! _timer.scheduled() || _timer.expiry() >= sk->chunk_wait_expiry )
+				_timer.reschedule_at(sk->chunk_wait_expiry);
+		} else
+			sk->chunk_wait_expiry = Timestamp();
+		return;
+	}
+
+	ReturnResult(_sport, xia_socket_msg, done);
+}
+
+// fill in the status of each CID in msg and return how many are no longer
+// waiting, the ones reported are no longer counted as news for Xpoll
+int XTRANSPORT::ChunkStatuses(sock *sk, xia::X_Getchunkstatus_Msg *msg)
+{
+	int done = 0;
+
+	msg->clear_status();
+
+	for (int i = 0; i < msg->dag_size(); i++) {
+		String dest = msg->dag(i).c_str();
 		XIAPath dst_path;
 		dst_path.parse(dest);
 
-		//Find DAG info for this DGRAM
-		sock *sk = portToSock.get(_sport);
-
 		XID	destination_cid = dst_path.xid(dst_path.destination_node());
 
 		// Check the status of CID request
@@ -3674,30 +3991,59 @@ void XTRANSPORT::XgetChunkStatus(unsigned short _sport, xia::XSocketMsg *xia_soc
 			int status = it->second;
 
 			if(status == WAITING_FOR_CHUNK) {
-				x_getchunkstatus_msg->add_status("WAITING");
+				msg->add_status("WAITING");
+				continue;
 
 			} else if(status == READY_TO_READ) {
-				x_getchunkstatus_msg->add_status("READY");
+				msg->add_status("READY");
 
 			} else if(status == INVALID_HASH) {
-				x_getchunkstatus_msg->add_status("INVALID_HASH");
+				msg->add_status("INVALID_HASH");
 
 			} else if(status == REQUEST_FAILED) {
-				x_getchunkstatus_msg->add_status("FAILED");
+				msg->add_status("FAILED");
 			}
 
 		} else {
 			// Status query for the CID that was not requested...
-			x_getchunkstatus_msg->add_status("FAILED");
+			msg->add_status("FAILED");
 		}
+
+		sk->XIDtoDone.erase(destination_cid);
+		done++;
 	}
 
 	// Send back the report
-
 	const char *buf = "CID request status response";
-	x_getchunkstatus_msg->set_payload((const char*)buf, strlen(buf) + 1);
+	msg->set_payload((const char*)buf, strlen(buf) + 1);
 
-	ReturnResult(_sport, xia_socket_msg); // TODO: Error codes?
+	return done;
+}
+
+// is cid one of the chunks the socket's pending chunk wait lists
+bool XTRANSPORT::ChunkWaitedOn(sock *sk, const XID &cid)
+{
+	const xia::X_Getchunkstatus_Msg &msg = sk->pending_chunk_wait->x_getchunkstatus();
+
+	for (int i = 0; i < msg.dag_size(); i++) {
+		XIAPath dst_path;
+		dst_path.parse(msg.dag(i).c_str());
+
+		if (dst_path.xid(dst_path.destination_node()) == cid)
+			return true;
+	}
+	return false;
+}
+
+// answer the socket's pending chunk wait with the current statuses
+void XTRANSPORT::ReturnChunkWait(sock *sk)
+{
+	xia::XSocketMsg *xsm = sk->pending_chunk_wait;
+	sk->pending_chunk_wait = NULL;
+
+	int done = ChunkStatuses(sk, xsm->mutable_x_getchunkstatus());
+	ReturnResult(sk->port, xsm, done);
+	delete xsm;
 }
 
 void XTRANSPORT::XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
@@ -3708,7 +4054,6 @@ void XTRANSPORT::XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_m
 	
 
 	String dest = x_readchunk_msg->dag().c_str();
-	WritablePacket *copy;
 	//click_chatter("CID-Request for %s  (size=%d) \n", dest.c_str(), dag_size);
 	//click_chatter("\n\n (%s) hi 3 \n\n", (_local_addr.unparse()).c_str());
 	XIAPath dst_path;
@@ -3739,20 +4084,34 @@ void XTRANSPORT::XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_m
 			// Send the buffered pkt to upper layer
 
 			sk->XIDtoReadReq.set(destination_cid, false);
+			sk->XIDtoDone.erase(destination_cid);
 			portToSock.set(_sport, sk);
 
 			HashTable<XID, WritablePacket*>::iterator it2;
 			it2 = sk->XIDtoCIDresponsePkt.find(destination_cid);
-			copy = copy_cid_response_packet(it2->second, sk);
 
-			XIAHeader xiah(copy->xia_header());
+			// the buffered response is already a copy made for this socket,
+			// slices are read straight out of it
+			WritablePacket *buffered = it2->second;
+			XIAHeader xiah(buffered->xia_header());
 
 			//Unparse dag info
 			String src_path = xiah.src_path().unparse();
 
-			xia::X_Readchunk_Msg *x_readchunk_msg = xia_socket_msg->mutable_x_readchunk();
+			// a chunk too large for one reply is read a slice at a time
+			uint32_t size = buffered->end_data() - xiah.payload();
+			uint32_t offset = x_readchunk_msg->offset();
+			uint32_t length = x_readchunk_msg->has_length() ? x_readchunk_msg->length() : size;
+			if (offset > size)
+				offset = size;
+			if (length > size - offset)
+				length = size - offset;
+			if (length > READ_CHUNK_SLICE)
+				length = READ_CHUNK_SLICE;
+
 			x_readchunk_msg->set_dag(src_path.c_str());
-			x_readchunk_msg->set_payload((const char *)xiah.payload(), xiah.plen());
+			x_readchunk_msg->set_payload((const char *)xiah.payload() + offset, length);
+			x_readchunk_msg->set_size(size);
 
 			//click_chatter("FROM CACHE. data length = %d  \n", str.length());
 			_errh->debug("Sent packet to socket: sport %d dport %d", _sport, _sport);
@@ -3817,8 +4176,15 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 	xia::X_Putchunk_Msg *x_putchunk_msg = xia_socket_msg->mutable_x_putchunk();
 	
 	click_chatter(">>putchunk message from API %d\n", _sport);
-	
-	
+
+	if (x_putchunk_msg->has_op()) {
+		XputChunkStream(_sport, xia_socket_msg);
+		return;
+	}
+	if (x_putchunk_msg->sizes_size() > 0) {
+		XputChunkBatch(_sport, xia_socket_msg);
+		return;
+	}
 	
 //			int hasCID = x_putchunk_msg->hascid();
 	int32_t contextID = x_putchunk_msg->contextid();
@@ -3827,22 +4193,162 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 	int32_t cachePolicy = x_putchunk_msg->cachepolicy();
 
 	String pktPayload(x_putchunk_msg->payload().c_str(), x_putchunk_msg->payload().size());
+	String src = PublishChunk(_sport, pktPayload, contextID, ttl, cacheSize, cachePolicy);
+
+	// (for Ack purpose) Reply with a packet with the destination port=source port
+	x_putchunk_msg->set_cid(src.c_str());
+	ReturnResult(_sport, xia_socket_msg, 0, 0);
+}
+
+/*
+ * Chunks larger than one API message are built up in the socket by a
+ * BEGIN, a run of APPENDs and a COMMIT, then published like any other.
+ * Replies carry the stream id and the length so far, not the data.
+ */
+void XTRANSPORT::XputChunkStream(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
+{
+	xia::X_Putchunk_Msg *x_putchunk_msg = xia_socket_msg->mutable_x_putchunk();
+	sock *sk = portToSock.get(_sport);
+	int rc = 0, ec = 0;
+
+	if (!sk) {
+		x_putchunk_msg->clear_payload();
+		ReturnResult(_sport, xia_socket_msg, -1, EBADF);
+		return;
+	}
+
+	uint32_t id = x_putchunk_msg->stream();
+	HashTable<uint32_t, String>::iterator it = sk->chunk_streams.find(id);
+
+	switch (x_putchunk_msg->op()) {
+		case xia::X_Putchunk_Msg::BEGIN:
+			if (sk->chunk_streams.size() >= MAX_CHUNK_STREAMS) {
+				rc = -1;
+				ec = EMFILE;
+				break;
+			}
+			do {
+				id = ++sk->next_chunk_stream;
+			} while (id == 0 || sk->chunk_streams.find(id) != sk->chunk_streams.end());
+			sk->chunk_streams.set(id, String());
+			x_putchunk_msg->set_stream(id);
+			x_putchunk_msg->set_length(0);
+			break;
+
+		case xia::X_Putchunk_Msg::APPEND:
+			if (it == sk->chunk_streams.end()) {
+				rc = -1;
+				ec = EBADF;
+			} else if (it->second.length() + x_putchunk_msg->payload().size() > MAX_CHUNK_SIZE) {
+				rc = -1;
+				ec = EMSGSIZE;
+			} else {
+				it->second.append(x_putchunk_msg->payload().data(), x_putchunk_msg->payload().size());
+				x_putchunk_msg->set_length(it->second.length());
+			}
+			break;
+
+		case xia::X_Putchunk_Msg::COMMIT:
+			if (it == sk->chunk_streams.end()) {
+				rc = -1;
+				ec = EBADF;
+			} else {
+				String src = PublishChunk(_sport, it->second, x_putchunk_msg->contextid(), x_putchunk_msg->ttl(),
+										  x_putchunk_msg->cachesize(), x_putchunk_msg->cachepolicy());
+				x_putchunk_msg->set_cid(src.c_str());
+				x_putchunk_msg->set_length(it->second.length());
+				sk->chunk_streams.erase(it);
+			}
+			break;
+
+		case xia::X_Putchunk_Msg::ABORT:
+			if (it != sk->chunk_streams.end())
+				sk->chunk_streams.erase(it);
+			break;
+	}
+
+	x_putchunk_msg->clear_payload();
+	ReturnResult(_sport, xia_socket_msg, rc, ec);
+}
+
+/*
+ * Several small chunks in one message, published in order. Their hashes
+ * are computed together so the SHA-1 engine can run them side by side.
+ */
+void XTRANSPORT::XputChunkBatch(unsigned short _sport, xia::XSocketMsg *xia_socket_msg)
+{
+	xia::X_Putchunk_Msg *x_putchunk_msg = xia_socket_msg->mutable_x_putchunk();
+	const std::string &data = x_putchunk_msg->payload();
+	int n = x_putchunk_msg->sizes_size();
+	int32_t cachePolicy = x_putchunk_msg->cachepolicy();
+
+	size_t total = 0;
+	for (int i = 0; i < n; i++)
+		total += x_putchunk_msg->sizes(i);
+	if (total != data.size()) {
+		x_putchunk_msg->clear_payload();
+		ReturnResult(_sport, xia_socket_msg, -1, EINVAL);
+		return;
+	}
+
+	const unsigned char *ptr[XIAHash::LANES];
+	size_t len[XIAHash::LANES];
+	unsigned char digests[XIAHash::LANES][HASH_KEYSIZE];
+	size_t offset = 0;
+
+	for (int i = 0; i < n; i += XIAHash::LANES) {
+		int k = n - i < XIAHash::LANES ? n - i : XIAHash::LANES;
+		size_t at = offset;
+
+		for (int j = 0; j < k; j++) {
+			ptr[j] = (const unsigned char *)data.data() + at;
+			len[j] = x_putchunk_msg->sizes(i + j);
+			at += len[j];
+		}
+		if (!(cachePolicy & POLICY_MERKLE))
+			XIAHash::sha1_many(k, ptr, len, digests);
+
+		for (int j = 0; j < k; j++) {
+			String chunk((const char *)ptr[j], len[j]);
+			String src = PublishChunk(_sport, chunk, x_putchunk_msg->contextid(), x_putchunk_msg->ttl(),
+									  x_putchunk_msg->cachesize(), cachePolicy,
+									  (cachePolicy & POLICY_MERKLE) ? 0 : digests[j]);
+			x_putchunk_msg->add_cids(src.c_str());
+		}
+		offset = at;
+	}
+
+	x_putchunk_msg->clear_payload();
+	ReturnResult(_sport, xia_socket_msg, 0, 0);
+}
+
+/*
+ * hand a chunk to the local cache and return its CID, large chunks go
+ * over as several fragments that the cache puts back together
+ */
+String XTRANSPORT::PublishChunk(unsigned short _sport, const String &payload, int32_t contextID,
+								int32_t ttl, int32_t cacheSize, int32_t cachePolicy,
+								const unsigned char *digest)
+{
 	String src;
 
-	/* Computes SHA1 Hash if user does not supply it */
-	char hexBuf[3];
-	int i = 0;
-	SHA1_ctx sha_ctx;
-	unsigned char digest[HASH_KEYSIZE];
-	SHA1_init(&sha_ctx);
-	SHA1_update(&sha_ctx, (unsigned char *)pktPayload.c_str() , pktPayload.length() );
-	SHA1_final(digest, &sha_ctx);
-	for(i = 0; i < HASH_KEYSIZE; i++) {
-		sprintf(hexBuf, "%02x", digest[i]);
-		src.append(const_cast<char *>(hexBuf), 2);
+	/* Computes SHA1 Hash if the caller has not already, or the root of the
+	 * chunk's Merkle tree if the cache slice asks for one. A chunk that fits
+	 * in one leaf has nothing to check a fragment at a time and keeps its
+	 * SHA1 CID. */
+	unsigned char hash[HASH_KEYSIZE];
+	int merkle_leaf = 0;
+	if ((cachePolicy & POLICY_MERKLE) && payload.length() > (1 << MERKLE_LEAF_SHIFT)) {
+		merkle_leaf = XIAMerkleTree::leaf_shift(payload.length());
+		XIAMerkleTree::root((const unsigned char *)payload.data(), payload.length(), merkle_leaf, hash);
+		digest = hash;
+	} else if (!digest) {
+		XIAHash::sha1(payload.data(), payload.length(), hash);
+		digest = hash;
 	}
+	src = XIAHash::hex(digest, HASH_KEYSIZE);
 
-	_errh->debug("ctxID=%d, length=%d, ttl=%d cid=%s\n", contextID, x_putchunk_msg->payload().size(), ttl, src.c_str());
+	_errh->debug("ctxID=%d, length=%d, ttl=%d cid=%s\n", contextID, payload.length(), ttl, src.c_str());
 
 	//append local address before CID
 	String str_local_addr = _local_addr.unparse_re();
@@ -3865,32 +4371,38 @@ void XTRANSPORT::XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_ms
 	 * 4. Special OPCODE in content extension header and treat it specially in content module (done below)
 	 */
 
-	//Add XIA headers
-	XIAHeaderEncap xiah;
-	xiah.set_last(LAST_NODE_DEFAULT);
-	xiah.set_hlim(hlim.get(_sport));
-	xiah.set_dst_path(_local_addr);
-	xiah.set_src_path(src_path);
-	xiah.set_nxt(CLICK_XIA_NXT_CID);
+	int chunkSize = payload.length();
+	int offset = 0;
+	do {
+		int length = chunkSize - offset < PUT_FRAGMENT_SIZE ? chunkSize - offset : PUT_FRAGMENT_SIZE;
 
-	//Might need to remove more if another header is required (eg some control/DAG info)
+		//Add XIA headers
+		XIAHeaderEncap xiah;
+		xiah.set_last(LAST_NODE_DEFAULT);
+		xiah.set_hlim(hlim.get(_sport));
+		xiah.set_dst_path(_local_addr);
+		xiah.set_src_path(src_path);
+		xiah.set_nxt(CLICK_XIA_NXT_CID);
 
-	WritablePacket *just_payload_part = WritablePacket::make(256, (const void*)pktPayload.c_str(), pktPayload.length(), 0);
+		//Might need to remove more if another header is required (eg some control/DAG info)
 
-	WritablePacket *p = NULL;
-	int chunkSize = pktPayload.length();
-	ContentHeaderEncap  contenth(0, 0, pktPayload.length(), chunkSize, ContentHeader::OP_LOCAL_PUTCID,
-								 contextID, ttl, cacheSize, cachePolicy);
-	p = contenth.encap(just_payload_part);
-	p = xiah.encap(p, true);
+		WritablePacket *just_payload_part = WritablePacket::make(256, (const void*)(payload.data() + offset), length, 0);
+
+		WritablePacket *p = NULL;
+		ContentHeaderEncap  contenth(0, offset, length, chunkSize, ContentHeader::OP_LOCAL_PUTCID,
+									 contextID, ttl, cacheSize, cachePolicy);
+		if (merkle_leaf)
+			contenth.set_merkle_leaf(merkle_leaf);
+		p = contenth.encap(just_payload_part);
+		p = xiah.encap(p, true);
 
-	_errh->debug("sent packet to cache");
+		_errh->debug("sent packet to cache");
 	
-	output(CACHE_PORT).push(p);
+		output(CACHE_PORT).push(p);
+		offset += length;
+	} while (offset < chunkSize);
 
-	// (for Ack purpose) Reply with a packet with the destination port=source port
-	x_putchunk_msg->set_cid(src.c_str());
-	ReturnResult(_sport, xia_socket_msg, 0, 0);
+	return src;
 }
 
 
@@ -4041,6 +4553,6 @@ void XTRANSPORT::XpushChunkto(unsigned short _sport, xia::XSocketMsg *xia_socket
 CLICK_ENDDECLS
 
 EXPORT_ELEMENT(XTRANSPORT)
-ELEMENT_REQUIRES(userlevel)
+ELEMENT_REQUIRES(userlevel XIAHash XIAMerkleTree)
 ELEMENT_MT_SAFE(XTRANSPORT)
 ELEMENT_LIBS(-lcrypto -lssl -lprotobuf)
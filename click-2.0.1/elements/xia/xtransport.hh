@@ -52,6 +52,8 @@ using namespace std;
 #define LAST_NODE_DEFAULT	-1
 #define RANDOM_XID_FMT		"%s:30000ff0000000000000000000000000%08x"
 #define UDP_HEADER_SIZE		8
+#define MAX_DAG_NODES		20	// same as NODES_MAX in the API
+#define EPOLL_BATCH_BYTES	(15600 - 64)	// XIA_MAXBUF in the API, less room for the result fields
 
 #define XSOCKET_INVALID -1	// invalid socket type	
 #define XSOCKET_STREAM	1	// Reliable transport (SID)
@@ -76,6 +78,12 @@ using namespace std;
 
 #define HASH_KEYSIZE    20
 
+#define MAX_CHUNK_SIZE		(16*1024*1024)	// largest chunk XputChunk streams can build
+#define MAX_CHUNK_STREAMS	4				// open put streams per socket
+#define PUT_FRAGMENT_SIZE	(32*1024)		// chunk bytes per packet handed to the cache
+#define READ_CHUNK_SLICE	(15*1024)		// chunk bytes per XreadChunk reply
+#define CHUNK_RECV_WINDOW	(64*1024)		// chunk bytes a server may send us back to back
+
 #define API_PORT    0
 #define BAD_PORT       1
 #define NETWORK_PORT    2
@@ -279,6 +287,18 @@ typedef struct {
 	HashTable<unsigned short, unsigned int> events;
 } PollEvent;
 
+typedef struct {
+	unsigned int events;
+	uint64_t data;
+} EpollInterest;
+
+// persistent interest set for an Xepoll control socket
+// ready holds the edges seen since the last batch was pushed to the API
+typedef struct {
+	HashTable<unsigned short, EpollInterest> interest;
+	HashTable<unsigned short, unsigned int> ready;
+} EpollInstance;
+
 class XTRANSPORT : public Element { 
   public:
     XTRANSPORT();
@@ -333,7 +353,7 @@ class XTRANSPORT : public Element {
 	 * Socket states
 	 * ========================= */
     struct sock {
-		sock(): port(0), so_error(0), isConnected(false), isBlocking(true), initialized(false), full_src_dag(false), timer_on(false), synack_waiting(false), dataack_waiting(false), teardown_waiting(false), migrateack_waiting(false), send_buffer_size(DEFAULT_SEND_WIN_SIZE), recv_buffer_size(DEFAULT_RECV_WIN_SIZE), send_base(0), next_send_seqnum(0), recv_base(0), next_recv_seqnum(0), dgram_buffer_start(0), dgram_buffer_end(-1), recv_buffer_count(0), recv_pending(false), polling(0), did_poll(false) {};
+		sock(): port(0), so_error(0), isConnected(false), isBlocking(true), initialized(false), full_src_dag(false), timer_on(false), synack_waiting(false), dataack_waiting(false), teardown_waiting(false), migrateack_waiting(false), send_buffer_size(DEFAULT_SEND_WIN_SIZE), recv_buffer_size(DEFAULT_RECV_WIN_SIZE), send_base(0), next_send_seqnum(0), recv_base(0), next_recv_seqnum(0), dgram_buffer_start(0), dgram_buffer_end(-1), recv_buffer_count(0), recv_pending(false), polling(0), epolling(0), did_poll(false), pending_chunk_wait(NULL), next_chunk_stream(0) {};
 
 	/* =========================
 	 * Common Socket states
@@ -370,6 +390,7 @@ class XTRANSPORT : public Element {
 
 		bool did_poll;
 		unsigned polling;
+		unsigned epolling;	// number of Xepoll instances watching this socket
 
 		int num_connect_tries; // number of xconnect tries (Xconnect will fail after MAX_CONNECT_TRIES trials)
 		int num_migrate_tries; // number of migrate tries (Connection closes after MAX_MIGRATE_TRIES trials)
@@ -404,6 +425,11 @@ class XTRANSPORT : public Element {
 		HashTable<XID, bool> XIDtoTimerOn;
 		HashTable<XID, int> XIDtoStatus; // Content-chunk request status... 1: waiting to be read, 0: waiting for chunk response, -1: failed
 		HashTable<XID, bool> XIDtoReadReq; // Indicates whether ReadCID() is called for a specific CID
+		HashTable<XID, bool> XIDtoDone; // chunks that finished since the application last looked at them
+		xia::XSocketMsg *pending_chunk_wait; // XgetChunkStatus waiting for one of its chunks to finish
+		Timestamp chunk_wait_expiry; // when to give up on pending_chunk_wait, zero to wait forever
+		HashTable<uint32_t, String> chunk_streams; // chunks being built by XputChunk streams
+		uint32_t next_chunk_stream;
 		HashTable<XID, WritablePacket*> XIDtoCIDresponsePkt;
 		uint32_t seq_num;
 		uint32_t ack_num;
@@ -548,6 +574,8 @@ class XTRANSPORT : public Element {
     HashTable<unsigned short, int> hlim;
 
     HashTable<unsigned short, PollEvent> poll_events;
+    HashTable<unsigned short, EpollInstance> epoll_instances;
+    HashTable<unsigned short, bool> epoll_dirty;	// instances with unsent edges
 
     
     atomic_uint32_t _id;
@@ -556,13 +584,11 @@ class XTRANSPORT : public Element {
     
     //modify routing table
     void addRoute(const XID &sid) {
-		String cmd=sid.unparse() + " " + String(DESTINED_FOR_LOCALHOST);
-        HandlerCall::call_write(_routeTable, "add", cmd);
+        _routeTable->add_route(sid, DESTINED_FOR_LOCALHOST);
     }   
         
     void delRoute(const XID &sid) {
-        String cmd= sid.unparse();
-        HandlerCall::call_write(_routeTable, "remove", cmd);
+        _routeTable->remove_route(sid);
     }
  
 
@@ -595,6 +621,12 @@ class XTRANSPORT : public Element {
     void CreatePollEvent(unsigned short _sport, xia::X_Poll_Msg *msg);
     void ProcessPollEvent(unsigned short, unsigned int);
     void CancelPollEvent(unsigned short _sport);
+    unsigned int PollFlags(sock *sk, unsigned int flags);
+
+    void ProcessEpollEvent(unsigned short _sport, unsigned int flags_out);
+    void FlushEpollEvents();
+    void RemoveEpollInterest(unsigned short _sport);
+    void DestroyEpollInstance(unsigned short _epport);
 //    bool ProcessPollTimeout(unsigned short, PollEvent& pe);
     /*
     ** Xsockets API handlers
@@ -621,12 +653,19 @@ class XTRANSPORT : public Element {
 	void Xrecvfrom(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
     void XrequestChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in);
     void XgetChunkStatus(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+    int ChunkStatuses(sock *sk, xia::X_Getchunkstatus_Msg *msg);
+    bool ChunkWaitedOn(sock *sk, const XID &cid);
+    void ReturnChunkWait(sock *sk);
     void XreadChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
     void XremoveChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
     void XpushChunkto(unsigned short _sport, xia::XSocketMsg *xia_socket_msg, WritablePacket *p_in);
     void XbindPush(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
     void XputChunk(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+    void XputChunkStream(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+    void XputChunkBatch(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+    String PublishChunk(unsigned short _sport, const String &payload, int32_t contextID, int32_t ttl, int32_t cacheSize, int32_t cachePolicy, const unsigned char *digest = 0);
     void Xpoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
+    void Xepoll(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
     void Xupdaterv(unsigned short _sport, xia::XSocketMsg *xia_socket_msg);
 };
 
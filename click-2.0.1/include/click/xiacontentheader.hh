@@ -8,9 +8,12 @@
 #include <click/hashtable.hh>
 #include <click/xiaheader.hh>
 #include <click/xiaextheader.hh>
+#include <click/xid.hh>
 
 CLICK_DECLS
 
+#define CONTENT_PREFETCH_MAX	10	// CIDs in a prefetch hint
+
 class ContentHeaderEncap;
 
 class ContentHeader : public XIAGenericExtHeader { public:
@@ -26,6 +29,8 @@ class ContentHeader : public XIAGenericExtHeader { public:
     uint32_t chunk_offset() { if (!exists(CHUNK_OFFSET)) return 0; return *(const uint32_t*)_map[CHUNK_OFFSET].data();};  
     uint16_t length() { if (!exists(LENGTH)) return 0; return *(const uint16_t*)_map[LENGTH].data();};  
     uint32_t chunk_length() { if (!exists(CHUNK_LENGTH)) return 0; return *(const uint32_t*)_map[CHUNK_LENGTH].data();};  
+    // bytes a request asks for from chunk_offset(), 0 for the rest of the chunk
+    uint32_t range_length() { return exists(CHUNK_LENGTH) ? chunk_length() : length(); };
     
     uint32_t contextID() { 
         if (!exists(CONTEXT_ID)) 
@@ -47,8 +52,34 @@ class ContentHeader : public XIAGenericExtHeader { public:
             return 0; 
         return *(const uint32_t*)_map[CACHE_POLICY].data();
     };  
+    // log2 of the leaf size of a Merkle tree CID, 0 for a flat CID
+    uint8_t merkle_leaf() {
+        if (!exists(MERKLE_LEAF))
+            return 0;
+        return *(const uint8_t*)_map[MERKLE_LEAF].data();
+    };
+    // bytes the requester can take back to back, 0 if it didn't say
+    uint32_t window() {
+        if (!exists(WINDOW))
+            return 0;
+        return *(const uint32_t*)_map[WINDOW].data();
+    };
+    
+    // CIDs the requester will ask for next from the same place, returns how
+    // many were copied to out
+    int prefetch(XID *out, int max) {
+        if (!exists(PREFETCH))
+            return 0;
+        const String &v = _map[PREFETCH];
+        int n = v.length() / sizeof(struct click_xia_xid);
+        if (n > max)
+            n = max;
+        for (int i = 0; i < n; i++)
+            out[i] = XID(*(const struct click_xia_xid*)(v.data() + i * sizeof(struct click_xia_xid)));
+        return n;
+    };
     
-    enum { OPCODE, OFFSET, CHUNK_OFFSET, LENGTH, CHUNK_LENGTH, CONTEXT_ID, TTL, CACHE_SIZE, CACHE_POLICY}; 
+    enum { OPCODE, OFFSET, CHUNK_OFFSET, LENGTH, CHUNK_LENGTH, CONTEXT_ID, TTL, CACHE_SIZE, CACHE_POLICY, MERKLE_LEAF, WINDOW, PREFETCH}; 
     enum { OP_REQUEST=1, OP_RESPONSE, OP_LOCAL_PUTCID, OP_REDUNDANT_REQUEST, OP_LOCAL_REMOVECID, OP_PUSH};
 };
 
@@ -61,10 +92,21 @@ class ContentHeaderEncap : public XIAGenericExtHeaderEncap { public:
 
     ContentHeaderEncap(uint8_t opcode, uint32_t chunk_offset=0, uint16_t length=0);
 
+    /* mark the chunk as having a Merkle tree CID with 2^leaf_shift byte leaves */
+    void set_merkle_leaf(uint8_t leaf_shift);
+
+    /* advertise the requester's receive window in a request */
+    void set_window(uint32_t bytes);
+
+    /* hint the CIDs that will be requested next, up to CONTENT_PREFETCH_MAX */
+    void set_prefetch(const XID *cids, int n);
+
     static ContentHeaderEncap* MakeRequestHeader() { return new ContentHeaderEncap(ContentHeader::OP_REQUEST,0,0); };
     static ContentHeaderEncap* MakeRPTRequestHeader() { return new ContentHeaderEncap(ContentHeader::OP_REDUNDANT_REQUEST,0,0); };
     static ContentHeaderEncap* MakeRequestHeader( uint32_t chunk_offset, uint16_t length ) 
                         { return new ContentHeaderEncap(ContentHeader::OP_REQUEST,chunk_offset, length); };
+    /* a request for length bytes from chunk_offset, which may be more than a packet holds */
+    static ContentHeaderEncap* MakeRangeRequestHeader( uint32_t chunk_offset, uint32_t length );
     static ContentHeaderEncap* MakePushHeader() 
                         { return new ContentHeaderEncap(ContentHeader::OP_PUSH,0,0); };
     static ContentHeaderEncap* MakePushHeader( uint32_t chunk_offset, uint16_t length ) 
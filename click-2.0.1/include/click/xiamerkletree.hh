@@ -1,5 +1,94 @@
+// -*- c-basic-offset: 4; related-file-name: "../../elements/xia/xiamerkletree.cc" -*-
 #ifndef CLICK_XIAMERKLETREE_HH
 #define CLICK_XIAMERKLETREE_HH
+#include <click/glue.hh>
+#include <clicknet/xia.h>
 
+#define MERKLE_HASH_LEN		20
+#define MERKLE_LEAF_SHIFT	9		// 512 byte leaves
+#define MERKLE_MAX_LEAVES	8192	// larger chunks get larger leaves
+#define MERKLE_MAX_LEVELS	33
+#define MERKLE_PROOF_PER_HDR	12	// proof nodes in one extension header
 
+CLICK_DECLS
+
+/*
+ * Merkle tree CIDs, so large chunks can be checked a fragment at a time.
+ *
+ * The chunk is cut into leaves of 2^leaf_shift bytes, the last one may be
+ * shorter. A leaf is hashed as the SHA-1 of 0x00 followed by its bytes, an
+ * interior node as the SHA-1 of 0x01 followed by its two children, so one
+ * can't pass for the other. Nodes are paired level by level and a node left
+ * without a partner moves up a level unchanged. The CID is the SHA-1 of 0x02,
+ * the chunk length (32 bits, big endian), the leaf shift (8 bits) and the top
+ * node, so the length and leaf size a packet announces are checked along
+ * with the data. Chunks of one leaf gain nothing from a tree and should be
+ * published with plain SHA-1 CIDs.
+ *
+ * A fragment is an aligned run of 2^j leaves, or what is left of the chunk
+ * at the end. Its node is computed from the data, then the proof supplies the
+ * siblings on the way to the root. The shape of the tree follows from the
+ * chunk length and the leaf size, so the proof is only the sibling hashes,
+ * bottom up. They travel in CLICK_XIA_NXT_MERKLE extension headers chained
+ * after the content header, each holding up to MERKLE_PROOF_PER_HDR nodes
+ * after a count byte and a reserved byte.
+ */
+class XIAMerkleTree { public:
+    XIAMerkleTree(const unsigned char *data, uint32_t length, int leaf_shift);
+    ~XIAMerkleTree();
+
+    const unsigned char *root() const	{ return _root; }
+    uint32_t length() const		{ return _length; }
+    int leaf_shift() const		{ return _shift; }
+    int levels() const			{ return _levels; }
+    size_t bytes() const		{ return _nnodes * MERKLE_HASH_LEN; }
+
+    // the level of the largest fragments that fit with their proof in room
+    // bytes, never less than a leaf
+    int fragment_level(size_t room) const;
+    uint32_t fragment_length(uint32_t offset, int level) const;
+
+    // writes the proof for a fragment to out, which has room for levels()
+    // nodes, and returns the number of nodes or -1 if it isn't a fragment
+    int proof(uint32_t offset, uint32_t length, unsigned char *out) const;
+
+    static int leaf_shift(uint32_t length);
+    static void root(const unsigned char *data, uint32_t length, int leaf_shift,
+		     unsigned char out[MERKLE_HASH_LEN]);
+    static bool verify(const unsigned char *root, uint32_t chunk_length, int leaf_shift,
+		       uint32_t offset, const unsigned char *data, uint32_t length,
+		       const unsigned char *proof, int nproof);
+
+    // proof extension headers, write_proof() ends the chain with
+    // CLICK_XIA_NXT_NO, read_proof() returns -1 on a malformed chain
+    static size_t proof_size(int nproof);
+    static void write_proof(unsigned char *out, const unsigned char *proof, int nproof);
+    static int read_proof(const click_xia_ext *hdr, const unsigned char *end,
+			  unsigned char *out, int max);
+
+  private:
+    uint32_t _length;
+    int _shift;
+    int _levels;
+    uint32_t _count[MERKLE_MAX_LEVELS];	// nodes on each level, leaves first
+    uint32_t _start[MERKLE_MAX_LEVELS];	// index of each level's first node
+    size_t _nnodes;
+    unsigned char *_nodes;
+    unsigned char _root[MERKLE_HASH_LEN];
+
+    static int fragment(uint32_t chunk_length, int leaf_shift, uint32_t offset,
+			uint32_t length, uint32_t *first, uint32_t *leaves);
+    static void hash_leaves(const unsigned char *data, uint32_t length, int leaf_shift,
+			    uint32_t n, unsigned char *out);
+    static void hash_node(const unsigned char *left, const unsigned char *right,
+			  unsigned char *out);
+    static void hash_root(const unsigned char *top, uint32_t length, int leaf_shift,
+			  unsigned char *out);
+    static uint32_t combine(const unsigned char *in, uint32_t n, unsigned char *out);
+
+    XIAMerkleTree(const XIAMerkleTree &);
+    XIAMerkleTree &operator=(const XIAMerkleTree &);
+};
+
+CLICK_ENDDECLS
 #endif /* CLICK_XIAMERKLETREE_HH */
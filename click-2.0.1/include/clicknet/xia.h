@@ -65,6 +65,7 @@ struct click_xia {
 };
 
 #define CLICK_XIA_NXT_CID       12  /* CID-source specific key-value list */
+#define CLICK_XIA_NXT_MERKLE    13  /* Merkle proof for a CID fragment */
 #define CLICK_XIA_NXT_XCMP		61	/*  XCMP header */
 #define CLICK_XIA_NXT_HDR_MAX   (CLICK_XIA_NXT_NO-1)  /* maximum non-upper-layer nxt value */
 #define CLICK_XIA_NXT_NO        59                      /* no next header (as in IPv6) */
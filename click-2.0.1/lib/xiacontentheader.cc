@@ -39,4 +39,35 @@ ContentHeaderEncap::ContentHeaderEncap(uint8_t opcode, uint32_t chunk_offset, ui
     this->update();
 }
 
+void ContentHeaderEncap::set_merkle_leaf(uint8_t leaf_shift)
+{
+    this->map()[ContentHeader::MERKLE_LEAF]= String((const char*)&leaf_shift, sizeof(leaf_shift));
+    this->update();
+}
+
+void ContentHeaderEncap::set_window(uint32_t bytes)
+{
+    this->map()[ContentHeader::WINDOW]= String((const char*)&bytes, sizeof(bytes));
+    this->update();
+}
+
+void ContentHeaderEncap::set_prefetch(const XID *cids, int n)
+{
+    String v;
+    if (n > CONTENT_PREFETCH_MAX)
+        n = CONTENT_PREFETCH_MAX;
+    for (int i = 0; i < n; i++)
+        v.append((const char*)&cids[i].xid(), sizeof(struct click_xia_xid));
+    this->map()[ContentHeader::PREFETCH]= v;
+    this->update();
+}
+
+ContentHeaderEncap* ContentHeaderEncap::MakeRangeRequestHeader(uint32_t chunk_offset, uint32_t length)
+{
+    ContentHeaderEncap *h = new ContentHeaderEncap(ContentHeader::OP_REQUEST, chunk_offset, 0);
+    h->map()[ContentHeader::CHUNK_LENGTH]= String((const char*)&length, sizeof(length));
+    h->update();
+    return h;
+}
+
 CLICK_ENDDECLS
@@ -211,12 +211,116 @@ void migrate(const char *name, const char *dag)
 }
 
 
+// answer a single query or registration
+// returns the response type, response_str holds the name or dag to send back
+int process_request(ns_pkt *req_pkt, string &response_str)
+{
+	int rtype = NS_TYPE_RESPONSE_ERROR;
+
+	switch (req_pkt->type) {
+	case NS_TYPE_REGISTER:
+		// insert a new entry
+
+		if (req_pkt->flags & NS_FLAGS_MIGRATE) {
+			// this should be a host record, if no matching name is in the
+			//  database, just add the record
+			// if the name already exists, check that the HIDs match, and
+			//  if so replace the entry, and update the AD in any name records that
+			//  contain the same HID
+			migrate(req_pkt->name, req_pkt->dag);
+		} else {
+			// just add the new name record
+			syslog(LOG_INFO, "new entry: %s = %s", req_pkt->name, req_pkt->dag);
+			name_to_dag_db_table[req_pkt->name] = req_pkt->dag;
+		}
+		rtype = NS_TYPE_RESPONSE_REGISTER;
+		break;
+
+	case NS_TYPE_QUERY:
+	{
+		map<std::string, std::string>::iterator it;
+		it = name_to_dag_db_table.find(req_pkt->name);
+
+		if(it != name_to_dag_db_table.end()) {
+			response_str = it->second;
+			rtype = NS_TYPE_RESPONSE_QUERY;
+			syslog(LOG_DEBUG, "Successful name lookup for %s", req_pkt->name);
+		} else {
+			syslog(LOG_DEBUG, "DAG for %s not found", req_pkt->name);
+		}
+		break;
+	}
+
+	case NS_TYPE_RQUERY:
+	{
+		map<std::string, std::string>::iterator it;
+		// Walk the table and look for a matching DAG
+		for(it=name_to_dag_db_table.begin(); it!=name_to_dag_db_table.end(); it++) {
+			if(strcmp(it->second.c_str(), req_pkt->dag) != 0) {
+				continue;
+			}
+			response_str = it->first;
+			rtype = NS_TYPE_RESPONSE_RQUERY;
+			syslog(LOG_DEBUG, "Successful DAG lookup for %s", req_pkt->dag);
+		}
+		break;
+	}
+
+	default:
+		syslog(LOG_WARNING, "unrecognized request: %d", req_pkt->type);
+		break;
+	}
+
+	return rtype;
+}
+
+void make_response(ns_pkt *response_pkt, int rtype, string &response_str)
+{
+	response_pkt->type = rtype;
+	response_pkt->flags = 0;
+	response_pkt->name = (rtype == NS_TYPE_RESPONSE_RQUERY) ? response_str.c_str(): NULL;
+	response_pkt->dag = (rtype == NS_TYPE_RESPONSE_QUERY) ? response_str.c_str() : NULL;
+}
+
+// answer every record in a batch with a single response packet
+// if the answers don't fit, only the ones that do are returned and the
+//  client will resend the rest
+int process_batch(char *pkt_in, int len, char *pkt_out, int out_sz)
+{
+	ns_pkt records[NS_MAX_BATCH_RECORDS];
+	unsigned short id;
+	string response_str;
+
+	int n = get_ns_batch(pkt_in, len, &id, records, NS_MAX_BATCH_RECORDS);
+	if (n < 0) {
+		syslog(LOG_WARNING, "malformed batch request");
+		return 0;
+	}
+
+	int out_len = make_ns_batch(NS_TYPE_RESPONSE_BATCH, id, pkt_out, out_sz);
+
+	for (int i = 0; i < n; i++) {
+		ns_pkt response_pkt;
+		int rtype = process_request(&records[i], response_str);
+
+		make_response(&response_pkt, rtype, response_str);
+		int rc = add_ns_batch(&response_pkt, pkt_out, out_len, out_sz);
+		if (rc == 0) {
+			syslog(LOG_INFO, "batch %d truncated at %d of %d records", id, i, n);
+			break;
+		}
+		out_len = rc;
+	}
+
+	syslog(LOG_DEBUG, "answered batch %d with %d records", id, n);
+	return out_len;
+}
+
 int main(int argc, char *argv[]) {
 	sockaddr_x ddag;
-	int rtype;
 
-	char pkt_out[NS_MAX_PACKET_SIZE];
-	char pkt_in[NS_MAX_PACKET_SIZE];
+	char pkt_out[NS_MAX_BATCH_PACKET_SIZE];
+	char pkt_in[NS_MAX_BATCH_PACKET_SIZE];
 	string response_str;
 
 	config(argc, argv);
@@ -245,82 +349,33 @@ int main(int argc, char *argv[]) {
 
 	// main looping
 	while(1) {
-		memset(pkt_in, 0, sizeof(pkt_in));
 		socklen_t ddaglen = sizeof(ddag);
-		int rc = Xrecvfrom(sock, pkt_in, NS_MAX_PACKET_SIZE, 0, (struct sockaddr*)&ddag, &ddaglen);
+		int rc = Xrecvfrom(sock, pkt_in, NS_MAX_BATCH_PACKET_SIZE, 0, (struct sockaddr*)&ddag, &ddaglen);
 		if (rc < 0) {
 			syslog(LOG_WARNING, "error receiving data (%s)", strerror(errno));
 			continue;
 		}
 
-   		ns_pkt req_pkt;
-   		get_ns_packet(pkt_in, rc, &req_pkt);
-
-    	switch (req_pkt.type) {
-		case NS_TYPE_REGISTER:
-			// insert a new entry
-
-			if (req_pkt.flags & NS_FLAGS_MIGRATE) {
-				// this should be a host record, if no matching name is in the
-				//  database, just add the record
-				// if the name already exists, check that the HIDs match, and
-				//  if so replace the entry, and update the AD in any name records that
-				//  contain the same HID
-				migrate(req_pkt.name, req_pkt.dag);
-			} else {
-				// just add the new name record
-				syslog(LOG_INFO, "new entry: %s = %s", req_pkt.name, req_pkt.dag);
-				name_to_dag_db_table[req_pkt.name] = req_pkt.dag;
-			}
-			rtype = NS_TYPE_RESPONSE_REGISTER;
-			break;
+		int len;
 
-		case NS_TYPE_QUERY:
-		{
-			map<std::string, std::string>::iterator it;
-			it = name_to_dag_db_table.find(req_pkt.name);
-
-			if(it != name_to_dag_db_table.end()) {
-				response_str = it->second;
-				rtype = NS_TYPE_RESPONSE_QUERY;
-				syslog(LOG_DEBUG, "Successful name lookup for %s", req_pkt.name);
-			} else {
-				rtype = NS_TYPE_RESPONSE_ERROR;
-				syslog(LOG_DEBUG, "DAG for %s not found", req_pkt.name);
-			}
-			break;
-		}
+		if (pkt_in[0] == NS_TYPE_BATCH) {
+			len = process_batch(pkt_in, rc, pkt_out, sizeof(pkt_out));
+			if (len == 0)
+				continue;
 
-		case NS_TYPE_RQUERY:
-		{
-			map<std::string, std::string>::iterator it;
-			// Walk the table and look for a matching DAG
-			for(it=name_to_dag_db_table.begin(); it!=name_to_dag_db_table.end(); it++) {
-				if(strcmp(it->second.c_str(), req_pkt.dag) != 0) {
-					continue;
-				}
-				response_str = it->first;
-				rtype = NS_TYPE_RESPONSE_RQUERY;
-				syslog(LOG_DEBUG, "Successful DAG lookup for %s", req_pkt.dag);
-			}
-			break;
-		}
+		} else {
+			ns_pkt req_pkt;
+			get_ns_packet(pkt_in, rc, &req_pkt);
 
-		default:
-			syslog(LOG_WARNING, "unrecognized request: %d", req_pkt.type);
-			rtype = NS_TYPE_RESPONSE_ERROR;
-			break;
-		}
+			int rtype = process_request(&req_pkt, response_str);
 
-		//Construct a response packet
-		ns_pkt response_pkt;
+			//Construct a response packet
+			ns_pkt response_pkt;
+			make_response(&response_pkt, rtype, response_str);
 
-		response_pkt.type = rtype;
-		response_pkt.flags = 0;
-		response_pkt.name = (rtype == NS_TYPE_RESPONSE_RQUERY) ? response_str.c_str(): NULL;
-		response_pkt.dag = (rtype == NS_TYPE_RESPONSE_QUERY) ? response_str.c_str() : NULL;
-		// pack it up to go on the wire
-		int len = make_ns_packet(&response_pkt, pkt_out, sizeof(pkt_out));
+			// pack it up to go on the wire
+			len = make_ns_packet(&response_pkt, pkt_out, NS_MAX_PACKET_SIZE);
+		}
 
 		//Send the response packet back to the query node
 		rc = Xsendto(sock, pkt_out, len, 0, (struct sockaddr*)&ddag, sizeof(ddag));